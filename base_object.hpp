@@ -1,41 +1,439 @@
 #ifndef REELIA_BASE_OBJECT_HPP
 #define REELIA_BASE_OBJECT_HPP
 
+#include "bit_pattern.hpp"
+#include "object_pool.hpp"
+#include "soa_pool.hpp"
+#include <algorithm>
+#include <cstdint>
 #include <functional>
 #include <map>
 #include <memory>
+#include <stdexcept>
 #include <string>
 #include <vector>
 
 // 前方宣言
 class Environment;
+class BaseObject;
+class SnapshotWriter;
+class SnapshotReader;
+
+// オブジェクトの所有権（ムーブのみ。解放先はオブジェクト用アリーナ）
+using ObjectPtr = std::unique_ptr<BaseObject>;
+
+/**
+ * 値
+ * 属性の読み書きに使う小さなタグ付き値。値渡しで受け渡すため
+ * ヒープを使わない。
+ */
+struct Value {
+  enum Kind : uint8_t { INT, BINARY };
+
+  Kind kind;
+  int data;
+
+  Value() : kind(INT), data(0) {}
+  Value(Kind k, int d) : kind(k), data(d) {}
+
+  static Value integer(int v) { return Value(INT, v); }
+  static Value binary(int v) { return Value(BINARY, v); }
+
+  // オブジェクトの現在の値から作る（バイナリパターンは型を保つ）
+  static inline Value of(const BaseObject &obj);
+
+  int asInt() const { return data; }
+  bool isBinary() const { return kind == BINARY; }
+
+  bool operator==(const Value &other) const {
+    return kind == other.kind && data == other.data;
+  }
+  bool operator!=(const Value &other) const { return !(*this == other); }
+
+  // 同じ値を持つ新しいオブジェクトを作る（変数への代入用）
+  inline ObjectPtr toObject() const;
+
+  inline std::string toString() const;
+};
+
+/**
+ * 属性ID
+ * 属性名はコンパイル時に一度だけIDへ変換し、実行時は整数比較だけで
+ * 属性にアクセスする。note_N のようにステップ番号を持つ属性は index に
+ * 番号が入る。
+ */
+enum class Attr : uint8_t {
+  UNKNOWN,
+  VALUE,
+  DATA,
+  POSITION,
+  LENGTH,
+  STEP,
+  MAX,
+  MIN,
+  CHANNEL,
+  NOTE,
+  VELOCITY,
+  DURATION,
+  GATE,
+  PLAYING,
+  CONTROLLER,
+  PORT,
+  MIDI_CHANNEL,
+  MIDI_VELOCITY,
+  MIDI_ENABLE,
+  NOTE_MAP,
+  NOTE_BASE,
+  NOTE_STEP,
+  STEP_AT,
+  DENSITY,
+  RATE_MUL,
+  RATE_DIV
+};
+
+struct AttrKey {
+  Attr id;
+  int index;
+
+  AttrKey() : id(Attr::UNKNOWN), index(0) {}
+  AttrKey(Attr a, int i = 0) : id(a), index(i) {}
+
+  bool isKnown() const { return id != Attr::UNKNOWN; }
+
+  bool operator==(const AttrKey &other) const {
+    return id == other.id && index == other.index;
+  }
+};
+
+namespace attribute_detail {
+struct NameEntry {
+  const char *name;
+  Attr id;
+};
+
+// 属性名の表（別名も含む）
+const NameEntry NAMES[] = {
+    {"value", Attr::VALUE},
+    {"data", Attr::DATA},
+    {"pos", Attr::POSITION},
+    {"position", Attr::POSITION},
+    {"length", Attr::LENGTH},
+    {"step", Attr::STEP},
+    {"max", Attr::MAX},
+    {"min", Attr::MIN},
+    {"channel", Attr::CHANNEL},
+    {"note", Attr::NOTE},
+    {"velocity", Attr::VELOCITY},
+    {"duration", Attr::DURATION},
+    {"gate", Attr::GATE},
+    {"playing", Attr::PLAYING},
+    {"controller", Attr::CONTROLLER},
+    {"cc", Attr::CONTROLLER},
+    {"port", Attr::PORT},
+    {"midi_channel", Attr::MIDI_CHANNEL},
+    {"midi_velocity", Attr::MIDI_VELOCITY},
+    {"midi_enable", Attr::MIDI_ENABLE},
+    {"note_map", Attr::NOTE_MAP},
+    {"note_base", Attr::NOTE_BASE},
+    {"density", Attr::DENSITY},
+    {"mul", Attr::RATE_MUL},
+    {"div", Attr::RATE_DIV},
+};
+} // namespace attribute_detail
+
+// 属性名から属性IDへの変換（コンパイル時に使用）
+inline AttrKey resolveAttribute(const std::string &name) {
+  for (const auto &entry : attribute_detail::NAMES) {
+    if (name == entry.name) {
+      return AttrKey(entry.id);
+    }
+  }
+
+  // 特定のステップのノート（例：note_0）と値（例：step_40）
+  // 番号として読めなければ -1
+  const struct {
+    const char *prefix;
+    size_t length;
+    Attr id;
+  } indexed[] = {{"note_", 5, Attr::NOTE_STEP}, {"step_", 5, Attr::STEP_AT}};
+  for (const auto &entry : indexed) {
+    if (name.size() > entry.length &&
+        name.compare(0, entry.length, entry.prefix) == 0) {
+      int step = -1;
+      for (size_t i = entry.length;
+           i < name.size() && name[i] >= '0' && name[i] <= '9'; i++) {
+        step = (step < 0 ? 0 : step * 10) + (name[i] - '0');
+        if (step > 0xFFFF) {
+          break;
+        }
+      }
+      return AttrKey(entry.id, step);
+    }
+  }
+
+  return AttrKey();
+}
+
+// 属性IDから属性名への変換（エラーメッセージ用）
+inline std::string attributeName(const AttrKey &key) {
+  if (key.id == Attr::NOTE_STEP) {
+    return "note_" + std::to_string(key.index);
+  }
+  if (key.id == Attr::STEP_AT) {
+    return "step_" + std::to_string(key.index);
+  }
+  for (const auto &entry : attribute_detail::NAMES) {
+    if (entry.id == key.id) {
+      return entry.name;
+    }
+  }
+  return "unknown";
+}
+
+// メソッドID（メソッド名をコンパイル時に一度だけ変換したもの）
+using MethodId = uint16_t;
+constexpr MethodId INVALID_METHOD = 0xFFFF;
+
+// メソッドの実装（イベントキューから呼び出される）
+using MethodFn = void (*)(BaseObject &, Environment &);
+
+/**
+ * メソッドの引数
+ * 呼び出し時に評価した値。バイナリパターン（リテラルやパターンを持つ変数）は
+ * 桁数を保ったまま pattern にも入る（それ以外は空）。
+ */
+struct MethodArg {
+  Value value;
+  BitPattern pattern;
+
+  // パターンとして（整数なら最上位の1までの桁数のパターンにする）
+  BitPattern asPattern() const {
+    if (!pattern.empty()) {
+      return pattern;
+    }
+    uint32_t bits = static_cast<uint32_t>(value.asInt());
+    size_t width = bits ? 32 - static_cast<size_t>(__builtin_clz(bits)) : 1;
+    return BitPattern::fromBits(bits, width);
+  }
+};
+
+using MethodArgs = std::vector<MethodArg>;
+
+// 引数を取るメソッドの実装
+using MethodArgsFn = void (*)(BaseObject &, Environment &, const MethodArgs &);
+
+/**
+ * オブジェクト型
+ * 型名・生成関数・メソッド表をまとめたもの。メソッド表はメソッドIDで
+ * 添字アクセスするため、実行時は配列参照と関数ポインタ呼び出しだけで済む。
+ * 見つからないメソッドは親の型から探す。
+ */
+class ObjectType {
+public:
+  using Factory = BaseObject *(*)();
+
+  struct Method {
+    MethodFn fn;
+    MethodArgsFn argFn; // 引数を取るメソッド（fnとどちらか一方）
+    const char *message; // 実行時に表示するメッセージ（nullptrなら表示しない）
+    uint8_t minArgs;
+    uint8_t maxArgs;
+  };
+
+private:
+  std::string name;
+  Factory factory;
+  const ObjectType *parent;
+  std::vector<Method> methods; // MethodIdで添字
+
+public:
+  ObjectType(const std::string &typeName, Factory create,
+             const ObjectType *parentType = nullptr)
+      : name(typeName), factory(create), parent(parentType) {}
+
+  // メソッドの登録（登録順に連鎖して書ける）
+  ObjectType &method(const std::string &methodName, MethodFn fn,
+                     const char *message = nullptr);
+
+  // 引数を取るメソッドの登録（引数の個数は minArgs 以上 maxArgs 以下）
+  ObjectType &method(const std::string &methodName, MethodArgsFn fn,
+                     uint8_t minArgs, uint8_t maxArgs,
+                     const char *message = nullptr);
+
+  // メソッドの検索（未定義ならnullptr）
+  const Method *findMethod(MethodId id) const {
+    if (id < methods.size() && (methods[id].fn || methods[id].argFn)) {
+      return &methods[id];
+    }
+    return parent ? parent->findMethod(id) : nullptr;
+  }
+
+  const std::string &getName() const { return name; }
+  ObjectPtr create() const { return ObjectPtr(factory()); }
+};
+
+/**
+ * オブジェクト型の登録表
+ * 新しい型は object_factory.cpp の registerBuiltinTypes に追加するだけで
+ * パーサーから生成・メソッド呼び出しができる。
+ */
+class ObjectRegistry {
+public:
+  // 型の登録
+  static void registerType(const ObjectType &type);
+
+  // 型名から型を検索（未登録ならnullptr）
+  static const ObjectType *findType(const std::string &name);
+
+  // メソッド名をIDに変換（登録時に使用）
+  static MethodId internMethod(const std::string &name);
+
+  // メソッド名からIDを検索（どの型にもなければINVALID_METHOD）
+  static MethodId findMethod(const std::string &name);
+
+  // メソッドIDから名前への変換（エラーメッセージ用）
+  static const std::string &methodName(MethodId id);
+};
+
+/**
+ * ティックの速さ
+ * 基準のティック div 回につき mul 回ティックする（1/3 なら3ティックに1回、
+ * 3/2 なら2ティックに3回）。1/1 でないオブジェクトは環境が予定表から呼ぶ。
+ */
+struct TickRate {
+  static constexpr int MAX_MUL = 64;
+  static constexpr int MAX_DIV = 65535;
+
+  uint16_t mul;
+  uint16_t div;
+
+  bool isUnit() const { return mul == div; }
+  bool operator==(const TickRate &other) const {
+    return mul == other.mul && div == other.div;
+  }
+  bool operator!=(const TickRate &other) const { return !(*this == other); }
+};
 
 /**
  * ベースオブジェクトクラス
  * すべてのReeliaオブジェクトの基底クラス
+ * インスタンスはオブジェクト用アリーナから確保される
  */
-class BaseObject {
+class BaseObject : public PoolAllocated {
+private:
+  TickRate rate;
+
 public:
+  BaseObject() : rate{1, 1} {}
   virtual ~BaseObject() {}
 
   // オブジェクトの型名を取得
   virtual std::string getType() const = 0;
 
+  // 型情報（メソッド表）を取得
+  virtual const ObjectType &getObjectType() const = 0;
+
   // 現在の値を取得（MIDIなどに出力する際に使用）
   virtual int getValue() const = 0;
 
-  // 属性の設定
-  virtual void setAttribute(const std::string &name, BaseObject *value) = 0;
+  // 属性の設定（属性ID版。ティック中の読み書きはこちらを使う）
+  // どのオブジェクトもティックの速さ（mul/div）を持つ
+  virtual void setAttr(const AttrKey &key, Value value) {
+    switch (key.id) {
+    case Attr::RATE_MUL:
+      rate.mul = static_cast<uint16_t>(
+          std::min(static_cast<int>(TickRate::MAX_MUL), std::max(1, value.asInt())));
+      break;
+    case Attr::RATE_DIV:
+      rate.div = static_cast<uint16_t>(
+          std::min(static_cast<int>(TickRate::MAX_DIV), std::max(1, value.asInt())));
+      break;
+    default:
+      throw std::runtime_error("Unknown attribute: " + attributeName(key));
+    }
+  }
+
+  // 属性の取得（属性ID版。値渡しなのでヒープを使わない）
+  virtual Value getAttr(const AttrKey &key) const {
+    switch (key.id) {
+    case Attr::RATE_MUL:
+      return Value::integer(rate.mul);
+    case Attr::RATE_DIV:
+      return Value::integer(rate.div);
+    default:
+      throw std::runtime_error("Unknown attribute: " + attributeName(key));
+    }
+  }
 
-  // 属性の取得
-  virtual BaseObject *getAttribute(const std::string &name) = 0;
+  // ティックの速さ
+  const TickRate &getRate() const { return rate; }
+
+  // 属性の設定（名前版）
+  void setAttribute(const std::string &name, BaseObject *value) {
+    AttrKey key = resolveAttribute(name);
+    if (!key.isKnown()) {
+      throw std::runtime_error("Unknown attribute: " + name);
+    }
+    setAttr(key, Value::of(*value));
+  }
+
+  // 属性の取得（名前版。呼び出し側が所有権を持つ新しいオブジェクトを返す）
+  ObjectPtr getAttribute(const std::string &name) {
+    AttrKey key = resolveAttribute(name);
+    if (!key.isKnown()) {
+      throw std::runtime_error("Unknown attribute: " + name);
+    }
+    return getAttr(key).toObject();
+  }
+
+  // 属性をパターンとして設定（桁数のあるバイナリパターン用）
+  // パターンを持たない属性には先頭32ステップを値として設定する
+  virtual void setAttrPattern(const AttrKey &key, const BitPattern &pattern) {
+    setAttr(key, Value::binary(pattern.toInt()));
+  }
+
+  // 属性をパターンとして取得（パターンを持つ属性ならtrue）
+  virtual bool getAttrPattern(const AttrKey & /* key */,
+                              BitPattern & /* pattern */) const {
+    return false;
+  }
+
+  // バイナリパターンとして扱う値か
+  virtual bool isBinary() const { return false; }
+
+  // 値としてのパターン（パターンを持たなければnullptr）
+  virtual const BitPattern *getPattern() const { return nullptr; }
 
   // オブジェクトの複製
-  virtual BaseObject *clone() const = 0;
+  virtual ObjectPtr clone() const = 0;
+
+  // 同じ型のオブジェクトの状態をそのまま写す（先読みのチェックポイントを
+  // 取るときと戻すとき）。clone() と違い鳴っているノートのような一時的な
+  // 状態も写し、写し先の領域を使い回すので大きさが同じなら確保しない。
+  // 派生クラスは基底クラスの分に続けて写す
+  virtual void copyState(const BaseObject &other) { rate = other.rate; }
 
   // ティックごとの処理（オーバーライド可能）
   virtual void onTick(Environment & /* env */) {}
 
+  // 環境がonTickを呼ぶ必要があるか（再生中など）
+  // 環境はこれが真のオブジェクトだけをアクティブセットに入れて呼ぶ。
+  // 状態が変わったら（メソッド呼び出し・属性設定の後と、onTickの後）問い直す。
+  // 状態をプールに置くオブジェクトはプールがまとめて進めるのでfalse
+  virtual bool needsTick() const { return true; }
+
+  // 再生中・カウント中か（画面の状態表示用。止められないオブジェクトはfalse）
+  virtual bool isRunning() const { return false; }
+
+  // 環境の変数に登録されたときの処理（状態をプールへ移す、依存関係を登録するなど）
+  // slot は登録先の変数のスロット
+  virtual void attach(Environment & /* env */, uint32_t /* slot */) {}
+
+  // スナップショットへの状態の書き出しと読み込み（読み込みは型を作った直後、
+  // 環境に登録する前に呼ぶ）。派生クラスは基底クラスの分に続けて書く
+  virtual void save(SnapshotWriter &out) const;
+  virtual bool load(SnapshotReader &in);
+
   // オブジェクトを文字列表現に変換（デバッグ用）
   virtual std::string toString() const { return "BaseObject:" + getType(); }
 };
@@ -52,23 +450,35 @@ public:
 
   std::string getType() const override { return "int"; }
 
+  static const ObjectType &objectType();
+  const ObjectType &getObjectType() const override { return objectType(); }
+
   int getValue() const override { return value; }
 
-  void setAttribute(const std::string & /* name */,
-                    BaseObject * /* value */) override {
+  void setAttr(const AttrKey & /* key */, Value /* value */) override {
     // 整数オブジェクトは属性を持たない
     throw std::runtime_error("Integer objects don't have attributes");
   }
 
-  BaseObject *getAttribute(const std::string & /* name */) override {
+  Value getAttr(const AttrKey & /* key */) const override {
     // 整数オブジェクトは属性を持たない
     throw std::runtime_error("Integer objects don't have attributes");
   }
 
-  BaseObject *clone() const override { return new IntObject(value); }
+  ObjectPtr clone() const override { return ObjectPtr(new IntObject(value)); }
+
+  void copyState(const BaseObject &other) override {
+    BaseObject::copyState(other);
+    value = static_cast<const IntObject &>(other).value;
+  }
+
+  bool needsTick() const override { return false; }
 
   void setValue(int v) { value = v; }
 
+  void save(SnapshotWriter &out) const override;
+  bool load(SnapshotReader &in) override;
+
   std::string toString() const override {
     return "int:" + std::to_string(value);
   }
@@ -76,156 +486,361 @@ public:
 
 /**
  * 2進数パターンオブジェクト
+ * 桁数のあるビットパターンを持つ。値として読むと先頭32ステップの整数になる。
  */
 class BinaryPatternObject : public BaseObject {
 private:
-  int pattern;
+  BitPattern pattern;
+
+  // 整数から作るときの桁数（表示は最低8桁）
+  static BitPattern fromInt(int value) {
+    uint32_t bits = static_cast<uint32_t>(value);
+    size_t width = bits ? 32 - static_cast<size_t>(__builtin_clz(bits)) : 0;
+    return BitPattern::fromBits(bits, std::max<size_t>(8, width));
+  }
 
 public:
-  BinaryPatternObject(int p = 0) : pattern(p) {}
+  BinaryPatternObject(int p = 0) : pattern(fromInt(p)) {}
+  explicit BinaryPatternObject(const BitPattern &p) : pattern(p) {}
 
   std::string getType() const override { return "binary"; }
 
-  int getValue() const override { return pattern; }
+  static const ObjectType &objectType();
+  const ObjectType &getObjectType() const override { return objectType(); }
+
+  int getValue() const override { return pattern.toInt(); }
 
-  void setAttribute(const std::string &name, BaseObject *value) override {
-    if (name == "value") {
-      pattern = value->getValue();
+  bool isBinary() const override { return true; }
+
+  const BitPattern *getPattern() const override { return &pattern; }
+
+  void setAttr(const AttrKey &key, Value value) override {
+    if (key.id == Attr::VALUE) {
+      pattern = fromInt(value.asInt());
     } else {
-      throw std::runtime_error("Unknown attribute: " + name);
+      BaseObject::setAttr(key, value);
     }
   }
 
-  BaseObject *getAttribute(const std::string &name) override {
-    if (name == "value") {
-      return new IntObject(pattern);
+  Value getAttr(const AttrKey &key) const override {
+    if (key.id == Attr::VALUE) {
+      return Value::integer(pattern.toInt());
+    }
+    return BaseObject::getAttr(key);
+  }
+
+  void setAttrPattern(const AttrKey &key, const BitPattern &p) override {
+    if (key.id == Attr::VALUE) {
+      pattern = p;
     } else {
-      throw std::runtime_error("Unknown attribute: " + name);
+      BaseObject::setAttrPattern(key, p);
+    }
+  }
+
+  bool getAttrPattern(const AttrKey &key, BitPattern &p) const override {
+    if (key.id == Attr::VALUE) {
+      p = pattern;
+      return true;
     }
+    return false;
   }
 
-  BaseObject *clone() const override {
-    return new BinaryPatternObject(pattern);
+  ObjectPtr clone() const override {
+    return ObjectPtr(new BinaryPatternObject(pattern));
   }
 
+  void copyState(const BaseObject &other) override {
+    BaseObject::copyState(other);
+    pattern = static_cast<const BinaryPatternObject &>(other).pattern;
+  }
+
+  void save(SnapshotWriter &out) const override;
+  bool load(SnapshotReader &in) override;
+
+  bool needsTick() const override { return false; }
+
   std::string toString() const override {
-    std::string binStr = "b";
-    for (int i = 7; i >= 0; i--) {
-      binStr += ((pattern >> i) & 1) ? '1' : '0';
+    if (pattern.size() >= 8) {
+      return pattern.toString();
     }
-    return binStr;
+    BitPattern padded = pattern;
+    padded.resize(8);
+    return padded.toString();
   }
 };
 
 /**
  * シーケンスオブジェクト
+ * ステップはビットパターンで持ち、長さは BitPattern::MAX_STEPS まで伸ばせる。
+ * 回転・反転・マスクなどの変形は先頭 length ステップだけに語単位で行う。
+ * 再生位置・長さ・再生状態は環境に登録されると環境のSequencePoolへ移り、
+ * このオブジェクトはプールの要素を参照するビューになる。
  */
 class SeqObject : public BaseObject {
+public:
+  // マスクとの論理演算の種類
+  enum MaskOp { MASK_AND, MASK_OR, MASK_XOR };
+
 private:
-  std::vector<int> data;
-  int position;
-  int length;
-  bool playing;
+  BitPattern data;
+  SequenceState local; // プールに登録されるまでの状態
+  SequencePool *pool;  // 登録先のプール（未登録ならnullptr）
+  SequencePool *home;  // 環境のプール（速さが1/1でない間はプールから外れる）
+  uint32_t index;      // プール内の添字
+
+  int32_t &position() { return pool ? pool->position[index] : local.position; }
+  int32_t position() const {
+    return pool ? pool->position[index] : local.position;
+  }
+  int32_t &length() { return pool ? pool->length[index] : local.length; }
+  int32_t length() const { return pool ? pool->length[index] : local.length; }
+  uint8_t &playing() { return pool ? pool->playing[index] : local.playing; }
+  uint8_t playing() const {
+    return pool ? pool->playing[index] : local.playing;
+  }
+
+protected:
+  // 現在の再生状態（複製用）
+  SequenceState state() const { return pool ? pool->get(index) : local; }
+
+  // 環境のプールに出入りする（プールは毎ティック1/1で進めるので、
+  // 速さを変えたオブジェクトは自分で進める）
+  void syncPool() {
+    bool pooled = home && getRate().isUnit();
+    if (pooled && !pool) {
+      pool = home;
+      index = pool->add(local, &index);
+    } else if (!pooled && pool) {
+      local = pool->get(index);
+      pool->remove(index);
+      pool = nullptr;
+    }
+  }
 
 public:
-  SeqObject() : position(0), length(8), playing(false) {
-    data.resize(16, 0); // デフォルトで16ステップ、すべて0
+  // デフォルトで16ステップ、すべて0
+  SeqObject() : data(16), local{0, 8, 0}, pool(nullptr), home(nullptr), index(0) {}
+
+  SeqObject(const SeqObject &other)
+      : BaseObject(other), data(other.data), local(other.state()),
+        pool(nullptr), home(nullptr), index(0) {}
+
+  SeqObject &operator=(const SeqObject &) = delete;
+
+  ~SeqObject() override {
+    if (pool) {
+      pool->remove(index);
+    }
   }
 
   std::string getType() const override { return "seq"; }
 
+  static const ObjectType &objectType();
+  const ObjectType &getObjectType() const override { return objectType(); }
+
   int getValue() const override {
-    if (position >= 0 && static_cast<size_t>(position) < data.size()) {
-      return data[position];
-    }
-    return 0;
+    int pos = position();
+    return pos >= 0 && data.test(static_cast<size_t>(pos)) ? 1 : 0;
   }
 
-  void setAttribute(const std::string &name, BaseObject *value) override {
-    if (name == "data") {
-      // バイナリパターンからデータをセット
-      int pattern = value->getValue();
-      for (int i = 0; i < 8; i++) {
-        if (static_cast<size_t>(i) < data.size()) {
-          data[i] = (pattern & (1 << i)) ? 1 : 0;
-        }
+  void setAttr(const AttrKey &key, Value value) override {
+    switch (key.id) {
+    case Attr::DATA: {
+      // 整数のパターンは先頭32ステップにセットし、残りは0にする
+      size_t steps = data.size();
+      data = BitPattern::fromBits(static_cast<uint32_t>(value.asInt()), steps);
+      break;
+    }
+    case Attr::POSITION:
+      position() = value.asInt() % static_cast<int>(data.size());
+      break;
+    case Attr::LENGTH: {
+      int steps = static_cast<int>(BitPattern::MAX_STEPS);
+      length() = std::min(steps, std::max(1, value.asInt()));
+      if (data.size() < static_cast<size_t>(length())) {
+        data.resize(static_cast<size_t>(length()));
       }
-    } else if (name == "pos" || name == "position") {
-      position = value->getValue() % static_cast<int>(data.size());
-    } else if (name == "length") {
-      length = value->getValue();
-      if (length > 16)
-        length = 16;
-      if (length < 1)
-        length = 1;
-    } else if (name == "step") {
-      // セット対象のステップと値
-      int step = value->getValue() & 0xF; // 0-15に制限
-      int val = (value->getValue() >> 4) & 0xFF;
-      if (static_cast<size_t>(step) < data.size()) {
-        data[step] = val;
+      break;
+    }
+    case Attr::STEP: {
+      // セット対象のステップと値（0以外ならオン）。値<<4 | ステップなので
+      // ステップは0-15に限る（16以降は step_N で設定する）
+      int step = value.asInt() & 0xF;
+      int val = (value.asInt() >> 4) & 0xFF;
+      data.set(static_cast<size_t>(step), val != 0);
+      break;
+    }
+    case Attr::STEP_AT:
+      // 特定のステップの値（例：step_40 = 1。0以外ならオン）
+      // ステップ数が足りなければ伸ばす（長さは変えない）
+      if (key.index >= 0 && static_cast<size_t>(key.index) < BitPattern::MAX_STEPS) {
+        if (data.size() <= static_cast<size_t>(key.index)) {
+          data.resize(static_cast<size_t>(key.index) + 1);
+        }
+        data.set(static_cast<size_t>(key.index), value.asInt() != 0);
       }
-    } else {
-      throw std::runtime_error("Unknown attribute: " + name);
+      break;
+    case Attr::RATE_MUL:
+    case Attr::RATE_DIV:
+      BaseObject::setAttr(key, value);
+      syncPool();
+      break;
+    default:
+      BaseObject::setAttr(key, value);
     }
   }
 
-  BaseObject *getAttribute(const std::string &name) override {
-    if (name == "data") {
-      // 8ビットパターンとして最初の8ステップを返す
-      int pattern = 0;
-      for (int i = 0; i < 8 && static_cast<size_t>(i) < data.size(); i++) {
-        if (data[i] > 0) {
-          pattern |= (1 << i);
-        }
-      }
-      return new BinaryPatternObject(pattern);
-    } else if (name == "pos" || name == "position") {
-      return new IntObject(position);
-    } else if (name == "length") {
-      return new IntObject(length);
-    } else if (name == "step") {
+  Value getAttr(const AttrKey &key) const override {
+    switch (key.id) {
+    case Attr::DATA:
+      // 整数としては先頭32ステップ
+      return Value::binary(data.toInt());
+    case Attr::POSITION:
+      return Value::integer(position());
+    case Attr::LENGTH:
+      return Value::integer(length());
+    case Attr::STEP:
       // 現在のステップの値を返す
-      if (static_cast<size_t>(position) < data.size()) {
-        return new IntObject(data[position]);
-      }
-      return new IntObject(0);
-    } else {
-      throw std::runtime_error("Unknown attribute: " + name);
+      return Value::integer(getValue());
+    case Attr::STEP_AT:
+      return Value::integer(
+          key.index >= 0 && data.test(static_cast<size_t>(key.index)) ? 1 : 0);
+    case Attr::DENSITY:
+      // 先頭 length ステップのうちオンの数
+      return Value::integer(static_cast<int>(window().count()));
+    default:
+      return BaseObject::getAttr(key);
+    }
+  }
+
+  void setAttrPattern(const AttrKey &key, const BitPattern &pattern) override {
+    if (key.id != Attr::DATA) {
+      BaseObject::setAttrPattern(key, pattern);
+      return;
+    }
+    // パターン全体で置き換える（短ければ残りは0、長ければステップを増やす）
+    size_t steps = std::max(data.size(), pattern.size());
+    data = BitPattern(steps);
+    data.assignPrefix(pattern);
+  }
+
+  bool getAttrPattern(const AttrKey &key, BitPattern &pattern) const override {
+    if (key.id != Attr::DATA) {
+      return false;
     }
+    pattern = data;
+    return true;
+  }
+
+  // 先頭 length ステップ（変形の対象）
+  BitPattern window() const {
+    BitPattern steps = data;
+    steps.resize(static_cast<size_t>(length()));
+    return steps;
+  }
+
+  // 先頭 length ステップの変形（イベントキューでコールされる）
+  void rotate(long steps) {
+    BitPattern w = window();
+    w.rotate(steps);
+    data.assignPrefix(w);
+  }
+
+  void invert() {
+    BitPattern w = window();
+    w.invert();
+    data.assignPrefix(w);
   }
 
-  BaseObject *clone() const override {
-    SeqObject *clone = new SeqObject();
-    clone->data = this->data;
-    clone->position = this->position;
-    clone->length = this->length;
-    clone->playing = this->playing;
-    return clone;
+  void mirror() {
+    BitPattern w = window();
+    w.reverse();
+    data.assignPrefix(w);
   }
 
+  // マスクとの論理演算（マスクが短ければ繰り返す）
+  void applyMask(MaskOp op, const BitPattern &mask) {
+    BitPattern w = window();
+    switch (op) {
+    case MASK_AND:
+      w.andWith(mask);
+      break;
+    case MASK_OR:
+      w.orWith(mask);
+      break;
+    case MASK_XOR:
+      w.xorWith(mask);
+      break;
+    }
+    data.assignPrefix(w);
+  }
+
+  // steps ステップに pulses 個のオンを均等に置き、長さを steps にする
+  void euclid(int pulses, int steps) {
+    int maxSteps = static_cast<int>(BitPattern::MAX_STEPS);
+    steps = std::min(maxSteps, std::max(1, steps));
+    length() = steps;
+    if (data.size() < static_cast<size_t>(steps)) {
+      data.resize(static_cast<size_t>(steps));
+    }
+    data.assignPrefix(BitPattern::euclid(
+        static_cast<size_t>(std::max(0, pulses)), static_cast<size_t>(steps)));
+  }
+
+  // 現在位置
+  int getPosition() const { return position(); }
+
+  ObjectPtr clone() const override { return ObjectPtr(new SeqObject(*this)); }
+
+  // 速さを写してプールに出入りしてから、再生状態をプールか自分に書く
+  void copyState(const BaseObject &other) override {
+    BaseObject::copyState(other);
+    const SeqObject &o = static_cast<const SeqObject &>(other);
+    data = o.data;
+    syncPool();
+    SequenceState s = o.state();
+    position() = s.position;
+    length() = s.length;
+    playing() = s.playing;
+  }
+
+  // 再生中か
+  bool isPlaying() const { return playing() != 0; }
+
+  // プールに登録済みなら環境がまとめて進める（止まっていれば何もしない）
+  bool needsTick() const override { return pool == nullptr && isPlaying(); }
+  bool isRunning() const override { return isPlaying(); }
+
+  void attach(Environment &env, uint32_t slot) override;
+
+  void save(SnapshotWriter &out) const override;
+  bool load(SnapshotReader &in) override;
+
   void onTick(Environment & /* env */) override {
-    if (playing) {
-      position = (position + 1) % length;
+    // プールに登録済みの場合はSequencePool::tickで進んでいる
+    if (!pool && local.playing) {
+      local.position = SequencePool::next(local.position, local.length);
     }
   }
 
   // シーケンスの開始（イベントキューでコールされる）
   void start() {
-    playing = true;
-    position = 0;
+    playing() = 1;
+    position() = 0;
   }
 
   // シーケンスの停止（イベントキューでコールされる）
-  void stop() { playing = false; }
+  void stop() { playing() = 0; }
 
   std::string toString() const override {
+    int pos = position();
+    int len = length();
     std::string result = "seq[";
-    for (int i = 0; i < length; i++) {
+    for (int i = 0; i < len; i++) {
       if (i > 0)
         result += ",";
-      result += std::to_string(data[i]);
-      if (i == position)
+      result += data.test(static_cast<size_t>(i)) ? "1" : "0";
+      if (i == pos)
         result += "*";
     }
     result += "]";
@@ -235,101 +850,177 @@ public:
 
 /**
  * カウンターオブジェクト
+ * 状態は環境に登録されると環境のCounterPoolへ移り、このオブジェクトは
+ * プールの要素を参照するビューになる。
  */
 class CountObject : public BaseObject {
 private:
-  int value;
-  int max;
-  int min;
-  int step;
-  bool running;
+  CounterState local; // プールに登録されるまでの状態
+  CounterPool *pool;  // 登録先のプール（未登録ならnullptr）
+  CounterPool *home;  // 環境のプール（速さが1/1でない間はプールから外れる）
+  uint32_t index;     // プール内の添字
+
+  int32_t &value() { return pool ? pool->value[index] : local.value; }
+  int32_t value() const { return pool ? pool->value[index] : local.value; }
+  int32_t &min() { return pool ? pool->min[index] : local.min; }
+  int32_t min() const { return pool ? pool->min[index] : local.min; }
+  int32_t &max() { return pool ? pool->max[index] : local.max; }
+  int32_t max() const { return pool ? pool->max[index] : local.max; }
+  int32_t &step() { return pool ? pool->step[index] : local.step; }
+  int32_t step() const { return pool ? pool->step[index] : local.step; }
+  uint8_t &running() { return pool ? pool->running[index] : local.running; }
+  uint8_t running() const {
+    return pool ? pool->running[index] : local.running;
+  }
+
+  CounterState state() const { return pool ? pool->get(index) : local; }
+
+  // 環境のプールに出入りする（SeqObject::syncPool と同じ）
+  void syncPool() {
+    bool pooled = home && getRate().isUnit();
+    if (pooled && !pool) {
+      pool = home;
+      index = pool->add(local, &index);
+    } else if (!pooled && pool) {
+      local = pool->get(index);
+      pool->remove(index);
+      pool = nullptr;
+    }
+  }
 
 public:
-  CountObject() : value(0), max(16), min(0), step(1), running(false) {}
+  CountObject() : local{0, 0, 16, 1, 0}, pool(nullptr), home(nullptr), index(0) {}
+
+  CountObject(const CountObject &other)
+      : BaseObject(other), local(other.state()), pool(nullptr), home(nullptr),
+        index(0) {}
+
+  CountObject &operator=(const CountObject &) = delete;
+
+  ~CountObject() override {
+    if (pool) {
+      pool->remove(index);
+    }
+  }
 
   std::string getType() const override { return "count"; }
 
-  int getValue() const override { return value; }
+  static const ObjectType &objectType();
+  const ObjectType &getObjectType() const override { return objectType(); }
 
-  void setAttribute(const std::string &name, BaseObject *value) override {
-    if (name == "value") {
-      this->value = value->getValue();
-    } else if (name == "max") {
-      max = value->getValue();
-    } else if (name == "min") {
-      min = value->getValue();
-    } else if (name == "step") {
-      step = value->getValue();
-    } else {
-      throw std::runtime_error("Unknown attribute: " + name);
+  int getValue() const override { return value(); }
+
+  void setAttr(const AttrKey &key, Value value) override {
+    switch (key.id) {
+    case Attr::VALUE:
+      this->value() = value.asInt();
+      break;
+    case Attr::MAX:
+      max() = value.asInt();
+      break;
+    case Attr::MIN:
+      min() = value.asInt();
+      break;
+    case Attr::STEP:
+      step() = value.asInt();
+      break;
+    case Attr::RATE_MUL:
+    case Attr::RATE_DIV:
+      BaseObject::setAttr(key, value);
+      syncPool();
+      break;
+    default:
+      BaseObject::setAttr(key, value);
     }
   }
 
-  BaseObject *getAttribute(const std::string &name) override {
-    if (name == "value") {
-      return new IntObject(value);
-    } else if (name == "max") {
-      return new IntObject(max);
-    } else if (name == "min") {
-      return new IntObject(min);
-    } else if (name == "step") {
-      return new IntObject(step);
-    } else {
-      throw std::runtime_error("Unknown attribute: " + name);
+  Value getAttr(const AttrKey &key) const override {
+    switch (key.id) {
+    case Attr::VALUE:
+      return Value::integer(value());
+    case Attr::MAX:
+      return Value::integer(max());
+    case Attr::MIN:
+      return Value::integer(min());
+    case Attr::STEP:
+      return Value::integer(step());
+    default:
+      return BaseObject::getAttr(key);
     }
   }
 
-  BaseObject *clone() const override {
-    CountObject *clone = new CountObject();
-    clone->value = this->value;
-    clone->max = this->max;
-    clone->min = this->min;
-    clone->step = this->step;
-    clone->running = this->running;
-    return clone;
+  ObjectPtr clone() const override { return ObjectPtr(new CountObject(*this)); }
+
+  // SeqObject::copyState と同じ
+  void copyState(const BaseObject &other) override {
+    BaseObject::copyState(other);
+    syncPool();
+    CounterState s = static_cast<const CountObject &>(other).state();
+    value() = s.value;
+    min() = s.min;
+    max() = s.max;
+    step() = s.step;
+    running() = s.running;
   }
 
+  // プールに登録済みなら環境がまとめて進める（止まっていれば何もしない）
+  bool needsTick() const override { return pool == nullptr && running(); }
+  bool isRunning() const override { return running() != 0; }
+
+  void attach(Environment &env, uint32_t slot) override;
+
+  void save(SnapshotWriter &out) const override;
+  bool load(SnapshotReader &in) override;
+
   void onTick(Environment & /* env */) override {
-    if (running) {
-      value += step;
-      if (value > max) {
-        if (step > 0) {
-          value = min;
-        } else {
-          value = max;
-        }
-      } else if (value < min) {
-        if (step < 0) {
-          value = max;
-        } else {
-          value = min;
-        }
-      }
+    // プールに登録済みの場合はCounterPool::tickで進んでいる
+    if (!pool && local.running) {
+      local.value =
+          CounterPool::next(local.value, local.min, local.max, local.step);
     }
   }
 
   // カウンターの開始（イベントキューでコールされる）
-  void start() { running = true; }
+  void start() { running() = 1; }
 
   // カウンターの停止（イベントキューでコールされる）
-  void stop() { running = false; }
+  void stop() { running() = 0; }
 
   // カウンターのリセット（イベントキューでコールされる）
-  void reset() { value = min; }
+  void reset() { value() = min(); }
 
   std::string toString() const override {
-    return "count:" + std::to_string(value) + " [" + std::to_string(min) + ":" +
-           std::to_string(max) + ":" + std::to_string(step) + "]";
+    return "count:" + std::to_string(value()) + " [" + std::to_string(min()) +
+           ":" + std::to_string(max()) + ":" + std::to_string(step()) + "]";
   }
 };
 
+// Valueの実装（IntObject/BinaryPatternObjectの定義が必要なためここに置く）
+inline Value Value::of(const BaseObject &obj) {
+  return Value(obj.isBinary() ? BINARY : INT, obj.getValue());
+}
+
+inline ObjectPtr Value::toObject() const {
+  if (kind == BINARY) {
+    return ObjectPtr(new BinaryPatternObject(data));
+  }
+  return ObjectPtr(new IntObject(data));
+}
+
+inline std::string Value::toString() const {
+  if (kind == BINARY) {
+    return BinaryPatternObject(data).toString();
+  }
+  return "int:" + std::to_string(data);
+}
+
 /**
  * ファクトリークラス
  * オブジェクト名からインスタンスを生成
  */
 class ObjectFactory {
 public:
-  static BaseObject *createObject(const std::string &type);
+  static ObjectPtr createObject(const std::string &type);
 };
 
 #endif // REELIA_BASE_OBJECT_HPP
\ No newline at end of file
@@ -0,0 +1,739 @@
+// Reelia マイクロベンチマーク
+// make bench で実行する。MIDIはNullSinkに出力するので、デバイスのない
+// マシンでも動く。引数を渡すと名前にその文字列を含むものだけを実行する。
+
+#include "bit_pattern.hpp"
+#include "environment.hpp"
+#include "expression.hpp"
+#include "hot_reload.hpp"
+#include "lookahead.hpp"
+#include "midi_manager.hpp"
+#include "midi_output.hpp"
+#include "module.hpp"
+#include "osc_server.hpp"
+#include "parser.hpp"
+#include "snapshot.hpp"
+#include "tokenizer.hpp"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+//------------------------------------------------------------------------------
+// 確保回数の計測（グローバルな operator new を置き換える）
+//------------------------------------------------------------------------------
+
+namespace {
+std::atomic<uint64_t> g_allocations(0);
+
+// インライン展開されると new と free の組み合わせをコンパイラが誤って警告する
+__attribute__((noinline)) void release(void* p) noexcept {
+    std::free(p);
+}
+} // namespace
+
+void* operator new(size_t size) {
+    g_allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](size_t size) {
+    return ::operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    release(p);
+}
+
+void operator delete[](void* p) noexcept {
+    release(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    release(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    release(p);
+}
+
+namespace {
+
+//------------------------------------------------------------------------------
+// 計測と集計
+//------------------------------------------------------------------------------
+
+using Clock = std::chrono::steady_clock;
+
+// 1つのベンチマークにかける時間と標本数
+constexpr double TIME_BUDGET = 0.5;       // 秒
+constexpr size_t MAX_SAMPLES = 20000;
+constexpr size_t MIN_SAMPLES = 1000;
+
+// 1標本の最短時間（時計の分解能より十分長くなるよう操作をまとめて計る）
+constexpr double MIN_SAMPLE_NS = 2000.0;
+
+std::string g_filter;
+
+// 計測の前提が崩れていたとき（終了コードを1にする）
+bool g_failed = false;
+
+// スクリプトの表示を捨てる出力先
+class NullBuffer : public std::streambuf {
+protected:
+    int overflow(int c) override { return c; }
+};
+
+struct Result {
+    double mean;  // ns/op
+    double p50;
+    double p99;
+    double p999;
+    double allocations; // 確保回数/op
+};
+
+double percentile(const std::vector<double>& sorted, double p) {
+    if (sorted.empty()) {
+        return 0.0;
+    }
+    size_t index = static_cast<size_t>(p * (sorted.size() - 1) + 0.5);
+    return sorted[std::min(index, sorted.size() - 1)];
+}
+
+Result summarize(std::vector<double>& samples, uint64_t ops, double totalNs, uint64_t allocations) {
+    std::sort(samples.begin(), samples.end());
+    Result result;
+    result.mean = totalNs / ops;
+    result.p50 = percentile(samples, 0.50);
+    result.p99 = percentile(samples, 0.99);
+    result.p999 = percentile(samples, 0.999);
+    result.allocations = static_cast<double>(allocations) / ops;
+    return result;
+}
+
+void printHeader() {
+    std::printf("%-36s %12s %10s %10s %10s %10s\n", "benchmark", "ns/op", "allocs/op", "p50", "p99", "p999");
+}
+
+void printResult(const std::string& name, const Result& r) {
+    std::printf("%-36s %12.1f %10.2f %10.1f %10.1f %10.1f\n",
+                name.c_str(), r.mean, r.allocations, r.p50, r.p99, r.p999);
+    std::fflush(stdout);
+}
+
+bool selected(const std::string& name) {
+    return g_filter.empty() || name.find(g_filter) != std::string::npos;
+}
+
+/**
+ * 操作 op を繰り返し計る
+ * 1標本が MIN_SAMPLE_NS 以上になるように操作の回数をまとめ、標本ごとの
+ * 1操作あたりの時間から分位点を求める。
+ */
+template <typename Op>
+void run(const std::string& name, Op&& op) {
+    if (!selected(name)) {
+        return;
+    }
+
+    // 暖機と1標本あたりの回数の決定
+    size_t batch = 1;
+    while (batch < (1u << 20)) {
+        auto start = Clock::now();
+        for (size_t i = 0; i < batch; i++) {
+            op();
+        }
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        if (ns >= MIN_SAMPLE_NS) {
+            break;
+        }
+        batch *= 2;
+    }
+
+    std::vector<double> samples;
+    samples.reserve(MAX_SAMPLES);
+    uint64_t ops = 0;
+    double totalNs = 0.0;
+    uint64_t allocationsBefore = g_allocations.load(std::memory_order_relaxed);
+    auto deadline = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(TIME_BUDGET));
+
+    while (samples.size() < MAX_SAMPLES && (samples.size() < MIN_SAMPLES || Clock::now() < deadline)) {
+        auto start = Clock::now();
+        for (size_t i = 0; i < batch; i++) {
+            op();
+        }
+        double ns = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        samples.push_back(ns / batch);
+        totalNs += ns;
+        ops += batch;
+    }
+
+    uint64_t allocations = g_allocations.load(std::memory_order_relaxed) - allocationsBefore;
+    // 標本の配列は事前に確保しているので、確保回数は操作によるものだけ
+    printResult(name, summarize(samples, ops, totalNs, allocations));
+}
+
+//------------------------------------------------------------------------------
+// Environment::tick
+//------------------------------------------------------------------------------
+
+// カウンタ・シーケンス・MIDIシーケンスを混ぜて objects 個作り、すべて開始する
+// rated なら4つに1つの速さを 1/2・3/2・1/3 のどれかにする（ポリメーター）
+std::string tickScript(size_t objects, bool start = true, bool rated = false) {
+    std::ostringstream script;
+    for (size_t i = 0; i < objects; i++) {
+        switch (i % 4) {
+            case 0:
+            case 1:
+                script << "$c" << i << " = @count\n"
+                       << "$c" << i << ".max = " << (4 + i % 13) << "\n";
+                if (start) {
+                    script << "$c" << i << ".start()\n";
+                }
+                break;
+            case 2:
+                script << "$s" << i << " = @seq\n"
+                       << "$s" << i << ".data = b1011001110001011\n";
+                if (start) {
+                    script << "$s" << i << ".start()\n";
+                }
+                break;
+            default:
+                script << "$m" << i << " = @midi_seq\n"
+                       << "$m" << i << ".data = b10010010\n"
+                       << "$m" << i << ".midi_channel = " << (i % 16) << "\n"
+                       << "$m" << i << ".note_base = " << (36 + i % 48) << "\n";
+                if (rated) {
+                    static const char* const rates[] = {".div = 2", ".mul = 3\n$m%zu.div = 2", ".div = 3"};
+                    char line[64];
+                    std::snprintf(line, sizeof(line), rates[(i / 4) % 3], i);
+                    script << "$m" << i << line << "\n";
+                }
+                if (start) {
+                    script << "$m" << i << ".start()\n";
+                }
+                break;
+        }
+    }
+    return script.str();
+}
+
+// CCオブジェクト n 個の値を1つのカウンターに束縛するスクリプト
+std::string bindingScript(size_t n, bool running) {
+    std::ostringstream script;
+    script << "$mod = @count\n$mod.max = 127\n" << (running ? "$mod.start()\n" : "");
+    for (size_t i = 0; i < n; i++) {
+        script << "$cc" << i << " = @midi_cc\n$cc" << i << ".controller = " << i % 128 << "\n";
+        script << "$cc" << i << ".value <- $mod / 16 + " << i % 8 << "\n";
+    }
+    return script.str();
+}
+
+void benchTick() {
+    for (size_t objects : {static_cast<size_t>(10), static_cast<size_t>(100), static_cast<size_t>(10000)}) {
+        std::string name = "tick/" + std::to_string(objects);
+        if (!selected(name)) {
+            continue;
+        }
+        Environment env;
+        Parser parser(env);
+        parser.setEcho(false);
+        parser.parseMultipleLines(tickScript(objects));
+        run(name, [&]() { env.tick(); });
+    }
+
+    // 止まっているオブジェクトはアクティブセットに入らないので手間がかからない
+    if (selected("tick/idle_10000")) {
+        Environment env;
+        Parser parser(env);
+        parser.setEcho(false);
+        parser.parseMultipleLines(tickScript(10000, false));
+        run("tick/idle_10000", [&]() { env.tick(); });
+    }
+
+    // MIDIシーケンスの速さを変えたもの（予定表から呼ばれる）
+    if (selected("tick/polymeter_100")) {
+        Environment env;
+        Parser parser(env);
+        parser.setEcho(false);
+        parser.parseMultipleLines(tickScript(100, true, true));
+        run("tick/polymeter_100", [&]() { env.tick(); });
+    }
+
+    // 属性の束縛: 参照元が動いていれば毎ティック評価するが、送信は値が変わったときだけ
+    // 参照元が止まっていれば評価もしない
+    for (bool running : {true, false}) {
+        std::string name = running ? "tick/bindings_200" : "tick/bindings_200_idle";
+        if (!selected(name)) {
+            continue;
+        }
+        Environment env;
+        Parser parser(env);
+        parser.setEcho(false);
+        parser.parseMultipleLines(bindingScript(200, running));
+        run(name, [&]() { env.tick(); });
+    }
+
+    // 先読み: ティックごとに全変数の複製（チェックポイント）を取る手間
+    // （窓が MARGIN より短いので、先読みしたティックはすぐ確定する）
+    if (selected("tick/lookahead_100")) {
+        Environment env;
+        Parser parser(env);
+        parser.setEcho(false);
+        parser.parseMultipleLines(tickScript(100));
+        Lookahead lookahead(env);
+        lookahead.setWindow(Lookahead::MARGIN / 2);
+        run("tick/lookahead_100", [&]() { lookahead.tick(MIDIManager::now(), 0.001); });
+    }
+}
+
+//------------------------------------------------------------------------------
+// Parser::parseLine
+//------------------------------------------------------------------------------
+
+void benchParser() {
+    Environment env;
+    Parser parser(env);
+    parser.setEcho(false);
+    parser.parseMultipleLines("$b = @count\n$v = 1\n$p = b1010\n");
+
+    // 構文ごと（同じ行の繰り返しなのでコンパイル済みのキャッシュを使う）
+    const struct {
+        const char* name;
+        const char* line;
+    } forms[] = {
+        {"parse/create", "$o = @seq"},
+        {"parse/assign", "$v = 42"},
+        {"parse/binary", "$p = b10110011"},
+        {"parse/attribute", "$b.max = 8"},
+        {"parse/expression", "$v = ($b.max + 3) * 2 % 7"},
+        {"parse/method", "$b.reset()"},
+        {"parse/parallel", "$b.stop() | $b.reset()"},
+    };
+    for (const auto& form : forms) {
+        std::string line = form.line;
+        run(form.name, [&]() { parser.parseLine(line); });
+    }
+
+    // キャッシュに載らない行（キャッシュの容量4096行より多くの異なる行を順に流す）
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < 10000; i++) {
+        lines.push_back("$v = " + std::to_string(i) + " * $b.max + 1");
+    }
+    size_t next = 0;
+    run("parse/uncached", [&]() {
+        parser.parseLine(lines[next]);
+        next = (next + 1) % lines.size();
+    });
+}
+
+//------------------------------------------------------------------------------
+// Expression::evaluate
+//------------------------------------------------------------------------------
+
+void benchExpression() {
+    Environment env;
+    Parser parser(env);
+    parser.setEcho(false);
+    parser.parseMultipleLines("$a = 17\n$c = @count\n$c.max = 9\n");
+
+    const struct {
+        const char* name;
+        const char* source;
+    } expressions[] = {
+        {"expr/variable", "$a"},
+        {"expr/arithmetic", "$a * 3 + 7 % 5 - $a / 2"},
+        {"expr/attribute", "$c.max + $a"},
+        {"expr/functions", "clamp($a * 4 + t % 16, 0, 127)"},
+        {"expr/conditional", "$a > 10 && $c.max != 0 ? min($a, 64) : abs(0 - $a)"},
+        {"expr/random", "rnd(0, 127) + rnd(0, $a)"},
+    };
+    for (const auto& e : expressions) {
+        std::vector<Token> tokens;
+        std::string error;
+        size_t pos = 0;
+        Expression expr;
+        if (!Tokenizer::tokenize(e.source, tokens, error) ||
+            !ExpressionEvaluator::compile(tokens, pos, expr, error)) {
+            std::fprintf(stderr, "%s: %s\n", e.name, error.c_str());
+            continue;
+        }
+        expr.bind(env);
+        volatile int sink = 0;
+        run(e.name, [&]() { sink = expr.evaluate(env); });
+        (void)sink;
+    }
+}
+
+//------------------------------------------------------------------------------
+// Module::getValue
+//------------------------------------------------------------------------------
+
+void benchModules() {
+    // 位置パラメータを進めながら値を読む（シーケンサが1ステップごとに行うこと）
+    const struct {
+        const char* type;
+        const char* position;
+    } modules[] = {
+        {"PAT", "I"}, {"EUC", "I"}, {"SIN", "POS"}, {"TRI", "POS"},
+        {"SAW", "POS"}, {"SQR", "POS"}, {"RND", "POS"}, {"SEQ", "POS"},
+    };
+    for (const auto& m : modules) {
+        ModulePtr module = ModuleFactory::createModule(m.type);
+        if (!module) {
+            continue;
+        }
+        module->setParameter("LEN", 32);
+        module->setParameter("N", 16);
+        module->setParameter("K", 5);
+        module->setParameter("P", 0x5A5A);
+        // 表は名前で設定したときにできている
+        int position = module->findParameter(m.position);
+
+        int step = 0;
+        volatile int sink = 0;
+        run(std::string("module/") + m.type, [&]() {
+            module->setParameterById(position, step);
+            step = (step + 1) & 31;
+            sink = module->getValue();
+        });
+        (void)sink;
+    }
+
+    // 乱数モジュール1000個を同じステップで読む（状態は数十バイトずつなのでキャッシュに収まる）
+    std::vector<ModulePtr> randoms;
+    for (int i = 0; i < 1000; i++) {
+        randoms.push_back(ModuleFactory::createModule("RND"));
+        randoms.back()->setParameter("SEED", i);
+    }
+    int position = randoms.front()->findParameter("POS");
+    int step = 0;
+    volatile int sink = 0;
+    run("module/RND_x1000", [&]() {
+        int hits = 0;
+        for (const ModulePtr& module : randoms) {
+            module->setParameterById(position, step);
+            hits += module->getValue();
+        }
+        step++;
+        sink = hits;
+    });
+    (void)sink;
+}
+
+//------------------------------------------------------------------------------
+// BitPattern の変形
+//------------------------------------------------------------------------------
+
+void benchPatterns() {
+    // 16ステップ（1語）・128ステップ（2語）・1000ステップ（語の途中で終わる）
+    for (size_t steps : {static_cast<size_t>(16), static_cast<size_t>(128), static_cast<size_t>(1000)}) {
+        BitPattern pattern = BitPattern::euclid(steps / 3, steps);
+        BitPattern mask;
+        BitPattern::parse("b110", mask);
+        std::string suffix = "/" + std::to_string(steps);
+        volatile size_t sink = 0;
+
+        run("pattern/rotate" + suffix, [&]() { pattern.rotate(5); });
+        run("pattern/mirror" + suffix, [&]() { pattern.reverse(); });
+        run("pattern/invert" + suffix, [&]() { pattern.invert(); });
+        run("pattern/xor" + suffix, [&]() { pattern.xorWith(mask); });
+        run("pattern/density" + suffix, [&]() { sink = pattern.count(); });
+        run("pattern/euclid" + suffix, [&]() { sink = BitPattern::euclid(5, steps).size(); });
+        (void)sink;
+    }
+}
+
+//------------------------------------------------------------------------------
+// パターングラフ
+//------------------------------------------------------------------------------
+
+void benchGraphs() {
+    // euclid(5,16).rotate(r).and(rnd(70)) の現在のステップを1ステップずつ読む
+    CombinatorModule graph;
+    int rotate = graph.addRotate(graph.addEuclid(5, 16), 0);
+    graph.addMask(CombinatorModule::Op::AND, rotate, graph.addRandom(70));
+    int amount = CombinatorModule::parameterId(rotate, 0);
+    int64_t step = 0;
+    volatile bool sink = false;
+
+    // 引数が変わらなければ64ステップに1回だけ計算する
+    run("graph/step", [&]() { sink = graph.at(step++); });
+
+    // 回転量が毎ステップ変わる（$cnt に束縛したとき）
+    run("graph/step_rebind", [&]() {
+        graph.setParameterById(amount, static_cast<int>(step & 15));
+        sink = graph.at(step++);
+    });
+
+    // 比較用: 毎ステップ途中のパターンを作ってから読む
+    BitPattern random(BitPattern::MAX_STEPS);
+    for (size_t i = 0; i < random.size(); i++) {
+        random.set(i, graph.block(static_cast<int64_t>(i)) & 1);
+    }
+    run("graph/materialized", [&]() {
+        BitPattern p = BitPattern::euclid(5, 16);
+        p.rotate(static_cast<long>(step & 15));
+        p = BitPattern::repeat(p, BitPattern::MAX_STEPS);
+        p.andWith(random);
+        sink = p.test(static_cast<size_t>(step++ % BitPattern::MAX_STEPS));
+    });
+    (void)sink;
+}
+
+//------------------------------------------------------------------------------
+// スクリプトの再読み込み
+//------------------------------------------------------------------------------
+
+void benchReload() {
+    if (!selected("reload/")) {
+        return;
+    }
+    const std::string path = "bench_reload.tmp";
+    {
+        std::ofstream out(path);
+        for (int i = 0; i < 100; i++) {
+            out << "$cc" << i << " = @midi_cc\n$cc" << i << ".controller = " << i % 128 << "\n$cc" << i
+                << ".value = " << i % 128 << "\n";
+        }
+    }
+
+    // 裏での実行は下書きの環境なので、CCを1つも送ってはいけない
+    MIDIManager& midi = getMIDIManager();
+    std::unique_ptr<NullSink> owned(new NullSink());
+    NullSink* sink = owned.get();
+    midi.setOutputSink(std::move(owned));
+
+    Environment env;
+    HotReloader reloader;
+    run("reload/cc_100", [&]() {
+        ScriptPatch patch;
+        reloader.start(path, env);
+        while (!reloader.poll(patch, env)) {
+            std::this_thread::yield();
+        }
+    });
+    if (sink->getCount() != 0) {
+        std::fprintf(stderr, "reload/cc_100: the reload sent %llu MIDI messages\n",
+                     static_cast<unsigned long long>(sink->getCount()));
+        g_failed = true;
+    }
+
+    midi.setOutputSink(std::unique_ptr<MIDIOutputSink>(new NullSink()));
+    std::remove(path.c_str());
+}
+
+//------------------------------------------------------------------------------
+// シーンの読み込み
+//------------------------------------------------------------------------------
+
+void benchScenes() {
+    if (!selected("scene/")) {
+        return;
+    }
+    const std::string path = "bench_scene.tmp";
+    std::string script = tickScript(500, true, true);
+    {
+        Environment env;
+        Parser parser(env);
+        parser.setEcho(false);
+        parser.parseMultipleLines(script);
+        Scene scene;
+        scene.capture(env);
+        if (!scene.save(path)) {
+            return;
+        }
+    }
+
+    // 比較用: 同じ状態をスクリプトから作る（行のキャッシュが効かないよう毎回新しいパーサー）
+    run("scene/parse_500", [&]() {
+        Environment env;
+        Parser parser(env);
+        parser.setEcho(false);
+        parser.parseMultipleLines(script);
+    });
+
+    // ファイルを mmap して型ごとに状態を読み、環境に入れる
+    run("scene/load_500", [&]() {
+        Environment env;
+        Parser parser(env);
+        Scene scene;
+        scene.load(path, parser);
+        scene.patch().apply(env, "Scene");
+    });
+
+    // メモリに置いたシーンの呼び出し（複製して差し替えるだけ）
+    Environment env;
+    Parser parser(env);
+    Scene scene;
+    scene.load(path, parser);
+    run("scene/recall_500", [&]() { scene.patch().apply(env, "Scene"); });
+
+    std::remove(path.c_str());
+}
+
+//------------------------------------------------------------------------------
+// OSCの受信
+//------------------------------------------------------------------------------
+
+// OSCの文字列（0終端、4バイト境界まで詰める）
+void appendOSCString(std::vector<uint8_t>& packet, const char* s) {
+    size_t n = std::strlen(s) + 1;
+    packet.insert(packet.end(), s, s + n);
+    packet.resize((packet.size() + 3) & ~static_cast<size_t>(3), 0);
+}
+
+void benchOSC() {
+    if (!selected("osc/")) {
+        return;
+    }
+    Environment env;
+    Parser parser(env);
+    parser.setEcho(false);
+    parser.parseMultipleLines("$c = @count\n$c.max = 127\n");
+    OSCServer server(env); // ソケットは開かず、パケットを直接渡す
+
+    // フェーダー: /c/max ,f 0.5 を受け取り、ティックの頭でコマンドを実行する
+    std::vector<uint8_t> fader;
+    appendOSCString(fader, "/c/max");
+    appendOSCString(fader, ",f");
+    uint32_t bits;
+    float level = 64.0f;
+    std::memcpy(&bits, &level, sizeof(bits));
+    for (int shift = 24; shift >= 0; shift -= 8) {
+        fader.push_back(static_cast<uint8_t>(bits >> shift));
+    }
+    run("osc/fader", [&]() {
+        server.handlePacket(fader.data(), fader.size());
+        env.processCommands();
+    });
+
+    // 16個のフェーダーをまとめたバンドル（1操作で16メッセージ）
+    std::vector<uint8_t> bundle;
+    appendOSCString(bundle, "#bundle");
+    bundle.insert(bundle.end(), 8, 0);
+    for (int i = 0; i < 16; i++) {
+        bundle.insert(bundle.end(), {0, 0, 0, static_cast<uint8_t>(fader.size())});
+        bundle.insert(bundle.end(), fader.begin(), fader.end());
+    }
+    run("osc/bundle_16", [&]() {
+        server.handlePacket(bundle.data(), bundle.size());
+        env.processCommands();
+    });
+}
+
+//------------------------------------------------------------------------------
+// MIDIManager のキュー
+//------------------------------------------------------------------------------
+
+/**
+ * 送信時刻から実際に出力された時刻までの遅れを記録する出力先
+ * 出力スレッドだけが書き込む。
+ */
+class LatencySink : public MIDIOutputSink {
+private:
+    std::vector<double> latencies;
+    std::atomic<size_t> count;
+
+public:
+    explicit LatencySink(size_t capacity) : latencies(capacity), count(0) {}
+
+    bool send(const MIDIMessage& msg) override {
+        size_t n = count.load(std::memory_order_relaxed);
+        if (n < latencies.size()) {
+            latencies[n] = (MIDIManager::now() - msg.timestamp) * 1e9;
+        }
+        count.store(n + 1, std::memory_order_release);
+        return true;
+    }
+    bool isOpen() const override { return true; }
+
+    size_t received() const { return count.load(std::memory_order_acquire); }
+    std::vector<double>& samples() { return latencies; }
+};
+
+/**
+ * 出力スレッドを動かしたままメッセージを積み、全部出力されるまでを計る
+ * interval が0なら詰め込めるだけ積む（スループット）。0より大きければ
+ * その間隔（秒）で1つずつ積む（出力スレッドが待機から起きるまでの遅れ）。
+ * ns/op はメッセージあたりの時間、分位点は積んでから出力されるまでの遅れ。
+ */
+void benchMIDIQueue(const std::string& name, size_t messages, double interval) {
+    if (!selected(name)) {
+        return;
+    }
+
+    MIDIManager& midi = getMIDIManager();
+    std::unique_ptr<LatencySink> owned(new LatencySink(messages));
+    LatencySink* sink = owned.get();
+    midi.setOutputSink(std::move(owned));
+    midi.startProcessing();
+
+    // 送信時刻を「今」にして積む。満杯なら出力スレッドが追いつくまで待つ
+    uint64_t allocationsBefore = g_allocations.load(std::memory_order_relaxed);
+    auto start = Clock::now();
+    for (size_t i = 0; i < messages; i++) {
+        if (interval > 0.0) {
+            double due = MIDIManager::now() + interval;
+            while (MIDIManager::now() < due) {
+            }
+        }
+        MIDIMessage msg(MIDIMessage::CC, static_cast<int>(i & 15), 1, static_cast<int>(i & 127), MIDIManager::now());
+        while (!midi.queueMessage(msg)) {
+            std::this_thread::yield();
+        }
+    }
+    while (sink->received() < messages) {
+        std::this_thread::yield();
+    }
+    double totalNs = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+    uint64_t allocations = g_allocations.load(std::memory_order_relaxed) - allocationsBefore;
+
+    midi.stopProcessing();
+    Result result = summarize(sink->samples(), messages, totalNs, allocations);
+    midi.setOutputSink(std::unique_ptr<MIDIOutputSink>(new NullSink()));
+    printResult(name, result);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        g_filter = argv[1];
+    }
+
+    // スクリプトの実行結果の表示は捨てる（結果はprintfで表示する）
+    NullBuffer discard;
+    std::streambuf* console = std::cout.rdbuf(&discard);
+
+    // MIDIはデバイスを開かずに出力なしの出力先へ送る
+    getMIDIManager().setOutputSink(std::unique_ptr<MIDIOutputSink>(new NullSink()));
+
+    printHeader();
+    benchTick();
+    benchParser();
+    benchExpression();
+    benchModules();
+    benchPatterns();
+    benchGraphs();
+    benchReload();
+    benchScenes();
+    benchOSC();
+    benchMIDIQueue("midi/throughput", 200000, 0.0);
+    benchMIDIQueue("midi/latency", 5000, 100e-6);
+
+    std::cout.rdbuf(console);
+    return g_failed ? 1 : 0;
+}
@@ -0,0 +1,341 @@
+#ifndef REELIA_BIT_PATTERN_HPP
+#define REELIA_BIT_PATTERN_HPP
+
+#include "object_pool.hpp"
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/**
+ * ビットパターン
+ * 任意の長さのステップの列を64ステップずつ uint64_t の語に詰めて持つ。
+ * ステップ i は words[i / 64] の i % 64 ビット目。最後の語の余りのビットは
+ * 常に0にしておくので、回転・反転・マスク・個数はどれも語単位の
+ * シフトと論理演算だけで済み、ステップごとのループにならない。
+ */
+class BitPattern {
+public:
+  static constexpr size_t WORD_BITS = 64;
+
+  // 扱えるステップ数の上限
+  static constexpr size_t MAX_STEPS = 4096;
+  static constexpr size_t MAX_WORDS = MAX_STEPS / WORD_BITS;
+
+private:
+  std::vector<uint64_t, ArenaAllocator<uint64_t>> words; // アリーナから確保する
+  size_t steps;
+
+  static size_t wordCount(size_t n) { return (n + WORD_BITS - 1) / WORD_BITS; }
+  static size_t clampSteps(size_t n) { return n < MAX_STEPS ? n : MAX_STEPS; }
+
+  // 最後の語の余りのビットを0にする
+  void clearTail() {
+    size_t used = steps % WORD_BITS;
+    if (used != 0) {
+      words.back() &= (static_cast<uint64_t>(1) << used) - 1;
+    }
+  }
+
+  // out = src のステップを k だけ上（後ろ）へずらしたもの（はみ出した分は捨てる）
+  // out と src が同じでもよい（上の語から順に書く）
+  static void shiftUp(const uint64_t *src, size_t srcWords, size_t k,
+                      uint64_t *out, size_t outWords) {
+    size_t ws = k / WORD_BITS;
+    size_t bs = k % WORD_BITS;
+    for (size_t w = outWords; w-- > 0;) {
+      uint64_t v = 0;
+      if (w >= ws && w - ws < srcWords) {
+        v = src[w - ws] << bs;
+      }
+      if (bs != 0 && w > ws && w - ws - 1 < srcWords) {
+        v |= src[w - ws - 1] >> (WORD_BITS - bs);
+      }
+      out[w] = v;
+    }
+  }
+
+  // out = src のステップを k だけ下（前）へずらしたもの
+  // out と src が同じでもよい（下の語から順に書く）
+  static void shiftDown(const uint64_t *src, size_t srcWords, size_t k,
+                        uint64_t *out, size_t outWords) {
+    size_t ws = k / WORD_BITS;
+    size_t bs = k % WORD_BITS;
+    for (size_t w = 0; w < outWords; w++) {
+      uint64_t v = 0;
+      if (w + ws < srcWords) {
+        v = src[w + ws] >> bs;
+        if (bs != 0 && w + ws + 1 < srcWords) {
+          v |= src[w + ws + 1] << (WORD_BITS - bs);
+        }
+      }
+      out[w] = v;
+    }
+  }
+
+  // mask を繰り返して words.size() 語分並べる
+  // 長さが64の約数なら1語の中で、そうでなければ並べた分をずらして重ねることで
+  // 倍々に伸ばす（シフトとORが log(ステップ数/マスク長) 回で済む）
+  void tileInto(const BitPattern &mask, uint64_t *out) const {
+    size_t count = words.size();
+    size_t m = mask.steps;
+    for (size_t w = 0; w < count; w++) {
+      out[w] = 0;
+    }
+    if (m == 0) {
+      return;
+    }
+    if (WORD_BITS % m == 0) {
+      uint64_t word = mask.words[0];
+      for (size_t len = m; len < WORD_BITS; len *= 2) {
+        word |= word << len;
+      }
+      for (size_t w = 0; w < count; w++) {
+        out[w] = word;
+      }
+      return;
+    }
+    size_t copy = mask.words.size() < count ? mask.words.size() : count;
+    for (size_t w = 0; w < copy; w++) {
+      out[w] = mask.words[w];
+    }
+    uint64_t shifted[MAX_WORDS];
+    for (size_t len = m; len < steps; len *= 2) {
+      shiftUp(out, count, len, shifted, count);
+      for (size_t w = 0; w < count; w++) {
+        out[w] |= shifted[w];
+      }
+    }
+  }
+
+  // 語の中のビットの並びを逆にする
+  static uint64_t reverseWord(uint64_t v) {
+    v = ((v >> 1) & 0x5555555555555555ULL) | ((v & 0x5555555555555555ULL) << 1);
+    v = ((v >> 2) & 0x3333333333333333ULL) | ((v & 0x3333333333333333ULL) << 2);
+    v = ((v >> 4) & 0x0F0F0F0F0F0F0F0FULL) | ((v & 0x0F0F0F0F0F0F0F0FULL) << 4);
+    return __builtin_bswap64(v);
+  }
+
+public:
+  // ステップ数は MAX_STEPS までに切り詰める
+  explicit BitPattern(size_t n = 0)
+      : words(wordCount(clampSteps(n)), 0), steps(clampSteps(n)) {}
+
+  // 下位 n ビットから作る（ステップ i はビット i）
+  static BitPattern fromBits(uint64_t bits, size_t n) {
+    BitPattern p(n);
+    if (!p.words.empty()) {
+      p.words[0] = bits;
+      p.clearTail();
+    }
+    return p;
+  }
+
+  // リテラル（b1010 や #1010）から作る。右端の桁がステップ0で、桁数がステップ数
+  // （整数として読んだときのビットと同じ並び）
+  static bool parse(const std::string &text, BitPattern &out) {
+    if (text.size() <= 1 || text.size() - 1 > MAX_STEPS ||
+        (text[0] != 'b' && text[0] != '#')) {
+      return false;
+    }
+    size_t n = text.size() - 1;
+    BitPattern p(n);
+    for (size_t i = 0; i < n; i++) {
+      char c = text[text.size() - 1 - i];
+      if (c != '0' && c != '1') {
+        return false;
+      }
+      p.set(i, c == '1');
+    }
+    out = std::move(p);
+    return true;
+  }
+
+  size_t size() const { return steps; }
+  bool empty() const { return steps == 0; }
+
+  // ステップ数の変更（増やした分は0、減らした分は捨てる）
+  void resize(size_t n) {
+    n = clampSteps(n);
+    words.resize(wordCount(n), 0);
+    steps = n;
+    clearTail();
+  }
+
+  bool test(size_t i) const {
+    return i < steps && ((words[i / WORD_BITS] >> (i % WORD_BITS)) & 1);
+  }
+
+  void set(size_t i, bool on) {
+    if (i >= steps) {
+      return;
+    }
+    uint64_t bit = static_cast<uint64_t>(1) << (i % WORD_BITS);
+    if (on) {
+      words[i / WORD_BITS] |= bit;
+    } else {
+      words[i / WORD_BITS] &= ~bit;
+    }
+  }
+
+  // 先頭の32ステップを整数として（Valueや式で扱う値）
+  int toInt() const {
+    return words.empty() ? 0 : static_cast<int>(static_cast<uint32_t>(words[0]));
+  }
+
+  // 先頭から src のステップ数分を src で置き換える（残りはそのまま）
+  void assignPrefix(const BitPattern &src) {
+    size_t n = src.steps < steps ? src.steps : steps;
+    size_t full = n / WORD_BITS;
+    for (size_t w = 0; w < full; w++) {
+      words[w] = src.words[w];
+    }
+    size_t rest = n % WORD_BITS;
+    if (rest != 0) {
+      uint64_t mask = (static_cast<uint64_t>(1) << rest) - 1;
+      words[full] = (words[full] & ~mask) | (src.words[full] & mask);
+    }
+  }
+
+  // 語単位の読み書き（w 番目の語はステップ w*64 から。余りのビットは捨てる）
+  uint64_t word(size_t w) const { return w < words.size() ? words[w] : 0; }
+  void setWord(size_t w, uint64_t value) {
+    if (w < words.size()) {
+      words[w] = value;
+      if (w + 1 == words.size()) {
+        clearTail();
+      }
+    }
+  }
+
+  // offset から64ステップ分（ビット j がステップ offset+j。範囲外は0）
+  uint64_t extract(size_t offset) const {
+    size_t w = offset / WORD_BITS;
+    size_t b = offset % WORD_BITS;
+    uint64_t v = word(w) >> b;
+    if (b != 0) {
+      v |= word(w + 1) << (WORD_BITS - b);
+    }
+    return v;
+  }
+
+  // pattern を繰り返して n ステップにしたもの
+  static BitPattern repeat(const BitPattern &pattern, size_t n) {
+    BitPattern out(n);
+    out.tileInto(pattern, out.words.data());
+    out.clearTail();
+    return out;
+  }
+
+  // オンのステップ数（密度）
+  size_t count() const {
+    size_t total = 0;
+    for (uint64_t w : words) {
+      total += static_cast<size_t>(__builtin_popcountll(w));
+    }
+    return total;
+  }
+
+  // k ステップ後ろへ回転（末尾からはみ出したステップは先頭へ。負なら前へ）
+  void rotate(long k) {
+    if (steps == 0) {
+      return;
+    }
+    long n = static_cast<long>(steps);
+    size_t shift = static_cast<size_t>(((k % n) + n) % n);
+    if (shift == 0) {
+      return;
+    }
+    // 作業領域はスタックに置く（ヒープを使わない）
+    uint64_t down[MAX_WORDS];
+    size_t count = words.size();
+    shiftDown(words.data(), count, steps - shift, down, count);
+    shiftUp(words.data(), count, shift, words.data(), count);
+    for (size_t w = 0; w < count; w++) {
+      words[w] |= down[w];
+    }
+    clearTail();
+  }
+
+  // 全ステップの反転
+  void invert() {
+    for (uint64_t &w : words) {
+      w = ~w;
+    }
+    clearTail();
+  }
+
+  // 前後の反転（ステップ i と n-1-i を入れ替える）
+  void reverse() {
+    if (steps == 0) {
+      return;
+    }
+    size_t count = words.size();
+    uint64_t reversed[MAX_WORDS];
+    for (size_t w = 0; w < count; w++) {
+      reversed[count - 1 - w] = reverseWord(words[w]);
+    }
+    // 語の並びごと反転すると余りのビットの分だけ上にずれる
+    shiftDown(reversed, count, count * WORD_BITS - steps, words.data(), count);
+    clearTail();
+  }
+
+  // マスクとの論理演算（マスクが短ければ繰り返して長さを合わせる）
+  void andWith(const BitPattern &mask) {
+    uint64_t m[MAX_WORDS];
+    tileInto(mask, m);
+    for (size_t w = 0; w < words.size(); w++) {
+      words[w] &= m[w];
+    }
+  }
+
+  void orWith(const BitPattern &mask) {
+    uint64_t m[MAX_WORDS];
+    tileInto(mask, m);
+    for (size_t w = 0; w < words.size(); w++) {
+      words[w] |= m[w];
+    }
+    clearTail();
+  }
+
+  void xorWith(const BitPattern &mask) {
+    uint64_t m[MAX_WORDS];
+    tileInto(mask, m);
+    for (size_t w = 0; w < words.size(); w++) {
+      words[w] ^= m[w];
+    }
+    clearTail();
+  }
+
+  // n ステップに k 個のオンをなるべく均等に置く（ユークリッドリズム、先頭はオン）
+  // ステップ i は (i * k) mod n < k のときオン。これは j 番目のオンが
+  // ceil(j * n / k) にあることと同じなので、ステップごとではなくオンの数だけ書く
+  static BitPattern euclid(size_t k, size_t n) {
+    BitPattern out(n);
+    n = out.steps;
+    if (k > n) {
+      k = n;
+    }
+    for (size_t j = 0; j < k; j++) {
+      size_t i = (j * n + k - 1) / k;
+      out.words[i / WORD_BITS] |= static_cast<uint64_t>(1) << (i % WORD_BITS);
+    }
+    return out;
+  }
+
+  // リテラルと同じ表記（右端がステップ0）
+  std::string toString() const {
+    std::string text = "b";
+    for (size_t i = steps; i-- > 0;) {
+      text += test(i) ? '1' : '0';
+    }
+    return text;
+  }
+
+  bool operator==(const BitPattern &other) const {
+    return steps == other.steps && words == other.words;
+  }
+  bool operator!=(const BitPattern &other) const { return !(*this == other); }
+};
+
+#endif // REELIA_BIT_PATTERN_HPP
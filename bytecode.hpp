@@ -0,0 +1,64 @@
+#ifndef REELIA_BYTECODE_HPP
+#define REELIA_BYTECODE_HPP
+
+#include "expression.hpp"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+class PatternGraphObject;
+
+/**
+ * 命令
+ * 1行のスクリプトはコンパイル時に命令列へ変換され、以降は命令列だけを
+ * 実行する（正規表現・文字列の確保は行わない）。変数名はコンパイル時に
+ * 環境のスロット番号へ解決済み
+ */
+struct Instruction {
+  enum OpCode {
+    CREATE,   // $target = @className
+    SET_ATTR, // $target.member = expr
+    GET_ATTR, // target = $source.member
+    CALL,     // $target.member(args...)
+    ASSIGN,   // $target = expr
+    GRAPH,    // $target = euclid(...).rotate(...)...（パターングラフ）
+    BIND      // $target.member <- expr（属性の束縛）
+  };
+
+  OpCode op;
+  uint32_t target;    // 代入先・呼び出し対象の変数スロット
+  uint32_t source;    // GET_ATTRの参照元の変数スロット
+  std::string member; // 属性名・メソッド名・クラス名
+  AttrKey attr;       // SET_ATTR/GET_ATTR/BINDの属性ID（コンパイル時に解決）
+  MethodId method;    // CALLのメソッドID（コンパイル時に解決）
+  Expression expr;    // SET_ATTR/ASSIGN/BINDの値（コンパイル済みの式）
+  std::string definition; // BINDの式の表記（表示用）
+  BitPattern pattern; // 値がバイナリパターンのリテラルだけなら、その桁数のパターン
+
+  // CALLの引数（バイナリパターンのリテラルは pattern にも入る）
+  struct Argument {
+    Expression expr;
+    BitPattern pattern;
+  };
+  std::vector<Argument> args;
+
+  // GRAPHで作るオブジェクトの原型（実行時は複製して代入する）
+  std::shared_ptr<const PatternGraphObject> graph;
+
+  explicit Instruction(OpCode o)
+      : op(o), target(0), source(0), method(INVALID_METHOD) {}
+};
+
+/**
+ * コンパイル済みプログラム（1行分の命令列）
+ */
+struct Program {
+  std::vector<Instruction> code;
+  bool valid;        // コンパイルに成功したか
+  std::string error; // 失敗時のエラーメッセージ
+
+  Program() : valid(false) {}
+};
+
+#endif // REELIA_BYTECODE_HPP
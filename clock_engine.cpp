@@ -0,0 +1,233 @@
+#include "clock_engine.hpp"
+#include "metrics.hpp"
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace {
+// デッドライン直前はスリープではなくスピンで待機する（OSのタイマー精度対策）
+constexpr std::chrono::microseconds SPIN_MARGIN(500);
+
+// この周期数以上遅れた場合は追いつこうとせずティックをスキップする
+constexpr int64_t MAX_LAG_PERIODS = 4;
+
+// 同期元の次のティックが決まらないとき、またはまだ先のときに聞き直す間隔
+constexpr std::chrono::milliseconds SYNC_POLL(1);
+
+// 最小周期（これより短い周期は指定できない）
+constexpr int64_t MIN_PERIOD_NS = 50000; // 50us
+
+int64_t clampPeriod(int64_t ns) {
+    return ns < MIN_PERIOD_NS ? MIN_PERIOD_NS : ns;
+}
+} // namespace
+
+// コンストラクタ（デフォルト: 60 BPM, 4 PPQN = 250ms）
+ClockEngine::ClockEngine()
+    : running(false), periodNs(250000000), bpm(60.0), ppqn(4), droppedTicks(0), syncSource(nullptr) {
+}
+
+// デストラクタ
+ClockEngine::~ClockEngine() {
+    stop();
+}
+
+// 周期をナノ秒で設定
+void ClockEngine::setPeriod(std::chrono::nanoseconds period) {
+    int64_t ns = clampPeriod(period.count());
+    periodNs = ns;
+    bpm = 60.0e9 / (static_cast<double>(ns) * ppqn.load());
+}
+
+// 周期をミリ秒で設定（小数でサブミリ秒も指定可能）
+void ClockEngine::setPeriodMs(double ms) {
+    setPeriod(std::chrono::nanoseconds(static_cast<int64_t>(ms * 1.0e6)));
+}
+
+// BPMとPPQNからティック周期を設定
+void ClockEngine::setTempo(double beatsPerMinute, int pulsesPerQuarter) {
+    if (beatsPerMinute <= 0.0 || pulsesPerQuarter <= 0) {
+        return;
+    }
+    bpm = beatsPerMinute;
+    ppqn = pulsesPerQuarter;
+    periodNs = clampPeriod(static_cast<int64_t>(60.0e9 / (beatsPerMinute * pulsesPerQuarter)));
+}
+
+// BPMのみ変更
+void ClockEngine::setBPM(double beatsPerMinute) {
+    setTempo(beatsPerMinute, ppqn.load());
+}
+
+// PPQNのみ変更（BPMは維持）
+void ClockEngine::setPPQN(int pulsesPerQuarter) {
+    setTempo(bpm.load(), pulsesPerQuarter);
+}
+
+std::chrono::nanoseconds ClockEngine::getPeriod() const {
+    return std::chrono::nanoseconds(periodNs.load());
+}
+
+double ClockEngine::getPeriodMs() const {
+    return static_cast<double>(periodNs.load()) / 1.0e6;
+}
+
+double ClockEngine::getBPM() const {
+    return bpm.load();
+}
+
+int ClockEngine::getPPQN() const {
+    return ppqn.load();
+}
+
+uint64_t ClockEngine::getDroppedTicks() const {
+    return droppedTicks.load();
+}
+
+void ClockEngine::setSyncSource(SyncSource* source) {
+    syncSource = source;
+}
+
+ClockEngine::SyncSource* ClockEngine::getSyncSource() const {
+    return syncSource.load();
+}
+
+bool ClockEngine::isRunning() const {
+    return running.load();
+}
+
+// クロックスレッドの開始
+void ClockEngine::start(TickCallback cb) {
+    if (running) return;
+
+    callback = std::move(cb);
+    running = true;
+    clockThread = std::thread(&ClockEngine::run, this);
+
+#if defined(__linux__) || defined(__APPLE__)
+    // 可能であればリアルタイム優先度に上げる（権限がなければ通常優先度のまま）
+    sched_param param{};
+    param.sched_priority = sched_get_priority_min(SCHED_FIFO) + 10;
+    pthread_setschedparam(clockThread.native_handle(), SCHED_FIFO, &param);
+#endif
+}
+
+// クロックスレッドの停止
+void ClockEngine::stop() {
+    {
+        std::lock_guard<std::mutex> lock(waitMutex);
+        running = false;
+    }
+    waitCondition.notify_all();
+
+    if (clockThread.joinable()) {
+        clockThread.join();
+    }
+}
+
+// デッドラインまで待機（停止要求があればfalseを返す）
+bool ClockEngine::waitUntil(Clock::time_point deadline) {
+    {
+        std::unique_lock<std::mutex> lock(waitMutex);
+        waitCondition.wait_until(lock, deadline - SPIN_MARGIN, [this] { return !running.load(); });
+    }
+    if (!running) {
+        return false;
+    }
+
+    while (Clock::now() < deadline) {
+        std::this_thread::yield();
+    }
+    return running.load();
+}
+
+// 停止要求があるまで最大 duration だけ待機（スピンしない。停止要求があればfalse）
+bool ClockEngine::pause(Clock::duration duration) {
+    std::unique_lock<std::mutex> lock(waitMutex);
+    waitCondition.wait_for(lock, duration, [this] { return !running.load(); });
+    return running.load();
+}
+
+// 同期元に従って1ティック進める（停止要求があればfalse）
+bool ClockEngine::runSynced(SyncSource* source, uint64_t& tick) {
+    Clock::time_point deadline;
+    std::chrono::nanoseconds period;
+    if (!source->nextTick(ppqn.load(), deadline, period)) {
+        return pause(SYNC_POLL);
+    }
+
+    // 先のティックは、新しいパルスで予測が変わるので近づいてから聞き直す
+    if (deadline - Clock::now() > SYNC_POLL) {
+        return pause(SYNC_POLL);
+    }
+    if (!waitUntil(deadline)) {
+        return false;
+    }
+
+    // 外部クロックのティックは位置を合わせるため間引かない
+    getMetrics().record(Metrics::CLOCK_JITTER,
+                        std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - deadline).count());
+    int64_t ns = clampPeriod(period.count());
+    periodNs = ns;
+    bpm = 60.0e9 / (static_cast<double>(ns) * ppqn.load());
+
+    callback(tick++, deadline);
+    source->advance();
+    return true;
+}
+
+// クロックスレッド本体
+void ClockEngine::run() {
+    int64_t period = periodNs.load();
+    Clock::time_point anchor = Clock::now();
+    int64_t n = 0;     // anchorからのティック番号
+    uint64_t tick = 0; // 開始からの通算ティック番号
+    bool synced = false;
+
+    while (running) {
+        SyncSource* source = syncSource.load();
+        if (source) {
+            if (!runSynced(source, tick)) {
+                break;
+            }
+            synced = true;
+            continue;
+        }
+
+        // 同期をやめたら今を新しい基準点にする
+        if (synced) {
+            anchor = Clock::now();
+            n = 0;
+            period = periodNs.load();
+            synced = false;
+        }
+
+        // 周期が変更されたら現在のデッドラインを新しい基準点にする
+        int64_t newPeriod = periodNs.load();
+        if (newPeriod != period) {
+            anchor += std::chrono::nanoseconds(n * period);
+            n = 0;
+            period = newPeriod;
+        }
+
+        Clock::time_point deadline = anchor + std::chrono::nanoseconds(n * period);
+        if (!waitUntil(deadline)) {
+            break;
+        }
+
+        // 大きく遅れた場合はまとめて追いつかず、間引いて次のデッドラインへ進む
+        int64_t lateNs = std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - deadline).count();
+        getMetrics().record(Metrics::CLOCK_JITTER, lateNs);
+        if (lateNs > MAX_LAG_PERIODS * period) {
+            int64_t missed = lateNs / period;
+            n += missed;
+            droppedTicks += static_cast<uint64_t>(missed);
+            deadline = anchor + std::chrono::nanoseconds(n * period);
+        }
+
+        callback(tick++, deadline);
+        n++;
+    }
+}
@@ -0,0 +1,99 @@
+#ifndef REELIA_CLOCK_ENGINE_HPP
+#define REELIA_CLOCK_ENGINE_HPP
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+/**
+ * クロックエンジン
+ * 専用スレッドで絶対時刻のデッドライン（start + n * period）に従って
+ * ティックを発生させる。前回からの経過時間ではなく開始時刻を基準に
+ * するため、誤差が蓄積せずテンポがドリフトしない。
+ * 同期元（SyncSource）を設定すると、デッドラインと周期は同期元から得る
+ * （外部のMIDIクロックに追従するときなど）。
+ */
+class ClockEngine {
+public:
+    using Clock = std::chrono::steady_clock;
+
+    // ティックコールバック（ティック番号と予定時刻を受け取る）
+    using TickCallback = std::function<void(uint64_t tick, Clock::time_point scheduled)>;
+
+    /**
+     * ティックの同期元
+     * nextTick() と advance() はクロックスレッドから呼ばれる。
+     */
+    class SyncSource {
+    public:
+        virtual ~SyncSource() {}
+
+        // 次のティックの予定時刻と周期（まだ決まらなければfalse。少し待って聞き直す）
+        virtual bool nextTick(int pulsesPerQuarter, Clock::time_point& deadline, std::chrono::nanoseconds& period) = 0;
+
+        // nextTick() で得たティックを発生させた
+        virtual void advance() = 0;
+    };
+
+private:
+    std::thread clockThread;
+    std::atomic<bool> running;
+
+    // ティック周期（ナノ秒）。スレッド実行中でも変更可能
+    std::atomic<int64_t> periodNs;
+
+    // テンポ設定
+    std::atomic<double> bpm;
+    std::atomic<int> ppqn;
+
+    // 処理が間に合わずスキップしたティック数
+    std::atomic<uint64_t> droppedTicks;
+
+    // 停止要求を待機中のスレッドに伝えるため
+    std::mutex waitMutex;
+    std::condition_variable waitCondition;
+
+    TickCallback callback;
+
+    // 同期元（nullptrなら内部のクロック）
+    std::atomic<SyncSource*> syncSource;
+
+    // 内部メソッド
+    void run();
+    bool runSynced(SyncSource* source, uint64_t& tick);
+    bool waitUntil(Clock::time_point deadline);
+    bool pause(Clock::duration duration);
+
+public:
+    ClockEngine();
+    ~ClockEngine();
+
+    // 周期設定
+    void setPeriod(std::chrono::nanoseconds period);
+    void setPeriodMs(double ms);
+    void setTempo(double beatsPerMinute, int pulsesPerQuarter);
+    void setBPM(double beatsPerMinute);
+    void setPPQN(int pulsesPerQuarter);
+
+    std::chrono::nanoseconds getPeriod() const;
+    double getPeriodMs() const;
+    double getBPM() const;
+    int getPPQN() const;
+    uint64_t getDroppedTicks() const;
+
+    // 同期元の設定（nullptrで内部のクロックに戻す。実行中でも切り替えられる）
+    // 同期中はBPMと周期が同期元に追従する
+    void setSyncSource(SyncSource* source);
+    SyncSource* getSyncSource() const;
+
+    // クロックスレッドの開始と停止
+    void start(TickCallback cb);
+    void stop();
+    bool isRunning() const;
+};
+
+#endif // REELIA_CLOCK_ENGINE_HPP
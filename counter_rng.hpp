@@ -0,0 +1,57 @@
+#ifndef REELIA_COUNTER_RNG_HPP
+#define REELIA_COUNTER_RNG_HPP
+
+#include <cstdint>
+
+/**
+ * カウンター方式の乱数
+ * 状態を持たず、(鍵, 番号) から直接値を計算する（splitmix64 の n 番目の出力）。
+ * 鍵は seed と系列（オブジェクトやパラメータ）の組から作る。どのステップの値も
+ * 前のステップを生成せずに O(1) で求まるので、ティックをどのスレッドでどう
+ * 分けても同じ値になり、同じ鍵・番号なら何度計算しても同じ値になる。
+ * 分岐のない整数演算だけなので、多くの系列や連続した番号をまとめて計算する
+ * ループはコンパイラがベクトル化できる。
+ */
+namespace counter_rng {
+
+constexpr uint64_t GOLDEN = 0x9E3779B97F4A7C15ULL;
+
+// 64ビットの混ぜ合わせ（splitmix64 の仕上げ）
+inline uint64_t mix(uint64_t x) {
+  x ^= x >> 30;
+  x *= 0xBF58476D1CE4E5B9ULL;
+  x ^= x >> 27;
+  x *= 0x94D049BB133111EBULL;
+  x ^= x >> 31;
+  return x;
+}
+
+// seed と系列の組の鍵（組ごとに別の乱数列になる）
+inline uint64_t key(uint64_t seed, uint64_t stream) {
+  return mix(mix(seed + GOLDEN) ^ stream);
+}
+
+// 鍵の乱数列の counter 番目
+inline uint64_t at(uint64_t key, uint64_t counter) {
+  return mix(key + (counter + 1) * GOLDEN);
+}
+
+// 0以上n未満（n は 2^32 まで。上位32ビットを掛けて縮めるので割り算はしない）
+inline uint64_t below(uint64_t random, uint64_t n) {
+  return ((random >> 32) * n) >> 32;
+}
+
+// start 番から64個を percent% の確率で1にしたビット列（i 番目が start + i 番）
+inline uint64_t chanceBits(uint64_t key, uint64_t start, int percent) {
+  uint64_t bits = 0;
+  for (uint64_t i = 0; i < 64; i++) {
+    bits |= static_cast<uint64_t>(below(at(key, start + i), 100) <
+                                  static_cast<uint64_t>(percent))
+            << i;
+  }
+  return bits;
+}
+
+} // namespace counter_rng
+
+#endif // REELIA_COUNTER_RNG_HPP
@@ -0,0 +1,90 @@
+#ifndef REELIA_DEPENDENCY_GRAPH_HPP
+#define REELIA_DEPENDENCY_GRAPH_HPP
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+/**
+ * 依存グラフ
+ * 「あるオブジェクトが別のオブジェクトの属性を読む」という関係を
+ * Union-Findで管理し、互いに独立なオブジェクトの集まり（グループ）に
+ * 分ける。同じグループのオブジェクトは同じスレッドで順に処理し、
+ * 異なるグループは並列に処理してよい。
+ */
+class DependencyGraph {
+private:
+  std::vector<uint32_t> parent;
+  std::vector<std::pair<uint32_t, uint32_t>> edges;
+
+  uint32_t find(uint32_t x) {
+    while (parent[x] != x) {
+      parent[x] = parent[parent[x]]; // 経路圧縮（半分）
+      x = parent[x];
+    }
+    return x;
+  }
+
+  void unite(uint32_t a, uint32_t b) {
+    a = find(a);
+    b = find(b);
+    if (a != b) {
+      // 小さい番号を代表にして、グループの順序をスロット順に揃える
+      if (a < b) {
+        parent[b] = a;
+      } else {
+        parent[a] = b;
+      }
+    }
+  }
+
+public:
+  // 依存関係の追加（reader が source を読む）
+  void addEdge(uint32_t reader, uint32_t source) {
+    edges.emplace_back(reader, source);
+  }
+
+  // 依存関係の削除（reader が持つものすべて）
+  void removeEdgesFrom(uint32_t reader) {
+    size_t out = 0;
+    for (size_t i = 0; i < edges.size(); i++) {
+      if (edges[i].first != reader) {
+        edges[out++] = edges[i];
+      }
+    }
+    edges.resize(out);
+  }
+
+  void clear() { edges.clear(); }
+
+  size_t edgeCount() const { return edges.size(); }
+
+  // nodes をグループに分ける（各グループ内はnodesの順序を保つ）
+  // グループは最初に現れるノードの順に並ぶ
+  void partition(const std::vector<uint32_t> &nodes, uint32_t nodeCount,
+                 std::vector<std::vector<uint32_t>> &groups) {
+    parent.resize(nodeCount);
+    for (uint32_t i = 0; i < nodeCount; i++) {
+      parent[i] = i;
+    }
+    for (const auto &edge : edges) {
+      if (edge.first < nodeCount && edge.second < nodeCount) {
+        unite(edge.first, edge.second);
+      }
+    }
+
+    groups.clear();
+    std::unordered_map<uint32_t, size_t> groupOf;
+    for (uint32_t node : nodes) {
+      uint32_t root = find(node);
+      auto it = groupOf.find(root);
+      if (it == groupOf.end()) {
+        it = groupOf.emplace(root, groups.size()).first;
+        groups.emplace_back();
+      }
+      groups[it->second].push_back(node);
+    }
+  }
+};
+
+#endif // REELIA_DEPENDENCY_GRAPH_HPP
@@ -2,22 +2,304 @@
 #define REELIA_ENVIRONMENT_HPP
 
 #include "base_object.hpp"
+#include "counter_rng.hpp"
+#include "dependency_graph.hpp"
+#include "expression.hpp"
+#include "metrics.hpp"
+#include "midi_manager.hpp"
+#include "mpsc_queue.hpp"
+#include "note_scheduler.hpp"
+#include "thread_pool.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
 #include <functional>
 #include <iostream>
-#include <map>
 #include <memory>
+#include <mutex>
+#include <queue>
 #include <stdexcept>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
+// 変数スロット番号（名前を一度だけ整数に変換したもの）
+using SlotId = uint32_t;
+constexpr SlotId INVALID_SLOT = 0xFFFFFFFFu;
+
+/**
+ * オブジェクトハンドル
+ * スロット番号と世代の組。変数が再代入されると世代が変わるため、
+ * 古いハンドルからは新しいオブジェクトに触れない。
+ */
+struct ObjectHandle {
+  SlotId slot;
+  uint32_t generation;
+
+  ObjectHandle() : slot(INVALID_SLOT), generation(0) {}
+  ObjectHandle(SlotId s, uint32_t g) : slot(s), generation(g) {}
+
+  bool isValid() const { return slot != INVALID_SLOT; }
+};
+
+/**
+ * コマンドの実行タイミング
+ * NOW は次のティックの頭、BEAT/BAR は次の拍・小節の頭で実行する
+ */
+enum class Quantize : uint8_t { NOW, BEAT, BAR };
+
+/**
+ * 外部からの制御コマンド（OSCなど）
+ * スクリプトを介さずに属性の設定・メソッドの呼び出しを送る。値だけを持つので
+ * 作るときも送るときも確保しない（スロット・属性・メソッドは送る側で解決済み）。
+ */
+struct ControlCommand {
+  enum Kind : uint8_t { SET_ATTR, CALL };
+  static constexpr size_t MAX_ARGS = 4;
+
+  Kind kind;
+  uint8_t argc;     // args のうち有効な数（SET_ATTR は args[0] を使う）
+  MethodId method;  // CALL のメソッド
+  SlotId slot;      // 対象の変数
+  AttrKey attr;     // SET_ATTR の属性
+  Value args[MAX_ARGS];
+
+  ControlCommand() : kind(SET_ATTR), argc(0), method(INVALID_METHOD), slot(INVALID_SLOT) {}
+};
+
 /**
  * 環境クラス
  * 変数テーブルと実行コンテキストを管理
  */
 class Environment {
 private:
-  // 変数テーブル: 名前からオブジェクトへのマッピング
-  std::map<std::string, BaseObject *> variables;
+  // 種類ごとの状態プール（ビューのオブジェクトより後に破棄されるよう先に宣言）
+  CounterPool counterPool;
+  SequencePool sequencePool;
+
+  // 変数スロット（連続した配列。最初に代入されたときに伸ばす）
+  struct Slot {
+    ObjectPtr object;
+    uint32_t generation;
+    uint32_t version; // 状態が変わるたびに増やす（属性の束縛が変化を見るのに使う）
+
+    // 速さが1/1でないオブジェクトの予定（予定表に入っている間だけ使う）
+    bool scheduled;
+    uint32_t ticket; // 予定を作り直すたびに増やし、予定表に残った古い予定を捨てる
+    TickRate rate;   // 予定を作ったときの速さ
+    uint64_t count;  // 次に行うオブジェクトのティックの番号
+  };
+  std::vector<Slot> slots;
+
+  // 名前からスロット番号への変換表
+  // 入力スレッドがティックと並行してコンパイルできるよう、ロックで守り、
+  // スロットの配列とは別に持つ（名前はdequeなので参照が無効にならない）
+  mutable std::mutex symbolMutex;
+  std::unordered_map<std::string, SlotId> slotIndex;
+  std::deque<std::string> slotNames;
+
+  // アクティブセット: 毎ティックonTickを呼ぶスロット（スロット順）
+  // 開始・停止などで状態が変わったときだけ出し入れし、止まっている
+  // オブジェクトはティックの手間がかからない
+  std::vector<SlotId> tickSlots;
+  bool tickSlotsDirty; // グループ分けの作り直しが必要か
+
+  // onTickの後にアクティブでなくなったスロット（ティックの最後に外す）
+  std::vector<SlotId> idleSlots;
+
+  /**
+   * 速さが1/1でないオブジェクトの予定表
+   * オブジェクトの n 回目のティックは曲の位置 floor(n * div / mul) に行う
+   * （曲の頭に揃うので、同じ速さのオブジェクトはいつ開始しても拍が揃う）。
+   * 次に呼ぶ位置の小さい順に取り出し、呼んだら次の位置で入れ直す。
+   */
+  struct RatedTick {
+    uint64_t due; // 呼ぶ曲の位置
+    SlotId slot;
+    uint32_t ticket;
+
+    bool operator>(const RatedTick &other) const {
+      return due != other.due ? due > other.due : slot > other.slot;
+    }
+  };
+  std::priority_queue<RatedTick, std::vector<RatedTick>,
+                      std::greater<RatedTick>>
+      ratedTicks;
+
+  // このティックのオブジェクトの処理が済んだか（次に予定を入れる位置の判定用）
+  bool objectsTicked;
+
+  // オブジェクト間の依存関係と、それで分けた互いに独立なグループ
+  DependencyGraph dependencies;
+  std::vector<std::vector<SlotId>> tickGroups;
+
+  /**
+   * 属性の束縛: $target.member <- expr
+   * 式が読む変数（参照元）の版を覚えておき、参照元が変わったティック
+   * （版が進んだか、動いているオブジェクト）だけ式を評価する。値が前と
+   * 同じなら設定しないので、CCの送信は値が変わったときだけになる。
+   * 束縛は参照元の束縛が先になる順に並べ、1ティックで連鎖が伝わる。
+   */
+  struct Binding {
+    SlotId target;
+    AttrKey attr;
+    std::string member;     // 属性名（表示用）
+    std::string definition; // 式の表記（表示用）
+    Expression expr;
+    bool timeVarying;       // T や RND() を読む（毎ティック評価する）
+    bool applied;           // 一度でも設定したか
+    Value last;             // 最後に設定した値
+    uint32_t targetGeneration;  // 最後に設定したときの代入先の世代
+    std::vector<uint32_t> seen; // 最後に評価したときの参照元の版（expr.getSlots() の順）
+  };
+  std::vector<Binding> bindings;
+
+  uint32_t versionOf(SlotId slot) const {
+    return slot < slots.size() ? slots[slot].version : 0;
+  }
+
+  // 参照元が最後の評価から変わったか
+  bool bindingDirty(const Binding &b) const {
+    if (!b.applied || b.timeVarying ||
+        slots[b.target].generation != b.targetGeneration) {
+      return true;
+    }
+    const std::vector<uint32_t> &sources = b.expr.getSlots();
+    for (size_t i = 0; i < sources.size(); i++) {
+      BaseObject *source = getVariable(sources[i]);
+      if (versionOf(sources[i]) != b.seen[i] || (source && source->isRunning())) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // 束縛を評価し、値が変わっていれば設定する（変わったらtrue。設定できなければ例外）
+  bool applyBinding(Binding &b) {
+    BaseObject *obj = getVariable(b.target);
+    const std::vector<uint32_t> &sources = b.expr.getSlots();
+    for (size_t i = 0; i < sources.size(); i++) {
+      b.seen[i] = versionOf(sources[i]);
+    }
+    // 式の RND() は束縛ごとに別の系列
+    uint64_t stream = static_cast<uint64_t>(b.target) << 32 |
+                      static_cast<uint64_t>(b.attr.id) << 16 |
+                      static_cast<uint16_t>(b.attr.index);
+    Value value = Value::integer(b.expr.evaluate(*this, stream));
+    if (b.applied && value == b.last &&
+        slots[b.target].generation == b.targetGeneration) {
+      return false;
+    }
+    obj->setAttr(b.attr, value);
+    b.applied = true;
+    b.last = value;
+    b.targetGeneration = slots[b.target].generation;
+    updateSchedule(b.target);
+    return true;
+  }
+
+  // slot の束縛が（束縛の連鎖をたどって）source を読むか
+  bool bindingReads(SlotId slot, SlotId source, size_t depth = 0) const {
+    if (depth > bindings.size()) {
+      return false;
+    }
+    for (const Binding &b : bindings) {
+      if (b.target != slot) {
+        continue;
+      }
+      for (SlotId s : b.expr.getSlots()) {
+        if (s == source || bindingReads(s, source, depth + 1)) {
+          return true;
+        }
+      }
+    }
+    return false;
+  }
+
+  // 参照元の束縛が先になるよう並べ直す（束縛は循環しない）
+  // 束縛 i が束縛 j の代入先を読むなら j から i への辺とし、入ってくる辺が
+  // なくなった束縛から順に並べる（Kahn法。束縛と辺の数にほぼ比例する）
+  void sortBindings() {
+    size_t n = bindings.size();
+    // 代入先のスロット順に並べた束縛の添字（スロットを書く束縛を二分探索で引く）
+    std::vector<std::pair<SlotId, size_t>> writers(n);
+    for (size_t i = 0; i < n; i++) {
+      writers[i] = std::make_pair(bindings[i].target, i);
+    }
+    std::sort(writers.begin(), writers.end());
+
+    std::vector<std::vector<size_t>> readers(n); // 束縛の代入先を読む束縛
+    std::vector<size_t> waiting(n, 0);           // まだ並べていない参照元の束縛の数
+    for (size_t i = 0; i < n; i++) {
+      for (SlotId source : bindings[i].expr.getSlots()) {
+        auto it = std::lower_bound(writers.begin(), writers.end(),
+                                   std::make_pair(source, static_cast<size_t>(0)));
+        for (; it != writers.end() && it->first == source; ++it) {
+          if (it->second != i) {
+            readers[it->second].push_back(i);
+            waiting[i]++;
+          }
+        }
+      }
+    }
+
+    std::vector<size_t> order;
+    order.reserve(n);
+    for (size_t i = 0; i < n; i++) {
+      if (waiting[i] == 0) {
+        order.push_back(i);
+      }
+    }
+    for (size_t k = 0; k < order.size(); k++) {
+      for (size_t reader : readers[order[k]]) {
+        if (--waiting[reader] == 0) {
+          order.push_back(reader);
+        }
+      }
+    }
+
+    std::vector<Binding> sorted;
+    sorted.reserve(n);
+    for (size_t i : order) {
+      sorted.push_back(std::move(bindings[i]));
+    }
+    bindings = std::move(sorted);
+  }
+
+  // 並列ティック用のスレッドプール（nullptrなら逐次実行）
+  std::unique_ptr<WorkStealingPool> tickPool;
+
+  // onTickの数がこれ未満なら並列化の手間の方が大きいので逐次実行する
+  static constexpr size_t PARALLEL_MIN_OBJECTS = 64;
+
+  /**
+   * 並列ティック中の出力
+   * ワーカースレッドからはMIDIManagerやタイマーホイールに直接触れず、
+   * グループごとのバッファに溜めてからスロット順に並べ直して送る。
+   * これで出力順は逐次実行のときと同じになる。
+   */
+  struct TickEmission {
+    enum Kind : uint8_t { NOTE_ON, NOTE_OFF, CC, SCHEDULE_NOTE_OFF };
+    SlotId slot;
+    Kind kind;
+    uint8_t port;
+    uint8_t channel;
+    uint8_t data1;
+    uint8_t data2;
+    int ticks; // SCHEDULE_NOTE_OFFの長さ
+    int gate;  // SCHEDULE_NOTE_OFFのゲート
+  };
+  struct TickOutput {
+    SlotId slot; // 処理中のスロット
+    std::vector<TickEmission> emissions;
+    std::vector<SlotId> idle; // onTickの後にアクティブでなくなったスロット
+  };
+  std::vector<TickOutput> tickOutputs;
+  std::vector<TickEmission> mergedEmissions;
+
+  // このスレッドが処理中のグループの出力先（並列ティック中以外はnullptr）
+  static inline thread_local TickOutput *currentOutput = nullptr;
 
   // ティックごとのイベントコールバック
   std::vector<std::function<void(Environment &)>> tickHandlers;
@@ -25,42 +307,534 @@ private:
   // パイプラインに登録されたイベントキュー
   std::vector<std::function<void(Environment &)>> eventQueue;
 
-  // 現在のティックカウンター
-  int tickCounter;
+  // 他のスレッドから届くコマンド（ティックの頭で取り出す）
+  // action が空なら control を実行する
+  struct Command {
+    std::function<void(Environment &)> action;
+    Quantize quantize;
+    ControlCommand control;
+  };
+  static constexpr size_t COMMAND_QUEUE_CAPACITY = 1024;
+  MPSCQueue<Command, COMMAND_QUEUE_CAPACITY> commands;
+
+  // 拍・小節の頭まで待っているイベント（実行するティックの順に並ぶ）
+  struct DeferredEvent {
+    uint64_t due; // 実行する通算ティック（0始まり）
+    std::function<void(Environment &)> action;
+  };
+  std::vector<DeferredEvent> deferred;
+
+  // 1拍・1小節のティック数
+  int beatTicks;
+  int barTicks;
+
+  // 曲の位置: 開始からの通算ティック数（周回しない。ノートオフや予定表も
+  // これを基準にする）
+  uint64_t songPosition;
+
+  // 現在のティックの予定時刻と周期（秒、MIDIManager::now()基準。0なら即時送信）
+  double tickTime;
+  double tickPeriod;
+
+  // ノートオフのタイマーホイール
+  NoteOffWheel noteOffs;
+
+  // ホイールに予約したノートオフのハンドルを書き足す先（nullptrなら記録しない）
+  std::vector<NoteOffWheel::Handle> *noteOffJournal;
+
+  // 最後にコマンドかイベントを実行したティックの曲の位置
+  uint64_t lastEdit;
+
+  // MIDIを一切送らない（再読み込みの下書きの環境など）
+  bool muted;
+
+  // 文の式を評価した回数（文ごとに RND() の系列を変える）
+  uint64_t statementDraws;
+
+  // ティック中に起きたことの知らせ（外した束縛など）。ティックのスレッドは
+  // 端末に書かずにためるだけにし、入力スレッドが reportNotices で表示する
+  // 誰も表示しない間（--host でコマンドが来ないときなど）は MAX_NOTICES までにして残りは数えるだけ
+  static constexpr size_t MAX_NOTICES = 256;
+  std::vector<std::string> notices;
+  size_t droppedNotices;
+  std::atomic<bool> noticesPending;
+
+  // オブジェクトの port（論理ポート）から MIDIManager の出力ポートへの対応
+  // （複数のセッションで出力ポートを分け合うときに使う。既定はそのまま）
+  uint8_t portMap[MIDIManager::MAX_PORTS];
+
+  // サブティック位置に対応する送信時刻
+  double subTickTime(int subTick) const {
+    if (tickTime <= 0.0) {
+      return 0.0;
+    }
+    return tickTime + tickPeriod * subTick / NoteOffWheel::SUBTICKS;
+  }
+
+  // 速さが1/1でないオブジェクトの予定表を今の曲の位置から作り直す
+  void rebuildRatedTicks() {
+    ratedTicks = decltype(ratedTicks)();
+    for (SlotId slot = 0; slot < slots.size(); slot++) {
+      slots[slot].scheduled = false;
+      updateSchedule(slot);
+    }
+  }
+
+  // アクティブセットのグループ分けを作り直す
+  void rebuildTickGroups() {
+    dependencies.partition(tickSlots, static_cast<uint32_t>(slots.size()),
+                           tickGroups);
+    tickSlotsDirty = false;
+  }
+
+  // 予定表の先頭から、このティックに呼ぶオブジェクトを呼ぶ
+  // 1ティックに複数回呼ぶ（mul > div）ときは、ティックの中の位置の時刻で送る
+  void tickRated() {
+    double baseTime = tickTime;
+    while (!ratedTicks.empty() && ratedTicks.top().due <= songPosition) {
+      RatedTick next = ratedTicks.top();
+      ratedTicks.pop();
+      Slot &s = slots[next.slot];
+      if (!s.scheduled || s.ticket != next.ticket) {
+        continue; // 作り直した・外した予定
+      }
+      BaseObject *obj = s.object.get();
+      uint64_t mul = s.rate.mul;
+      uint64_t div = s.rate.div;
+      while (s.count * div / mul <= songPosition) {
+        if (baseTime > 0.0) {
+          uint64_t phase = s.count * div % mul;
+          tickTime = baseTime + tickPeriod * static_cast<double>(phase) / mul;
+        }
+        obj->onTick(*this);
+        s.count++;
+      }
+      tickTime = baseTime;
+      if (obj->needsTick()) {
+        ratedTicks.push({s.count * div / mul, next.slot, s.ticket});
+      } else {
+        s.scheduled = false;
+      }
+    }
+  }
+
+  // 並列ティック中ならバッファに溜める
+  bool bufferEmission(TickEmission::Kind kind, int port, int channel,
+                      int data1, int data2, int ticks = 0, int gate = 0) {
+    if (!currentOutput) {
+      return false;
+    }
+    currentOutput->emissions.push_back(
+        {currentOutput->slot, kind, static_cast<uint8_t>(port),
+         static_cast<uint8_t>(channel),
+         static_cast<uint8_t>(data1), static_cast<uint8_t>(data2), ticks,
+         gate});
+    return true;
+  }
+
+  // tick 以降で最初の拍・小節の頭（NOWならtickそのもの）
+  uint64_t boundary(uint64_t tick, Quantize quantize) const {
+    uint64_t unit = quantize == Quantize::BAR    ? barTicks
+                    : quantize == Quantize::BEAT ? beatTicks
+                                                 : 1;
+    return (tick + unit - 1) / unit * unit;
+  }
+
+  // イベントを実行するティックの順に挿入（同じティックなら届いた順）
+  void defer(uint64_t due, std::function<void(Environment &)> action) {
+    auto it = std::upper_bound(
+        deferred.begin(), deferred.end(), due,
+        [](uint64_t d, const DeferredEvent &e) { return d < e.due; });
+    deferred.insert(it, DeferredEvent{due, std::move(action)});
+  }
+
+  // コマンドを取り出し、tick（0始まりの通算ティック）までに実行すべきものを実行
+  void processCommands(uint64_t tick) {
+    Command command;
+    while (commands.tryPop(command)) {
+      uint64_t due = boundary(tick, command.quantize);
+      if (due <= tick) {
+        lastEdit = songPosition;
+        if (command.action) {
+          command.action(*this);
+        } else {
+          applyControl(command.control);
+        }
+      } else if (command.action) {
+        defer(due, std::move(command.action));
+      } else {
+        ControlCommand control = command.control;
+        defer(due, [control](Environment &env) { env.applyControl(control); });
+      }
+    }
+
+    size_t done = 0;
+    while (done < deferred.size() && deferred[done].due <= tick) {
+      // 実行中のイベントが新しいイベントを追加してもよいよう取り出してから呼ぶ
+      auto action = std::move(deferred[done].action);
+      done++;
+      lastEdit = songPosition;
+      action(*this);
+    }
+    deferred.erase(deferred.begin(), deferred.begin() + done);
+  }
+
+  // 独立したグループを並列にティックし、出力をスロット順に送る
+  void tickParallel() {
+    tickOutputs.resize(tickGroups.size());
+    tickPool->run(tickGroups.size(), [this](size_t group) {
+      TickOutput &out = tickOutputs[group];
+      out.emissions.clear();
+      out.idle.clear();
+      currentOutput = &out;
+      for (SlotId slot : tickGroups[group]) {
+        if (BaseObject *obj = slots[slot].object.get()) {
+          out.slot = slot;
+          obj->onTick(*this);
+          if (!obj->needsTick()) {
+            out.idle.push_back(slot);
+          }
+        }
+      }
+      currentOutput = nullptr;
+    });
+    for (const TickOutput &out : tickOutputs) {
+      idleSlots.insert(idleSlots.end(), out.idle.begin(), out.idle.end());
+    }
+
+    // 同じスロットの出力は同じバッファにあるので、安定ソートで順序を保てる
+    mergedEmissions.clear();
+    for (const TickOutput &out : tickOutputs) {
+      mergedEmissions.insert(mergedEmissions.end(), out.emissions.begin(),
+                             out.emissions.end());
+    }
+    std::stable_sort(mergedEmissions.begin(), mergedEmissions.end(),
+                     [](const TickEmission &a, const TickEmission &b) {
+                       return a.slot < b.slot;
+                     });
+
+    for (const TickEmission &e : mergedEmissions) {
+      switch (e.kind) {
+      case TickEmission::NOTE_ON:
+        sendNoteOn(e.channel, e.data1, e.data2, e.port);
+        break;
+      case TickEmission::NOTE_OFF:
+        sendNoteOff(e.channel, e.data1, e.port);
+        break;
+      case TickEmission::CC:
+        sendCC(e.channel, e.data1, e.data2, e.port);
+        break;
+      case TickEmission::SCHEDULE_NOTE_OFF:
+        scheduleNoteOff(e.ticks, e.gate, e.channel, e.data1, e.port);
+        break;
+      }
+    }
+  }
 
 public:
-  Environment() : tickCounter(0) {}
+  Environment()
+      : tickSlotsDirty(false), objectsTicked(true), beatTicks(24),
+        barTicks(96), songPosition(0),
+        tickTime(0.0),
+        tickPeriod(0.0), noteOffJournal(nullptr), lastEdit(0), muted(false), statementDraws(0),
+        droppedNotices(0), noticesPending(false) {
+    for (int port = 0; port < MIDIManager::MAX_PORTS; port++) {
+      portMap[port] = static_cast<uint8_t>(port);
+    }
+  }
 
   ~Environment() {
-    // メモリリークを防ぐため全変数を解放
-    for (auto &pair : variables) {
-      delete pair.second;
+    // 鳴っているノートを残さないよう、未発火のノートオフをすべて送信
+    noteOffs.flush([this](int port, int channel, int note, int /* subTick */) {
+      getMIDIManager().sendNoteOff(channel, note, 0.0, outputPort(port));
+    });
+
+    // 全変数を解放（状態プールより先に破棄する）
+    slots.clear();
+  }
+
+  // 名前をスロット番号に変換（未登録なら空のスロットを作る）
+  // どのスレッドからでも呼べる（スロットの配列には触れない）
+  SlotId intern(const std::string &name) {
+    std::lock_guard<std::mutex> lock(symbolMutex);
+    auto it = slotIndex.find(name);
+    if (it != slotIndex.end()) {
+      return it->second;
     }
-    variables.clear();
+    SlotId id = static_cast<SlotId>(slotNames.size());
+    slotNames.push_back(name);
+    slotIndex.emplace(name, id);
+    return id;
+  }
+
+  // 名前からスロット番号を検索（未登録ならINVALID_SLOT）
+  SlotId findSlot(const std::string &name) const {
+    std::lock_guard<std::mutex> lock(symbolMutex);
+    auto it = slotIndex.find(name);
+    return it != slotIndex.end() ? it->second : INVALID_SLOT;
   }
 
+  // スロットの変数名
+  const std::string &getName(SlotId slot) const {
+    std::lock_guard<std::mutex> lock(symbolMutex);
+    return slotNames[slot];
+  }
+
+  // スロット数
+  size_t slotCount() const { return slots.size(); }
+
+  // スロットの版（状態が変わるたびに進む。先読みが変わっていない変数を見分けるのに使う）
+  uint32_t slotVersion(SlotId slot) const { return versionOf(slot); }
+
   // 変数の設定（所有権を移動）
-  void setVariable(const std::string &name, BaseObject *value) {
-    // 既存の変数があれば削除
-    auto it = variables.find(name);
-    if (it != variables.end()) {
-      delete it->second;
+  void setVariable(SlotId slot, ObjectPtr value) {
+    // 既存の変数があれば削除し、古いハンドルを無効にする
+    // （解放したブロックはアリーナが次のオブジェクトに再利用する）
+    if (slot >= slots.size()) {
+      slots.resize(slot + 1);
+    }
+    Slot &s = slots[slot];
+    s.object = std::move(value);
+    s.generation++;
+    s.version++;
+
+    // 前のオブジェクトの依存関係は捨て、状態をプールへ移せるオブジェクトは
+    // ここでビューになる
+    dependencies.removeEdgesFrom(slot);
+    if (s.object) {
+      s.object->attach(*this, slot);
+    }
+    tickSlotsDirty = true;
+    updateSchedule(slot);
+  }
+
+  void setVariable(const std::string &name, ObjectPtr value) {
+    setVariable(intern(name), std::move(value));
+  }
+
+  // 変数の状態をチェックポイントに戻す（先読みのやり直し用）
+  // オブジェクトはそのままで状態だけを写すので、世代もハンドルも依存関係も変わらない
+  void restoreVariable(SlotId slot, const BaseObject &state) {
+    BaseObject *obj = getVariable(slot);
+    if (!obj || &obj->getObjectType() != &state.getObjectType()) {
+      return;
     }
-    variables[name] = value;
+    obj->copyState(state);
+    updateSchedule(slot);
   }
 
+  // オブジェクトの状態が変わった後に呼ぶ（開始・停止、速さの変更など）
+  // needsTick() と速さを見て、アクティブセットと予定表に出し入れする
+  // メソッド呼び出しと属性設定の後にはパーサーが呼ぶ
+  void updateSchedule(SlotId slot) {
+    if (slot >= slots.size()) {
+      return;
+    }
+    Slot &s = slots[slot];
+    s.version++;
+    BaseObject *obj = s.object.get();
+    bool active = obj && obj->needsTick();
+    bool rated = active && !obj->getRate().isUnit();
+
+    // 毎ティック呼ぶもの（スロット順を保つ）
+    auto it = std::lower_bound(tickSlots.begin(), tickSlots.end(), slot);
+    bool member = it != tickSlots.end() && *it == slot;
+    if (active && !rated && !member) {
+      tickSlots.insert(it, slot);
+      tickSlotsDirty = true;
+    } else if ((!active || rated) && member) {
+      tickSlots.erase(it);
+      tickSlotsDirty = true;
+    }
+
+    // 速さが変わらず予定表に入っていればそのまま（拍の位置は変わらない）
+    if (rated && s.scheduled && s.rate == obj->getRate()) {
+      return;
+    }
+    s.ticket++;
+    s.scheduled = rated;
+    if (rated) {
+      // このティックのオブジェクトの処理が済んでいれば次のティックから
+      uint64_t from = objectsTicked ? songPosition + 1 : songPosition;
+      s.rate = obj->getRate();
+      uint64_t mul = s.rate.mul;
+      uint64_t div = s.rate.div;
+      s.count = (from * mul + div - 1) / div;
+      ratedTicks.push({s.count * div / mul, slot, s.ticket});
+    }
+  }
+
+  // 並列ティックのスレッド数（1以下なら逐次実行）
+  void setTickThreads(size_t threads) {
+    if (threads <= 1) {
+      tickPool.reset();
+    } else if (!tickPool || tickPool->size() != threads) {
+      tickPool.reset(new WorkStealingPool(threads));
+    }
+  }
+
+  size_t getTickThreads() const { return tickPool ? tickPool->size() : 1; }
+
+  // 依存関係の登録（reader のティックが source の状態を読む）
+  // 依存し合うオブジェクトは同じスレッドで順に処理される
+  void addDependency(SlotId reader, SlotId source) {
+    dependencies.addEdge(reader, source);
+    tickSlotsDirty = true;
+  }
+
+  // reader が持つ依存関係をすべて削除
+  void removeDependencies(SlotId reader) {
+    dependencies.removeEdgesFrom(reader);
+    tickSlotsDirty = true;
+  }
+
+  // 属性の束縛（同じ属性の束縛は置き換え、すぐに一度設定する）
+  // 自分自身を読む・循環する束縛や、設定できない属性ならエラーを知らせてfalse
+  // （コマンドとしてティックのスレッドで実行されるので notify で知らせる）
+  bool bind(SlotId target, const AttrKey &attr, const std::string &member,
+            const Expression &expr, const std::string &definition) {
+    if (!getVariable(target)) {
+      notify("Error: Object $" + getName(target) + " not found");
+      return false;
+    }
+    for (SlotId source : expr.getSlots()) {
+      if (source == target || bindingReads(source, target)) {
+        notify("Error: Binding $" + getName(target) + "." + member +
+               " would depend on itself through $" + getName(source));
+        return false;
+      }
+    }
+
+    Binding b;
+    b.target = target;
+    b.attr = attr;
+    b.member = member;
+    b.definition = definition;
+    b.expr = expr;
+    b.timeVarying = expr.isTimeVarying();
+    b.applied = false;
+    b.targetGeneration = 0;
+    b.seen.assign(expr.getSlots().size(), 0);
+    try {
+      applyBinding(b);
+    } catch (const std::exception &e) {
+      notify("Error: Binding $" + getName(target) + "." + member + ": " + e.what());
+      return false;
+    }
+
+    unbind(target, attr);
+    bindings.push_back(std::move(b));
+    sortBindings();
+    return true;
+  }
+
+  // 属性の束縛の解除（束縛があればtrue）
+  bool unbind(SlotId target, const AttrKey &attr) {
+    for (size_t i = 0; i < bindings.size(); i++) {
+      if (bindings[i].target == target && bindings[i].attr == attr) {
+        bindings.erase(bindings.begin() + static_cast<std::ptrdiff_t>(i));
+        return true;
+      }
+    }
+    return false;
+  }
+
+  size_t bindingCount() const { return bindings.size(); }
+
+  // 知らせをためる（ティックのスレッドから。環境を排他にして呼ぶ）
+  void notify(const std::string &message) {
+    if (notices.size() < MAX_NOTICES) {
+      notices.push_back(message);
+    } else {
+      droppedNotices++;
+    }
+    noticesPending.store(true, std::memory_order_release);
+  }
+
+  // ためた知らせがあるか（ロックなしでどのスレッドからでも呼べる）
+  bool hasNotices() const {
+    return noticesPending.load(std::memory_order_acquire);
+  }
+
+  // ためた知らせを out に移す（環境を排他にして呼ぶ）
+  void takeNotices(std::vector<std::string> &out) {
+    out.insert(out.end(), notices.begin(), notices.end());
+    if (droppedNotices > 0) {
+      out.push_back("[" + std::to_string(droppedNotices) + " notices dropped]");
+      droppedNotices = 0;
+    }
+    notices.clear();
+    noticesPending.store(false, std::memory_order_release);
+  }
+
+  // ためた知らせを1行ずつ書き出して消す（環境を排他にして呼ぶ）
+  void reportNotices(std::ostream &out) {
+    for (const std::string &message : notices) {
+      out << message << std::endl;
+    }
+    if (droppedNotices > 0) {
+      out << "[" << droppedNotices << " notices dropped]" << std::endl;
+      droppedNotices = 0;
+    }
+    notices.clear();
+    noticesPending.store(false, std::memory_order_release);
+  }
+
+  // 参照元が変わった束縛だけを評価する（ティックごとに呼ばれる）
+  // 値が変わって設定した数を返す。設定できなくなった束縛は外す
+  size_t updateBindings() {
+    size_t changed = 0;
+    for (size_t i = 0; i < bindings.size();) {
+      Binding &b = bindings[i];
+      if (!getVariable(b.target) || !bindingDirty(b)) {
+        i++;
+        continue;
+      }
+      try {
+        if (applyBinding(b)) {
+          changed++;
+        }
+        i++;
+      } catch (const std::exception &e) {
+        notify("Binding $" + getName(b.target) + "." + b.member + " removed: " + e.what());
+        bindings.erase(bindings.begin() + static_cast<std::ptrdiff_t>(i));
+      }
+    }
+    return changed;
+  }
+
+  // 種類ごとの状態プール
+  CounterPool &getCounterPool() { return counterPool; }
+  SequencePool &getSequencePool() { return sequencePool; }
+
   // 変数の取得（所有権は移動しない）
-  BaseObject *getVariable(const std::string &name) {
-    auto it = variables.find(name);
-    if (it != variables.end()) {
-      return it->second;
+  BaseObject *getVariable(SlotId slot) const {
+    return slot < slots.size() ? slots[slot].object.get() : nullptr;
+  }
+
+  BaseObject *getVariable(const ObjectHandle &handle) const {
+    if (handle.slot >= slots.size() ||
+        slots[handle.slot].generation != handle.generation) {
+      return nullptr;
+    }
+    return slots[handle.slot].object.get();
+  }
+
+  BaseObject *getVariable(const std::string &name) const {
+    return getVariable(findSlot(name));
+  }
+
+  // 現在スロットに入っているオブジェクトへのハンドル
+  ObjectHandle getHandle(SlotId slot) const {
+    if (slot >= slots.size()) {
+      return ObjectHandle();
     }
-    return nullptr;
+    return ObjectHandle(slot, slots[slot].generation);
   }
 
   // 変数が存在するかチェック
-  bool hasVariable(const std::string &name) {
-    return variables.find(name) != variables.end();
+  bool hasVariable(const std::string &name) const {
+    return getVariable(name) != nullptr;
   }
 
   // ティックハンドラの登録
@@ -73,22 +847,271 @@ public:
     eventQueue.push_back(event);
   }
 
+  // 次の小節の頭で実行するイベントの追加
+  // 同じ小節の頭に実行するイベントは、どのオブジェクトのティックよりも先に
+  // まとめて実行されるので、途中の状態で音が出ることはない
+  void queueAtBar(std::function<void(Environment &)> event) {
+    defer(boundary(songPosition, Quantize::BAR), std::move(event));
+  }
+
+  // コマンドの送信（どのスレッドからでも呼べ、ロック・待ちは一切しない）
+  // ティックの頭で取り出し、quantize に従って実行する。キューが満杯ならfalse
+  bool post(std::function<void(Environment &)> action,
+            Quantize quantize = Quantize::NOW) {
+    return commands.tryPush(Command{std::move(action), quantize, ControlCommand()});
+  }
+
+  // 制御コマンドの送信（post と同じキューを通る。関数オブジェクトを作らない）
+  bool post(const ControlCommand &control, Quantize quantize = Quantize::NOW) {
+    return commands.tryPush(Command{nullptr, quantize, control});
+  }
+
+  // 制御コマンドの実行（ティックのスレッドで呼ぶ）
+  // 変数が空・メソッドがない・引数の数が合わなければ何もしない
+  void applyControl(const ControlCommand &control) {
+    BaseObject *obj = getVariable(control.slot);
+    if (!obj) {
+      return;
+    }
+    try {
+      if (control.kind == ControlCommand::SET_ATTR) {
+        obj->setAttr(control.attr, control.args[0]);
+      } else {
+        const ObjectType::Method *method = obj->getObjectType().findMethod(control.method);
+        if (!method) {
+          return;
+        }
+        if (method->argFn) {
+          if (control.argc < method->minArgs || control.argc > method->maxArgs) {
+            return;
+          }
+          MethodArgs args(control.argc);
+          for (size_t i = 0; i < control.argc; i++) {
+            args[i].value = control.args[i];
+          }
+          method->argFn(*obj, *this, args);
+        } else if (control.argc > 0 && control.args[0].asInt() == 0) {
+          // 引数を取らないメソッドに0を送ったら呼ばない（ボタンを離したとき）
+          return;
+        } else {
+          method->fn(*obj, *this);
+        }
+        if (method->message) {
+          // ティックのスレッドでは端末に書かず、知らせとしてためる
+          notify(std::string(method->message) + " $" + getName(control.slot));
+        }
+      }
+      updateSchedule(control.slot);
+    } catch (const std::exception &e) {
+      notify("Control: $" + getName(control.slot) + ": " + e.what());
+    }
+  }
+
+  // 届いたコマンドをすぐ処理する（クロックが止まっているとき用。
+  // ティックと同じスレッドか、ティックと排他にして呼ぶこと）
+  void processCommands() { processCommands(songPosition); }
+
+  // まだ取り出していないコマンドがあるか（ティックのスレッドで呼ぶ）
+  bool hasPendingCommands() const { return commands.hasPending(); }
+
+  // 最後にコマンドかイベントを実行したティックの曲の位置
+  // （そのティックの前には巻き戻せない）
+  uint64_t getLastEdit() const { return lastEdit; }
+
+  // 拍・小節の長さ（ティック数）の設定
+  void setBeatTicks(int ticks) { beatTicks = ticks > 0 ? ticks : 1; }
+  int getBeatTicks() const { return beatTicks; }
+  void setBarTicks(int ticks) { barTicks = ticks > 0 ? ticks : 1; }
+  int getBarTicks() const { return barTicks; }
+
+  // 次の小節の頭までのティック数（今が小節の頭なら0）
+  int ticksUntilBar() const {
+    int offset = static_cast<int>(songPosition % barTicks);
+    return offset == 0 ? 0 : barTicks - offset;
+  }
+
+  // 論理ポートの出力先（ports[i] が論理ポート i の出力ポート。足りない分は
+  // 先頭から繰り返す。空なら元に戻す）。ノートが鳴っていないときに呼ぶこと
+  void setPortMap(const std::vector<int> &ports) {
+    for (int port = 0; port < MIDIManager::MAX_PORTS; port++) {
+      int target = ports.empty() ? port : ports[static_cast<size_t>(port) % ports.size()];
+      portMap[port] = static_cast<uint8_t>(std::min(MIDIManager::MAX_PORTS - 1, std::max(0, target)));
+    }
+  }
+
+  // 論理ポートの出力先
+  int outputPort(int port) const {
+    return port >= 0 && port < MIDIManager::MAX_PORTS ? portMap[port] : port;
+  }
+
+  // 次のティックの予定時刻と周期を設定（クロックスレッドから呼ばれる）
+  void setTickTiming(double time, double period) {
+    tickTime = time;
+    tickPeriod = period;
+  }
+
+  // 現在のティックの予定時刻（MIDIメッセージのタイムスタンプに使用）
+  double getTickTime() const { return tickTime; }
+
+  // MIDIを送らないようにする（ノートオフの予約もしない）
+  // 再読み込みの下書きのように、ティックのスレッド以外で実行する環境は
+  // 出力ポートのキューに積んではいけない（キューの生産者は1つだけ）
+  void setMuted(bool value) { muted = value; }
+  bool isMuted() const { return muted; }
+
+  // MIDIメッセージの送信（現在のティックの時刻で送る）
+  // 並列ティック中はバッファに溜め、ティックの最後にスロット順で送る
+  // port: MIDIManagerの出力ポート
+  void sendNoteOn(int channel, int note, int velocity, int port = 0) {
+    if (muted) {
+      return;
+    }
+    if (!bufferEmission(TickEmission::NOTE_ON, port, channel, note, velocity)) {
+      getMIDIManager().sendNoteOn(channel, note, velocity, tickTime, outputPort(port));
+    }
+  }
+
+  void sendNoteOff(int channel, int note, int port = 0) {
+    if (muted) {
+      return;
+    }
+    if (!bufferEmission(TickEmission::NOTE_OFF, port, channel, note, 0)) {
+      getMIDIManager().sendNoteOff(channel, note, tickTime, outputPort(port));
+    }
+  }
+
+  void sendCC(int channel, int controller, int value, int port = 0) {
+    if (muted) {
+      return;
+    }
+    if (!bufferEmission(TickEmission::CC, port, channel, controller, value)) {
+      getMIDIManager().sendCC(channel, controller, value, tickTime, outputPort(port));
+    }
+  }
+
+  // ノートオフの予約
+  // ticks: ノートオンからの長さ（ティック）、gate: その中で鳴らす割合（%）
+  // 同じティック内に収まる場合はタイムスタンプ付きで即座に送信する
+  // 並列ティック中は予約自体を後回しにするため INVALID_HANDLE を返す
+  NoteOffWheel::Handle scheduleNoteOff(int ticks, int gate, int channel,
+                                       int note, int port = 0) {
+    if (muted) {
+      return NoteOffWheel::INVALID_HANDLE;
+    }
+    if (bufferEmission(TickEmission::SCHEDULE_NOTE_OFF, port, channel, note,
+                       0, ticks, gate)) {
+      return NoteOffWheel::INVALID_HANDLE;
+    }
+
+    int64_t length =
+        static_cast<int64_t>(ticks) * NoteOffWheel::SUBTICKS * gate / 100;
+    if (length < 1) {
+      length = 1;
+    }
+    int64_t wholeTicks = length / NoteOffWheel::SUBTICKS;
+    int subTick = static_cast<int>(length % NoteOffWheel::SUBTICKS);
+
+    if (wholeTicks == 0 && tickTime > 0.0) {
+      getMIDIManager().sendNoteOff(channel, note, subTickTime(subTick), outputPort(port));
+      return NoteOffWheel::INVALID_HANDLE;
+    }
+    if (wholeTicks == 0) {
+      // 実時間が分からない（手動ティック）場合は次のティックで送信
+      wholeTicks = 1;
+      subTick = 0;
+    }
+
+    NoteOffWheel::Handle handle =
+        noteOffs.schedule(songPosition + wholeTicks, subTick, channel, note,
+                          port);
+    if (handle == NoteOffWheel::INVALID_HANDLE) {
+      // ホイールが満杯ならボイススティールとして即座にノートオフ
+      getMIDIManager().sendNoteOff(channel, note, subTickTime(0), outputPort(port));
+    } else if (noteOffJournal) {
+      noteOffJournal->push_back(handle);
+    }
+    return handle;
+  }
+
+  // 予約したノートオフのハンドルの記録先（nullptrで記録をやめる）
+  void setNoteOffJournal(std::vector<NoteOffWheel::Handle> *journal) {
+    noteOffJournal = journal;
+  }
+
+  // ノートオフ予約の取消
+  bool cancelNoteOff(NoteOffWheel::Handle handle) {
+    return noteOffs.cancel(handle);
+  }
+
+  // ノートオフが未発火か
+  bool isNoteOffPending(NoteOffWheel::Handle handle) const {
+    return noteOffs.isPending(handle);
+  }
+
   // ティックの実行（1サイクル）
   void tick() {
-    // ティックカウンターの更新
-    tickCounter = (tickCounter + 1) % 256;
+    // 処理時間は段階ごとに計測する（tick.events はノートオフ・コマンド・イベントキューの合計）
+    Metrics &metrics = getMetrics();
+    int64_t started = Metrics::now();
+
+    // 曲の位置を進める
+    songPosition++;
+    objectsTicked = false;
+
+    // このティックで期限を迎えたノートオフを送信（ノートオンより先に出す）
+    noteOffs.advance(songPosition, [this](int port, int channel, int note,
+                                          int subTick) {
+      getMIDIManager().sendNoteOff(channel, note, subTickTime(subTick), outputPort(port));
+    });
+
+    // 届いたコマンドと、このティックを待っていたイベントを
+    // オブジェクトを進める前に実行
+    processCommands(songPosition - 1);
+    int64_t objectsStarted = Metrics::now();
 
-    // 全てのオブジェクトのonTickを呼び出し
-    for (auto &pair : variables) {
-      if (pair.second) {
-        pair.second->onTick(*this);
+    // プールに置かれたオブジェクトは種類ごとにまとめて進める
+    counterPool.tick();
+    sequencePool.tick();
+
+    // アクティブセットのonTickを呼び出し
+    bool parallel =
+        tickPool && tickSlots.size() >= PARALLEL_MIN_OBJECTS;
+    if (parallel && tickSlotsDirty) {
+      rebuildTickGroups();
+    }
+    if (parallel && tickGroups.size() > 1) {
+      tickParallel();
+    } else {
+      for (SlotId slot : tickSlots) {
+        BaseObject *obj = slots[slot].object.get();
+        obj->onTick(*this);
+        if (!obj->needsTick()) {
+          idleSlots.push_back(slot);
+        }
       }
     }
 
+    // 速さが1/1でないオブジェクトは予定表から（アクティブセットの後に逐次）
+    tickRated();
+
+    // 止まったオブジェクトをアクティブセットから外す
+    for (SlotId slot : idleSlots) {
+      updateSchedule(slot);
+    }
+    idleSlots.clear();
+    objectsTicked = true;
+
+    // 参照元が変わった属性の束縛だけを評価する
+    if (!bindings.empty()) {
+      updateBindings();
+    }
+    int64_t handlersStarted = Metrics::now();
+
     // 登録されたティックハンドラを呼び出し
     for (auto &handler : tickHandlers) {
       handler(*this);
     }
+    int64_t eventsStarted = Metrics::now();
 
     // イベントキューの処理
     auto currentEvents = std::move(eventQueue);
@@ -97,21 +1120,85 @@ public:
     for (auto &event : currentEvents) {
       event(*this);
     }
+
+    int64_t finished = Metrics::now();
+    metrics.record(Metrics::TICK_OBJECTS, handlersStarted - objectsStarted);
+    metrics.record(Metrics::TICK_HANDLERS, eventsStarted - handlersStarted);
+    metrics.record(Metrics::TICK_EVENTS,
+                   (objectsStarted - started) + (finished - eventsStarted));
+    metrics.record(Metrics::TICK_TOTAL, finished - started);
   }
 
-  // 現在のティックカウンターを取得
-  int getTickCount() const { return tickCounter; }
+  // 曲の位置（開始からの通算ティック数）
+  uint64_t getSongPosition() const { return songPosition; }
+
+  // 曲の位置を移す（シーンを読み込んで前回の位置から始めるときなど）
+  // 鳴っているノートは止め、予約した処理は今からの残りのティック数を保つ。
+  // 速さを変えたオブジェクトの予定は新しい位置から数え直す
+  void locate(uint64_t position) {
+    noteOffs.flush([this](int port, int channel, int note, int /* subTick */) {
+      getMIDIManager().sendNoteOff(channel, note, 0.0, outputPort(port));
+    });
+    for (DeferredEvent &event : deferred) {
+      event.due = event.due > songPosition ? position + (event.due - songPosition)
+                                           : position;
+    }
+    songPosition = position;
+    rebuildRatedTicks();
+  }
+
+  // 曲の位置を戻す（先読みしたティックをやり直すとき。変数は restoreVariable で
+  // 戻しておく）。locate と違い、ノートオフも予約した処理もそのままにする。
+  // 束縛は戻した状態に設定し直すよう、次のティックで全部評価する
+  void rewind(uint64_t position) {
+    songPosition = position;
+    for (Binding &b : bindings) {
+      b.applied = false;
+    }
+    rebuildRatedTicks();
+  }
+
+  // 毎ティックonTickを呼んでいるオブジェクトの数（ベンチマーク用）
+  size_t activeCount() const { return tickSlots.size(); }
+
+  // 文の式の RND() の系列（評価するたびに新しい系列）
+  // 束縛やパターングラフの系列（上位ビットが0）とは重ならない
+  uint64_t nextStatementStream() {
+    return STATEMENT_STREAM | statementDraws++;
+  }
+  static constexpr uint64_t STATEMENT_STREAM = 1ULL << 63;
+
+  // min以上max以下の乱数（式のRND()用）
+  // 系列の鍵と曲の位置だけで決まるので、どのスレッドで何度評価しても同じ値
+  int getRandom(int min, int max, uint64_t key) const {
+    if (min > max) {
+      std::swap(min, max);
+    }
+    uint64_t range = static_cast<uint64_t>(static_cast<int64_t>(max) - min) + 1;
+    uint64_t offset = counter_rng::below(counter_rng::at(key, songPosition), range);
+    return static_cast<int>(min + static_cast<int64_t>(offset));
+  }
 
   // 全変数の表示（デバッグ用）
   void dumpVariables() {
-    for (const auto &pair : variables) {
-      std::cout << "$" << pair.first << " = ";
-      if (pair.second) {
-        std::cout << pair.second->toString();
-      } else {
-        std::cout << "null";
+    // 名前順に表示
+    std::vector<SlotId> order;
+    for (SlotId i = 0; i < slots.size(); i++) {
+      if (slots[i].object) {
+        order.push_back(i);
       }
-      std::cout << std::endl;
+    }
+    std::sort(order.begin(), order.end(), [this](SlotId a, SlotId b) {
+      return getName(a) < getName(b);
+    });
+
+    for (SlotId slot : order) {
+      std::cout << "$" << getName(slot) << " = "
+                << slots[slot].object->toString() << std::endl;
+    }
+    for (const Binding &b : bindings) {
+      std::cout << "$" << getName(b.target) << "." << b.member << " <- "
+                << b.definition << std::endl;
     }
   }
 };
@@ -1,270 +1,463 @@
 #include "expression.hpp"
-#include "parser.hpp"
+#include "environment.hpp"
 #include <algorithm>
 #include <cctype>
 #include <cmath>
+#include <cstdlib>
 #include <iostream>
 
-// Check if a character is whitespace
-bool ExpressionEvaluator::isSpace(char c) {
-  return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+//------------------------------------------------------------------------------
+// Operators
+//------------------------------------------------------------------------------
+
+namespace {
+// Arithmetic is done in uint32_t so that overflow wraps instead of being UB
+int wrap(uint32_t value) {
+  return static_cast<int>(value);
+}
+} // namespace
+
+// Apply a pure operator to already evaluated operands
+int ExpressionEvaluator::apply(ExprOp op, int a, int b, int c,
+                               bool &divisionByZero) {
+  switch (op) {
+  case ExprOp::NEG:
+    return wrap(0u - static_cast<uint32_t>(a));
+  case ExprOp::BIT_NOT:
+    return ~a;
+  case ExprOp::LOG_NOT:
+    return a ? 0 : 1;
+  case ExprOp::MUL:
+    return wrap(static_cast<uint32_t>(a) * static_cast<uint32_t>(b));
+  case ExprOp::DIV:
+    if (b == 0) {
+      divisionByZero = true;
+      return 0;
+    }
+    // INT_MIN / -1 overflows (and traps on x86), so wrap like NEG
+    if (b == -1) {
+      return wrap(0u - static_cast<uint32_t>(a));
+    }
+    return a / b;
+  case ExprOp::MOD:
+    if (b == 0) {
+      divisionByZero = true;
+      return 0;
+    }
+    if (b == -1) {
+      return 0;
+    }
+    return a % b;
+  case ExprOp::ADD:
+    return wrap(static_cast<uint32_t>(a) + static_cast<uint32_t>(b));
+  case ExprOp::SUB:
+    return wrap(static_cast<uint32_t>(a) - static_cast<uint32_t>(b));
+  case ExprOp::SHL:
+    return wrap(static_cast<uint32_t>(a) << (b & 31));
+  case ExprOp::SHR:
+    return a >> (b & 31);
+  case ExprOp::LT:
+    return a < b ? 1 : 0;
+  case ExprOp::LE:
+    return a <= b ? 1 : 0;
+  case ExprOp::GT:
+    return a > b ? 1 : 0;
+  case ExprOp::GE:
+    return a >= b ? 1 : 0;
+  case ExprOp::EQ:
+    return a == b ? 1 : 0;
+  case ExprOp::NE:
+    return a != b ? 1 : 0;
+  case ExprOp::BIT_AND:
+    return a & b;
+  case ExprOp::BIT_XOR:
+    return a ^ b;
+  case ExprOp::BIT_OR:
+    return a | b;
+  case ExprOp::LOG_AND:
+    return (a && b) ? 1 : 0;
+  case ExprOp::LOG_OR:
+    return (a || b) ? 1 : 0;
+  case ExprOp::SELECT:
+    return a ? b : c;
+  case ExprOp::MIN:
+    return std::min(a, b);
+  case ExprOp::MAX:
+    return std::max(a, b);
+  case ExprOp::ABS:
+    // std::abs(INT_MIN) overflows, so negate in uint32_t like NEG
+    return a < 0 ? wrap(0u - static_cast<uint32_t>(a)) : a;
+  case ExprOp::CLAMP:
+    return std::min(std::max(a, b), c);
+  default:
+    return 0;
+  }
 }
 
-// Skip whitespace characters
-void ExpressionEvaluator::skipWhitespace(
-    std::string::const_iterator &it, const std::string::const_iterator &end) {
-  while (it != end && isSpace(*it)) {
-    ++it;
+namespace {
+// Number of stack operands consumed by an opcode
+int operandCount(ExprOp op) {
+  switch (op) {
+  case ExprOp::PUSH_CONST:
+  case ExprOp::LOAD_VAR:
+  case ExprOp::LOAD_ATTR:
+  case ExprOp::LOAD_TICK:
+    return 0;
+  case ExprOp::NEG:
+  case ExprOp::BIT_NOT:
+  case ExprOp::LOG_NOT:
+  case ExprOp::ABS:
+    return 1;
+  case ExprOp::SELECT:
+  case ExprOp::CLAMP:
+    return 3;
+  default:
+    return 2;
   }
 }
+} // namespace
 
-// Check if the current character matches the expected one
-bool ExpressionEvaluator::match(std::string::const_iterator &it,
-                                const std::string::const_iterator &end,
-                                char expected) {
-  skipWhitespace(it, end);
-  if (it != end && *it == expected) {
-    ++it;
-    return true;
+//------------------------------------------------------------------------------
+// Evaluation
+//------------------------------------------------------------------------------
+
+// Resolve variable names to slots so evaluation never looks names up
+void Expression::bind(Environment &env) {
+  slots.clear();
+  for (const std::string &name : symbols) {
+    slots.push_back(env.intern(name));
+  }
+}
+
+// Evaluate the compiled postfix program
+bool Expression::isTimeVarying() const {
+  for (const ExprInstr &ins : code) {
+    if (ins.op == ExprOp::LOAD_TICK || ins.op == ExprOp::RND) {
+      return true;
+    }
   }
   return false;
 }
 
-// Evaluate an entire expression
-int ExpressionEvaluator::evaluate(const std::string &expr) {
-  auto it = expr.begin();
-  auto end = expr.end();
+int Expression::evaluate(Environment &env, uint64_t stream) const {
+  if (shape == CONSTANT || shape == BINARY_LITERAL) {
+    return constant;
+  }
+
+  int stack[MAX_STACK];
+  int sp = 0;
 
-  // Evaluate the full expression including conditional operators
-  int result = parseConditional(it, end);
+  for (const ExprInstr &ins : code) {
+    switch (ins.op) {
+    case ExprOp::PUSH_CONST:
+      stack[sp++] = ins.operand;
+      break;
 
-  skipWhitespace(it, end);
-  if (it != end) {
-    std::cerr << "Error: Unexpected character at end of expression: " << *it
-              << std::endl;
+    case ExprOp::LOAD_VAR: {
+      BaseObject *obj = env.getVariable(slots[ins.operand]);
+      if (!obj) {
+        std::cerr << "Error: Undefined variable $" << symbols[ins.operand]
+                  << std::endl;
+      }
+      stack[sp++] = obj ? obj->getValue() : 0;
+      break;
+    }
+
+    case ExprOp::LOAD_ATTR: {
+      const AttributeRef &ref = attributes[ins.operand];
+      BaseObject *obj = env.getVariable(slots[ref.symbol]);
+      int value = 0;
+      if (obj) {
+        if (!ref.key.isKnown()) {
+          std::cerr << "Error: Unknown attribute: " << ref.member << std::endl;
+        } else {
+          try {
+            value = obj->getAttr(ref.key).asInt();
+          } catch (const std::exception &e) {
+            std::cerr << "Error: " << e.what() << std::endl;
+          }
+        }
+      } else {
+        std::cerr << "Error: Undefined variable $" << symbols[ref.symbol]
+                  << std::endl;
+      }
+      stack[sp++] = value;
+      break;
+    }
+
+    case ExprOp::LOAD_TICK:
+      // Low 31 bits of the song position (T % 2^k is unaffected by the wrap)
+      stack[sp++] = static_cast<int>(env.getSongPosition() & 0x7FFFFFFF);
+      break;
+
+    case ExprOp::RND: {
+      int b = stack[--sp];
+      int a = stack[sp - 1];
+      uint64_t site = static_cast<uint64_t>(&ins - code.data());
+      stack[sp - 1] = env.getRandom(a, b, counter_rng::key(stream, site));
+      break;
+    }
+
+    default: {
+      int count = operandCount(ins.op);
+      int a = 0, b = 0, c = 0;
+      if (count == 3) {
+        c = stack[--sp];
+        b = stack[--sp];
+      } else if (count == 2) {
+        b = stack[--sp];
+      }
+      a = stack[sp - 1];
+
+      bool divisionByZero = false;
+      stack[sp - 1] = ExpressionEvaluator::apply(ins.op, a, b, c, divisionByZero);
+      if (divisionByZero) {
+        std::cerr << "Error: Division by zero" << std::endl;
+      }
+      break;
+    }
+    }
   }
 
-  return result;
+  return sp > 0 ? stack[sp - 1] : 0;
 }
 
-// Parse function calls
-int ExpressionEvaluator::parseFunction(std::string::const_iterator &it,
-                                       const std::string::const_iterator &end) {
-  skipWhitespace(it, end);
+//------------------------------------------------------------------------------
+// Compilation
+//------------------------------------------------------------------------------
 
-  if (it == end) {
-    return 0;
+// Check if the current token is the given operator and consume it
+bool ExpressionEvaluator::matchOperator(const char *op) {
+  const Token &tok = peek();
+  if (tok.isOperator(op) ||
+      (tok.is(Token::PIPE) && op[0] == '|' && op[1] == '\0')) {
+    pos++;
+    return true;
+  }
+  return false;
+}
+
+bool ExpressionEvaluator::fail(const std::string &message) {
+  if (error.empty()) {
+    error = message;
   }
+  return false;
+}
 
-  // Save start position of function name
-  auto funcStart = it;
+int ExpressionEvaluator::makeLeaf(ExprOp op, int operand) {
+  nodes.push_back({op, operand, {-1, -1, -1}, 0});
+  return static_cast<int>(nodes.size()) - 1;
+}
 
-  // Read function name (alphabetic characters)
-  while (it != end && std::isalpha(*it)) {
-    ++it;
+// Create an operator node, folding it to a constant when all operands are
+// constants
+int ExpressionEvaluator::makeNode(ExprOp op, int a, int b, int c) {
+  if (a < 0 || (b < 0 && operandCount(op) >= 2) ||
+      (c < 0 && operandCount(op) >= 3)) {
+    return -1;
   }
 
-  // If no function name found, parse as primary expression
-  if (it == funcStart) {
-    return parsePrimary(it, end);
+  int children[3] = {a, b, c};
+  int count = operandCount(op);
+
+  bool allConstant = op != ExprOp::RND;
+  for (int i = 0; i < count && allConstant; i++) {
+    allConstant = nodes[children[i]].op == ExprOp::PUSH_CONST;
   }
 
-  // Get function name
-  std::string funcName(funcStart, it);
+  if (allConstant) {
+    bool divisionByZero = false;
+    int value = apply(op, nodes[a].operand, b >= 0 ? nodes[b].operand : 0,
+                      c >= 0 ? nodes[c].operand : 0, divisionByZero);
+    if (divisionByZero) {
+      fail(op == ExprOp::MOD ? "Modulo by zero" : "Division by zero");
+      return -1;
+    }
+    return makeLeaf(ExprOp::PUSH_CONST, value);
+  }
+
+  nodes.push_back({op, 0, {a, b, c}, count});
+  return static_cast<int>(nodes.size()) - 1;
+}
+
+// Register a referenced variable name
+int ExpressionEvaluator::internSymbol(const std::string &name) {
+  auto &symbols = out.symbols;
+  for (size_t i = 0; i < symbols.size(); i++) {
+    if (symbols[i] == name) {
+      return static_cast<int>(i);
+    }
+  }
+  symbols.push_back(name);
+  return static_cast<int>(symbols.size()) - 1;
+}
+
+// Parse function calls
+int ExpressionEvaluator::parseFunction(const std::string &name) {
+  std::string funcName = name;
   std::transform(funcName.begin(), funcName.end(), funcName.begin(),
                  [](unsigned char c) { return std::toupper(c); });
 
-  // Check for opening parenthesis
-  if (!match(it, end, '(')) {
-    // No parenthesis, revert position and parse as primary
-    it = funcStart;
-    return parsePrimary(it, end);
-  }
+  pos++; // Skip '('
 
   // Parse argument list
   std::vector<int> args;
-
-  if (!match(it, end, ')')) { // If not empty argument list
+  if (peek().is(Token::RPAREN)) {
+    pos++;
+  } else {
     while (true) {
-      args.push_back(parseConditional(it, end)); // Parse argument
+      int arg = parseConditional();
+      if (arg < 0) {
+        return -1;
+      }
+      args.push_back(arg);
 
-      if (match(it, end, ')')) {
+      if (peek().is(Token::RPAREN)) {
+        pos++;
         break; // End of argument list
       }
-
-      if (!match(it, end, ',')) {
-        std::cerr << "Error: Expected ',' or ')' in function arguments"
-                  << std::endl;
-        return 0;
+      if (!peek().is(Token::COMMA)) {
+        fail("Expected ',' or ')' in function arguments");
+        return -1;
       }
+      pos++;
     }
   }
 
-  // Identify and execute function
-  if (funcName == "MIN") {
-    if (args.size() != 2) {
-      std::cerr << "Error: MIN requires 2 arguments" << std::endl;
-      return 0;
-    }
-    return std::min(args[0], args[1]);
-  } else if (funcName == "MAX") {
-    if (args.size() != 2) {
-      std::cerr << "Error: MAX requires 2 arguments" << std::endl;
-      return 0;
-    }
-    return std::max(args[0], args[1]);
-  } else if (funcName == "ABS") {
-    if (args.size() != 1) {
-      std::cerr << "Error: ABS requires 1 argument" << std::endl;
-      return 0;
-    }
-    return std::abs(args[0]);
-  } else if (funcName == "CLAMP") {
-    if (args.size() != 3) {
-      std::cerr << "Error: CLAMP requires 3 arguments" << std::endl;
-      return 0;
-    }
-    return std::min(std::max(args[0], args[1]), args[2]);
-  } else if (funcName == "RND") {
-    if (args.size() != 2) {
-      std::cerr << "Error: RND requires 2 arguments" << std::endl;
-      return 0;
+  // Identify the function and check its arity
+  struct FunctionInfo {
+    const char *name;
+    ExprOp op;
+    size_t arity;
+  };
+  static const FunctionInfo functions[] = {
+      {"MIN", ExprOp::MIN, 2},     {"MAX", ExprOp::MAX, 2},
+      {"ABS", ExprOp::ABS, 1},     {"CLAMP", ExprOp::CLAMP, 3},
+      {"RND", ExprOp::RND, 2},
+  };
+
+  for (const auto &f : functions) {
+    if (funcName == f.name) {
+      if (args.size() != f.arity) {
+        fail(funcName + " requires " + std::to_string(f.arity) +
+             (f.arity == 1 ? " argument" : " arguments"));
+        return -1;
+      }
+      return makeNode(f.op, args[0], f.arity > 1 ? args[1] : -1,
+                      f.arity > 2 ? args[2] : -1);
     }
-    return parser.getRandom(args[0], args[1]);
   }
 
-  std::cerr << "Error: Unknown function: " << funcName << std::endl;
-  return 0;
+  fail("Unknown function: " + funcName);
+  return -1;
 }
 
 // Parse primary expressions (literal values, variables, parenthesized
 // expressions)
-int ExpressionEvaluator::parsePrimary(std::string::const_iterator &it,
-                                      const std::string::const_iterator &end) {
-  skipWhitespace(it, end);
-
-  if (it == end) {
-    std::cerr << "Error: Unexpected end of expression" << std::endl;
-    return 0;
-  }
-
-  // Check for function calls first
-  if (std::isalpha(*it) && *it != 'X' && *it != 'x' && *it != 'T' &&
-      *it != 't') {
-    return parseFunction(it, end);
-  }
-
-  // Parenthesized expression
-  if (*it == '(') {
-    ++it; // Skip '('
-    int value = parseConditional(it, end);
-    if (!match(it, end, ')')) {
-      std::cerr << "Error: Expected ')'" << std::endl;
-      return 0;
+int ExpressionEvaluator::parsePrimary() {
+  const Token &tok = peek();
+
+  switch (tok.kind) {
+  case Token::END:
+    fail("Unexpected end of expression");
+    return -1;
+
+  case Token::NUMBER:
+  case Token::BINARY:
+    pos++;
+    return makeLeaf(ExprOp::PUSH_CONST, tok.value);
+
+  case Token::LPAREN: {
+    pos++; // Skip '('
+    int value = parseConditional();
+    if (value < 0) {
+      return -1;
+    }
+    if (!peek().is(Token::RPAREN)) {
+      fail("Expected ')'");
+      return -1;
     }
+    pos++;
     return value;
   }
 
-  // Unary minus
-  if (*it == '-') {
-    ++it;
-    return -parsePrimary(it, end);
-  }
-
-  // Bitwise NOT
-  if (*it == '~') {
-    ++it;
-    return ~parsePrimary(it, end);
+  case Token::VARIABLE: {
+    pos++;
+    int symbol = internSymbol(tok.text);
+
+    // Attribute reference ($obj.attr)
+    if (peek().is(Token::DOT) && tokens[pos + 1].is(Token::IDENTIFIER)) {
+      const std::string &member = tokens[pos + 1].text;
+      out.attributes.push_back({symbol, member, resolveAttribute(member)});
+      pos += 2;
+      return makeLeaf(ExprOp::LOAD_ATTR,
+                      static_cast<int>(out.attributes.size()) - 1);
+    }
+    return makeLeaf(ExprOp::LOAD_VAR, symbol);
   }
 
-  // Variable reference ($X)
-  if (*it == '$' && (it + 1) != end && std::isalpha(*(it + 1))) {
-    char varName = std::toupper(*(it + 1));
-    it += 2; // Skip "$X"
+  case Token::IDENTIFIER: {
+    pos++;
 
-    BaseValue *value = parser.getVariable(varName);
-    if (value) {
-      return value->toInt();
-    } else {
-      std::cerr << "Error: Undefined variable $" << varName << std::endl;
-      return 0;
+    // Function call
+    if (peek().is(Token::LPAREN)) {
+      return parseFunction(tok.text);
     }
-  }
-
-  // Numeric literals
-  if (std::isdigit(*it) || *it == '#' || *it == 'X' || *it == 'x') {
-    std::string number;
 
-    // Binary pattern (#1010)
-    if (*it == '#') {
-      number += *it;
-      ++it;
-      while (it != end && (*it == '0' || *it == '1')) {
-        number += *it;
-        ++it;
-      }
-      return parser.parseLiteral(number);
+    // System variable T (tick counter)
+    if (tok.text == "T" || tok.text == "t") {
+      return makeLeaf(ExprOp::LOAD_TICK, 0);
     }
 
     // Hexadecimal (XFF or xFF)
-    if (*it == 'X' || *it == 'x') {
-      number += 'X'; // Standardize to uppercase
-      ++it;
-      while (it != end && std::isxdigit(*it)) {
-        number += std::toupper(*it);
-        ++it;
-      }
-      return parser.parseLiteral(number);
+    if (tok.text.size() > 1 && (tok.text[0] == 'X' || tok.text[0] == 'x') &&
+        std::all_of(tok.text.begin() + 1, tok.text.end(),
+                    [](unsigned char c) { return std::isxdigit(c); })) {
+      return makeLeaf(ExprOp::PUSH_CONST, static_cast<int>(std::strtoul(
+                                              tok.text.c_str() + 1, nullptr, 16)));
     }
 
-    // Decimal
-    while (it != end && std::isdigit(*it)) {
-      number += *it;
-      ++it;
-    }
-    return std::stoi(number);
+    fail("Unknown identifier: " + tok.text);
+    return -1;
   }
 
-  // System variable T (tick counter)
-  if (*it == 'T' || *it == 't') {
-    ++it;
-    return parser.getTick();
+  case Token::OPERATOR:
+    // Unary minus
+    if (tok.text == "-") {
+      pos++;
+      return makeNode(ExprOp::NEG, parsePrimary());
+    }
+    // Bitwise NOT
+    if (tok.text == "~") {
+      pos++;
+      return makeNode(ExprOp::BIT_NOT, parsePrimary());
+    }
+    // Logical NOT
+    if (tok.text == "!") {
+      pos++;
+      return makeNode(ExprOp::LOG_NOT, parsePrimary());
+    }
+    break;
+
+  default:
+    break;
   }
 
-  std::cerr << "Error: Unexpected character in expression: " << *it
-            << std::endl;
-  return 0;
+  fail("Unexpected '" + tok.text + "' in expression");
+  return -1;
 }
 
 // Parse multiplication, division, and modulo operations
-int ExpressionEvaluator::parseTerm(std::string::const_iterator &it,
-                                   const std::string::const_iterator &end) {
-  int left = parsePrimary(it, end);
-
-  while (true) {
-    skipWhitespace(it, end);
-    if (it == end)
-      break;
-
-    if (*it == '*') {
-      ++it;
-      left *= parsePrimary(it, end);
-    } else if (*it == '/') {
-      ++it;
-      int right = parsePrimary(it, end);
-      if (right == 0) {
-        std::cerr << "Error: Division by zero" << std::endl;
-        return 0;
-      }
-      left /= right;
-    } else if (*it == '%') {
-      ++it;
-      int right = parsePrimary(it, end);
-      if (right == 0) {
-        std::cerr << "Error: Modulo by zero" << std::endl;
-        return 0;
-      }
-      left %= right;
+int ExpressionEvaluator::parseTerm() {
+  int left = parsePrimary();
+
+  while (left >= 0) {
+    if (matchOperator("*")) {
+      left = makeNode(ExprOp::MUL, left, parsePrimary());
+    } else if (matchOperator("/")) {
+      left = makeNode(ExprOp::DIV, left, parsePrimary());
+    } else if (matchOperator("%")) {
+      left = makeNode(ExprOp::MOD, left, parsePrimary());
     } else {
       break;
     }
@@ -274,21 +467,14 @@ int ExpressionEvaluator::parseTerm(std::string::const_iterator &it,
 }
 
 // Parse addition and subtraction operations
-int ExpressionEvaluator::parseAdditive(std::string::const_iterator &it,
-                                       const std::string::const_iterator &end) {
-  int left = parseTerm(it, end);
-
-  while (true) {
-    skipWhitespace(it, end);
-    if (it == end)
-      break;
-
-    if (*it == '+') {
-      ++it;
-      left += parseTerm(it, end);
-    } else if (*it == '-') {
-      ++it;
-      left -= parseTerm(it, end);
+int ExpressionEvaluator::parseAdditive() {
+  int left = parseTerm();
+
+  while (left >= 0) {
+    if (matchOperator("+")) {
+      left = makeNode(ExprOp::ADD, left, parseTerm());
+    } else if (matchOperator("-")) {
+      left = makeNode(ExprOp::SUB, left, parseTerm());
     } else {
       break;
     }
@@ -298,21 +484,14 @@ int ExpressionEvaluator::parseAdditive(std::string::const_iterator &it,
 }
 
 // Parse bit shift operations
-int ExpressionEvaluator::parseShift(std::string::const_iterator &it,
-                                    const std::string::const_iterator &end) {
-  int left = parseAdditive(it, end);
-
-  while (true) {
-    skipWhitespace(it, end);
-    if (it == end || it + 1 == end)
-      break;
-
-    if (*it == '<' && *(it + 1) == '<') {
-      it += 2;
-      left <<= parseAdditive(it, end);
-    } else if (*it == '>' && *(it + 1) == '>') {
-      it += 2;
-      left >>= parseAdditive(it, end);
+int ExpressionEvaluator::parseShift() {
+  int left = parseAdditive();
+
+  while (left >= 0) {
+    if (matchOperator("<<")) {
+      left = makeNode(ExprOp::SHL, left, parseAdditive());
+    } else if (matchOperator(">>")) {
+      left = makeNode(ExprOp::SHR, left, parseAdditive());
     } else {
       break;
     }
@@ -322,31 +501,18 @@ int ExpressionEvaluator::parseShift(std::string::const_iterator &it,
 }
 
 // Parse relational operators (<, >, <=, >=)
-int ExpressionEvaluator::parseRelational(
-    std::string::const_iterator &it, const std::string::const_iterator &end) {
-  int left = parseShift(it, end);
-
-  while (true) {
-    skipWhitespace(it, end);
-    if (it == end)
-      break;
-
-    if (*it == '<') {
-      if (it + 1 != end && *(it + 1) == '=') {
-        it += 2;
-        left = (left <= parseShift(it, end)) ? 1 : 0;
-      } else {
-        ++it;
-        left = (left < parseShift(it, end)) ? 1 : 0;
-      }
-    } else if (*it == '>') {
-      if (it + 1 != end && *(it + 1) == '=') {
-        it += 2;
-        left = (left >= parseShift(it, end)) ? 1 : 0;
-      } else {
-        ++it;
-        left = (left > parseShift(it, end)) ? 1 : 0;
-      }
+int ExpressionEvaluator::parseRelational() {
+  int left = parseShift();
+
+  while (left >= 0) {
+    if (matchOperator("<=")) {
+      left = makeNode(ExprOp::LE, left, parseShift());
+    } else if (matchOperator(">=")) {
+      left = makeNode(ExprOp::GE, left, parseShift());
+    } else if (matchOperator("<")) {
+      left = makeNode(ExprOp::LT, left, parseShift());
+    } else if (matchOperator(">")) {
+      left = makeNode(ExprOp::GT, left, parseShift());
     } else {
       break;
     }
@@ -356,21 +522,14 @@ int ExpressionEvaluator::parseRelational(
 }
 
 // Parse equality operators (==, !=)
-int ExpressionEvaluator::parseEquality(std::string::const_iterator &it,
-                                       const std::string::const_iterator &end) {
-  int left = parseRelational(it, end);
-
-  while (true) {
-    skipWhitespace(it, end);
-    if (it == end || it + 1 == end)
-      break;
-
-    if (*it == '=' && *(it + 1) == '=') {
-      it += 2;
-      left = (left == parseRelational(it, end)) ? 1 : 0;
-    } else if (*it == '!' && *(it + 1) == '=') {
-      it += 2;
-      left = (left != parseRelational(it, end)) ? 1 : 0;
+int ExpressionEvaluator::parseEquality() {
+  int left = parseRelational();
+
+  while (left >= 0) {
+    if (matchOperator("==")) {
+      left = makeNode(ExprOp::EQ, left, parseRelational());
+    } else if (matchOperator("!=")) {
+      left = makeNode(ExprOp::NE, left, parseRelational());
     } else {
       break;
     }
@@ -380,131 +539,153 @@ int ExpressionEvaluator::parseEquality(std::string::const_iterator &it,
 }
 
 // Parse bitwise AND operations
-int ExpressionEvaluator::parseBitwiseAnd(
-    std::string::const_iterator &it, const std::string::const_iterator &end) {
-  int left = parseEquality(it, end);
+int ExpressionEvaluator::parseBitwiseAnd() {
+  int left = parseEquality();
 
-  while (true) {
-    skipWhitespace(it, end);
-    if (it == end)
-      break;
-
-    if (*it == '&' && (it + 1 == end || *(it + 1) != '&')) {
-      ++it;
-      left &= parseEquality(it, end);
-    } else {
-      break;
-    }
+  while (left >= 0 && matchOperator("&")) {
+    left = makeNode(ExprOp::BIT_AND, left, parseEquality());
   }
 
   return left;
 }
 
 // Parse bitwise XOR operations
-int ExpressionEvaluator::parseBitwiseXor(
-    std::string::const_iterator &it, const std::string::const_iterator &end) {
-  int left = parseBitwiseAnd(it, end);
+int ExpressionEvaluator::parseBitwiseXor() {
+  int left = parseBitwiseAnd();
 
-  while (true) {
-    skipWhitespace(it, end);
-    if (it == end)
-      break;
-
-    if (*it == '^') {
-      ++it;
-      left ^= parseBitwiseAnd(it, end);
-    } else {
-      break;
-    }
+  while (left >= 0 && matchOperator("^")) {
+    left = makeNode(ExprOp::BIT_XOR, left, parseBitwiseAnd());
   }
 
   return left;
 }
 
 // Parse bitwise OR operations
-int ExpressionEvaluator::parseBitwiseOr(
-    std::string::const_iterator &it, const std::string::const_iterator &end) {
-  int left = parseBitwiseXor(it, end);
+int ExpressionEvaluator::parseBitwiseOr() {
+  int left = parseBitwiseXor();
 
-  while (true) {
-    skipWhitespace(it, end);
-    if (it == end)
-      break;
-
-    if (*it == '|' && (it + 1 == end || *(it + 1) != '|')) {
-      ++it;
-      left |= parseBitwiseXor(it, end);
-    } else {
-      break;
-    }
+  while (left >= 0 && matchOperator("|")) {
+    left = makeNode(ExprOp::BIT_OR, left, parseBitwiseXor());
   }
 
   return left;
 }
 
 // Parse logical AND operations
-int ExpressionEvaluator::parseLogicalAnd(
-    std::string::const_iterator &it, const std::string::const_iterator &end) {
-  int left = parseBitwiseOr(it, end);
-
-  while (true) {
-    skipWhitespace(it, end);
-    if (it == end || it + 1 == end)
-      break;
+int ExpressionEvaluator::parseLogicalAnd() {
+  int left = parseBitwiseOr();
 
-    if (*it == '&' && *(it + 1) == '&') {
-      it += 2;
-      int right = parseBitwiseOr(it, end);
-      left = (left && right) ? 1 : 0;
-    } else {
-      break;
-    }
+  while (left >= 0 && matchOperator("&&")) {
+    left = makeNode(ExprOp::LOG_AND, left, parseBitwiseOr());
   }
 
   return left;
 }
 
 // Parse logical OR operations
-int ExpressionEvaluator::parseLogicalOr(
-    std::string::const_iterator &it, const std::string::const_iterator &end) {
-  int left = parseLogicalAnd(it, end);
-
-  while (true) {
-    skipWhitespace(it, end);
-    if (it == end || it + 1 == end)
-      break;
+int ExpressionEvaluator::parseLogicalOr() {
+  int left = parseLogicalAnd();
 
-    if (*it == '|' && *(it + 1) == '|') {
-      it += 2;
-      int right = parseLogicalAnd(it, end);
-      left = (left || right) ? 1 : 0;
-    } else {
-      break;
-    }
+  while (left >= 0 && matchOperator("||")) {
+    left = makeNode(ExprOp::LOG_OR, left, parseLogicalAnd());
   }
 
   return left;
 }
 
 // Parse conditional operator (cond ? expr1 : expr2)
-int ExpressionEvaluator::parseConditional(
-    std::string::const_iterator &it, const std::string::const_iterator &end) {
-  int condition = parseLogicalOr(it, end);
-
-  skipWhitespace(it, end);
-  if (it != end && *it == '?') {
-    ++it;
-    int trueValue = parseConditional(it, end);
-
-    skipWhitespace(it, end);
-    if (!match(it, end, ':')) {
-      std::cerr << "Error: Expected ':' in conditional expression" << std::endl;
-      return 0;
-    }
+int ExpressionEvaluator::parseConditional() {
+  int condition = parseLogicalOr();
 
-    int falseValue = parseConditional(it, end);
-    return condition ? trueValue : falseValue;
+  if (condition >= 0 && matchOperator("?")) {
+    int trueValue = parseConditional();
+    if (trueValue < 0) {
+      return -1;
+    }
+    if (!matchOperator(":")) {
+      fail("Expected ':' in conditional expression");
+      return -1;
+    }
+    int falseValue = parseConditional();
+    return makeNode(ExprOp::SELECT, condition, trueValue, falseValue);
   }
 
   return condition;
-}
\ No newline at end of file
+}
+
+// Emit postfix code for a node and track the stack depth
+bool ExpressionEvaluator::emit(int node, int depth, int &maxDepth) {
+  const Node &n = nodes[node];
+  for (int i = 0; i < n.childCount; i++) {
+    if (!emit(n.children[i], depth + i, maxDepth)) {
+      return false;
+    }
+  }
+
+  int resultDepth = depth + 1;
+  maxDepth = std::max(maxDepth, resultDepth);
+  if (maxDepth > Expression::MAX_STACK) {
+    return fail("Expression is too deeply nested");
+  }
+
+  out.code.push_back({n.op, n.operand});
+  return true;
+}
+
+// Compile an expression from the token stream
+bool ExpressionEvaluator::compile(const std::vector<Token> &tokens,
+                                  size_t &pos, Expression &out,
+                                  std::string &error) {
+  out = Expression();
+
+  size_t start = pos;
+  ExpressionEvaluator compiler(tokens, pos, out, error);
+  int root = compiler.parseConditional();
+  if (root < 0) {
+    if (error.empty()) {
+      error = "Could not evaluate expression";
+    }
+    return false;
+  }
+
+  const Node &rootNode = compiler.nodes[root];
+  if (rootNode.op == ExprOp::PUSH_CONST) {
+    out.shape = (pos == start + 1 && tokens[start].is(Token::BINARY))
+                    ? Expression::BINARY_LITERAL
+                    : Expression::CONSTANT;
+    out.constant = rootNode.operand;
+    return true;
+  }
+
+  int maxDepth = 0;
+  if (!compiler.emit(root, 0, maxDepth)) {
+    return false;
+  }
+  out.shape = rootNode.op == ExprOp::LOAD_VAR ? Expression::VARIABLE
+                                               : Expression::GENERAL;
+  return true;
+}
+
+// Compile and evaluate an entire expression string
+int ExpressionEvaluator::evaluate(const std::string &expr, Environment &env) {
+  std::vector<Token> tokens;
+  std::string error;
+  if (!Tokenizer::tokenize(expr, tokens, error)) {
+    std::cerr << "Error: " << error << std::endl;
+    return 0;
+  }
+
+  size_t pos = 0;
+  Expression compiled;
+  if (!compile(tokens, pos, compiled, error)) {
+    std::cerr << "Error: " << error << std::endl;
+    return 0;
+  }
+  if (!tokens[pos].is(Token::END)) {
+    std::cerr << "Error: Unexpected character at end of expression: "
+              << tokens[pos].text << std::endl;
+  }
+
+  compiled.bind(env);
+  return compiled.evaluate(env, env.nextStatementStream());
+}
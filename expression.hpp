@@ -1,59 +1,185 @@
 #ifndef REELIA_EXPRESSION_HPP
 #define REELIA_EXPRESSION_HPP
 
+#include "base_object.hpp"
+#include "tokenizer.hpp"
+#include <cstdint>
 #include <string>
+#include <vector>
 
-class ReeliaParser; // Forward declaration
+class Environment; // Forward declaration
+
+/**
+ * Expression opcodes
+ * A compiled expression is a flat postfix program evaluated on a small
+ * fixed-size stack.
+ */
+enum class ExprOp : uint8_t {
+  PUSH_CONST, // push operand
+  LOAD_VAR,   // push value of symbols[operand]
+  LOAD_ATTR,  // push attribute attributes[operand]
+  LOAD_TICK,  // push the environment tick counter
+  NEG,
+  BIT_NOT,
+  LOG_NOT,
+  MUL,
+  DIV,
+  MOD,
+  ADD,
+  SUB,
+  SHL,
+  SHR,
+  LT,
+  LE,
+  GT,
+  GE,
+  EQ,
+  NE,
+  BIT_AND,
+  BIT_XOR,
+  BIT_OR,
+  LOG_AND,
+  LOG_OR,
+  SELECT, // cond ? a : b
+  MIN,
+  MAX,
+  ABS,
+  CLAMP,
+  RND
+};
+
+struct ExprInstr {
+  ExprOp op;
+  int operand;
+};
+
+/**
+ * Compiled expression
+ * Produced once by ExpressionEvaluator::compile and evaluated as often as
+ * needed without re-parsing. Constant subexpressions are already folded.
+ */
+class Expression {
+public:
+  // Maximum evaluation stack depth
+  static constexpr int MAX_STACK = 64;
+
+  // Overall shape of the expression (used by the parser to keep object types)
+  enum Shape {
+    GENERAL,        // anything that has to be evaluated
+    CONSTANT,       // folded to a single integer
+    BINARY_LITERAL, // a single binary pattern literal
+    VARIABLE        // a single variable reference ($var)
+  };
+
+  // Attribute read ($obj.attr)
+  struct AttributeRef {
+    int symbol;         // index into symbols
+    std::string member; // attribute name
+    AttrKey key;        // attribute id resolved at compile time
+  };
+
+private:
+  friend class ExpressionEvaluator;
+
+  std::vector<ExprInstr> code;
+  std::vector<std::string> symbols;       // referenced variable names
+  std::vector<uint32_t> slots;            // environment slots bound to symbols
+  std::vector<AttributeRef> attributes;   // referenced attributes
+  Shape shape;
+  int constant;
+
+public:
+  Expression() : shape(CONSTANT), constant(0) {}
+
+  // Resolve variable names to environment slots (once, after compiling)
+  void bind(Environment &env);
+
+  // Evaluate against the environment the expression was bound to.
+  // `stream` keys RND(): each RND() call in the expression draws from its own
+  // counter-based sequence of (stream, call site), indexed by song position.
+  int evaluate(Environment &env, uint64_t stream = 0) const;
+
+  Shape getShape() const { return shape; }
+  bool isConstant() const {
+    return shape == CONSTANT || shape == BINARY_LITERAL;
+  }
+  int constantValue() const { return constant; }
+
+  // Referenced variables (for VARIABLE shape, symbols[0] is the variable)
+  const std::vector<std::string> &getSymbols() const { return symbols; }
+  const std::vector<uint32_t> &getSlots() const { return slots; }
+  const std::vector<AttributeRef> &getAttributes() const { return attributes; }
+
+  // Number of postfix instructions (after folding)
+  size_t size() const { return code.size(); }
+
+  // Whether the value can change without any referenced variable changing
+  // (reads T or calls RND)
+  bool isTimeVarying() const;
+};
 
 /**
  * Expression Evaluator for the REELIA language
  * Implements a recursive descent parser that handles mathematical expressions
- * with proper operator precedence.
+ * with proper operator precedence, and compiles them into Expression programs.
  */
 class ExpressionEvaluator {
 private:
-  ReeliaParser &parser;
+  // Intermediate tree node used for constant folding before emitting code
+  struct Node {
+    ExprOp op;
+    int operand;
+    int children[3];
+    int childCount;
+  };
+
+  const std::vector<Token> &tokens;
+  size_t &pos;
+  Expression &out;
+  std::string &error;
+  std::vector<Node> nodes;
 
   // Helper functions for expression parsing
-  bool isSpace(char c);
-  void skipWhitespace(std::string::const_iterator &it,
-                      const std::string::const_iterator &end);
-  bool match(std::string::const_iterator &it,
-             const std::string::const_iterator &end, char expected);
-
-  // Recursive descent parser levels
-  int parsePrimary(std::string::const_iterator &it,
-                   const std::string::const_iterator &end);
-  int parseTerm(std::string::const_iterator &it,
-                const std::string::const_iterator &end);
-  int parseAdditive(std::string::const_iterator &it,
-                    const std::string::const_iterator &end);
-  int parseShift(std::string::const_iterator &it,
-                 const std::string::const_iterator &end);
-  int parseRelational(std::string::const_iterator &it,
-                      const std::string::const_iterator &end);
-  int parseEquality(std::string::const_iterator &it,
-                    const std::string::const_iterator &end);
-  int parseBitwiseAnd(std::string::const_iterator &it,
-                      const std::string::const_iterator &end);
-  int parseBitwiseXor(std::string::const_iterator &it,
-                      const std::string::const_iterator &end);
-  int parseBitwiseOr(std::string::const_iterator &it,
-                     const std::string::const_iterator &end);
-  int parseLogicalAnd(std::string::const_iterator &it,
-                      const std::string::const_iterator &end);
-  int parseLogicalOr(std::string::const_iterator &it,
-                     const std::string::const_iterator &end);
-  int parseConditional(std::string::const_iterator &it,
-                       const std::string::const_iterator &end);
-  int parseFunction(std::string::const_iterator &it,
-                    const std::string::const_iterator &end);
+  const Token &peek() const { return tokens[pos]; }
+  bool matchOperator(const char *op);
+  bool fail(const std::string &message);
+  int makeLeaf(ExprOp op, int operand);
+  int makeNode(ExprOp op, int a, int b = -1, int c = -1);
+  int internSymbol(const std::string &name);
+
+  // Recursive descent parser levels (each returns a node index, -1 on error)
+  int parsePrimary();
+  int parseTerm();
+  int parseAdditive();
+  int parseShift();
+  int parseRelational();
+  int parseEquality();
+  int parseBitwiseAnd();
+  int parseBitwiseXor();
+  int parseBitwiseOr();
+  int parseLogicalAnd();
+  int parseLogicalOr();
+  int parseConditional();
+  int parseFunction(const std::string &name);
+
+  // Code generation
+  bool emit(int node, int depth, int &maxDepth);
+
+  ExpressionEvaluator(const std::vector<Token> &t, size_t &p, Expression &e,
+                      std::string &err)
+      : tokens(t), pos(p), out(e), error(err) {}
 
 public:
-  ExpressionEvaluator(ReeliaParser &p) : parser(p) {}
+  // Compile an expression from a token stream starting at pos.
+  // Stops at the first token that cannot continue the expression.
+  static bool compile(const std::vector<Token> &tokens, size_t &pos,
+                      Expression &out, std::string &error);
+
+  // Compile and evaluate a complete expression string
+  static int evaluate(const std::string &expr, Environment &env);
 
-  // Evaluate a complete expression string
-  int evaluate(const std::string &expr);
+  // Apply a pure operator (shared by folding and evaluation)
+  static int apply(ExprOp op, int a, int b, int c, bool &divisionByZero);
 };
 
-#endif // REELIA_EXPRESSION_HPP
\ No newline at end of file
+#endif // REELIA_EXPRESSION_HPP
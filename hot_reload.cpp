@@ -0,0 +1,318 @@
+#include "hot_reload.hpp"
+#include "parser.hpp"
+#include "pattern_graph.hpp"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+//------------------------------------------------------------------------------
+// 差分の適用
+//------------------------------------------------------------------------------
+
+void ScriptPatch::apply(Environment& env, const char* label) {
+    for (Op& op : ops) {
+        SlotId slot = env.intern(op.name);
+        if (op.kind == Op::REPLACE) {
+            env.setVariable(slot, std::move(op.object));
+            continue;
+        }
+
+        BaseObject* obj = env.getVariable(slot);
+        if (!obj) {
+            continue;
+        }
+        try {
+            if (op.pattern.empty()) {
+                obj->setAttr(op.attr, op.value);
+            } else {
+                obj->setAttrPattern(op.attr, op.pattern);
+            }
+            env.updateSchedule(slot);
+        } catch (const std::exception& e) {
+            std::cerr << label << ": $" << op.name << "." << attributeName(op.attr) << ": " << e.what() << std::endl;
+        }
+    }
+    std::cout << label << " applied (" << ops.size() << " changes)" << std::endl;
+}
+
+//------------------------------------------------------------------------------
+// 裏での実行
+//------------------------------------------------------------------------------
+
+namespace {
+// 値として代入されるオブジェクト（属性を持たない）か
+bool isPlainValue(const BaseObject& obj) {
+    const ObjectType& type = obj.getObjectType();
+    return &type == &IntObject::objectType() || &type == &BinaryPatternObject::objectType();
+}
+
+// コメント行・空行か（Parser::parseLine と同じ判定）
+bool isBlankLine(const std::string& line) {
+    size_t first = line.find_first_not_of(" \t\n\r");
+    return first == std::string::npos || line[first] == '#' || line.compare(first, 2, "//") == 0;
+}
+} // namespace
+
+std::unique_ptr<HotReloader::Image> HotReloader::build(
+    const std::string& code, std::vector<std::pair<std::string, ObjectPtr>>& seed) {
+    std::unique_ptr<Image> image(new Image());
+    image->skippedCalls = 0;
+
+    // 実行中の環境の複製の上で実行する（スクリプトからライブの変数を読めるように）
+    // 下書きなので、属性の設定でCCなどを送らないようにする
+    Environment scratch;
+    scratch.setMuted(true);
+    for (auto& entry : seed) {
+        scratch.setVariable(entry.first, std::move(entry.second));
+    }
+    seed.clear();
+
+    Parser parser(scratch);
+    parser.setEcho(false);
+
+    // スクリプトが触れた変数（現れた順）と、その宣言
+    std::vector<SlotId> order;
+    std::unordered_map<SlotId, Declaration> declarations;
+    auto touch = [&](SlotId slot) -> Declaration& {
+        auto it = declarations.find(slot);
+        if (it == declarations.end()) {
+            order.push_back(slot);
+            it = declarations.emplace(slot, Declaration{std::string(), false, Value(), BitPattern(), {}}).first;
+        }
+        return it->second;
+    };
+
+    std::istringstream stream(code);
+    std::string line;
+    int lineNumber = 0;
+    while (std::getline(stream, line)) {
+        lineNumber++;
+        if (isBlankLine(line)) {
+            continue;
+        }
+
+        std::shared_ptr<const Program> compiled = parser.compile(line);
+        const Program& program = *compiled;
+        if (!program.valid) {
+            image->errors.push_back("line " + std::to_string(lineNumber) + ": " + program.error);
+            continue;
+        }
+        if (!program.code.empty() && program.code[0].op == Instruction::CALL) {
+            image->skippedCalls += program.code.size();
+            continue;
+        }
+
+        for (const Instruction& ins : program.code) {
+            if (ins.op == Instruction::SET_ATTR) {
+                // 同じ属性を何度も設定したら最後の値を使う（位置は最初に現れた所）
+                Declaration& decl = touch(ins.target);
+                bool found = false;
+                for (const auto& attr : decl.attrs) {
+                    found = found || attr.key == ins.attr;
+                }
+                if (!found && ins.attr.isKnown()) {
+                    decl.attrs.push_back(Setting{ins.attr, Value(), BitPattern()});
+                }
+            } else {
+                // 作り直したら、それまでに設定した属性は新しいオブジェクトの値になる
+                Declaration& decl = touch(ins.target);
+                decl.assigned = true;
+                decl.attrs.clear();
+            }
+        }
+        if (!parser.execute(program)) {
+            // 束縛のエラーなどは下書きの環境の知らせにたまっている
+            std::vector<std::string> notices;
+            scratch.takeNotices(notices);
+            if (notices.empty()) {
+                notices.push_back("failed to execute");
+            }
+            for (const std::string& notice : notices) {
+                image->errors.push_back("line " + std::to_string(lineNumber) + ": " + notice);
+            }
+        }
+    }
+
+    // 実行後の状態を読み出す
+    for (SlotId slot : order) {
+        BaseObject* obj = scratch.getVariable(slot);
+        if (!obj) {
+            continue;
+        }
+        Declaration& decl = declarations[slot];
+        decl.type = obj->getType();
+        decl.value = Value::of(*obj);
+        decl.pattern = obj->getPattern() ? *obj->getPattern() : BitPattern();
+
+        std::vector<Setting> readable;
+        for (const auto& attr : decl.attrs) {
+            try {
+                Setting setting{attr.key, obj->getAttr(attr.key), BitPattern()};
+                obj->getAttrPattern(attr.key, setting.pattern);
+                readable.push_back(std::move(setting));
+            } catch (const std::exception&) {
+                // 読み出せない属性は比べられないので差分に含めない
+            }
+        }
+        decl.attrs = std::move(readable);
+
+        image->variables.push_back(Variable{scratch.getName(slot), obj->clone(), std::move(decl)});
+    }
+    return image;
+}
+
+//------------------------------------------------------------------------------
+// 差分の作成
+//------------------------------------------------------------------------------
+
+ScriptPatch HotReloader::diff(Image& image, const Environment& env) {
+    ScriptPatch patch;
+
+    for (Variable& var : image.variables) {
+        const Declaration& decl = var.declaration;
+        auto prevIt = previous.find(var.name);
+        const Declaration* prev = prevIt != previous.end() ? &prevIt->second : nullptr;
+        if (prev && prev->type != decl.type) {
+            prev = nullptr;
+        }
+        BaseObject* live = env.getVariable(var.name);
+
+        // 型が変わった・まだない変数は丸ごと置き換える
+        bool replace = !live || live->getType() != decl.type;
+        if (!replace && decl.assigned && isPlainValue(*var.object)) {
+            if (prev && prev->assigned) {
+                replace = prev->value != decl.value || prev->pattern != decl.pattern;
+            } else {
+                const BitPattern* livePattern = live->getPattern();
+                replace = Value::of(*live) != decl.value || (livePattern ? *livePattern : BitPattern()) != decl.pattern;
+            }
+        }
+        // パターングラフは組み合わせの式が変わったときだけ作り直す（同じなら再生位置を残す）
+        if (!replace && decl.assigned && &var.object->getObjectType() == &PatternGraphObject::objectType()) {
+            replace = static_cast<const PatternGraphObject&>(*live).getDefinition() !=
+                      static_cast<const PatternGraphObject&>(*var.object).getDefinition();
+        }
+        if (replace) {
+            // 置き換えるなら状態も作り直す（変数がないのに代入しなかった場合を除く）
+            if (live || decl.assigned) {
+                patch.ops.push_back({ScriptPatch::Op::REPLACE, var.name, std::move(var.object), AttrKey(), Value(), BitPattern()});
+            }
+            continue;
+        }
+
+        // 型が同じなら状態を残し、宣言が変わった属性だけ設定する
+        for (const auto& attr : decl.attrs) {
+            bool changed = true;
+            const Setting* before = nullptr;
+            if (prev) {
+                for (const auto& p : prev->attrs) {
+                    if (p.key == attr.key) {
+                        before = &p;
+                    }
+                }
+            }
+            if (before) {
+                changed = before->value != attr.value || before->pattern != attr.pattern;
+            } else {
+                try {
+                    BitPattern livePattern;
+                    live->getAttrPattern(attr.key, livePattern);
+                    changed = live->getAttr(attr.key) != attr.value || livePattern != attr.pattern;
+                } catch (const std::exception&) {
+                }
+            }
+            if (changed) {
+                patch.ops.push_back(
+                    {ScriptPatch::Op::SET_ATTR, var.name, nullptr, attr.key, attr.value, attr.pattern});
+            }
+        }
+    }
+
+    for (Variable& var : image.variables) {
+        previous[var.name] = std::move(var.declaration);
+    }
+    return patch;
+}
+
+//------------------------------------------------------------------------------
+// 再読み込みの制御
+//------------------------------------------------------------------------------
+
+HotReloader::~HotReloader() {
+    if (worker.joinable()) {
+        worker.join();
+    }
+}
+
+bool HotReloader::start(const std::string& file, const Environment& env) {
+    if (running.load()) {
+        std::cerr << "Reload: already in progress" << std::endl;
+        return false;
+    }
+    if (!file.empty()) {
+        // 別のファイルに切り替えたら前回の宣言は使わない
+        if (file != path) {
+            previous.clear();
+        }
+        path = file;
+    }
+    if (path.empty()) {
+        std::cerr << "Reload: no file given" << std::endl;
+        return false;
+    }
+
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Reload: cannot open " << path << std::endl;
+        return false;
+    }
+    std::ostringstream contents;
+    contents << in.rdbuf();
+
+    // 実行中の変数の複製（プールに属さない）を裏のスレッドに渡す
+    std::vector<std::pair<std::string, ObjectPtr>> seed;
+    for (SlotId slot = 0; slot < env.slotCount(); slot++) {
+        if (BaseObject* obj = env.getVariable(slot)) {
+            seed.emplace_back(env.getName(slot), obj->clone());
+        }
+    }
+
+    if (worker.joinable()) {
+        worker.join();
+    }
+    running = true;
+    worker = std::thread([this, code = contents.str(), seed = std::move(seed)]() mutable {
+        std::unique_ptr<Image> image = build(code, seed);
+        std::lock_guard<std::mutex> lock(resultMutex);
+        result = std::move(image);
+        running = false;
+        ready = true;
+    });
+    return true;
+}
+
+bool HotReloader::poll(ScriptPatch& patch, const Environment& env) {
+    std::unique_ptr<Image> image;
+    {
+        std::lock_guard<std::mutex> lock(resultMutex);
+        image = std::move(result);
+        ready = false;
+    }
+    if (!image) {
+        return false;
+    }
+
+    // エラーがあれば何も適用しない（途中までの状態で演奏しない）
+    if (!image->errors.empty()) {
+        for (const std::string& error : image->errors) {
+            std::cerr << "Reload error (" << path << ") " << error << std::endl;
+        }
+        return false;
+    }
+    if (image->skippedCalls > 0) {
+        std::cout << "Reload: skipped " << image->skippedCalls << " method call(s)" << std::endl;
+    }
+
+    patch = diff(*image, env);
+    return true;
+}
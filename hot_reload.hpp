@@ -0,0 +1,121 @@
+#ifndef REELIA_HOT_RELOAD_HPP
+#define REELIA_HOT_RELOAD_HPP
+
+#include "base_object.hpp"
+#include "environment.hpp"
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+/**
+ * スクリプトの差分
+ * 再読み込みしたスクリプトと実行中の環境との違い。apply() は小節の頭で
+ * 一度に適用する（どのオブジェクトのティックよりも先に呼ばれる）。
+ */
+struct ScriptPatch {
+  struct Op {
+    enum Kind { REPLACE, SET_ATTR };
+
+    Kind kind;
+    std::string name; // 変数名
+    ObjectPtr object; // REPLACE: 新しいオブジェクト
+    AttrKey attr;     // SET_ATTR: 属性と値
+    Value value;
+    BitPattern pattern; // SET_ATTR: パターンを持つ属性ならその値（空なら value を使う）
+  };
+
+  std::vector<Op> ops;
+
+  bool empty() const { return ops.empty(); }
+
+  // 環境への適用（失敗した操作はエラーを表示して読み飛ばす）
+  // label は表示の見出し（シーンの呼び出しなどにも使う）
+  void apply(Environment &env, const char *label = "Reload");
+};
+
+/**
+ * スクリプトのホットリロード
+ * ファイルを読み込み、実行中の環境の複製の上でスクリプト全体を裏のスレッドで
+ * 実行する。終わったら変数名と型で実行中の環境と比べ、次の差分を作る。
+ * - 型が変わった・新しく作られた変数はオブジェクトごと置き換える
+ * - 型が同じ変数は状態（再生位置など）を残し、変わった属性だけ設定する
+ * 属性が変わったかは前回読み込んだときの値と比べる（初回は実行中の値と比べる）
+ * ので、スクリプトで触れていない属性や、ライブで変えた値は上書きしない。
+ * メソッド呼び出しは音を出すため裏では実行せず、差分にも含めない。
+ */
+class HotReloader {
+private:
+  // 設定した属性の値（パターンを持つ属性は32ステップを超える分も比べる）
+  struct Setting {
+    AttrKey key;
+    Value value;
+    BitPattern pattern;
+  };
+
+  // スクリプトが1つの変数について宣言した内容
+  struct Declaration {
+    std::string type;
+    bool assigned;      // スクリプトで作成・代入したか
+    Value value;        // 代入した値（int/binaryのとき）
+    BitPattern pattern; // 代入した値のパターン（binaryのとき）
+    std::vector<Setting> attrs; // 設定した属性（順序を保つ）
+  };
+
+  // 裏で実行した結果
+  struct Variable {
+    std::string name;
+    ObjectPtr object; // 実行後のオブジェクト（プールに属さない複製）
+    Declaration declaration;
+  };
+
+  struct Image {
+    std::vector<Variable> variables; // スクリプトに現れた順
+    std::vector<std::string> errors;
+    size_t skippedCalls;
+  };
+
+  std::string path;
+
+  // 裏のスレッドと結果の受け渡し
+  std::thread worker;
+  std::mutex resultMutex;
+  std::unique_ptr<Image> result;
+  std::atomic<bool> running;
+  std::atomic<bool> ready;
+
+  // 前回の読み込みで各変数に宣言した内容
+  std::unordered_map<std::string, Declaration> previous;
+
+  // スクリプト全体を別の環境で実行する（裏のスレッドで呼ばれる）
+  static std::unique_ptr<Image>
+  build(const std::string &code,
+        std::vector<std::pair<std::string, ObjectPtr>> &seed);
+
+  // 実行中の環境との差分を作る
+  ScriptPatch diff(Image &image, const Environment &env);
+
+public:
+  HotReloader() : running(false), ready(false) {}
+  ~HotReloader();
+
+  HotReloader(const HotReloader &) = delete;
+  HotReloader &operator=(const HotReloader &) = delete;
+
+  // 再読み込みの開始（環境はロックした状態で呼ぶこと）
+  // file が空なら前回のファイルを読み直す
+  bool start(const std::string &file, const Environment &env);
+
+  // 裏での実行が終わっていれば差分を作って返す（環境はロックした状態で呼ぶこと）
+  bool poll(ScriptPatch &patch, const Environment &env);
+
+  bool isRunning() const { return running.load(); }
+  bool hasResult() const { return ready.load(); }
+  const std::string &getPath() const { return path; }
+};
+
+#endif // REELIA_HOT_RELOAD_HPP
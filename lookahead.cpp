@@ -0,0 +1,160 @@
+#include "lookahead.hpp"
+#include <algorithm>
+
+Lookahead::Lookahead(Environment& environment)
+    : env(environment), window(0.0), head(0), count(0), rewinds(0), rerenderedTicks(0) {}
+
+void Lookahead::setWindow(double seconds) {
+    window = seconds > 0.0 ? seconds : 0.0;
+    reset();
+}
+
+void Lookahead::reset() {
+    while (count > 0) {
+        popFrame();
+    }
+}
+
+void Lookahead::tick(double time, double period) {
+    if (window <= 0.0) {
+        env.setTickTiming(time, period);
+        env.tick();
+        return;
+    }
+
+    // 送信が始まったティックと、コマンドを実行したティックまでは確定
+    double deadline = MIDIManager::now() + getMIDIManager().getOutputLatency() + MARGIN;
+    while (count > 0 && (frame(0).time <= deadline || frame(0).position < env.getLastEdit())) {
+        popFrame();
+    }
+
+    // コマンドが届いていれば、まだ送っていないティックをやり直す
+    if (count > 0 && env.hasPendingCommands()) {
+        rerender();
+    }
+
+    bool full = count == 0;
+    Frame& next = pushFrame();
+    next.time = time + window;
+    next.period = period;
+    render(next, full);
+}
+
+// 末尾に空のティックを足す（満杯なら並べ直して倍に広げる）
+Lookahead::Frame& Lookahead::pushFrame() {
+    if (count == ring.size()) {
+        std::rotate(ring.begin(), ring.begin() + static_cast<std::ptrdiff_t>(head), ring.end());
+        head = 0;
+        ring.resize(std::max<size_t>(8, ring.size() * 2));
+    }
+    count++;
+    return frame(count - 1);
+}
+
+// 先頭のティックを確定させる（変わっていない変数の写しは次のティックへ引き継ぐ）
+void Lookahead::popFrame() {
+    Frame& first = frame(0);
+    if (count > 1) {
+        Frame& second = frame(1);
+        for (SlotId slot = 0; slot < first.objects.size() && slot < second.objects.size(); slot++) {
+            if (first.objects[slot] && !second.objects[slot]) {
+                second.objects[slot] = std::move(first.objects[slot]);
+            }
+        }
+    }
+    release(first);
+    head = (head + 1) % ring.size();
+    count--;
+}
+
+// ティックの写しを使い回し用に戻す
+void Lookahead::release(Frame& target) {
+    if (spare.size() < target.objects.size()) {
+        spare.resize(target.objects.size());
+    }
+    for (SlotId slot = 0; slot < target.objects.size(); slot++) {
+        if (target.objects[slot]) {
+            spare[slot].push_back(std::move(target.objects[slot]));
+        }
+    }
+}
+
+// 変数の写しを取る（同じ型の使い終わった写しがあれば上書きする）
+ObjectPtr Lookahead::checkpoint(SlotId slot, const BaseObject& obj) {
+    if (slot < spare.size()) {
+        std::vector<ObjectPtr>& list = spare[slot];
+        while (!list.empty()) {
+            ObjectPtr copy = std::move(list.back());
+            list.pop_back();
+            if (&copy->getObjectType() == &obj.getObjectType()) {
+                copy->copyState(obj);
+                return copy;
+            }
+        }
+    }
+    ObjectPtr copy = obj.clone();
+    copy->copyState(obj);
+    return copy;
+}
+
+// チェックポイントを取ってから1ティック計算する
+// full でなければ、前のチェックポイントから変わった変数だけ写す
+void Lookahead::render(Frame& target, bool full) {
+    size_t slots = env.slotCount();
+    if (versions.size() < slots) {
+        // 初めて見るスロットは変わったものとして扱う
+        versions.resize(slots, 0);
+        active.resize(slots, 1);
+    }
+
+    target.position = env.getSongPosition();
+    target.objects.resize(slots);
+    for (SlotId slot = 0; slot < slots; slot++) {
+        BaseObject* obj = env.getVariable(slot);
+        uint32_t version = env.slotVersion(slot);
+        bool changed = full || active[slot] || version != versions[slot];
+        versions[slot] = version;
+        active[slot] = obj && (obj->needsTick() || obj->isRunning());
+        if (obj && changed) {
+            target.objects[slot] = checkpoint(slot, *obj);
+        }
+    }
+
+    target.noteOffs.clear();
+    env.setNoteOffJournal(&target.noteOffs);
+    env.setTickTiming(target.time, target.period);
+    env.tick();
+    env.setNoteOffJournal(nullptr);
+}
+
+// 最初の送信待ちのティックまで戻し、同じ送信時刻で計算し直す
+// 戻したティックで予約したノートオフは取り消す。送信待ちのノートオフは、
+// 取り消したノートオンの分だけ出力スレッドが一緒に取り消す
+// （鳴っているノートを止めそこなうことはない）
+// 出力のキューが満杯で取り消せなければやり直さず、コマンドは先読みした
+// ティックの後に実行する
+void Lookahead::rerender() {
+    Frame& first = frame(0);
+    if (!getMIDIManager().retract(first.time)) {
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        for (NoteOffWheel::Handle handle : frame(i).noteOffs) {
+            env.cancelNoteOff(handle);
+        }
+    }
+
+    for (SlotId slot = 0; slot < first.objects.size(); slot++) {
+        if (first.objects[slot]) {
+            env.restoreVariable(slot, *first.objects[slot]);
+        }
+    }
+    env.rewind(first.position);
+
+    for (size_t i = 0; i < count; i++) {
+        release(frame(i));
+        render(frame(i), i == 0);
+    }
+    rewinds++;
+    rerenderedTicks += count;
+}
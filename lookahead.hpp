@@ -0,0 +1,84 @@
+#ifndef REELIA_LOOKAHEAD_HPP
+#define REELIA_LOOKAHEAD_HPP
+
+#include "environment.hpp"
+#include <cstdint>
+#include <vector>
+
+/**
+ * 先読み
+ * ティックを送信時刻より window 秒だけ先に計算し、MIDIの出力スレッドの
+ * 送信待ちに溜めておく。ティックのスレッドが window 未満だけ遅れても
+ * 送信時刻は変わらない。先読みしたティックごとに、ティック前の変数の状態の写し
+ * （チェックポイント）を残しておき、コマンドが届いたら、まだ送っていない
+ * ティックのうち最初のものまで戻して送信待ちを取り消し、コマンドを実行して
+ * から同じ送信時刻で計算し直す。乱数はカウンター方式なので、コマンドで
+ * 変わらないところは同じ結果になる。
+ * 最後にコマンドやイベントを実行したティックより前には戻らない。
+ * チェックポイントは前のティックから変わった変数（版が進んだか、動いている
+ * もの）だけ取り、送信を確定したティックの写しは使い回すので、同じ曲を
+ * 続けている間はティックごとの確保がない。
+ */
+class Lookahead {
+public:
+    // 送信に間に合わないとみなす余裕（秒。出力スレッドが起きるまでの遅れ）
+    static constexpr double MARGIN = 0.002;
+
+private:
+    // 先読みしたティック
+    struct Frame {
+        uint64_t position;  // ティック前の曲の位置（ここへ戻す）
+        double time;        // 送信時刻（予定時刻に window を足したもの）
+        double period;
+        // ティック前の変数の写し（スロット順）。前のティックから変わっていない
+        // 変数は nullptr で、先頭のティックになるときに前のティックの写しを引き継ぐ
+        // （先頭のティックでは nullptr は空のスロット）
+        std::vector<ObjectPtr> objects;
+        std::vector<NoteOffWheel::Handle> noteOffs;  // このティックで予約したノートオフ
+    };
+
+    Environment& env;
+    double window;
+    std::vector<Frame> ring;  // 送信待ちのティック（head から count 個、古い順）
+    size_t head;
+    size_t count;
+
+    // 最後にチェックポイントを取ったときのスロットの版と、動いていたか
+    std::vector<uint32_t> versions;
+    std::vector<uint8_t> active;
+    std::vector<std::vector<ObjectPtr>> spare;  // 使い終わった写し（スロットごと）
+
+    uint64_t rewinds;          // 戻した回数
+    uint64_t rerenderedTicks;  // 計算し直したティックの数
+
+    Frame& frame(size_t i) { return ring[(head + i) % ring.size()]; }
+    Frame& pushFrame();
+    void popFrame();
+    void release(Frame& frame);
+    ObjectPtr checkpoint(SlotId slot, const BaseObject& obj);
+    void render(Frame& frame, bool full);
+    void rerender();
+
+public:
+    explicit Lookahead(Environment& environment);
+
+    Lookahead(const Lookahead&) = delete;
+    Lookahead& operator=(const Lookahead&) = delete;
+
+    // 先読みする長さ（秒。0なら先読みせず、ティックはすぐ送る）
+    void setWindow(double seconds);
+    double getWindow() const { return window; }
+
+    // クロックの1ティック（time は予定時刻、period は周期。秒、MIDIManager::now()基準）
+    // 呼び出し側は環境を排他にしておく
+    void tick(double time, double period);
+
+    // 先読みしたティックを確定させる（クロックを止めたとき、手動でティックしたとき）
+    void reset();
+
+    size_t pendingTicks() const { return count; }
+    uint64_t getRewinds() const { return rewinds; }
+    uint64_t getRerenderedTicks() const { return rerenderedTicks; }
+};
+
+#endif // REELIA_LOOKAHEAD_HPP
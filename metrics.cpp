@@ -0,0 +1,138 @@
+#include "metrics.hpp"
+#include <cstdio>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+
+//------------------------------------------------------------------------------
+// ヒストグラム
+//------------------------------------------------------------------------------
+
+LatencyHistogram::LatencyHistogram() : sum(0), maximum(0) {
+    for (auto& bucket : buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+int64_t LatencyHistogram::bucketLower(int index) {
+    int group = index / SUB_BUCKETS;
+    int sub = index % SUB_BUCKETS;
+    if (group == 0) {
+        return sub;
+    }
+    return static_cast<int64_t>(SUB_BUCKETS + sub) << (group - 1);
+}
+
+int64_t LatencyHistogram::bucketUpper(int index) {
+    int group = index / SUB_BUCKETS;
+    return bucketLower(index) + (group == 0 ? 1 : static_cast<int64_t>(1) << (group - 1));
+}
+
+LatencyHistogram::Summary LatencyHistogram::summarize() const {
+    uint64_t counts[BUCKETS];
+    uint64_t total = 0;
+    for (int i = 0; i < BUCKETS; i++) {
+        counts[i] = buckets[i].load(std::memory_order_relaxed);
+        total += counts[i];
+    }
+
+    Summary summary = {};
+    summary.count = total;
+    summary.max = maximum.load(std::memory_order_relaxed);
+    if (total == 0) {
+        return summary;
+    }
+    summary.mean = static_cast<double>(sum.load(std::memory_order_relaxed)) / total;
+
+    // 分位点はバケットの中央の値（最大値を超えないようにする）
+    const double quantiles[] = {0.50, 0.90, 0.99, 0.999};
+    int64_t* results[] = {&summary.p50, &summary.p90, &summary.p99, &summary.p999};
+    uint64_t cumulative = 0;
+    int q = 0;
+    for (int i = 0; i < BUCKETS && q < 4; i++) {
+        cumulative += counts[i];
+        while (q < 4 && cumulative >= static_cast<uint64_t>(quantiles[q] * total + 0.5) && cumulative > 0) {
+            int64_t mid = (bucketLower(i) + bucketUpper(i) - 1) / 2;
+            *results[q++] = mid < summary.max ? mid : summary.max;
+        }
+    }
+    return summary;
+}
+
+void LatencyHistogram::reset() {
+    for (auto& bucket : buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    sum.store(0, std::memory_order_relaxed);
+    maximum.store(0, std::memory_order_relaxed);
+}
+
+//------------------------------------------------------------------------------
+// 計測値の集まり
+//------------------------------------------------------------------------------
+
+// 終了時に他のスレッドがまだ記録していても安全なよう、破棄しない
+Metrics& getMetrics() {
+    static Metrics* instance = new Metrics();
+    return *instance;
+}
+
+const char* Metrics::name(Kind kind) {
+    switch (kind) {
+        case CLOCK_JITTER:  return "clock.jitter";
+        case CLOCK_SYNC:    return "clock.sync";
+        case TICK_TOTAL:    return "tick.total";
+        case TICK_OBJECTS:  return "tick.objects";
+        case TICK_HANDLERS: return "tick.handlers";
+        case TICK_EVENTS:   return "tick.events";
+        case PARSE:         return "parse";
+        case MIDI_QUEUE:    return "midi.queue";
+        case MIDI_SEND:     return "midi.send";
+        default:            return "unknown";
+    }
+}
+
+void Metrics::reset() {
+    for (auto& histogram : histograms) {
+        histogram.reset();
+    }
+}
+
+namespace {
+// ナノ秒をマイクロ秒で表示
+std::string micros(double ns) {
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.1f", ns / 1000.0);
+    return text;
+}
+} // namespace
+
+void Metrics::print(std::ostream& out) const {
+    out << std::left << std::setw(15) << "metric (us)" << std::right
+        << std::setw(10) << "count" << std::setw(10) << "mean" << std::setw(10) << "p50"
+        << std::setw(10) << "p90" << std::setw(10) << "p99" << std::setw(10) << "p999"
+        << std::setw(10) << "max" << std::endl;
+    for (int i = 0; i < KIND_COUNT; i++) {
+        LatencyHistogram::Summary s = histograms[i].summarize();
+        out << std::left << std::setw(15) << name(static_cast<Kind>(i)) << std::right
+            << std::setw(10) << s.count << std::setw(10) << micros(s.mean) << std::setw(10) << micros(s.p50)
+            << std::setw(10) << micros(s.p90) << std::setw(10) << micros(s.p99) << std::setw(10) << micros(s.p999)
+            << std::setw(10) << micros(static_cast<double>(s.max)) << std::endl;
+    }
+}
+
+bool Metrics::writeCSV(const std::string& path) const {
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "Cannot open " << path << " for writing" << std::endl;
+        return false;
+    }
+
+    out << "metric,count,mean_ns,p50_ns,p90_ns,p99_ns,p999_ns,max_ns" << std::endl;
+    for (int i = 0; i < KIND_COUNT; i++) {
+        LatencyHistogram::Summary s = histograms[i].summarize();
+        out << name(static_cast<Kind>(i)) << "," << s.count << "," << std::fixed << std::setprecision(1) << s.mean
+            << "," << s.p50 << "," << s.p90 << "," << s.p99 << "," << s.p999 << "," << s.max << std::endl;
+    }
+    return static_cast<bool>(out);
+}
@@ -0,0 +1,120 @@
+#ifndef REELIA_METRICS_HPP
+#define REELIA_METRICS_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <ostream>
+#include <string>
+
+/**
+ * 時間のヒストグラム（ナノ秒）
+ * 2のべき乗ごとの区間をさらに8つに分けたバケットに数える（誤差12.5%以内）。
+ * 記録はバケットのカウンタを1つ増やすだけで、ロックも確保もしないので
+ * どのスレッドからでも呼べる。
+ */
+class LatencyHistogram {
+public:
+    static constexpr int SUB_BITS = 3;
+    static constexpr int SUB_BUCKETS = 1 << SUB_BITS;
+    static constexpr int BUCKETS = (64 - SUB_BITS) * SUB_BUCKETS;
+
+    struct Summary {
+        uint64_t count;
+        double mean;
+        int64_t p50;
+        int64_t p90;
+        int64_t p99;
+        int64_t p999;
+        int64_t max;
+    };
+
+private:
+    std::atomic<uint64_t> buckets[BUCKETS]; // 件数はバケットの合計
+    std::atomic<uint64_t> sum;
+    std::atomic<int64_t> maximum;
+
+public:
+    LatencyHistogram();
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    // 値の記録（負の値は0として数える）
+    void record(int64_t ns) {
+        if (ns < 0) {
+            ns = 0;
+        }
+        buckets[bucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+        sum.fetch_add(static_cast<uint64_t>(ns), std::memory_order_relaxed);
+        int64_t current = maximum.load(std::memory_order_relaxed);
+        while (ns > current && !maximum.compare_exchange_weak(current, ns, std::memory_order_relaxed)) {
+        }
+    }
+
+    // 分位点などの集計（記録と並行して呼んでもよい）
+    Summary summarize() const;
+
+    void reset();
+
+    // バケットの番号と範囲 [lower, upper)
+    static int bucketIndex(int64_t ns) {
+        uint64_t v = static_cast<uint64_t>(ns);
+        if (v < SUB_BUCKETS) {
+            return static_cast<int>(v);
+        }
+        int msb = 63 - __builtin_clzll(v);
+        int group = msb - SUB_BITS + 1;
+        int sub = static_cast<int>((v >> (msb - SUB_BITS)) & (SUB_BUCKETS - 1));
+        return group * SUB_BUCKETS + sub;
+    }
+    static int64_t bucketLower(int index);
+    static int64_t bucketUpper(int index);
+};
+
+/**
+ * 常時有効な実行時の計測
+ * ティックの遅れ・処理時間、パース時間、MIDIの送信までの遅れを
+ * 種類ごとのヒストグラムに記録する。
+ */
+class Metrics {
+public:
+    enum Kind {
+        CLOCK_JITTER,  // クロックのティックの予定時刻からの遅れ
+        CLOCK_SYNC,    // 受信したMIDIクロックのパルスの、PLLの予測からのずれ
+        TICK_TOTAL,    // Environment::tick() 全体
+        TICK_OBJECTS,  // オブジェクトのティック（プールとonTick）
+        TICK_HANDLERS, // ティックハンドラ
+        TICK_EVENTS,   // ノートオフ・コマンド・イベントキュー
+        PARSE,         // 行のコンパイル（キャッシュになかった行）
+        MIDI_QUEUE,    // MIDIメッセージがキューに積まれて（または送信時刻になって）から出力されるまで
+        MIDI_SEND,     // 出力先への送信（RtMidiOut::sendMessage など）
+        KIND_COUNT
+    };
+
+private:
+    LatencyHistogram histograms[KIND_COUNT];
+
+public:
+    static const char* name(Kind kind);
+
+    // 計測用の現在時刻（steady_clock、ナノ秒）
+    static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void record(Kind kind, int64_t ns) { histograms[kind].record(ns); }
+    const LatencyHistogram& get(Kind kind) const { return histograms[kind]; }
+
+    void reset();
+
+    // 表の表示とCSVでの書き出し（値はナノ秒）
+    void print(std::ostream& out) const;
+    bool writeCSV(const std::string& path) const;
+};
+
+// グローバルアクセス関数
+Metrics& getMetrics();
+
+#endif // REELIA_METRICS_HPP
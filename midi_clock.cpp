@@ -0,0 +1,271 @@
+#include "midi_clock.hpp"
+#include "metrics.hpp"
+#include "midi_manager.hpp"
+#include <cmath>
+#include <iostream>
+
+namespace {
+// 4分音符あたりのパルス数
+constexpr int PPQ = MIDIClockMaster::PULSES_PER_QUARTER;
+
+// ソングポジションの単位（16分音符）あたりのパルス数と、指定できる最大値
+constexpr uint64_t PULSES_PER_BEAT = PPQ / 4;
+constexpr uint64_t MAX_SONG_POSITION = 0x3FFF;
+
+ClockEngine::Clock::time_point toTimePoint(double seconds) {
+    return ClockEngine::Clock::time_point(std::chrono::duration_cast<ClockEngine::Clock::duration>(
+        std::chrono::duration<double>(seconds)));
+}
+} // namespace
+
+//------------------------------------------------------------------------------
+// マスター
+//------------------------------------------------------------------------------
+
+void MIDIClockMaster::start() {
+    if (!playing) {
+        startPending = true;
+    }
+}
+
+void MIDIClockMaster::stop(double time) {
+    if (playing) {
+        getMIDIManager().sendSystem(MIDIMessage::STOP, 0, time, port);
+    }
+    playing = false;
+    startPending = false;
+}
+
+void MIDIClockMaster::tick(double tickTime, double period, int pulsesPerQuarter) {
+    if (pulsesPerQuarter <= 0) {
+        return;
+    }
+    MIDIManager& midi = getMIDIManager();
+    uint64_t ppqn = static_cast<uint64_t>(pulsesPerQuarter);
+
+    if (startPending) {
+        if (ticks == 0) {
+            midi.sendSystem(MIDIMessage::START, 0, tickTime, port);
+        } else {
+            // 途中からは16分音符の頭に揃えて位置を知らせる
+            uint64_t position = std::min(ticks * PPQ / ppqn / PULSES_PER_BEAT, MAX_SONG_POSITION);
+            ticks = position * PULSES_PER_BEAT * ppqn / PPQ;
+            midi.sendSystem(MIDIMessage::SONG_POSITION, static_cast<int>(position), tickTime, port);
+            midi.sendSystem(MIDIMessage::CONTINUE, 0, tickTime, port);
+        }
+        playing = true;
+        startPending = false;
+    }
+    if (!playing) {
+        return;
+    }
+
+    // パルス k はティック k * ppqn / 24 の位置（単位を 1/24 ティックにして整数で数える）
+    uint64_t begin = ticks * PPQ;
+    uint64_t end = begin + PPQ;
+    for (uint64_t k = (begin + ppqn - 1) / ppqn; k * ppqn < end; k++) {
+        double offset = static_cast<double>(k * ppqn - begin) / PPQ;
+        midi.sendSystem(MIDIMessage::CLOCK, 0, tickTime + offset * period, port);
+    }
+    ticks++;
+}
+
+//------------------------------------------------------------------------------
+// PLL
+//------------------------------------------------------------------------------
+
+void ClockPLL::restart(uint64_t firstPulse) {
+    nextPulse = firstPulse;
+    received = 0;
+}
+
+double ClockPLL::pulse(double time) {
+    if (received == 0) {
+        phase = time;
+        lastPulse = nextPulse;
+        received = 1;
+        return 0.0;
+    }
+
+    double elapsed = time - phase;
+    lastPulse++;
+    received++;
+
+    // 途切れた後は間隔が分からないので、次のパルスで測り直す
+    if (period > 0.0 && elapsed > period * DROPOUT) {
+        phase = time;
+        period = 0.0;
+        return 0.0;
+    }
+
+    // 最初の間隔と、テンポが大きく変わったときは測った間隔をそのまま使う
+    double error = time - (phase + period);
+    if (period <= 0.0 || std::fabs(error) > period * RELOCK) {
+        phase = time;
+        period = elapsed > 0.0 ? elapsed : period;
+        return 0.0;
+    }
+
+    phase += period + PHASE_GAIN * error;
+    period += PERIOD_GAIN * error;
+    return error;
+}
+
+//------------------------------------------------------------------------------
+// スレーブ
+//------------------------------------------------------------------------------
+
+MIDIClockSlave::MIDIClockSlave()
+    : currentDevice(-1), playing(false), songPulse(0), ticks(0), tickPPQN(PPQ) {
+}
+
+MIDIClockSlave::~MIDIClockSlave() {
+    close();
+}
+
+std::vector<std::string> MIDIClockSlave::getAvailableInputs() {
+    std::vector<std::string> names;
+    try {
+        RtMidiIn probe;
+        unsigned int count = probe.getPortCount();
+        for (unsigned int i = 0; i < count; i++) {
+            names.push_back(probe.getPortName(i));
+        }
+    } catch (RtMidiError& error) {
+        std::cerr << "MIDI input error: " << error.getMessage() << std::endl;
+    }
+    return names;
+}
+
+bool MIDIClockSlave::openInputDevice(int deviceId) {
+    try {
+        close();
+        if (!midiIn) {
+            midiIn.reset(new RtMidiIn());
+        }
+        if (deviceId < 0 || deviceId >= static_cast<int>(midiIn->getPortCount())) {
+            std::cerr << "Invalid MIDI input device ID: " << deviceId << std::endl;
+            return false;
+        }
+        // クロック（タイミングメッセージ）だけは受け取る
+        midiIn->ignoreTypes(true, false, true);
+        midiIn->setCallback(&MIDIClockSlave::onMessage, this);
+        midiIn->openPort(deviceId);
+        currentDevice = deviceId;
+        std::cout << "MIDI clock input opened: " << midiIn->getPortName(deviceId) << std::endl;
+        return true;
+    } catch (RtMidiError& error) {
+        std::cerr << "MIDI input device open error: " << error.getMessage() << std::endl;
+        return false;
+    }
+}
+
+void MIDIClockSlave::close() {
+    if (midiIn) {
+        if (midiIn->isPortOpen()) {
+            midiIn->closePort();
+        }
+        midiIn->cancelCallback();
+    }
+    currentDevice = -1;
+
+    std::lock_guard<std::mutex> lock(stateMutex);
+    playing = false;
+}
+
+bool MIDIClockSlave::isPlaying() const {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    return playing;
+}
+
+bool MIDIClockSlave::isLocked() const {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    return pll.isLocked();
+}
+
+double MIDIClockSlave::getBPM() const {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    double period = pll.getPeriod();
+    return period > 0.0 ? 60.0 / (period * PPQ) : 0.0;
+}
+
+// RtMidiの入力スレッドから呼ばれる（受信時刻はこちらの時計で測る）
+void MIDIClockSlave::onMessage(double /* deltaTime */, std::vector<unsigned char>* message, void* userData) {
+    if (message && !message->empty()) {
+        static_cast<MIDIClockSlave*>(userData)->receive(message->data(), message->size(), MIDIManager::now());
+    }
+}
+
+// 位置を合わせる（次に受け取るパルスが pulse）
+void MIDIClockSlave::locate(uint64_t pulse) {
+    pll.restart(pulse);
+    ticks = pulse * static_cast<uint64_t>(tickPPQN) / PPQ;
+}
+
+void MIDIClockSlave::receive(const unsigned char* bytes, size_t size, double time) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    switch (bytes[0]) {
+        case MIDIMessage::CLOCK: {
+            // 止まっている間もテンポの推定は続ける
+            double error = pll.pulse(time);
+            if (playing) {
+                getMetrics().record(Metrics::CLOCK_SYNC, static_cast<int64_t>(std::fabs(error) * 1e9));
+            }
+            break;
+        }
+        case MIDIMessage::START:
+            songPulse = 0;
+            locate(0);
+            playing = true;
+            break;
+        case MIDIMessage::CONTINUE:
+            locate(songPulse);
+            playing = true;
+            break;
+        case MIDIMessage::STOP:
+            // 次のコンティニューは止まった次のパルスから
+            if (playing && pll.hasPulse()) {
+                songPulse = pll.getLastPulse() + 1;
+            }
+            playing = false;
+            break;
+        case MIDIMessage::SONG_POSITION:
+            if (size >= 3) {
+                songPulse = (static_cast<uint64_t>(bytes[1] & 0x7F) | (static_cast<uint64_t>(bytes[2] & 0x7F) << 7)) *
+                            PULSES_PER_BEAT;
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+bool MIDIClockSlave::nextTick(int pulsesPerQuarter, ClockEngine::Clock::time_point& deadline,
+                              std::chrono::nanoseconds& period) {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    if (!playing || !pll.hasPulse() || pulsesPerQuarter <= 0) {
+        return false;
+    }
+
+    // PPQNが変わったら同じ位置になるようティック数を数え直す
+    if (pulsesPerQuarter != tickPPQN) {
+        ticks = ticks * static_cast<uint64_t>(pulsesPerQuarter) / static_cast<uint64_t>(tickPPQN);
+        tickPPQN = pulsesPerQuarter;
+    }
+
+    // 受信した最後のパルスの1パルス先まで進める（間隔が分からなければパルスの位置だけ）
+    double position = static_cast<double>(ticks) * PPQ / pulsesPerQuarter;
+    double last = static_cast<double>(pll.getLastPulse());
+    if (position > last + 1.0 || (position > last && !pll.isLocked())) {
+        return false;
+    }
+
+    deadline = toTimePoint(pll.timeAt(position));
+    period = std::chrono::nanoseconds(static_cast<int64_t>(pll.getPeriod() * PPQ / pulsesPerQuarter * 1e9));
+    return true;
+}
+
+void MIDIClockSlave::advance() {
+    std::lock_guard<std::mutex> lock(stateMutex);
+    ticks++;
+}
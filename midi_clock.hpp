@@ -0,0 +1,140 @@
+#ifndef REELIA_MIDI_CLOCK_HPP
+#define REELIA_MIDI_CLOCK_HPP
+
+#include "clock_engine.hpp"
+#include "RtMidi.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/**
+ * MIDIクロックの送信（マスター）
+ * ティックごとに、そのティックの間に入る24PPQNのクロックパルスを
+ * ティックの予定時刻から計算したタイムスタンプ付きで送る。
+ * ティックのPPQNが24でなくても、パルスは4分音符あたり24回になる。
+ * クロックスレッド（または環境ロックを持つスレッド）から呼ぶこと。
+ */
+class MIDIClockMaster {
+private:
+    int port;          // 送信先のMIDIManagerのポート
+    bool playing;      // スタートを送ってからストップを送るまで
+    bool startPending; // 次のティックでスタート（またはコンティニュー）を送る
+    uint64_t ticks;    // 曲の頭からのティック数（ストップしても保持し、コンティニューで続ける）
+
+public:
+    static constexpr int PULSES_PER_QUARTER = 24;
+
+    MIDIClockMaster() : port(0), playing(false), startPending(false), ticks(0) {}
+
+    void setPort(int outputPort) { port = outputPort; }
+    int getPort() const { return port; }
+    bool isPlaying() const { return playing; }
+
+    // 次のティックからクロックを送る（曲の途中ならソングポジションとコンティニュー）
+    void start();
+
+    // ストップを送り、クロックを止める
+    void stop(double time);
+
+    // 曲の頭に戻す（次のstart()はスタートを送る）
+    void rewind() { ticks = 0; }
+
+    // 1ティック分のクロックを送る（tickTime: 予定時刻、period: ティック周期、秒）
+    void tick(double tickTime, double period, int pulsesPerQuarter);
+};
+
+/**
+ * 受信したクロックパルスに追従するPLL
+ * 最後のパルスの時刻とパルス間隔を推定し、次のパルスを予測する。
+ * 予測とのずれの一定割合だけ位相と間隔を補正するので、
+ * 受信のジッタは平滑化され、テンポの変化にはなめらかに追従する。
+ * パルスの間の時刻は推定した間隔で外挿する。
+ */
+class ClockPLL {
+private:
+    static constexpr double PHASE_GAIN = 0.2;   // 位相の補正率
+    static constexpr double PERIOD_GAIN = 0.01; // 間隔の補正率
+    static constexpr double RELOCK = 0.25;      // 間隔のこの割合以上ずれたら測り直す
+    static constexpr double DROPOUT = 4.0;      // 間隔のこの倍以上来なければ途切れたとみなす
+
+    double phase;       // 最後のパルスの推定時刻（秒）
+    double period;      // パルス間隔の推定（秒、0なら未知）
+    uint64_t lastPulse; // 最後のパルスの位置（曲の頭からのパルス数）
+    uint64_t nextPulse; // restart() 後の最初のパルスの位置
+    uint64_t received;  // restart() から受け取ったパルス数
+
+public:
+    ClockPLL() : phase(0.0), period(0.0), lastPulse(0), nextPulse(0), received(0) {}
+
+    // 次に受け取るパルスの位置を firstPulse にする（推定した間隔は残す）
+    void restart(uint64_t firstPulse);
+
+    // パルスを受け取った（戻り値は予測からのずれ、秒。予測できなければ0）
+    double pulse(double time);
+
+    // 位置 position（パルス単位、小数も可）の推定時刻
+    double timeAt(double position) const {
+        return phase + (position - static_cast<double>(lastPulse)) * period;
+    }
+
+    // restart() の後にパルスを受け取ったか、パルス間隔が分かっているか
+    bool hasPulse() const { return received > 0; }
+    bool isLocked() const { return period > 0.0; }
+    uint64_t getLastPulse() const { return lastPulse; }
+    double getPeriod() const { return period; }
+};
+
+/**
+ * MIDIクロックの受信（スレーブ）
+ * RtMidiInで受けたクロック・スタート・ストップ・コンティニュー・
+ * ソングポジションからティックの時刻を決め、ClockEngineの同期元になる。
+ * ティックは受信した最後のパルスの1パルス先までしか進めないので、
+ * クロックが途切れるとティックも止まる。
+ */
+class MIDIClockSlave : public ClockEngine::SyncSource {
+private:
+    std::unique_ptr<RtMidiIn> midiIn;
+    int currentDevice;
+
+    // 入力のコールバックとクロックスレッドで共有する状態
+    mutable std::mutex stateMutex;
+    ClockPLL pll;
+    bool playing;      // スタートかコンティニューを受けてからストップまで
+    uint64_t songPulse; // ソングポジションで指定された位置（パルス）
+    uint64_t ticks;    // 曲の頭からのティック数
+    int tickPPQN;      // ticks を数えているPPQN
+
+    static void onMessage(double deltaTime, std::vector<unsigned char>* message, void* userData);
+    void locate(uint64_t pulse);
+
+public:
+    MIDIClockSlave();
+    ~MIDIClockSlave() override;
+
+    MIDIClockSlave(const MIDIClockSlave&) = delete;
+    MIDIClockSlave& operator=(const MIDIClockSlave&) = delete;
+
+    // 入力デバイスの一覧と接続
+    static std::vector<std::string> getAvailableInputs();
+    bool openInputDevice(int deviceId);
+    void close();
+    int getCurrentInputDevice() const { return currentDevice; }
+
+    bool isPlaying() const;
+    bool isLocked() const;
+    // 受信しているテンポ（分からなければ0）
+    double getBPM() const;
+
+    // 受信したメッセージの処理（time: MIDIManager::now() 基準の秒）
+    // 入力のコールバックから呼ばれる。デバイスなしで試すときにも使える
+    void receive(const unsigned char* bytes, size_t size, double time);
+
+    // ClockEngine::SyncSource
+    bool nextTick(int pulsesPerQuarter, ClockEngine::Clock::time_point& deadline,
+                  std::chrono::nanoseconds& period) override;
+    void advance() override;
+};
+
+#endif // REELIA_MIDI_CLOCK_HPP
@@ -1,4 +1,5 @@
 #include "midi_manager.hpp"
+#include "metrics.hpp"
 #include <chrono>
 #include <cmath>
 #include <array>
@@ -15,9 +16,395 @@ MIDIManager& getMIDIManager() {
     return *g_instance;
 }
 
+namespace {
+// 新着メッセージがなくてもこの間隔でリングバッファを再確認する（秒）
+constexpr double IDLE_WAIT = 0.002;
+
+// 送信時刻の直前はスリープせずスピンで待つ（秒）
+constexpr double SPIN_MARGIN = 0.0003;
+
+// ヒープの比較関数（送信時刻が早い順、同時刻は投入順）
+struct LaterFirst {
+    template <typename T>
+    bool operator()(const T& a, const T& b) const {
+        if (a.sendTime != b.sendTime) {
+            return a.sendTime > b.sendTime;
+        }
+        return a.sequence > b.sequence;
+    }
+};
+
+std::chrono::steady_clock::time_point toTimePoint(double seconds) {
+    return std::chrono::steady_clock::time_point(
+        std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds)));
+}
+} // namespace
+
+//------------------------------------------------------------------------------
+// 出力ポート
+//------------------------------------------------------------------------------
+
+MIDIPort::MIDIPort(const MIDIManager& manager)
+    : owner(manager), device(nullptr), currentDevice(-1), running(false), outputSleeping(false),
+      nextSequence(0), droppedMessages(0), retractedMessages(0), ccFilterReset(false), filteredMessages(0),
+      swapState(SWAP_NONE) {
+}
+
+MIDIPort::~MIDIPort() {
+    close();
+}
+
+// 出力先やデバイスを替える前に出力スレッドを止める（動いていたらtrue）
+// 替えている間に届いたメッセージは出力先へ直接送らず、再開するならキューに積み、
+// 再開しないなら捨てる
+bool MIDIPort::beginSwap() {
+    bool wasRunning = running;
+    swapState.store(wasRunning ? SWAP_QUEUE : SWAP_DROP);
+    if (wasRunning) {
+        stop();
+    }
+    return wasRunning;
+}
+
+void MIDIPort::endSwap(bool wasRunning) {
+    if (wasRunning) {
+        start();
+    }
+    swapState.store(SWAP_NONE);
+}
+
+// 出力先の差し替え（出力スレッドは止めてから呼ぶ）
+void MIDIPort::replaceSink(std::unique_ptr<MIDIOutputSink> newSink) {
+    if (sink) {
+        sink->flush();
+    }
+    sink = std::move(newSink);
+    device = nullptr;
+    currentDevice = -1;
+    ccFilterReset = true;
+}
+
+// 出力先の差し替え
+void MIDIPort::setSink(std::unique_ptr<MIDIOutputSink> newSink) {
+    // 出力スレッドが古い出力先を使っている間は差し替えない
+    bool wasRunning = beginSwap();
+    replaceSink(std::move(newSink));
+    endSwap(wasRunning);
+}
+
+// RtMidiのデバイスを開く
+// 開き直すときも出力スレッドが同じデバイスに送っている間は触らない
+bool MIDIPort::openDevice(int deviceId) {
+    bool wasRunning = beginSwap();
+    bool opened = openDeviceStopped(deviceId);
+    endSwap(wasRunning);
+    return opened;
+}
+
+bool MIDIPort::openDeviceStopped(int deviceId) {
+    if (!sink) {
+        // まだ出力先のないポートにはRtMidiの出力を作る
+        try {
+            std::unique_ptr<RtMidiSink> rtMidi(new RtMidiSink());
+            RtMidiSink* rtMidiDevice = rtMidi.get();
+            replaceSink(std::move(rtMidi));
+            device = rtMidiDevice;
+        } catch (RtMidiError &error) {
+            std::cerr << "MIDI initialization error: " << error.getMessage() << std::endl;
+            return false;
+        }
+    }
+    
+    if (!device) {
+        std::cerr << "MIDI output is not a device" << std::endl;
+        return false;
+    }
+    
+    if (!device->openPort(deviceId)) {
+        return false;
+    }
+    currentDevice = deviceId;
+    // 新しいデバイスには前の値が届いていないので、同じ値のCCも送り直す
+    ccFilterReset = true;
+    return true;
+}
+
+// 出力スレッドを止め、出力先を閉じる
+void MIDIPort::close() {
+    if (running) {
+        stop();
+    }
+    
+    if (sink) {
+        sink->flush();
+    }
+    sink.reset();
+    device = nullptr;
+    currentDevice = -1;
+}
+
+// 出力スレッドが動いていればキュー経由、そうでなければ直接送信
+bool MIDIPort::dispatch(const MIDIMessage& msg) {
+    if (running) {
+        return queueMessage(msg);
+    }
+    int swapping = swapState.load();
+    if (swapping == SWAP_QUEUE) {
+        return queueMessage(msg);
+    }
+    if (swapping == SWAP_DROP) {
+        droppedMessages++;
+        return false;
+    }
+    
+    // 直接送るときは保留したCCを後で送る仕組みがないので、同じ値の削除だけ行う
+    prepareFilter(false);
+    double time = msg.timestamp > 0.0 ? msg.timestamp : MIDIManager::now();
+    if (ccFilter.check(msg, time) != CCFilter::SEND) {
+        filteredMessages++;
+        return true;
+    }
+    bool sent = sendMessage(msg);
+    if (sink) {
+        sink->endBatch();
+    }
+    return sent;
+}
+
+// メッセージをキューに追加（ロックフリー、確保なし）
+bool MIDIPort::queueMessage(const MIDIMessage& msg) {
+    if (!messageQueue.tryPush(QueuedMessage{msg, MIDIManager::now(), false})) {
+        droppedMessages++;
+        return false;
+    }
+    
+    // 出力スレッドが待機中なら起こす（取りこぼしても最大IDLE_WAITで再確認される）
+    if (outputSleeping.load()) {
+        wakeCondition.notify_one();
+    }
+    return true;
+}
+
+// 取り消しの目印をキューに積む（出力スレッドがなければ送信待ちもない）
+bool MIDIPort::retract(double from) {
+    if (!running) {
+        return false;
+    }
+    MIDIMessage marker;
+    marker.timestamp = from;
+    if (!messageQueue.tryPush(QueuedMessage{marker, MIDIManager::now(), true})) {
+        droppedMessages++;
+        return false;
+    }
+    if (outputSleeping.load()) {
+        wakeCondition.notify_one();
+    }
+    return true;
+}
+
+// 出力スレッドの開始
+void MIDIPort::start() {
+    if (running) return;
+    
+    running = true;
+    processingThread = std::thread(&MIDIPort::processMessages, this);
+}
+
+// 出力スレッドの停止
+void MIDIPort::stop() {
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        running = false;
+    }
+    wakeCondition.notify_all();
+    
+    if (processingThread.joinable()) {
+        processingThread.join();
+    }
+}
+
+// 送信するスレッドでCCFilterに設定を反映する
+void MIDIPort::prepareFilter(bool thinning) {
+    if (ccFilterReset.load(std::memory_order_relaxed) && ccFilterReset.exchange(false)) {
+        ccFilter.reset();
+    }
+    ccFilter.configure(owner.getDropRedundantCC(), thinning ? owner.getCCMinInterval() : 0.0);
+}
+
+// リングバッファのメッセージをすべて送信待ちヒープへ移す
+void MIDIPort::drainQueue() {
+    double latency = owner.getOutputLatency();
+    QueuedMessage queued;
+    
+    while (messageQueue.tryPop(queued)) {
+        const MIDIMessage& msg = queued.msg;
+        if (queued.retract) {
+            retractPending(msg.timestamp);
+            continue;
+        }
+        double sendTime = msg.timestamp > 0.0 ? msg.timestamp - latency : 0.0;
+        pending.push_back({sendTime, nextSequence++, msg, queued.queuedAt, false});
+        std::push_heap(pending.begin(), pending.end(), LaterFirst());
+    }
+}
+
+// 時刻 from 以降のチャンネルメッセージを送信待ちから外す
+// ノートオフは、取り消したノートオンの後の同じノートのものだけを外す
+// （それより前に鳴らしたノートのノートオフは残す）
+void MIDIPort::retractPending(double from) {
+    std::sort(pending.begin(), pending.end(),
+              [](const ScheduledMessage& a, const ScheduledMessage& b) { return LaterFirst()(b, a); });
+    uint16_t open[16][128] = {};
+    size_t kept = 0;
+    for (size_t i = 0; i < pending.size(); i++) {
+        const MIDIMessage& msg = pending[i].msg;
+        uint16_t& notes = open[msg.channel & 0x0F][msg.data1 & 0x7F];
+        if (msg.type == MIDIMessage::NOTE_OFF && !pending[i].release && notes > 0) {
+            notes--;
+            continue;
+        }
+        bool retractable = !pending[i].release && msg.type != MIDIMessage::NOTE_OFF && msg.type != MIDIMessage::SYSTEM;
+        if (retractable && msg.timestamp >= from) {
+            if (msg.type == MIDIMessage::NOTE_ON) {
+                notes++;
+            }
+            continue;
+        }
+        pending[kept++] = pending[i];
+    }
+    retractedMessages += pending.size() - kept;
+    pending.resize(kept);
+    std::make_heap(pending.begin(), pending.end(), LaterFirst());
+}
+
+// 1メッセージの送信（CCの間引きを通す）
+void MIDIPort::deliver(const ScheduledMessage& scheduled, double currentTime) {
+    MIDIMessage msg = scheduled.msg;
+    if (scheduled.release) {
+        // 保留していたCCの最新の値（その後に送られていれば何もしない）
+        if (!ccFilter.release(msg.channel, msg.data1, currentTime, msg)) {
+            return;
+        }
+    } else {
+        switch (ccFilter.check(msg, currentTime)) {
+            case CCFilter::SEND:
+                break;
+            case CCFilter::HOLD:
+                pending.push_back({ccFilter.holdUntil(msg.channel, msg.data1), nextSequence++, msg, currentTime, true});
+                std::push_heap(pending.begin(), pending.end(), LaterFirst());
+                filteredMessages++;
+                return;
+            case CCFilter::DROP:
+                filteredMessages++;
+                return;
+        }
+    }
+    
+    // 送れるようになった時刻（積んだ時刻か送信時刻の遅い方）からの遅れ
+    // （時刻の読み出しはティックのスレッドの負担にならないよう出力スレッドだけで行う）
+    Metrics& metrics = getMetrics();
+    double ready = std::max(scheduled.queuedAt, scheduled.sendTime);
+    int64_t started = Metrics::now();
+    metrics.record(Metrics::MIDI_QUEUE, started - static_cast<int64_t>(ready * 1e9));
+    sendMessage(msg);
+    metrics.record(Metrics::MIDI_SEND, Metrics::now() - started);
+}
+
+// 送信時刻に達したメッセージをまとめて送信（まとめて1回で出力先に渡す）
+void MIDIPort::sendDueMessages(double currentTime) {
+    if (pending.empty() || pending.front().sendTime > currentTime) {
+        return;
+    }
+    
+    prepareFilter(true);
+    while (!pending.empty() && pending.front().sendTime <= currentTime) {
+        std::pop_heap(pending.begin(), pending.end(), LaterFirst());
+        ScheduledMessage scheduled = pending.back();
+        pending.pop_back();
+        deliver(scheduled, currentTime);
+    }
+    if (sink) {
+        sink->endBatch();
+    }
+}
+
+// 次の送信時刻まで待機（粗いスリープの後、直前はスピン）
+void MIDIPort::waitForNext() {
+    double current = MIDIManager::now();
+    double deadline = current + IDLE_WAIT;
+    if (!pending.empty() && pending.front().sendTime < deadline) {
+        deadline = pending.front().sendTime;
+    }
+    
+    double coarse = deadline - SPIN_MARGIN;
+    if (coarse > current) {
+        outputSleeping = true;
+        if (messageQueue.empty()) {
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wakeCondition.wait_until(lock, toTimePoint(coarse), [this] {
+                return !running.load() || !messageQueue.empty();
+            });
+        }
+        outputSleeping = false;
+    }
+    
+    if (pending.empty()) {
+        return;
+    }
+    
+    // 送信時刻までスピン（新着があれば先に取り込む）
+    double target = pending.front().sendTime;
+    while (running && messageQueue.empty() && MIDIManager::now() < target) {
+        std::this_thread::yield();
+    }
+}
+
+// 停止時に残っているメッセージを時刻を無視して送り切る（ノートの鳴りっぱなし防止）
+void MIDIPort::flushPending() {
+    drainQueue();
+    
+    // 保留したCCも最新の値を送る（間隔の制限はもう守らない）
+    prepareFilter(false);
+    double currentTime = MIDIManager::now();
+    while (!pending.empty()) {
+        std::pop_heap(pending.begin(), pending.end(), LaterFirst());
+        ScheduledMessage scheduled = pending.back();
+        pending.pop_back();
+        deliver(scheduled, currentTime);
+    }
+    if (sink) {
+        sink->endBatch();
+    }
+}
+
+// キュー内のMIDIメッセージを処理（出力スレッド）
+void MIDIPort::processMessages() {
+    pending.reserve(QUEUE_CAPACITY * 2);
+    
+    while (running) {
+        drainQueue();
+        sendDueMessages(MIDIManager::now());
+        waitForNext();
+    }
+    
+    flushPending();
+}
+
+// MIDIメッセージの実際の送信処理
+bool MIDIPort::sendMessage(const MIDIMessage& msg) {
+    return sink && sink->send(msg);
+}
+
+//------------------------------------------------------------------------------
+// MIDIManager
+//------------------------------------------------------------------------------
+
 // コンストラクタ
 MIDIManager::MIDIManager()
-    : currentOutputDevice(-1), initialized(false), running(false) {
+    : initialized(false), processing(false), outputLatency(0.0), dropRedundantCC(true), ccMinInterval(0.0) {
+    for (auto& port : ports) {
+        port.reset(new MIDIPort(*this));
+    }
 }
 
 // デストラクタ
@@ -32,17 +419,13 @@ bool MIDIManager::initialize() {
     }
     
     try {
-        midiOut = std::make_unique<RtMidiOut>();
+        // 利用可能なMIDI出力ポートはRtMidiSinkの作成時にスキャンされる
+        // （作ったものはそのままポート0の出力先にする）
+        std::unique_ptr<RtMidiSink> rtMidi(new RtMidiSink());
+        availableOutputs = rtMidi->getPortNames();
+        ports[0]->setSink(std::move(rtMidi));
         initialized = true;
         
-        // 利用可能なMIDI出力ポートをスキャン
-        availableOutputs.clear();
-        unsigned int portCount = midiOut->getPortCount();
-        
-        for (unsigned int i = 0; i < portCount; i++) {
-            availableOutputs.push_back(midiOut->getPortName(i));
-        }
-        
         return true;
     } catch (RtMidiError &error) {
         std::cerr << "MIDI initialization error: " << error.getMessage() << std::endl;
@@ -60,35 +443,56 @@ std::vector<std::string> MIDIManager::getAvailableOutputs() {
     return availableOutputs;
 }
 
-// MIDI出力デバイスを開く
-bool MIDIManager::openOutputDevice(int deviceId) {
+// ポートにMIDI出力デバイスを開く
+bool MIDIManager::openOutputDevice(int deviceId, int port) {
     if (!initialized && !initialize()) {
         return false;
     }
     
-    try {
-        if (deviceId >= 0 && deviceId < static_cast<int>(availableOutputs.size())) {
-            if (midiOut->isPortOpen()) {
-                midiOut->closePort();
-            }
-            
-            midiOut->openPort(deviceId);
-            currentOutputDevice = deviceId;
-            std::cout << "MIDI output device opened: " << availableOutputs[deviceId] << std::endl;
-            return true;
-        } else {
-            std::cerr << "Invalid MIDI output device ID: " << deviceId << std::endl;
-            return false;
-        }
-    } catch (RtMidiError &error) {
-        std::cerr << "MIDI output device open error: " << error.getMessage() << std::endl;
+    MIDIPort* target = getPort(port);
+    if (!target) {
+        std::cerr << "Invalid MIDI port: " << port << " (0-" << MAX_PORTS - 1 << ")" << std::endl;
+        return false;
+    }
+    
+    if (deviceId < 0 || deviceId >= static_cast<int>(availableOutputs.size())) {
+        std::cerr << "Invalid MIDI output device ID: " << deviceId << std::endl;
+        return false;
+    }
+    
+    if (!target->openDevice(deviceId)) {
         return false;
     }
+    if (processing && !target->isRunning()) {
+        target->start();
+    }
+    std::cout << "MIDI output device opened: " << availableOutputs[deviceId] << " (port " << port << ")" << std::endl;
+    return true;
 }
 
-// 現在のMIDI出力デバイスIDを取得
-int MIDIManager::getCurrentOutputDevice() const {
-    return currentOutputDevice;
+// 出力先の差し替え
+void MIDIManager::setOutputSink(std::unique_ptr<MIDIOutputSink> newSink, int port) {
+    MIDIPort* target = getPort(port);
+    if (!target) {
+        std::cerr << "Invalid MIDI port: " << port << " (0-" << MAX_PORTS - 1 << ")" << std::endl;
+        return;
+    }
+    
+    target->setSink(std::move(newSink));
+    if (processing && target->getSink() && !target->isRunning()) {
+        target->start();
+    }
+}
+
+MIDIOutputSink* MIDIManager::getOutputSink(int port) const {
+    MIDIPort* target = getPort(port);
+    return target ? target->getSink() : nullptr;
+}
+
+// ポートのMIDI出力デバイスIDを取得
+int MIDIManager::getCurrentOutputDevice(int port) const {
+    MIDIPort* target = getPort(port);
+    return target ? target->getCurrentDevice() : -1;
 }
 
 // 初期化状態を取得
@@ -98,163 +502,162 @@ bool MIDIManager::isInitialized() const {
 
 // リソース解放
 void MIDIManager::cleanup() {
-    if (running) {
-        stopProcessing();
+    processing = false;
+    for (auto& port : ports) {
+        port->close();
     }
-    
-    if (initialized && midiOut) {
-        if (midiOut->isPortOpen()) {
-            midiOut->closePort();
-        }
-    }
-    
-    midiOut.reset();
     initialized = false;
 }
 
 // MIDIノートオンメッセージの送信
-bool MIDIManager::sendNoteOn(int channel, int note, int velocity) {
-    MIDIMessage msg(MIDIMessage::NOTE_ON, channel, note, velocity);
-    return sendMessage(msg);
+bool MIDIManager::sendNoteOn(int channel, int note, int velocity, double timestamp, int port) {
+    MIDIMessage msg(MIDIMessage::NOTE_ON, channel, note, velocity, timestamp);
+    return dispatch(msg, port);
 }
 
 // MIDIノートオフメッセージの送信
-bool MIDIManager::sendNoteOff(int channel, int note) {
-    MIDIMessage msg(MIDIMessage::NOTE_OFF, channel, note, 0);
-    return sendMessage(msg);
+bool MIDIManager::sendNoteOff(int channel, int note, double timestamp, int port) {
+    MIDIMessage msg(MIDIMessage::NOTE_OFF, channel, note, 0, timestamp);
+    return dispatch(msg, port);
 }
 
 // MIDIコントロールチェンジメッセージの送信
-bool MIDIManager::sendCC(int channel, int controller, int value) {
-    MIDIMessage msg(MIDIMessage::CC, channel, controller, value);
-    return sendMessage(msg);
+bool MIDIManager::sendCC(int channel, int controller, int value, double timestamp, int port) {
+    MIDIMessage msg(MIDIMessage::CC, channel, controller, value, timestamp);
+    return dispatch(msg, port);
 }
 
 // MIDIプログラムチェンジメッセージの送信
-bool MIDIManager::sendProgramChange(int channel, int program) {
-    MIDIMessage msg(MIDIMessage::PROGRAM_CHANGE, channel, program);
-    return sendMessage(msg);
+bool MIDIManager::sendProgramChange(int channel, int program, double timestamp, int port) {
+    MIDIMessage msg(MIDIMessage::PROGRAM_CHANGE, channel, program, 0, timestamp);
+    return dispatch(msg, port);
 }
 
 // MIDIピッチベンドメッセージの送信
-bool MIDIManager::sendPitchBend(int channel, int value) {
-    MIDIMessage msg(MIDIMessage::PITCH_BEND, channel, value & 0x7F, (value >> 7) & 0x7F);
-    return sendMessage(msg);
+bool MIDIManager::sendPitchBend(int channel, int value, double timestamp, int port) {
+    MIDIMessage msg(MIDIMessage::PITCH_BEND, channel, value & 0x7F, (value >> 7) & 0x7F, timestamp);
+    return dispatch(msg, port);
 }
 
 // MIDIアフタータッチメッセージの送信
-bool MIDIManager::sendAftertouch(int channel, int note, int pressure) {
-    MIDIMessage msg(MIDIMessage::AFTERTOUCH, channel, note, pressure);
-    return sendMessage(msg);
+bool MIDIManager::sendAftertouch(int channel, int note, int pressure, double timestamp, int port) {
+    MIDIMessage msg(MIDIMessage::AFTERTOUCH, channel, note, pressure, timestamp);
+    return dispatch(msg, port);
 }
 
 // MIDIチャンネルプレッシャーメッセージの送信
-bool MIDIManager::sendChannelPressure(int channel, int pressure) {
-    MIDIMessage msg(MIDIMessage::AFTERTOUCH, channel, pressure);
-    return sendMessage(msg);
+bool MIDIManager::sendChannelPressure(int channel, int pressure, double timestamp, int port) {
+    MIDIMessage msg(MIDIMessage::AFTERTOUCH, channel, pressure, 0, timestamp);
+    return dispatch(msg, port);
 }
 
-// メッセージをキューに追加
-void MIDIManager::queueMessage(const MIDIMessage& msg) {
-    std::lock_guard<std::mutex> lock(queueMutex);
-    messageQueue.push(msg);
+// システムメッセージの送信（クロック、スタート、ストップ、ソングポジションなど）
+bool MIDIManager::sendSystem(int status, int data, double timestamp, int port) {
+    MIDIMessage msg(MIDIMessage::SYSTEM, 0, status, data, timestamp);
+    return dispatch(msg, port);
 }
 
-// メッセージ処理スレッドの開始
+// 指定したポートへ送信
+bool MIDIManager::dispatch(const MIDIMessage& msg, int port) {
+    MIDIPort* target = getPort(port);
+    return target && target->dispatch(msg);
+}
+
+// スケジューリング用の現在時刻
+double MIDIManager::now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// メッセージをポートのキューに追加
+bool MIDIManager::queueMessage(const MIDIMessage& msg, int port) {
+    MIDIPort* target = getPort(port);
+    return target && target->queueMessage(msg);
+}
+
+// 出力先のあるポートごとに出力スレッドを開始
 void MIDIManager::startProcessing() {
-    if (running) return;
-    
-    running = true;
-    processingThread = std::thread(&MIDIManager::processMessages, this);
+    processing = true;
+    for (auto& port : ports) {
+        if (port->getSink() && !port->isRunning()) {
+            port->start();
+        }
+    }
 }
 
-// メッセージ処理スレッドの停止
+// すべての出力スレッドを停止
 void MIDIManager::stopProcessing() {
-    running = false;
-    if (processingThread.joinable()) {
-        processingThread.join();
+    processing = false;
+    for (auto& port : ports) {
+        port->stop();
     }
 }
 
-// キュー内のMIDIメッセージを処理
-void MIDIManager::processMessages() {
-    while (running) {
-        MIDIMessage msg(MIDIMessage::NOTE_OFF, 0, 0);
-        bool hasMessage = false;
-        
-        {
-            std::lock_guard<std::mutex> lock(queueMutex);
-            if (!messageQueue.empty()) {
-                msg = messageQueue.front();
-                messageQueue.pop();
-                hasMessage = true;
-            }
-        }
-        
-        if (hasMessage) {
-            sendMessage(msg);
+// 出力スレッドが動作中か
+bool MIDIManager::isProcessing() const {
+    return processing.load();
+}
+
+// レイテンシ補正の設定
+void MIDIManager::setOutputLatency(double seconds) {
+    outputLatency = seconds < 0.0 ? 0.0 : seconds;
+}
+
+double MIDIManager::getOutputLatency() const {
+    return outputLatency.load();
+}
+
+uint64_t MIDIManager::getDroppedMessages() const {
+    uint64_t total = 0;
+    for (const auto& port : ports) {
+        total += port->getDroppedMessages();
+    }
+    return total;
+}
+
+bool MIDIManager::retract(double from) {
+    for (const auto& port : ports) {
+        if (!port->canRetract()) {
+            return false;
         }
-        
-        // スリープして CPU 使用率を抑える
-        std::this_thread::sleep_for(std::chrono::milliseconds(1));
     }
+    for (const auto& port : ports) {
+        port->retract(from);
+    }
+    return true;
 }
 
-// MIDIメッセージの実際の送信処理
-bool MIDIManager::sendMessage(const MIDIMessage& msg) {
-    if (!initialized || !midiOut || !midiOut->isPortOpen()) {
-        return false;
+uint64_t MIDIManager::getRetractedMessages() const {
+    uint64_t total = 0;
+    for (const auto& port : ports) {
+        total += port->getRetractedMessages();
     }
-    
-    try {
-        std::vector<unsigned char> message;
-        
-        switch (msg.type) {
-            case MIDIMessage::NOTE_ON:
-                message.push_back(0x90 | (msg.channel & 0x0F));
-                message.push_back(msg.data1 & 0x7F);
-                message.push_back(msg.data2 & 0x7F);
-                break;
-                
-            case MIDIMessage::NOTE_OFF:
-                message.push_back(0x80 | (msg.channel & 0x0F));
-                message.push_back(msg.data1 & 0x7F);
-                message.push_back(msg.data2 & 0x7F);
-                break;
-                
-            case MIDIMessage::CC:
-                message.push_back(0xB0 | (msg.channel & 0x0F));
-                message.push_back(msg.data1 & 0x7F);
-                message.push_back(msg.data2 & 0x7F);
-                break;
-                
-            case MIDIMessage::PROGRAM_CHANGE:
-                message.push_back(0xC0 | (msg.channel & 0x0F));
-                message.push_back(msg.data1 & 0x7F);
-                break;
-                
-            case MIDIMessage::AFTERTOUCH:
-                message.push_back(0xA0 | (msg.channel & 0x0F));
-                message.push_back(msg.data1 & 0x7F);
-                message.push_back(msg.data2 & 0x7F);
-                break;
-                
-            case MIDIMessage::PITCH_BEND:
-                message.push_back(0xE0 | (msg.channel & 0x0F));
-                message.push_back(msg.data1 & 0x7F);
-                message.push_back(msg.data2 & 0x7F);
-                break;
-                
-            default:
-                return false;
-        }
-        
-        midiOut->sendMessage(&message);
-        return true;
-    } catch (RtMidiError &error) {
-        std::cerr << "MIDI send error: " << error.getMessage() << std::endl;
-        return false;
+    return total;
+}
+
+// CCの間引きの設定
+void MIDIManager::setDropRedundantCC(bool enabled) {
+    dropRedundantCC = enabled;
+}
+
+bool MIDIManager::getDropRedundantCC() const {
+    return dropRedundantCC.load();
+}
+
+void MIDIManager::setCCRateLimit(double hz) {
+    ccMinInterval = hz > 0.0 ? 1.0 / hz : 0.0;
+}
+
+double MIDIManager::getCCRateLimit() const {
+    double interval = ccMinInterval.load();
+    return interval > 0.0 ? 1.0 / interval : 0.0;
+}
+
+uint64_t MIDIManager::getFilteredMessages() const {
+    uint64_t total = 0;
+    for (const auto& port : ports) {
+        total += port->getFilteredMessages();
     }
+    return total;
 }
 
 // MIDI ノート番号から名前へ変換
@@ -1,14 +1,17 @@
 #ifndef REELIA_MIDI_MANAGER_HPP
 #define REELIA_MIDI_MANAGER_HPP
 
-#include "RtMidi.h"
+#include "midi_output.hpp"
+#include "spsc_queue.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <iostream>
 #include <memory>
 #include <thread>
 #include <mutex>
-#include <queue>
 #include <map>
 
 /**
@@ -26,36 +29,177 @@ struct MIDIMessage {
         SYSTEM
     };
     
+    // SYSTEMのdata1（ステータスバイト）。ソングポジションはdata2に16分音符単位の位置
+    enum SystemStatus {
+        SONG_POSITION = 0xF2,
+        CLOCK = 0xF8,
+        START = 0xFA,
+        CONTINUE = 0xFB,
+        STOP = 0xFC
+    };
+    
     Type type;
     int channel;  // 0-15
     int data1;    // ノート番号、CCナンバーなど
     int data2;    // ベロシティ、CCバリューなど
-    double timestamp; // 将来的なスケジューリング用
+    double timestamp; // 送信予定時刻（MIDIManager::now()基準の秒、0なら即時）
+    
+    MIDIMessage()
+        : type(SYSTEM), channel(0), data1(0), data2(0), timestamp(0.0) {}
     
     MIDIMessage(Type t, int ch, int d1, int d2 = 0, double ts = 0.0)
         : type(t), channel(ch), data1(d1), data2(d2), timestamp(ts) {}
 };
 
+class MIDIManager;
+
 /**
- * MIDIデバイス管理クラス
- * RtMidiを使用してMIDI出力を処理
+ * MIDI出力ポート
+ * 出力先（デバイスやファイル）1つと、その専用のキュー・出力スレッド・
+ * 送信待ちヒープを持つ。ポートごとに別のスレッドが送信するので、
+ * 遅いデバイスがあっても他のポートの送信は待たされない。
  */
-class MIDIManager {
+class MIDIPort {
 private:
-    std::unique_ptr<RtMidiOut> midiOut;
-    std::vector<std::string> availableOutputs;
-    int currentOutputDevice;
-    bool initialized;
+    // レイテンシ補正とCCの間引きの設定は全ポート共通
+    const MIDIManager& owner;
+    
+    // 出力先と、それがRtMidiのデバイスならその参照（差し替えたらnullptr）
+    std::unique_ptr<MIDIOutputSink> sink;
+    RtMidiSink* device;
+    int currentDevice;
     
-    // MIDIイベントキュー
-    std::queue<MIDIMessage> messageQueue;
-    std::mutex queueMutex;
+    // ティックスレッドから出力スレッドへのSPSCリングバッファ
+    // （生産者はティックスレッドのみ。入力スレッドからの送信は環境ロックで直列化される前提）
+    // 積んだ時刻はキューから出力までの遅れの計測に使う
+    // retract なら送信ではなく取り消しの目印（msg.timestamp 以降を取り消す）
+    struct QueuedMessage {
+        MIDIMessage msg;
+        double queuedAt;
+        bool retract;
+    };
+    static constexpr size_t QUEUE_CAPACITY = 4096;
+    SPSCQueue<QueuedMessage, QUEUE_CAPACITY> messageQueue;
     std::thread processingThread;
-    bool running;
+    std::atomic<bool> running;
+    
+    // 出力スレッドが待機中のときだけ生産者が起こす
+    std::mutex wakeMutex;
+    std::condition_variable wakeCondition;
+    std::atomic<bool> outputSleeping;
+    
+    // 出力スレッド側の送信待ちメッセージ（送信時刻順のヒープ、出力スレッド専用）
+    struct ScheduledMessage {
+        double sendTime;
+        uint64_t sequence; // 同時刻メッセージの順序保持用
+        MIDIMessage msg;
+        double queuedAt;
+        bool release; // CCFilterで保留したCCを送る時刻の目印
+    };
+    std::vector<ScheduledMessage> pending;
+    uint64_t nextSequence;
+    
+    // キューが満杯で破棄したメッセージ数
+    std::atomic<uint64_t> droppedMessages;
+    
+    // 取り消した送信待ちメッセージ数
+    std::atomic<uint64_t> retractedMessages;
+    
+    // 同じ値のCCの削除と、CCの送信間隔の制限（状態は送信するスレッドだけが触る）
+    CCFilter ccFilter;
+    std::atomic<bool> ccFilterReset;
+    std::atomic<uint64_t> filteredMessages;
+    
+    // 出力先・デバイスを替えている最中か（替えている間は出力先に直接送らない）
+    enum SwapState { SWAP_NONE, SWAP_QUEUE, SWAP_DROP };
+    std::atomic<int> swapState;
     
     // 内部メソッド
     void processMessages();
+    void drainQueue();
+    void sendDueMessages(double currentTime);
+    void waitForNext();
+    void flushPending();
+    void retractPending(double from);
     bool sendMessage(const MIDIMessage& msg);
+    void prepareFilter(bool thinning);
+    void deliver(const ScheduledMessage& scheduled, double currentTime);
+    bool beginSwap();
+    void endSwap(bool wasRunning);
+    void replaceSink(std::unique_ptr<MIDIOutputSink> newSink);
+    bool openDeviceStopped(int deviceId);
+    
+public:
+    explicit MIDIPort(const MIDIManager& manager);
+    ~MIDIPort();
+    
+    MIDIPort(const MIDIPort&) = delete;
+    MIDIPort& operator=(const MIDIPort&) = delete;
+    
+    // 出力先の差し替え（出力スレッドが動いていれば再起動する）
+    void setSink(std::unique_ptr<MIDIOutputSink> newSink);
+    MIDIOutputSink* getSink() const { return sink.get(); }
+    
+    // RtMidiのデバイスを開く（出力先がデバイスでなければ作る。出力スレッドは止めて開き直す）
+    bool openDevice(int deviceId);
+    int getCurrentDevice() const { return currentDevice; }
+    
+    // 出力スレッドが動いていればキュー経由、そうでなければ直接送信
+    bool dispatch(const MIDIMessage& msg);
+    bool queueMessage(const MIDIMessage& msg);
+    
+    // 時刻 from 以降に送る予定のメッセージの取り消し（生産者のスレッドから呼ぶ）
+    // キューの中の順序を保つので、この後に積んだメッセージは取り消されない
+    // システムメッセージと、取り消さないノートオンのノートオフは残す
+    // （鳴っているノートを止めそこなわないように）
+    bool retract(double from);
+
+    // 取り消しの目印を積む空きがあるか（生産者のスレッドから呼ぶ。出力スレッドが
+    // キューを空けるだけなので、真ならこの後の retract は必ず積める）
+    bool canRetract() const { return !running || messageQueue.size() < QUEUE_CAPACITY; }
+    
+    // 出力スレッドの開始と停止
+    void start();
+    void stop();
+    bool isRunning() const { return running.load(); }
+    
+    // 出力スレッドを止め、出力先を閉じる
+    void close();
+    
+    uint64_t getDroppedMessages() const { return droppedMessages.load(); }
+    uint64_t getFilteredMessages() const { return filteredMessages.load(); }
+    uint64_t getRetractedMessages() const { return retractedMessages.load(); }
+};
+
+/**
+ * MIDIデバイス管理クラス
+ * MAX_PORTS 個の出力ポートを持ち、ポート番号で指定した出力先
+ * （既定はRtMidiのデバイス）へMIDIメッセージを送る
+ */
+class MIDIManager {
+public:
+    static constexpr int MAX_PORTS = 8;
+    
+private:
+    std::unique_ptr<MIDIPort> ports[MAX_PORTS];
+    std::vector<std::string> availableOutputs;
+    bool initialized;
+    
+    // 出力先を持つポートの出力スレッドを動かすか（後から開いたポートもすぐ動かす）
+    std::atomic<bool> processing;
+    
+    // レイテンシ補正（秒）。この分だけ早めに送信する
+    std::atomic<double> outputLatency;
+    
+    // CCの間引きの設定（全ポート共通）
+    std::atomic<bool> dropRedundantCC;
+    std::atomic<double> ccMinInterval;
+    
+    // 範囲外のポート番号ならnullptr
+    MIDIPort* getPort(int port) const {
+        return port >= 0 && port < MAX_PORTS ? ports[port].get() : nullptr;
+    }
+    bool dispatch(const MIDIMessage& msg, int port);
     
 public:
     MIDIManager();
@@ -65,23 +209,55 @@ public:
     bool initialize();
     void cleanup();
     std::vector<std::string> getAvailableOutputs();
-    bool openOutputDevice(int deviceId);
-    int getCurrentOutputDevice() const;
+    bool openOutputDevice(int deviceId, int port = 0);
+    int getCurrentOutputDevice(int port = 0) const;
     bool isInitialized() const;
     
-    // MIDIメッセージ送信
-    bool sendNoteOn(int channel, int note, int velocity);
-    bool sendNoteOff(int channel, int note);
-    bool sendCC(int channel, int controller, int value);
-    bool sendProgramChange(int channel, int program);
-    bool sendPitchBend(int channel, int value);
-    bool sendAftertouch(int channel, int note, int pressure);
-    bool sendChannelPressure(int channel, int pressure);
+    // 出力先の差し替え（ファイル書き出しや出力なしに使う。出力スレッドは再起動する）
+    void setOutputSink(std::unique_ptr<MIDIOutputSink> newSink, int port = 0);
+    MIDIOutputSink* getOutputSink(int port = 0) const;
+    
+    // MIDIメッセージ送信（timestampを指定するとその時刻に送信、0なら即時）
+    bool sendNoteOn(int channel, int note, int velocity, double timestamp = 0.0, int port = 0);
+    bool sendNoteOff(int channel, int note, double timestamp = 0.0, int port = 0);
+    bool sendCC(int channel, int controller, int value, double timestamp = 0.0, int port = 0);
+    bool sendProgramChange(int channel, int program, double timestamp = 0.0, int port = 0);
+    bool sendPitchBend(int channel, int value, double timestamp = 0.0, int port = 0);
+    bool sendAftertouch(int channel, int note, int pressure, double timestamp = 0.0, int port = 0);
+    bool sendChannelPressure(int channel, int pressure, double timestamp = 0.0, int port = 0);
+    // システムメッセージ（status: MIDIMessage::SystemStatus、data: ソングポジション）
+    bool sendSystem(int status, int data = 0, double timestamp = 0.0, int port = 0);
     
     // キューベースのメッセージスケジューリング
-    void queueMessage(const MIDIMessage& msg);
+    // 出力スレッドは出力先のあるポートごとに1つ
+    bool queueMessage(const MIDIMessage& msg, int port = 0);
     void startProcessing();
     void stopProcessing();
+    bool isProcessing() const;
+    
+    // レイテンシ補正（デバイスの遅延分だけ早めに送信する）
+    void setOutputLatency(double seconds);
+    double getOutputLatency() const;
+    
+    // 全ポートの合計
+    uint64_t getDroppedMessages() const;
+    
+    // 全ポートの時刻 from 以降の送信待ちメッセージの取り消し（MIDIPort::retract）
+    // どれかのポートのキューが満杯なら、どのポートも取り消さずにfalse
+    bool retract(double from);
+    uint64_t getRetractedMessages() const;
+    
+    // CCの間引き。同じ値のCCを送らない（既定はオン）、同じCCを送る最大頻度（Hz、0なら制限なし）
+    // 送信間隔の制限は出力スレッドが動いているときだけ働く
+    void setDropRedundantCC(bool enabled);
+    bool getDropRedundantCC() const;
+    void setCCRateLimit(double hz);
+    double getCCRateLimit() const;
+    double getCCMinInterval() const { return ccMinInterval.load(); }
+    uint64_t getFilteredMessages() const;
+    
+    // スケジューリング用の現在時刻（steady_clock基準の秒）
+    static double now();
     
     // ユーティリティ
     static std::string noteName(int noteNumber);
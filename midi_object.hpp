@@ -4,8 +4,14 @@
 #include "base_object.hpp"
 #include "environment.hpp"
 #include "midi_manager.hpp"
+#include <algorithm>
 #include <vector>
 
+// MIDI出力ポート番号を有効な範囲に制限
+inline int clampPort(int port) {
+    return std::min(MIDIManager::MAX_PORTS - 1, std::max(0, port));
+}
+
 /**
  * MIDI Note オブジェクト
  * シーケンサーに接続してMIDIノートを送信
@@ -16,91 +22,126 @@ private:
     int note;          // MIDIノート (0-127)
     int velocity;      // ベロシティ (0-127)
     int duration;      // ノート持続時間（ティック数）
-    int durationCount; // 持続時間カウンター
+    int gate;          // 持続時間のうち実際に鳴らす割合 (1-100%)
+    int port;          // MIDI出力ポート (0-MAX_PORTS-1)
     bool isPlaying;    // 再生状態
+    NoteOffWheel::Handle noteOff; // 予約中のノートオフ
     
 public:
     MIDINoteObject() 
         : channel(0), note(60), velocity(100),
-          duration(1), durationCount(0), isPlaying(false) {}
+          duration(1), gate(100), port(0), isPlaying(false),
+          noteOff(NoteOffWheel::INVALID_HANDLE) {}
     
     std::string getType() const override { return "midi_note"; }
     
+    static const ObjectType &objectType();
+    const ObjectType &getObjectType() const override { return objectType(); }
+    
     int getValue() const override { return isPlaying ? velocity : 0; }
+
+    // 鳴っている間だけノートオフを見届ける
+    bool needsTick() const override { return isPlaying; }
+    bool isRunning() const override { return isPlaying; }
     
-    void setAttribute(const std::string &name, BaseObject* value) override {
-        if (name == "channel") {
-            channel = value->getValue() & 0x0F;  // 0-15に制限
-        } else if (name == "note") {
-            note = value->getValue() & 0x7F;     // 0-127に制限
-        } else if (name == "velocity") {
-            velocity = value->getValue() & 0x7F; // 0-127に制限
-        } else if (name == "duration") {
-            duration = value->getValue();
-            if (duration < 1) duration = 1;
-        } else {
-            throw std::runtime_error("Unknown attribute: " + name);
+    void setAttr(const AttrKey &key, Value value) override {
+        switch (key.id) {
+            case Attr::CHANNEL:
+                channel = value.asInt() & 0x0F;  // 0-15に制限
+                break;
+            case Attr::NOTE:
+                note = value.asInt() & 0x7F;     // 0-127に制限
+                break;
+            case Attr::VELOCITY:
+                velocity = value.asInt() & 0x7F; // 0-127に制限
+                break;
+            case Attr::DURATION:
+                duration = std::max(1, value.asInt());
+                break;
+            case Attr::GATE:
+                gate = std::min(100, std::max(1, value.asInt()));
+                break;
+            case Attr::PORT:
+                port = clampPort(value.asInt());
+                break;
+            default:
+                BaseObject::setAttr(key, value);
         }
     }
     
-    BaseObject* getAttribute(const std::string &name) override {
-        if (name == "channel") {
-            return new IntObject(channel);
-        } else if (name == "note") {
-            return new IntObject(note);
-        } else if (name == "velocity") {
-            return new IntObject(velocity);
-        } else if (name == "duration") {
-            return new IntObject(duration);
-        } else if (name == "playing") {
-            return new IntObject(isPlaying ? 1 : 0);
-        } else {
-            throw std::runtime_error("Unknown attribute: " + name);
+    Value getAttr(const AttrKey &key) const override {
+        switch (key.id) {
+            case Attr::CHANNEL:  return Value::integer(channel);
+            case Attr::NOTE:     return Value::integer(note);
+            case Attr::VELOCITY: return Value::integer(velocity);
+            case Attr::DURATION: return Value::integer(duration);
+            case Attr::GATE:     return Value::integer(gate);
+            case Attr::PORT:     return Value::integer(port);
+            case Attr::PLAYING:  return Value::integer(isPlaying ? 1 : 0);
+            default:             return BaseObject::getAttr(key);
         }
     }
     
-    BaseObject* clone() const override {
-        MIDINoteObject* clone = new MIDINoteObject();
+    ObjectPtr clone() const override {
+        // 予約中のノートオフは元のオブジェクトが持つため複製しない
+        std::unique_ptr<MIDINoteObject> clone(new MIDINoteObject());
         clone->channel = this->channel;
         clone->note = this->note;
         clone->velocity = this->velocity;
         clone->duration = this->duration;
-        clone->durationCount = this->durationCount;
-        clone->isPlaying = this->isPlaying;
+        clone->gate = this->gate;
+        clone->port = this->port;
         return clone;
     }
+
+    // 先読みで戻すときは予約中のノートオフも戻す
+    // （戻した先より後に予約したものは先読みが取り消す）
+    void copyState(const BaseObject& other) override {
+        BaseObject::copyState(other);
+        const MIDINoteObject& o = static_cast<const MIDINoteObject&>(other);
+        channel = o.channel;
+        note = o.note;
+        velocity = o.velocity;
+        duration = o.duration;
+        gate = o.gate;
+        port = o.port;
+        isPlaying = o.isPlaying;
+        noteOff = o.noteOff;
+    }
+
+    // 鳴っているノートは残さない（ノートオフは元の環境が持つため）
+    void save(SnapshotWriter& out) const override;
+    bool load(SnapshotReader& in) override;
     
-    void onTick(Environment& /* env */) override {
-        if (isPlaying) {
-            durationCount++;
-            if (durationCount >= duration) {
-                // ノート持続時間が経過したらノートオフを送信
-                getMIDIManager().sendNoteOff(channel, note);
-                isPlaying = false;
-                durationCount = 0;
-            }
+    void onTick(Environment& env) override {
+        // ノートオフはタイマーホイールが送信するので状態だけ更新する
+        if (isPlaying && !env.isNoteOffPending(noteOff)) {
+            isPlaying = false;
+            noteOff = NoteOffWheel::INVALID_HANDLE;
         }
     }
     
     // ノートトリガーメソッド（イベントキューから呼び出される）
-    void trigger() {
+    void trigger(Environment& env) {
         if (isPlaying) {
-            // 既に再生中の場合、いったんノートオフを送信
-            getMIDIManager().sendNoteOff(channel, note);
+            // 既に再生中の場合、予約を取り消していったんノートオフを送信
+            env.cancelNoteOff(noteOff);
+            env.sendNoteOff(channel, note, port);
         }
         
-        // ノートオンを送信
-        getMIDIManager().sendNoteOn(channel, note, velocity);
-        isPlaying = true;
-        durationCount = 0;
+        // ノートオンを送信し、ノートオフを予約
+        env.sendNoteOn(channel, note, velocity, port);
+        noteOff = env.scheduleNoteOff(duration, gate, channel, note, port);
+        isPlaying = env.isNoteOffPending(noteOff);
     }
     
     // ノート停止メソッド（イベントキューから呼び出される）
-    void stop() {
+    void stop(Environment& env) {
         if (isPlaying) {
-            getMIDIManager().sendNoteOff(channel, note);
+            env.cancelNoteOff(noteOff);
+            env.sendNoteOff(channel, note, port);
             isPlaying = false;
-            durationCount = 0;
+            noteOff = NoteOffWheel::INVALID_HANDLE;
         }
     }
     
@@ -108,6 +149,9 @@ public:
         return "midi_note: ch=" + std::to_string(channel) + 
                " note=" + getMIDIManager().noteName(note) + 
                " vel=" + std::to_string(velocity) + 
+               " dur=" + std::to_string(duration) +
+               " gate=" + std::to_string(gate) + "%" +
+               (port != 0 ? " port=" + std::to_string(port) : "") +
                (isPlaying ? " [playing]" : "");
     }
 };
@@ -121,56 +165,91 @@ private:
     int channel;     // MIDIチャンネル (0-15)
     int controller;  // コントローラー番号 (0-127)
     int value;       // CC値 (0-127)
+    int port;        // MIDI出力ポート (0-MAX_PORTS-1)
+    Environment* env; // 登録先の環境（送信の時刻とポートの対応に使う。未登録ならnullptr）
     
 public:
-    MIDICCObject() : channel(0), controller(1), value(0) {}
+    MIDICCObject() : channel(0), controller(1), value(0), port(0), env(nullptr) {}
     
     std::string getType() const override { return "midi_cc"; }
     
+    static const ObjectType &objectType();
+    const ObjectType &getObjectType() const override { return objectType(); }
+    
     int getValue() const override { return value; }
     
-    void setAttribute(const std::string &name, BaseObject* val) override {
-        if (name == "channel") {
-            channel = val->getValue() & 0x0F;      // 0-15に制限
-        } else if (name == "controller" || name == "cc") {
-            controller = val->getValue() & 0x7F;   // 0-127に制限
-        } else if (name == "value") {
-            value = val->getValue() & 0x7F;        // 0-127に制限
-            // 値が変更されたら即座にCC送信
-            getMIDIManager().sendCC(channel, controller, value);
-        } else {
-            throw std::runtime_error("Unknown attribute: " + name);
+    void setAttr(const AttrKey &key, Value val) override {
+        switch (key.id) {
+            case Attr::CHANNEL:
+                channel = val.asInt() & 0x0F;      // 0-15に制限
+                break;
+            case Attr::CONTROLLER:
+                controller = val.asInt() & 0x7F;   // 0-127に制限
+                break;
+            case Attr::VALUE:
+                value = val.asInt() & 0x7F;        // 0-127に制限
+                // 値が変更されたら即座にCC送信
+                send();
+                break;
+            case Attr::PORT:
+                port = clampPort(val.asInt());
+                break;
+            default:
+                BaseObject::setAttr(key, val);
         }
     }
     
-    BaseObject* getAttribute(const std::string &name) override {
-        if (name == "channel") {
-            return new IntObject(channel);
-        } else if (name == "controller" || name == "cc") {
-            return new IntObject(controller);
-        } else if (name == "value") {
-            return new IntObject(value);
-        } else {
-            throw std::runtime_error("Unknown attribute: " + name);
+    Value getAttr(const AttrKey &key) const override {
+        switch (key.id) {
+            case Attr::CHANNEL:    return Value::integer(channel);
+            case Attr::CONTROLLER: return Value::integer(controller);
+            case Attr::VALUE:      return Value::integer(value);
+            case Attr::PORT:       return Value::integer(port);
+            default:               return BaseObject::getAttr(key);
         }
     }
     
-    BaseObject* clone() const override {
-        MIDICCObject* clone = new MIDICCObject();
+    ObjectPtr clone() const override {
+        std::unique_ptr<MIDICCObject> clone(new MIDICCObject());
         clone->channel = this->channel;
         clone->controller = this->controller;
         clone->value = this->value;
+        clone->port = this->port;
         return clone;
     }
+
+    // 登録先の環境は写さない（写しても値は送らない）
+    void copyState(const BaseObject& other) override {
+        BaseObject::copyState(other);
+        const MIDICCObject& o = static_cast<const MIDICCObject&>(other);
+        channel = o.channel;
+        controller = o.controller;
+        value = o.value;
+        port = o.port;
+    }
+    
+    // 読み込んでも値は送らない
+    void save(SnapshotWriter& out) const override;
+    bool load(SnapshotReader& in) override;
+    
+    bool needsTick() const override { return false; }
+    
+    void attach(Environment& environment, uint32_t /* slot */) override { env = &environment; }
     
+    // 登録先の環境があれば、そのティックの時刻で環境の出力ポートへ送る
     void send() {
-        getMIDIManager().sendCC(channel, controller, value);
+        if (env) {
+            env->sendCC(channel, controller, value, port);
+        } else {
+            getMIDIManager().sendCC(channel, controller, value, 0.0, port);
+        }
     }
     
     std::string toString() const override {
         return "midi_cc: ch=" + std::to_string(channel) + 
                " cc=" + std::to_string(controller) + 
-               " val=" + std::to_string(value);
+               " val=" + std::to_string(value) +
+               (port != 0 ? " port=" + std::to_string(port) : "");
     }
 };
 
@@ -181,139 +260,158 @@ public:
 class MIDISeqObject : public SeqObject {
 private:
     int midiChannel;         // MIDIチャンネル
-    std::vector<int> notes;  // ステップごとのノート番号
+    std::vector<int, ArenaAllocator<int>> notes;  // ステップごとのノート番号（先頭から繰り返す）
     int velocity;            // ベロシティ
+    int duration;            // ノートの長さ（ティック数）
+    int gate;                // 長さのうち実際に鳴らす割合 (1-100%)
+    int port;                // MIDI出力ポート (0-MAX_PORTS-1)
     bool midiEnabled;        // MIDI出力有効/無効
     
 public:
-    MIDISeqObject() : midiChannel(0), velocity(100), midiEnabled(true) {
+    MIDISeqObject()
+        : midiChannel(0), velocity(100), duration(1), gate(50), port(0), midiEnabled(true) {
         // デフォルトのノートマッピング (C4 = 60)
         notes.resize(16, 60);
     }
     
+    // 型情報（メソッドはSeqObjectから継承）
+    static const ObjectType &objectType();
+    const ObjectType &getObjectType() const override { return objectType(); }
+    
+    // ノートを送信するのでプール登録後も再生中は毎ティック呼び出す
+    bool needsTick() const override { return isPlaying(); }
+    
     // オーバーライドされたonTick
     void onTick(Environment& env) override {
-        // 基底クラスの処理を呼び出し
+        // 基底クラスの処理を呼び出し（プール登録済みなら位置は進んでいる）
         SeqObject::onTick(env);
         
         // MIDI出力が有効で、現在のステップが1（オン）の場合
         if (midiEnabled && getValue() > 0) {
-            int position = 0;
-            BaseObject* posObj = getAttribute("position");
-            if (posObj) {
-                position = posObj->getValue();
-                delete posObj;
-            }
+            int position = getPosition();
             
-            // 位置が有効範囲内の場合、ノートを発音
-            if (position >= 0 && static_cast<size_t>(position) < notes.size()) {
-                int note = notes[position];
+            // ノートの割り当てはステップ数より短ければ繰り返して使う
+            if (position >= 0) {
+                int note = notes[static_cast<size_t>(position) % notes.size()];
                 if (note >= 0) {
-                    getMIDIManager().sendNoteOn(midiChannel, note, velocity);
+                    env.sendNoteOn(midiChannel, note, velocity, port);
                     
-                    // ノートオフを遅延送信するラムダ関数を登録
-                    auto noteOffEvent = [this, note](Environment& /* env */) {
-                        getMIDIManager().sendNoteOff(this->midiChannel, note);
-                    };
-                    
-                    // 次のティックでノートオフを送信
-                    env.queueEvent(noteOffEvent);
+                    // ゲート長に応じたノートオフをタイマーホイールに予約
+                    env.scheduleNoteOff(duration, gate, midiChannel, note, port);
                 }
             }
         }
     }
     
     // MIDI関連の属性アクセス
-    void setAttribute(const std::string &name, BaseObject* value) override {
-        if (name == "midi_channel") {
-            midiChannel = value->getValue() & 0x0F;  // 0-15に制限
-        } else if (name == "midi_velocity") {
-            velocity = value->getValue() & 0x7F;     // 0-127に制限
-        } else if (name == "midi_enable") {
-            midiEnabled = value->getValue() > 0;
-        } else if (name == "note_map") {
-            // バイナリパターンからノートマッピングを設定
-            int baseNote = 60; // デフォルトのベースノート
-            int pattern = value->getValue();
-            for (int i = 0; i < 8; i++) {
-                if (static_cast<size_t>(i) < notes.size()) {
-                    notes[i] = (pattern & (1 << i)) ? baseNote + i : -1;
+    void setAttr(const AttrKey &key, Value value) override {
+        switch (key.id) {
+            case Attr::MIDI_CHANNEL:
+                midiChannel = value.asInt() & 0x0F;  // 0-15に制限
+                break;
+            case Attr::MIDI_VELOCITY:
+                velocity = value.asInt() & 0x7F;     // 0-127に制限
+                break;
+            case Attr::MIDI_ENABLE:
+                midiEnabled = value.asInt() > 0;
+                break;
+            case Attr::DURATION:
+                duration = std::max(1, value.asInt());
+                break;
+            case Attr::GATE:
+                gate = std::min(100, std::max(1, value.asInt()));
+                break;
+            case Attr::PORT:
+                port = clampPort(value.asInt());
+                break;
+            case Attr::NOTE_MAP: {
+                // バイナリパターンからノートマッピングを設定
+                int baseNote = 60; // デフォルトのベースノート
+                int pattern = value.asInt();
+                for (int i = 0; i < 8; i++) {
+                    if (static_cast<size_t>(i) < notes.size()) {
+                        notes[i] = (pattern & (1 << i)) ? baseNote + i : -1;
+                    }
                 }
+                break;
             }
-        } else if (name == "note_base") {
-            // ベースノートを設定（例：36 = C2）
-            int baseNote = value->getValue() & 0x7F;
-            for (size_t i = 0; i < notes.size(); i++) {
-                if (notes[i] >= 0) {
-                    notes[i] = baseNote + static_cast<int>(i);
+            case Attr::NOTE_BASE: {
+                // ベースノートを設定（例：36 = C2）
+                int baseNote = value.asInt() & 0x7F;
+                for (size_t i = 0; i < notes.size(); i++) {
+                    if (notes[i] >= 0) {
+                        notes[i] = baseNote + static_cast<int>(i);
+                    }
                 }
+                break;
             }
-        } else if (name.substr(0, 5) == "note_" && name.size() > 5) {
-            // 特定のステップのノートを設定（例：note_0 = 60）
-            try {
-                int step = std::stoi(name.substr(5));
-                if (step >= 0 && static_cast<size_t>(step) < notes.size()) {
-                    notes[step] = value->getValue() & 0x7F;
+            case Attr::NOTE_STEP:
+                // 特定のステップのノートを設定（例：note_0 = 60）
+                if (key.index >= 0 && static_cast<size_t>(key.index) < BitPattern::MAX_STEPS) {
+                    // 割り当てを伸ばすときは、これまで繰り返して使っていたノートで埋める
+                    size_t count = notes.size();
+                    for (size_t i = count; i <= static_cast<size_t>(key.index); i++) {
+                        notes.push_back(notes[i % count]);
+                    }
+                    notes[key.index] = value.asInt() & 0x7F;
                 }
-            } catch (...) {
-                // 数値変換エラー
-            }
-        } else {
-            // 基底クラスの属性設定を呼び出し
-            SeqObject::setAttribute(name, value);
+                break;
+            default:
+                // 基底クラスの属性設定を呼び出し
+                SeqObject::setAttr(key, value);
         }
     }
     
-    BaseObject* getAttribute(const std::string &name) override {
-        if (name == "midi_channel") {
-            return new IntObject(midiChannel);
-        } else if (name == "midi_velocity") {
-            return new IntObject(velocity);
-        } else if (name == "midi_enable") {
-            return new IntObject(midiEnabled ? 1 : 0);
-        } else if (name == "note_base") {
-            // 最初のノート番号を返す
-            for (int note : notes) {
-                if (note >= 0) {
-                    return new IntObject(note);
+    Value getAttr(const AttrKey &key) const override {
+        switch (key.id) {
+            case Attr::MIDI_CHANNEL:  return Value::integer(midiChannel);
+            case Attr::MIDI_VELOCITY: return Value::integer(velocity);
+            case Attr::MIDI_ENABLE:   return Value::integer(midiEnabled ? 1 : 0);
+            case Attr::DURATION:      return Value::integer(duration);
+            case Attr::GATE:          return Value::integer(gate);
+            case Attr::PORT:          return Value::integer(port);
+            case Attr::NOTE_BASE:
+                // 最初のノート番号を返す
+                for (int note : notes) {
+                    if (note >= 0) {
+                        return Value::integer(note);
+                    }
                 }
-            }
-            return new IntObject(60); // デフォルト
-        } else if (name.substr(0, 5) == "note_" && name.size() > 5) {
-            try {
-                int step = std::stoi(name.substr(5));
-                if (step >= 0 && static_cast<size_t>(step) < notes.size()) {
-                    return new IntObject(notes[step]);
+                return Value::integer(60); // デフォルト
+            case Attr::NOTE_STEP:
+                if (key.index >= 0) {
+                    return Value::integer(notes[static_cast<size_t>(key.index) % notes.size()]);
                 }
-            } catch (...) {
-                // 数値変換エラー
-            }
-            return new IntObject(-1);
-        } else {
-            // 基底クラスの属性取得を呼び出し
-            return SeqObject::getAttribute(name);
+                return Value::integer(-1);
+            default:
+                // 基底クラスの属性取得を呼び出し
+                return SeqObject::getAttr(key);
         }
     }
     
-    BaseObject* clone() const override {
-        MIDISeqObject* clone = new MIDISeqObject();
-        
-        // 基底クラスの基本プロパティをコピー
-        SeqObject* baseClone = static_cast<SeqObject*>(SeqObject::clone());
-        *static_cast<SeqObject*>(clone) = *baseClone;
-        delete baseClone;
-        
-        // MIDI固有の属性をコピー
-        clone->midiChannel = this->midiChannel;
-        clone->notes = this->notes;
-        clone->velocity = this->velocity;
-        clone->midiEnabled = this->midiEnabled;
-        
-        return clone;
+    ObjectPtr clone() const override {
+        // 再生状態はSeqObjectのコピーコンストラクタが複製する
+        return ObjectPtr(new MIDISeqObject(*this));
     }
+
+    void copyState(const BaseObject& other) override {
+        SeqObject::copyState(other);
+        const MIDISeqObject& o = static_cast<const MIDISeqObject&>(other);
+        midiChannel = o.midiChannel;
+        notes = o.notes;
+        velocity = o.velocity;
+        duration = o.duration;
+        gate = o.gate;
+        port = o.port;
+        midiEnabled = o.midiEnabled;
+    }
+    
+    void save(SnapshotWriter& out) const override;
+    bool load(SnapshotReader& in) override;
     
     std::string toString() const override {
-        return SeqObject::toString() + " [MIDI ch=" + std::to_string(midiChannel) + 
+        return SeqObject::toString() + " [MIDI ch=" + std::to_string(midiChannel) +
+               (port != 0 ? " port=" + std::to_string(port) : "") +
                (midiEnabled ? " enabled" : " disabled") + "]";
     }
 };
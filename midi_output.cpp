@@ -0,0 +1,360 @@
+#include "midi_output.hpp"
+#include "midi_manager.hpp"
+#include <algorithm>
+#include <cmath>
+
+// MIDIメッセージのバイト列への変換
+size_t encodeMIDIMessage(const MIDIMessage& msg, unsigned char out[3]) {
+    if (msg.type == MIDIMessage::SYSTEM) {
+        // ソングポジションは14ビットの位置を下位・上位の7ビットずつ、リアルタイムメッセージは1バイト
+        if (msg.data1 == MIDIMessage::SONG_POSITION) {
+            out[0] = MIDIMessage::SONG_POSITION;
+            out[1] = static_cast<unsigned char>(msg.data2 & 0x7F);
+            out[2] = static_cast<unsigned char>((msg.data2 >> 7) & 0x7F);
+            return 3;
+        }
+        if (msg.data1 >= 0xF8 && msg.data1 <= 0xFF) {
+            out[0] = static_cast<unsigned char>(msg.data1);
+            return 1;
+        }
+        return 0;
+    }
+
+    unsigned char channel = static_cast<unsigned char>(msg.channel & 0x0F);
+    unsigned char data1 = static_cast<unsigned char>(msg.data1 & 0x7F);
+    unsigned char data2 = static_cast<unsigned char>(msg.data2 & 0x7F);
+
+    switch (msg.type) {
+        case MIDIMessage::NOTE_ON:        out[0] = 0x90 | channel; break;
+        case MIDIMessage::NOTE_OFF:       out[0] = 0x80 | channel; break;
+        case MIDIMessage::CC:             out[0] = 0xB0 | channel; break;
+        case MIDIMessage::AFTERTOUCH:     out[0] = 0xA0 | channel; break;
+        case MIDIMessage::PITCH_BEND:     out[0] = 0xE0 | channel; break;
+        case MIDIMessage::PROGRAM_CHANGE:
+            out[0] = 0xC0 | channel;
+            out[1] = data1;
+            return 2;
+        default:
+            return 0;
+    }
+    out[1] = data1;
+    out[2] = data2;
+    return 3;
+}
+
+//------------------------------------------------------------------------------
+// CCの間引き
+//------------------------------------------------------------------------------
+
+CCFilter::CCFilter() : dropRedundant(true), minInterval(0.0) {
+    reset();
+}
+
+void CCFilter::reset() {
+    for (State& st : states) {
+        st.value = -1;
+        st.held = -1;
+        st.lastSent = 0.0;
+    }
+}
+
+CCFilter::Decision CCFilter::check(const MIDIMessage& msg, double time) {
+    // チャンネルモードメッセージ（CC 120-127、オールノートオフなど）は値ではなく命令なので常に送る
+    if (msg.type != MIDIMessage::CC || (msg.data1 & 0x7F) >= 120) {
+        return SEND;
+    }
+
+    State& st = state(msg.channel, msg.data1);
+    int16_t value = static_cast<int16_t>(msg.data2 & 0x7F);
+
+    // 最小間隔の間は最新の値だけを保留する
+    if (minInterval > 0.0 && st.value >= 0 && time - st.lastSent < minInterval) {
+        if (dropRedundant && value == st.value) {
+            // 送った値に戻ったなら保留していた値も送らなくてよい
+            st.held = -1;
+            return DROP;
+        }
+        bool first = st.held < 0;
+        st.held = value;
+        return first ? HOLD : DROP;
+    }
+
+    st.held = -1;
+    if (dropRedundant && value == st.value) {
+        return DROP;
+    }
+    st.value = value;
+    st.lastSent = time;
+    return SEND;
+}
+
+bool CCFilter::release(int channel, int controller, double time, MIDIMessage& out) {
+    State& st = state(channel, controller);
+    if (st.held < 0) {
+        return false;
+    }
+    out = MIDIMessage(MIDIMessage::CC, channel, controller, st.held);
+    st.value = st.held;
+    st.held = -1;
+    st.lastSent = time;
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// RtMidi出力
+//------------------------------------------------------------------------------
+
+RtMidiSink::RtMidiSink() : midiOut(new RtMidiOut()), packing(false), bytesSent(0), calls(0) {
+    unsigned int portCount = midiOut->getPortCount();
+    for (unsigned int i = 0; i < portCount; i++) {
+        portNames.push_back(midiOut->getPortName(i));
+    }
+
+    // 1回の sendMessage に複数のメッセージを渡せるAPIだけまとめる
+    // （ALSAのエンコーダはランニングステータスを解釈する。CoreMIDIのパケットでは使わない）
+    RtMidi::Api api = midiOut->getCurrentApi();
+    packing = api == RtMidi::LINUX_ALSA || api == RtMidi::MACOSX_CORE;
+    packet.setRunningStatus(api == RtMidi::LINUX_ALSA);
+}
+
+RtMidiSink::~RtMidiSink() {
+    closePort();
+}
+
+bool RtMidiSink::openPort(int port) {
+    try {
+        closePort();
+        midiOut->openPort(port);
+        return true;
+    } catch (RtMidiError& error) {
+        std::cerr << "MIDI output device open error: " << error.getMessage() << std::endl;
+        return false;
+    }
+}
+
+void RtMidiSink::closePort() {
+    sendPacket();
+    packet.clear();
+    if (midiOut && midiOut->isPortOpen()) {
+        midiOut->closePort();
+    }
+}
+
+bool RtMidiSink::sendPacket() {
+    if (packet.empty()) {
+        return true;
+    }
+    bool ok = isOpen();
+    if (ok) {
+        try {
+            midiOut->sendMessage(packet.bytes(), packet.size());
+            bytesSent += packet.size();
+            calls++;
+        } catch (RtMidiError& error) {
+            std::cerr << "MIDI send error: " << error.getMessage() << std::endl;
+            ok = false;
+        }
+    }
+    packet.clear();
+    return ok;
+}
+
+bool RtMidiSink::isOpen() const {
+    return midiOut && midiOut->isPortOpen();
+}
+
+bool RtMidiSink::send(const MIDIMessage& msg) {
+    if (!isOpen()) {
+        return false;
+    }
+
+    unsigned char bytes[3];
+    size_t size = encodeMIDIMessage(msg, bytes);
+    if (size == 0) {
+        return false;
+    }
+
+    // まとめられないAPIでは、このメッセージだけのパケットとしてすぐ送る
+    if (!packing) {
+        packet.append(bytes, size);
+        return sendPacket();
+    }
+    if (!packet.append(bytes, size)) {
+        sendPacket();
+        packet.append(bytes, size);
+    }
+    return true;
+}
+
+//------------------------------------------------------------------------------
+// Standard MIDI File書き出し
+//------------------------------------------------------------------------------
+
+namespace {
+// ヒープの比較関数（時刻が早い順、同時刻は届いた順）
+struct LaterEvent {
+    template <typename T>
+    bool operator()(const T& a, const T& b) const {
+        if (a.time != b.time) {
+            return a.time > b.time;
+        }
+        return a.sequence > b.sequence;
+    }
+};
+
+// トラックチャンクの長さを書く位置（"MThd"チャンク14バイト + "MTrk"4バイト）
+constexpr long TRACK_LENGTH_OFFSET = 18;
+} // namespace
+
+SMFWriterSink::SMFWriterSink(const std::string& filePath, double bpm, int division)
+    : file(std::fopen(filePath.c_str(), "wb")), path(filePath), nextSequence(0),
+      origin(0.0), ticksPerSecond(division * bpm / 60.0), lastTick(0), runningStatus(0),
+      trackBytes(0), eventCount(0) {
+    if (!file) {
+        std::cerr << "Cannot open " << filePath << " for writing" << std::endl;
+        return;
+    }
+    buffer.reserve(BUFFER_SIZE);
+
+    // ヘッダチャンク: フォーマット0、1トラック
+    const unsigned char header[] = {
+        'M', 'T', 'h', 'd', 0, 0, 0, 6,
+        0, 0, 0, 1,
+        static_cast<unsigned char>((division >> 8) & 0x7F), static_cast<unsigned char>(division & 0xFF),
+        'M', 'T', 'r', 'k', 0, 0, 0, 0 // トラック長は閉じるときに書き戻す
+    };
+    std::fwrite(header, 1, sizeof(header), file);
+
+    // テンポ（4分音符あたりのマイクロ秒）
+    uint32_t tempo = static_cast<uint32_t>(std::lround(60000000.0 / bpm));
+    const unsigned char tempoEvent[] = {
+        0x00, 0xFF, 0x51, 0x03,
+        static_cast<unsigned char>((tempo >> 16) & 0xFF),
+        static_cast<unsigned char>((tempo >> 8) & 0xFF),
+        static_cast<unsigned char>(tempo & 0xFF)
+    };
+    write(tempoEvent, sizeof(tempoEvent));
+}
+
+SMFWriterSink::~SMFWriterSink() {
+    close();
+}
+
+void SMFWriterSink::write(const unsigned char* data, size_t size) {
+    if (buffer.size() + size > BUFFER_SIZE) {
+        flushBuffer();
+    }
+    buffer.insert(buffer.end(), data, data + size);
+    trackBytes += static_cast<uint32_t>(size);
+}
+
+void SMFWriterSink::writeVarLen(uint32_t value) {
+    // 7ビットずつ上位から、最後のバイト以外は最上位ビットを立てる
+    unsigned char bytes[5];
+    size_t count = 0;
+    bytes[4 - count++] = value & 0x7F;
+    while ((value >>= 7) != 0) {
+        bytes[4 - count++] = 0x80 | (value & 0x7F);
+    }
+    write(bytes + 5 - count, count);
+}
+
+void SMFWriterSink::writeEvent(const Pending& event) {
+    // 並べ直しの範囲より前の時刻で届いたメッセージは直前のイベントに揃える
+    double seconds = event.time - origin;
+    uint64_t tick = seconds > 0.0 ? static_cast<uint64_t>(std::llround(seconds * ticksPerSecond)) : 0;
+    if (tick < lastTick) {
+        tick = lastTick;
+    }
+    writeVarLen(static_cast<uint32_t>(tick - lastTick));
+
+    // ノートオンの後のベロシティ0のノートオフは、同じ意味のベロシティ0のノートオンにして
+    // ステータスバイトを省けるようにする
+    unsigned char bytes[3] = {event.bytes[0], event.bytes[1], event.bytes[2]};
+    if ((bytes[0] & 0xF0) == 0x80 && bytes[2] == 0 && runningStatus == (0x90 | (bytes[0] & 0x0F))) {
+        bytes[0] = runningStatus;
+    }
+
+    // 直前と同じステータスバイトは省く（ランニングステータス）
+    size_t skip = bytes[0] == runningStatus ? 1 : 0;
+    write(bytes + skip, event.size - skip);
+    runningStatus = bytes[0];
+    lastTick = tick;
+    eventCount++;
+}
+
+void SMFWriterSink::flushBuffer() {
+    if (file && !buffer.empty()) {
+        std::fwrite(buffer.data(), 1, buffer.size(), file);
+    }
+    buffer.clear();
+}
+
+void SMFWriterSink::writeUpTo(double time, bool all) {
+    while (!pending.empty() && (all || pending.front().time < time)) {
+        std::pop_heap(pending.begin(), pending.end(), LaterEvent());
+        writeEvent(pending.back());
+        pending.pop_back();
+    }
+}
+
+bool SMFWriterSink::send(const MIDIMessage& msg) {
+    if (!file) {
+        return false;
+    }
+
+    // クロックやスタートなどのシステムメッセージはSMFのイベントにならない
+    if (msg.type == MIDIMessage::SYSTEM) {
+        return true;
+    }
+
+    Pending event;
+    event.size = static_cast<uint8_t>(encodeMIDIMessage(msg, event.bytes));
+    if (event.size == 0) {
+        return false;
+    }
+    event.time = msg.timestamp;
+    event.sequence = nextSequence++;
+    pending.push_back(event);
+    std::push_heap(pending.begin(), pending.end(), LaterEvent());
+    return true;
+}
+
+void SMFWriterSink::advance(double time) {
+    writeUpTo(time, false);
+}
+
+void SMFWriterSink::flush() {
+    writeUpTo(0.0, true);
+    flushBuffer();
+    if (file) {
+        std::fflush(file);
+    }
+}
+
+bool SMFWriterSink::close() {
+    if (!file) {
+        return false;
+    }
+
+    writeUpTo(0.0, true);
+    const unsigned char endOfTrack[] = {0x00, 0xFF, 0x2F, 0x00};
+    write(endOfTrack, sizeof(endOfTrack));
+    flushBuffer();
+
+    // トラック長の書き戻し（ビッグエンディアン）
+    const unsigned char length[] = {
+        static_cast<unsigned char>((trackBytes >> 24) & 0xFF),
+        static_cast<unsigned char>((trackBytes >> 16) & 0xFF),
+        static_cast<unsigned char>((trackBytes >> 8) & 0xFF),
+        static_cast<unsigned char>(trackBytes & 0xFF)
+    };
+    bool ok = std::fseek(file, TRACK_LENGTH_OFFSET, SEEK_SET) == 0 &&
+              std::fwrite(length, 1, sizeof(length), file) == sizeof(length);
+    ok = std::fclose(file) == 0 && ok;
+    file = nullptr;
+    if (!ok) {
+        std::cerr << "Error writing " << path << std::endl;
+    }
+    return ok;
+}
@@ -0,0 +1,261 @@
+#ifndef REELIA_MIDI_OUTPUT_HPP
+#define REELIA_MIDI_OUTPUT_HPP
+
+#include "RtMidi.h"
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct MIDIMessage;
+
+/**
+ * MIDIメッセージをバイト列に変換（戻り値はバイト数、変換できなければ0）
+ */
+size_t encodeMIDIMessage(const MIDIMessage& msg, unsigned char out[3]);
+
+/**
+ * 同時に送るMIDIメッセージをまとめるバッファ
+ * ランニングステータスを使うと、直前と同じステータスバイトを省く
+ * （同じチャンネルのノートやCCが続くと1メッセージ3バイトが2バイトになる）。
+ * バッファは固定長で、追加のたびに確保することはない。
+ */
+class MIDIPacket {
+public:
+    static constexpr size_t CAPACITY = 256;
+
+private:
+    unsigned char data[CAPACITY];
+    size_t length;
+    unsigned char status; // 直前のステータスバイト（0なら省略しない）
+    bool runningStatus;
+
+public:
+    explicit MIDIPacket(bool useRunningStatus = false)
+        : length(0), status(0), runningStatus(useRunningStatus) {}
+
+    void setRunningStatus(bool enabled) {
+        runningStatus = enabled;
+        status = 0;
+    }
+
+    // メッセージの追加（入りきらなければfalse）
+    bool append(const unsigned char* bytes, size_t size) {
+        // システムメッセージ（0xF0以上）はランニングステータスの対象外
+        size_t skip = runningStatus && bytes[0] == status ? 1 : 0;
+        if (length + size - skip > CAPACITY) {
+            return false;
+        }
+        for (size_t i = skip; i < size; i++) {
+            data[length++] = bytes[i];
+        }
+        status = bytes[0] < 0xF0 ? bytes[0] : 0;
+        return true;
+    }
+
+    void clear() {
+        length = 0;
+        status = 0;
+    }
+
+    const unsigned char* bytes() const { return data; }
+    size_t size() const { return length; }
+    bool empty() const { return length == 0; }
+};
+
+/**
+ * CCの間引き
+ * チャンネルとコントローラごとに最後に送った値と時刻を覚えておき、
+ * - 最後に送った値と同じCCは捨てる
+ * - 最小間隔より早く来たCCは保留し、間隔が空いたら最新の値だけを送る
+ * 保留した値は捨てないので、最後に送られる値は間引かない場合と同じになる。
+ */
+class CCFilter {
+public:
+    enum Decision {
+        SEND,  // そのまま送る
+        DROP,  // 送らない（同じ値、または保留中の値を置き換えた）
+        HOLD   // 保留した。holdUntil() の時刻に release() を呼ぶこと
+    };
+
+private:
+    static constexpr int CHANNELS = 16;
+    static constexpr int CONTROLLERS = 128;
+
+    struct State {
+        int16_t value; // 最後に送った値（-1なら未送信）
+        int16_t held;  // 保留中の値（-1ならなし）
+        double lastSent;
+    };
+    State states[CHANNELS * CONTROLLERS];
+
+    bool dropRedundant;
+    double minInterval; // 秒（0なら間引かない）
+
+    State& state(int channel, int controller) {
+        return states[(channel & (CHANNELS - 1)) * CONTROLLERS + (controller & (CONTROLLERS - 1))];
+    }
+
+public:
+    CCFilter();
+
+    void configure(bool dropRedundantValues, double minSeconds) {
+        dropRedundant = dropRedundantValues;
+        minInterval = minSeconds > 0.0 ? minSeconds : 0.0;
+    }
+
+    // メッセージを time（秒）に送ってよいか（CC以外とチャンネルモードメッセージは常にSEND）
+    Decision check(const MIDIMessage& msg, double time);
+
+    // 保留した値を取り出して送信済みにする（保留がなければfalse）
+    bool release(int channel, int controller, double time, MIDIMessage& out);
+
+    // 保留した値を送れるようになる時刻
+    double holdUntil(int channel, int controller) {
+        return state(channel, controller).lastSent + minInterval;
+    }
+
+    // 送信済みの値を忘れる（出力先を変えたときなど）
+    void reset();
+};
+
+/**
+ * MIDI出力先
+ * MIDIManagerはメッセージを送信時刻に達した順にsend()へ渡す。
+ * 実装はハードウェア（RtMidi）、何もしない出力、ファイル書き出しなど。
+ */
+class MIDIOutputSink {
+public:
+    virtual ~MIDIOutputSink() {}
+
+    // メッセージの出力（出力できなければfalse）
+    virtual bool send(const MIDIMessage& msg) = 0;
+
+    // これより前の時刻のメッセージはもう来ない（時刻順に並べ直す出力先用）
+    virtual void advance(double /* time */) {}
+
+    // 同時に送るメッセージの区切り（まとめて送る出力先はここで送信する）
+    virtual void endBatch() {}
+
+    // 溜めているものをすべて書き出す
+    virtual void flush() {}
+
+    // 出力できる状態か
+    virtual bool isOpen() const = 0;
+};
+
+/**
+ * RtMidiによるハードウェア出力
+ * ALSAとCoreMIDIでは同時に送るメッセージを1回の sendMessage にまとめる
+ * （ALSAではランニングステータスも使う）。それ以外のAPIは1メッセージずつ送る。
+ */
+class RtMidiSink : public MIDIOutputSink {
+private:
+    std::unique_ptr<RtMidiOut> midiOut;
+    std::vector<std::string> portNames;
+    MIDIPacket packet;
+    bool packing;
+    uint64_t bytesSent;
+    uint64_t calls;
+
+    bool sendPacket();
+
+public:
+    // RtMidiの初期化に失敗したらRtMidiErrorを投げる
+    RtMidiSink();
+    ~RtMidiSink() override;
+
+    const std::vector<std::string>& getPortNames() const { return portNames; }
+    bool openPort(int port);
+    void closePort();
+
+    bool send(const MIDIMessage& msg) override;
+    void endBatch() override { sendPacket(); }
+    void flush() override { sendPacket(); }
+    bool isOpen() const override;
+
+    // デバイスに渡したバイト数と sendMessage の呼び出し回数
+    uint64_t getBytesSent() const { return bytesSent; }
+    uint64_t getCalls() const { return calls; }
+};
+
+/**
+ * 何も出力しない出力先（ベンチマーク・テスト用に件数だけ数える）
+ */
+class NullSink : public MIDIOutputSink {
+private:
+    uint64_t count;
+
+public:
+    NullSink() : count(0) {}
+
+    bool send(const MIDIMessage&) override {
+        count++;
+        return true;
+    }
+    bool isOpen() const override { return true; }
+    uint64_t getCount() const { return count; }
+};
+
+/**
+ * Standard MIDI File（フォーマット0）への書き出し
+ * メッセージのタイムスタンプ（秒）をテンポとPPQNからデルタタイムに変換する。
+ * 1ティック分のメッセージだけを時刻順のヒープに溜め、advance()で
+ * 確定した分から固定長のバッファ経由で書き出すので、長時間の書き出しでも
+ * メモリ使用量は増えない。イベントはランニングステータスで書く。
+ * トラック長は閉じるときに書き戻す。
+ */
+class SMFWriterSink : public MIDIOutputSink {
+private:
+    static constexpr size_t BUFFER_SIZE = 64 * 1024;
+
+    struct Pending {
+        double time;
+        uint64_t sequence; // 同時刻のメッセージは届いた順
+        unsigned char bytes[3];
+        uint8_t size;
+    };
+
+    std::FILE* file;
+    std::string path;
+    std::vector<unsigned char> buffer;
+    std::vector<Pending> pending;
+    uint64_t nextSequence;
+
+    double origin;        // ファイル先頭に対応する時刻（秒）
+    double ticksPerSecond; // SMFティック/秒
+    uint64_t lastTick;     // 最後に書いたイベントのSMFティック
+    unsigned char runningStatus; // 直前のイベントのステータスバイト
+    uint32_t trackBytes;   // トラックチャンクの長さ
+    uint64_t eventCount;
+
+    void write(const unsigned char* data, size_t size);
+    void writeVarLen(uint32_t value);
+    void writeEvent(const Pending& event);
+    void flushBuffer();
+    void writeUpTo(double time, bool all);
+
+public:
+    // division: 4分音符あたりのSMFティック数
+    SMFWriterSink(const std::string& filePath, double bpm, int division = 960);
+    ~SMFWriterSink() override;
+
+    SMFWriterSink(const SMFWriterSink&) = delete;
+    SMFWriterSink& operator=(const SMFWriterSink&) = delete;
+
+    // ファイル先頭に対応する時刻（秒）
+    void setOrigin(double seconds) { origin = seconds; }
+
+    bool send(const MIDIMessage& msg) override;
+    void advance(double time) override;
+    void flush() override;
+    bool isOpen() const override { return file != nullptr; }
+
+    // トラックの終わりを書いてファイルを閉じる（デストラクタでも呼ばれる）
+    bool close();
+
+    uint64_t getEventCount() const { return eventCount; }
+};
+
+#endif // REELIA_MIDI_OUTPUT_HPP
@@ -2,7 +2,190 @@
 #include <algorithm>
 #include <cmath>
 #include <iomanip>
+#include <mutex>
+#include <numeric>
 #include <sstream>
+#include <unordered_map>
+
+//------------------------------------------------------------------------------
+// Module Base Implementation
+//------------------------------------------------------------------------------
+
+int Module::findParameter(const std::string &name) const {
+  const char *const *names = parameterNames();
+  for (int id = 0; names[id]; id++) {
+    if (name == names[id])
+      return id;
+  }
+  return -1;
+}
+
+//------------------------------------------------------------------------------
+// Lookup Tables
+//------------------------------------------------------------------------------
+
+namespace {
+// Sine wave lookup table (0-255)
+const int SIN_TABLE[16] = {128, 176, 218, 245, 255, 245, 218, 176,
+                           128, 80,  38,  11,  0,   11,  38,  80};
+
+// Scale a full-range (0-255) value by the amplitude around the center
+inline int scaleAmp(int value, int amp) { return 128 + ((value - 128) * amp) / 127; }
+
+inline int sineStep(int i, int len, int amp) {
+  return scaleAmp(SIN_TABLE[i * 16 / len], amp);
+}
+
+inline int triangleStep(int i, int len, int amp) {
+  int normalizedPos = i * 256 / len;
+  int rising = normalizedPos * 255 / 128;
+  int falling = 255 - ((normalizedPos - 128) * 255 / 128);
+  return scaleAmp(normalizedPos < 128 ? rising : falling, amp);
+}
+
+inline int sawtoothStep(int i, int len, int amp) {
+  return scaleAmp(i * 255 / len, amp);
+}
+
+inline int squareStep(int i, int len, int amp, int duty) {
+  return scaleAmp(i * 100 / len < duty ? 255 : 0, amp);
+}
+
+inline int euclideanStep(int i, int steps, int hits) {
+  if (hits >= steps)
+    return 1;
+  if (hits == 0)
+    return 0;
+  return ((i * static_cast<int64_t>(hits)) % steps) < hits ? 1 : 0;
+}
+
+struct TableKeyHash {
+  size_t operator()(const TableKey &k) const {
+    size_t h = static_cast<size_t>(k.shape);
+    h = h * 1000003u ^ static_cast<size_t>(k.length);
+    h = h * 1000003u ^ static_cast<size_t>(k.amp);
+    h = h * 1000003u ^ static_cast<size_t>(k.extra);
+    return h;
+  }
+};
+
+std::mutex cacheMutex;
+std::unordered_map<TableKey, std::weak_ptr<const PatternTable>, TableKeyHash>
+    cache;
+} // namespace
+
+int TableCache::sample(const TableKey &key, int step) {
+  switch (key.shape) {
+  case TableShape::SINE:
+    return sineStep(step, key.length, key.amp);
+  case TableShape::TRIANGLE:
+    return triangleStep(step, key.length, key.amp);
+  case TableShape::SAWTOOTH:
+    return sawtoothStep(step, key.length, key.amp);
+  case TableShape::SQUARE:
+    return squareStep(step, key.length, key.amp, key.extra);
+  case TableShape::EUCLIDEAN:
+    return euclideanStep(step, key.length, key.extra);
+  }
+  return 0;
+}
+
+void TableCache::fill(const TableKey &key, uint8_t *out) {
+  // One straight loop per shape so the compiler can vectorize it
+  const int len = key.length;
+  const int amp = key.amp;
+  switch (key.shape) {
+  case TableShape::SINE:
+    for (int i = 0; i < len; i++)
+      out[i] = static_cast<uint8_t>(sineStep(i, len, amp));
+    break;
+  case TableShape::TRIANGLE:
+    for (int i = 0; i < len; i++)
+      out[i] = static_cast<uint8_t>(triangleStep(i, len, amp));
+    break;
+  case TableShape::SAWTOOTH:
+    for (int i = 0; i < len; i++)
+      out[i] = static_cast<uint8_t>(sawtoothStep(i, len, amp));
+    break;
+  case TableShape::SQUARE:
+    for (int i = 0; i < len; i++)
+      out[i] = static_cast<uint8_t>(squareStep(i, len, amp, key.extra));
+    break;
+  case TableShape::EUCLIDEAN:
+    for (int i = 0; i < len; i++)
+      out[i] = static_cast<uint8_t>(euclideanStep(i, len, key.extra));
+    break;
+  }
+}
+
+std::vector<std::shared_ptr<const PatternTable>>
+TableCache::build(const std::vector<TableKey> &keys) {
+  std::vector<std::shared_ptr<const PatternTable>> result(keys.size());
+  std::lock_guard<std::mutex> lock(cacheMutex);
+
+  for (size_t i = 0; i < keys.size(); i++) {
+    std::weak_ptr<const PatternTable> &entry = cache[keys[i]];
+    std::shared_ptr<const PatternTable> &table = result[i];
+    if ((table = entry.lock())) {
+      continue;
+    }
+    auto built = std::make_shared<PatternTable>(keys[i].length);
+    fill(keys[i], built->data());
+    table = built;
+    entry = table;
+  }
+  return result;
+}
+
+std::shared_ptr<const PatternTable> TableCache::get(const TableKey &key) {
+  return build(std::vector<TableKey>(1, key))[0];
+}
+
+int TableModule::lookup(int step) const {
+  TableKey key = tableKey();
+  int len = key.length;
+  int i = step % len;
+  if (i < 0)
+    i += len;
+
+  if (len > TableCache::MAX_LENGTH)
+    return TableCache::sample(key, i);
+  if (!table)
+    table = TableCache::get(key);
+  return (*table)[i];
+}
+
+void TableModule::prepare() {
+  TableKey key;
+  if (pendingTable(key))
+    table = TableCache::get(key);
+}
+
+bool TableModule::pendingTable(TableKey &key) const {
+  if (table)
+    return false;
+  key = tableKey();
+  return key.length <= TableCache::MAX_LENGTH;
+}
+
+void prepareModuleTables(const std::vector<Module *> &modules) {
+  std::vector<TableModule *> pending;
+  std::vector<TableKey> keys;
+  for (Module *module : modules) {
+    TableModule *tableModule = dynamic_cast<TableModule *>(module);
+    TableKey key;
+    if (tableModule && tableModule->pendingTable(key)) {
+      pending.push_back(tableModule);
+      keys.push_back(key);
+    }
+  }
+
+  std::vector<std::shared_ptr<const PatternTable>> tables =
+      TableCache::build(keys);
+  for (size_t i = 0; i < pending.size(); i++) {
+    pending[i]->setTable(tables[i]);
+  }
+}
 
 //------------------------------------------------------------------------------
 // PAT Module Implementation
@@ -13,18 +196,26 @@ int PatternModule::getValue() const {
   return (pattern >> (index % 32)) & 1;
 }
 
-void PatternModule::setParameter(const std::string &name, int value) {
-  if (name == "P") {
+const char *const *PatternModule::parameterNames() const {
+  static const char *const names[] = {"P", "I", nullptr};
+  return names;
+}
+
+void PatternModule::setParameterById(int id, int value) {
+  switch (id) {
+  case PARAM_P:
     // Set pattern value
     pattern = value;
-  } else if (name == "I") {
+    break;
+  case PARAM_I:
     // Set index/position
     index = value;
+    break;
   }
 }
 
-Module *PatternModule::clone() const {
-  PatternModule *clone = new PatternModule();
+ModulePtr PatternModule::clone() const {
+  std::unique_ptr<PatternModule> clone(new PatternModule());
   clone->pattern = this->pattern;
   clone->index = this->index;
   return clone;
@@ -59,36 +250,42 @@ std::string PatternModule::getVisualRepresentation() const {
 // EUC Module Implementation (Euclidean Rhythm)
 //------------------------------------------------------------------------------
 
-int EuclideanModule::getValue() const {
-  if (steps == 0)
-    return 0;
-  if (hits >= steps)
-    return 1;
-  if (hits == 0)
-    return 0;
+int EuclideanModule::getValue() const { return lookup(index); }
 
-  // Euclidean rhythm calculation
-  return ((index * hits) % steps) < hits ? 1 : 0;
+TableKey EuclideanModule::tableKey() const {
+  return {TableShape::EUCLIDEAN, steps, 0, hits};
 }
 
-void EuclideanModule::setParameter(const std::string &name, int value) {
-  if (name == "K") {
+const char *const *EuclideanModule::parameterNames() const {
+  static const char *const names[] = {"K", "N", "I", nullptr};
+  return names;
+}
+
+void EuclideanModule::setParameterById(int id, int value) {
+  switch (id) {
+  case PARAM_K:
     // Set hits (K)
     hits = std::max(0, value);
-  } else if (name == "N") {
+    invalidateTable();
+    break;
+  case PARAM_N:
     // Set steps (N)
     steps = std::max(1, value); // Prevent division by zero
-  } else if (name == "I") {
+    invalidateTable();
+    break;
+  case PARAM_I:
     // Set index/position
     index = value;
+    break;
   }
 }
 
-Module *EuclideanModule::clone() const {
-  EuclideanModule *clone = new EuclideanModule();
+ModulePtr EuclideanModule::clone() const {
+  std::unique_ptr<EuclideanModule> clone(new EuclideanModule());
   clone->hits = this->hits;
   clone->steps = this->steps;
   clone->index = this->index;
+  clone->setTable(this->table);
   return clone;
 }
 
@@ -120,30 +317,39 @@ std::string EuclideanModule::getVisualRepresentation() const {
 // SIN Module Implementation (Sine Wave)
 //------------------------------------------------------------------------------
 
-int SineModule::getValue() const {
-  // Simple sine wave lookup table (0-255)
-  static const int sinTable[16] = {128, 176, 218, 245, 255, 245, 218, 176,
-                                   128, 80,  38,  11,  0,   11,  38,  80};
+int SineModule::getValue() const { return lookup(pos); }
 
-  int idx = (pos % length) * 16 / length;
-  return 128 + ((sinTable[idx] - 128) * amp) / 127;
+TableKey SineModule::tableKey() const {
+  return {TableShape::SINE, length, amp, 0};
 }
 
-void SineModule::setParameter(const std::string &name, int value) {
-  if (name == "LEN") {
+const char *const *SineModule::parameterNames() const {
+  static const char *const names[] = {"LEN", "POS", "A", nullptr};
+  return names;
+}
+
+void SineModule::setParameterById(int id, int value) {
+  switch (id) {
+  case PARAM_LEN:
     length = std::max(1, value);
-  } else if (name == "POS") {
+    invalidateTable();
+    break;
+  case PARAM_POS:
     pos = value;
-  } else if (name == "A") {
+    break;
+  case PARAM_A:
     amp = std::min(127, std::max(0, value));
+    invalidateTable();
+    break;
   }
 }
 
-Module *SineModule::clone() const {
-  SineModule *clone = new SineModule();
+ModulePtr SineModule::clone() const {
+  std::unique_ptr<SineModule> clone(new SineModule());
   clone->length = this->length;
   clone->pos = this->pos;
   clone->amp = this->amp;
+  clone->setTable(this->table);
   return clone;
 }
 
@@ -176,37 +382,39 @@ std::string SineModule::getVisualRepresentation() const {
 // TRI Module Implementation (Triangle Wave)
 //------------------------------------------------------------------------------
 
-int TriangleModule::getValue() const {
-  int normalizedPos = (pos % length) * 256 / length;
-  int halfCycle = 128;
-  int value;
+int TriangleModule::getValue() const { return lookup(pos); }
 
-  if (normalizedPos < halfCycle) {
-    // Rising
-    value = normalizedPos * 255 / halfCycle;
-  } else {
-    // Falling
-    value = 255 - ((normalizedPos - halfCycle) * 255 / halfCycle);
-  }
+TableKey TriangleModule::tableKey() const {
+  return {TableShape::TRIANGLE, length, amp, 0};
+}
 
-  return 128 + ((value - 128) * amp) / 127;
+const char *const *TriangleModule::parameterNames() const {
+  static const char *const names[] = {"LEN", "POS", "A", nullptr};
+  return names;
 }
 
-void TriangleModule::setParameter(const std::string &name, int value) {
-  if (name == "LEN") {
+void TriangleModule::setParameterById(int id, int value) {
+  switch (id) {
+  case PARAM_LEN:
     length = std::max(1, value);
-  } else if (name == "POS") {
+    invalidateTable();
+    break;
+  case PARAM_POS:
     pos = value;
-  } else if (name == "A") {
+    break;
+  case PARAM_A:
     amp = std::min(127, std::max(0, value));
+    invalidateTable();
+    break;
   }
 }
 
-Module *TriangleModule::clone() const {
-  TriangleModule *clone = new TriangleModule();
+ModulePtr TriangleModule::clone() const {
+  std::unique_ptr<TriangleModule> clone(new TriangleModule());
   clone->length = this->length;
   clone->pos = this->pos;
   clone->amp = this->amp;
+  clone->setTable(this->table);
   return clone;
 }
 
@@ -238,26 +446,39 @@ std::string TriangleModule::getVisualRepresentation() const {
 // SAW Module Implementation (Sawtooth Wave)
 //------------------------------------------------------------------------------
 
-int SawtoothModule::getValue() const {
-  int value = (pos % length) * 255 / length;
-  return 128 + ((value - 128) * amp) / 127;
+int SawtoothModule::getValue() const { return lookup(pos); }
+
+TableKey SawtoothModule::tableKey() const {
+  return {TableShape::SAWTOOTH, length, amp, 0};
+}
+
+const char *const *SawtoothModule::parameterNames() const {
+  static const char *const names[] = {"LEN", "POS", "A", nullptr};
+  return names;
 }
 
-void SawtoothModule::setParameter(const std::string &name, int value) {
-  if (name == "LEN") {
+void SawtoothModule::setParameterById(int id, int value) {
+  switch (id) {
+  case PARAM_LEN:
     length = std::max(1, value);
-  } else if (name == "POS") {
+    invalidateTable();
+    break;
+  case PARAM_POS:
     pos = value;
-  } else if (name == "A") {
+    break;
+  case PARAM_A:
     amp = std::min(127, std::max(0, value));
+    invalidateTable();
+    break;
   }
 }
 
-Module *SawtoothModule::clone() const {
-  SawtoothModule *clone = new SawtoothModule();
+ModulePtr SawtoothModule::clone() const {
+  std::unique_ptr<SawtoothModule> clone(new SawtoothModule());
   clone->length = this->length;
   clone->pos = this->pos;
   clone->amp = this->amp;
+  clone->setTable(this->table);
   return clone;
 }
 
@@ -304,30 +525,44 @@ std::string SawtoothModule::getVisualRepresentation() const {
 // SQR Module Implementation (Square Wave)
 //------------------------------------------------------------------------------
 
-int SquareModule::getValue() const {
-  int normalizedPos = (pos % length) * 100 / length;
-  int value = (normalizedPos < duty) ? 255 : 0;
-  return 128 + ((value - 128) * amp) / 127;
+int SquareModule::getValue() const { return lookup(pos); }
+
+TableKey SquareModule::tableKey() const {
+  return {TableShape::SQUARE, length, amp, duty};
 }
 
-void SquareModule::setParameter(const std::string &name, int value) {
-  if (name == "LEN") {
+const char *const *SquareModule::parameterNames() const {
+  static const char *const names[] = {"LEN", "POS", "A", "D", nullptr};
+  return names;
+}
+
+void SquareModule::setParameterById(int id, int value) {
+  switch (id) {
+  case PARAM_LEN:
     length = std::max(1, value);
-  } else if (name == "POS") {
+    invalidateTable();
+    break;
+  case PARAM_POS:
     pos = value;
-  } else if (name == "A") {
+    break;
+  case PARAM_A:
     amp = std::min(127, std::max(0, value));
-  } else if (name == "D") {
+    invalidateTable();
+    break;
+  case PARAM_D:
     duty = std::min(100, std::max(0, value));
+    invalidateTable();
+    break;
   }
 }
 
-Module *SquareModule::clone() const {
-  SquareModule *clone = new SquareModule();
+ModulePtr SquareModule::clone() const {
+  std::unique_ptr<SquareModule> clone(new SquareModule());
   clone->length = this->length;
   clone->pos = this->pos;
   clone->amp = this->amp;
   clone->duty = this->duty;
+  clone->setTable(this->table);
   return clone;
 }
 
@@ -361,54 +596,56 @@ std::string SquareModule::getVisualRepresentation() const {
 // RND Module Implementation (Random Pattern)
 //------------------------------------------------------------------------------
 
-void RandomModule::generatePattern() {
-  pattern.clear();
-  pattern.resize(length);
-
-  std::uniform_int_distribution<int> dist(1, 100);
-  for (int i = 0; i < length; i++) {
-    pattern[i] = (dist(rng) <= probability);
+int64_t RandomModule::cycleStart() const {
+  if (!regenerateOnCycle) {
+    return 0;
+  }
+  int64_t cycle = pos / length;
+  if (pos % length < 0) {
+    cycle--;
   }
+  return cycle * length;
 }
 
 int RandomModule::getValue() const {
-  if (pos % length == 0 && regenerateOnCycle && pos > 0) {
-    // We need to regenerate the pattern, but can't modify state in a const
-    // method So we cast away const for this operation
-    RandomModule *self = const_cast<RandomModule *>(this);
-    self->generatePattern();
-  }
+  int step = pos % length;
+  return bit(cycleStart() + (step < 0 ? step + length : step)) ? 1 : 0;
+}
 
-  return pattern[pos % length] ? 1 : 0;
+const char *const *RandomModule::parameterNames() const {
+  static const char *const names[] = {"P", "LEN", "POS", "SEED", "REGEN", nullptr};
+  return names;
 }
 
-void RandomModule::setParameter(const std::string &name, int value) {
-  if (name == "P") {
+void RandomModule::setParameterById(int id, int value) {
+  switch (id) {
+  case PARAM_P:
     probability = std::min(100, std::max(0, value));
-    generatePattern(); // Regenerate pattern when probability changes
-  } else if (name == "LEN") {
+    break;
+  case PARAM_LEN:
     length = std::max(1, value);
-    generatePattern(); // Regenerate pattern when length changes
-  } else if (name == "POS") {
+    break;
+  case PARAM_POS:
     pos = value;
-  } else if (name == "SEED") {
+    break;
+  case PARAM_SEED:
     seed = value;
-    rng.seed(seed);
-    generatePattern(); // Regenerate pattern when seed changes
-  } else if (name == "REGEN") {
+    key = counter_rng::key(static_cast<uint32_t>(seed), 0);
+    break;
+  case PARAM_REGEN:
     regenerateOnCycle = (value != 0);
+    break;
   }
 }
 
-Module *RandomModule::clone() const {
-  RandomModule *clone = new RandomModule();
+ModulePtr RandomModule::clone() const {
+  std::unique_ptr<RandomModule> clone(new RandomModule());
   clone->probability = this->probability;
   clone->seed = this->seed;
   clone->length = this->length;
   clone->pos = this->pos;
   clone->regenerateOnCycle = this->regenerateOnCycle;
-  clone->pattern = this->pattern;
-  clone->rng.seed(this->seed);
+  clone->key = this->key;
   return clone;
 }
 
@@ -420,13 +657,14 @@ std::string RandomModule::getVisualRepresentation() const {
   rep += "\nSeed: " + std::to_string(seed);
   rep += "\nRegenerate: " + std::string(regenerateOnCycle ? "Yes" : "No");
 
-  // Pattern visualization
+  // Pattern visualization (current cycle)
+  int64_t start = cycleStart();
   rep += "\n[";
   for (int i = 0; i < length; i++) {
     if (i == pos % length) {
-      rep += pattern[i] ? "*" : ".";
+      rep += bit(start + i) ? "*" : ".";
     } else {
-      rep += pattern[i] ? "o" : "-";
+      rep += bit(start + i) ? "o" : "-";
     }
   }
   rep += "]";
@@ -445,28 +683,48 @@ int SequencerModule::getValue() const {
   return steps[pos % length];
 }
 
-void SequencerModule::setParameter(const std::string &name, int value) {
-  if (name == "POS") {
-    pos = value;
-  } else if (name == "LEN") {
-    length = std::min(16, std::max(1, value));
-  } else if (name == "LOOP") {
-    looping = (value != 0);
-  } else if (name.size() > 1 && name[0] == 'S') {
+int SequencerModule::findParameter(const std::string &name) const {
+  if (name.size() > 1 && name[0] == 'S') {
     // S1-S16 step value settings
     try {
       int stepIdx = std::stoi(name.substr(1)) - 1; // S1 is index 0
       if (stepIdx >= 0 && stepIdx < 16) {
-        steps[stepIdx] = value;
+        return PARAM_STEP + stepIdx;
       }
     } catch (...) {
-      // Parse failed, do nothing
+      // Parse failed, fall back to the named parameters
     }
   }
+  return Module::findParameter(name);
 }
 
-Module *SequencerModule::clone() const {
-  SequencerModule *clone = new SequencerModule();
+const char *const *SequencerModule::parameterNames() const {
+  static const char *const names[] = {"POS", "LEN", "LOOP", nullptr};
+  return names;
+}
+
+void SequencerModule::setParameterById(int id, int value) {
+  switch (id) {
+  case PARAM_POS:
+    pos = value;
+    break;
+  case PARAM_LEN:
+    length = std::min(16, std::max(1, value));
+    break;
+  case PARAM_LOOP:
+    looping = (value != 0);
+    break;
+  default:
+    // S1-S16 step value settings
+    if (id >= PARAM_STEP && id < PARAM_STEP + 16) {
+      steps[id - PARAM_STEP] = value;
+    }
+    break;
+  }
+}
+
+ModulePtr SequencerModule::clone() const {
+  std::unique_ptr<SequencerModule> clone(new SequencerModule());
   clone->steps = this->steps;
   clone->pos = this->pos;
   clone->length = this->length;
@@ -508,29 +766,294 @@ std::string SequencerModule::getVisualRepresentation() const {
   return rep;
 }
 
+//------------------------------------------------------------------------------
+// CMB Module Implementation (Pattern Combinator Graph)
+//------------------------------------------------------------------------------
+
+namespace {
+// Non-negative remainder
+int64_t wrap(int64_t value, int64_t length) {
+  int64_t r = value % length;
+  return r < 0 ? r + length : r;
+}
+
+int lcmCapped(int a, int b) {
+  int64_t l = static_cast<int64_t>(a) / std::gcd(a, b) * b;
+  return static_cast<int>(
+      std::min<int64_t>(l, static_cast<int64_t>(BitPattern::MAX_STEPS)));
+}
+
+} // namespace
+
+int CombinatorModule::addNode(Op op, int left, int right, int a, int b,
+                              int c) {
+  int index = nodeCount();
+  Node node;
+  node.op = op;
+  node.params[0] = a;
+  node.params[1] = b;
+  node.params[2] = c;
+  node.left = left;
+  node.right = right;
+  node.parent = -1;
+  node.cachedStart = 0;
+  node.cachedBlock = 0;
+  node.cached = false;
+  nodes.push_back(std::move(node));
+  if (left >= 0)
+    nodes[left].parent = index;
+  if (right >= 0)
+    nodes[right].parent = index;
+  return index;
+}
+
+int CombinatorModule::addEuclid(int hits, int steps, int rotation) {
+  int n = std::min(static_cast<int>(BitPattern::MAX_STEPS), std::max(1, steps));
+  return addNode(Op::EUCLID, -1, -1, std::min(n, std::max(0, hits)), n,
+                 rotation);
+}
+
+int CombinatorModule::addPattern(const BitPattern &pattern) {
+  int index = addNode(Op::PATTERN, -1, -1);
+  nodes[index].source = pattern;
+  return index;
+}
+
+int CombinatorModule::addRandom(int probability, int seed) {
+  return addNode(Op::RANDOM, -1, -1, std::min(100, std::max(0, probability)),
+                 seed);
+}
+
+int CombinatorModule::addRotate(int input, int amount) {
+  return addNode(Op::ROTATE, input, -1, amount);
+}
+
+int CombinatorModule::addInvert(int input) {
+  return addNode(Op::INVERT, input, -1);
+}
+
+int CombinatorModule::addMask(Op op, int left, int right) {
+  return addNode(op, left, right);
+}
+
+// Drop the cached blocks of a node and everything that consumes it
+void CombinatorModule::invalidate(int node) {
+  for (; node >= 0; node = nodes[node].parent) {
+    nodes[node].cached = false;
+  }
+}
+
+uint64_t CombinatorModule::sourceBlock(int index, int64_t start) const {
+  const Node &node = nodes[index];
+
+  if (node.op == Op::RANDOM) {
+    // Counter-based, so any block is computed without the steps before it
+    return counter_rng::chanceBits(
+        counter_rng::key(static_cast<uint32_t>(node.params[1]),
+                         static_cast<uint64_t>(index)),
+        static_cast<uint64_t>(start), node.params[0]);
+  }
+
+  int n = node.op == Op::EUCLID ? node.params[1]
+                                : static_cast<int>(node.source.size());
+  if (n <= 0)
+    return 0;
+
+  // Built once per parameter change: the cycle repeated out to n + BLOCK
+  // steps, so the block starting at any step of the cycle is contiguous
+  if (node.table.empty()) {
+    BitPattern cycle;
+    if (node.op == Op::EUCLID) {
+      cycle = BitPattern::euclid(static_cast<size_t>(node.params[0]),
+                                 static_cast<size_t>(n));
+      cycle.rotate(node.params[2]);
+    } else {
+      cycle = node.source;
+    }
+    node.table = BitPattern::repeat(cycle, static_cast<size_t>(n) + BLOCK);
+  }
+
+  size_t offset = static_cast<size_t>(wrap(start, n));
+  uint64_t bits = node.table.extract(offset);
+  // Cycles close to MAX_STEPS have no room for the trailing block in the
+  // table; wrap the remainder around from the start of the cycle
+  if (offset + BLOCK > node.table.size()) {
+    bits |= node.table.extract(0) << (n - offset);
+  }
+  return bits;
+}
+
+uint64_t CombinatorModule::evaluate(int index, int64_t start) const {
+  const Node &node = nodes[index];
+  if (node.cached && node.cachedStart == start)
+    return node.cachedBlock;
+
+  uint64_t bits = 0;
+  switch (node.op) {
+  case Op::EUCLID:
+  case Op::PATTERN:
+  case Op::RANDOM:
+    bits = sourceBlock(index, start);
+    break;
+  case Op::ROTATE:
+    bits = evaluate(node.left, start - node.params[0]);
+    break;
+  case Op::INVERT:
+    bits = ~evaluate(node.left, start);
+    break;
+  case Op::AND:
+    bits = evaluate(node.left, start) & evaluate(node.right, start);
+    break;
+  case Op::OR:
+    bits = evaluate(node.left, start) | evaluate(node.right, start);
+    break;
+  case Op::XOR:
+    bits = evaluate(node.left, start) ^ evaluate(node.right, start);
+    break;
+  }
+
+  node.cachedStart = start;
+  node.cachedBlock = bits;
+  node.cached = true;
+  return bits;
+}
+
+uint64_t CombinatorModule::block(int64_t start) const {
+  return nodes.empty() ? 0 : evaluate(nodeCount() - 1, start);
+}
+
+bool CombinatorModule::at(int64_t step) const {
+  // Align to a block boundary so consecutive steps share one evaluation
+  int64_t offset = wrap(step, BLOCK);
+  return (block(step - offset) >> offset) & 1;
+}
+
+int CombinatorModule::cycleLength(int index) const {
+  const Node &node = nodes[index];
+  switch (node.op) {
+  case Op::EUCLID:
+    return node.params[1];
+  case Op::PATTERN:
+    return std::max(1, static_cast<int>(node.source.size()));
+  case Op::RANDOM:
+    return static_cast<int>(BitPattern::MAX_STEPS);
+  case Op::ROTATE:
+  case Op::INVERT:
+    return cycleLength(node.left);
+  default:
+    return lcmCapped(cycleLength(node.left), cycleLength(node.right));
+  }
+}
+
+int CombinatorModule::cycleLength() const {
+  return nodes.empty() ? 1 : cycleLength(nodeCount() - 1);
+}
+
+const char *const *CombinatorModule::parameterNames() const {
+  static const char *const names[] = {"POS", nullptr};
+  return names;
+}
+
+void CombinatorModule::setParameterById(int id, int value) {
+  if (id == PARAM_POS) {
+    pos = value;
+    return;
+  }
+
+  int index = (id - 1) / NODE_PARAMS;
+  int slot = (id - 1) % NODE_PARAMS;
+  if (id < 1 || index >= nodeCount())
+    return;
+  Node &node = nodes[index];
+
+  switch (node.op) {
+  case Op::EUCLID:
+    if (slot == 0)
+      value = std::min(node.params[1], std::max(0, value));
+    else if (slot == 1)
+      value = std::min(static_cast<int>(BitPattern::MAX_STEPS),
+                       std::max(1, value));
+    break;
+  case Op::RANDOM:
+    if (slot == 0)
+      value = std::min(100, std::max(0, value));
+    else if (slot != 1)
+      return;
+    break;
+  case Op::ROTATE:
+    if (slot != 0)
+      return;
+    break;
+  default:
+    return; // No parameters
+  }
+
+  // Unchanged inputs keep every cached block
+  if (node.params[slot] == value)
+    return;
+  node.params[slot] = value;
+  if (node.op == Op::EUCLID) {
+    node.params[0] = std::min(node.params[0], node.params[1]);
+    node.table = BitPattern();
+  }
+  invalidate(index);
+}
+
+ModulePtr CombinatorModule::clone() const {
+  return ModulePtr(new CombinatorModule(*this));
+}
+
+std::string CombinatorModule::getVisualRepresentation() const {
+  std::string rep = "Pattern Graph";
+  rep += "\nNodes: " + std::to_string(nodeCount());
+  rep += "\nCycle: " + std::to_string(cycleLength());
+  rep += "\nPosition: " + std::to_string(pos);
+
+  // The next 16 steps from the current position
+  uint64_t bits = block(pos);
+  rep += "\n[";
+  for (int i = 0; i < 16; i++) {
+    bool on = (bits >> i) & 1;
+    if (i == 0) {
+      rep += on ? "*" : ".";
+    } else {
+      rep += on ? "o" : "-";
+    }
+  }
+  rep += "]";
+
+  return rep;
+}
+
 //------------------------------------------------------------------------------
 // Module Factory Implementation
 //------------------------------------------------------------------------------
 
-Module *ModuleFactory::createModule(const std::string &type) {
+ModulePtr ModuleFactory::createModule(const std::string &type) {
+  ModulePtr module;
   if (type == "PAT") {
-    return new PatternModule();
+    module.reset(new PatternModule());
   } else if (type == "EUC") {
-    return new EuclideanModule();
+    module.reset(new EuclideanModule());
   } else if (type == "SIN") {
-    return new SineModule();
+    module.reset(new SineModule());
   } else if (type == "TRI") {
-    return new TriangleModule();
+    module.reset(new TriangleModule());
   } else if (type == "SAW") {
-    return new SawtoothModule();
+    module.reset(new SawtoothModule());
   } else if (type == "SQR") {
-    return new SquareModule();
+    module.reset(new SquareModule());
   } else if (type == "RND") {
-    return new RandomModule();
+    module.reset(new RandomModule());
   } else if (type == "SEQ") {
-    return new SequencerModule();
+    module.reset(new SequencerModule());
+  } else if (type == "CMB") {
+    module.reset(new CombinatorModule());
   }
 
-  // Return nullptr for unknown types
-  return nullptr;
+  // Build the tables for the default parameters here rather than on the
+  // first tick (nullptr for unknown types)
+  if (module)
+    module->prepare();
+  return module;
 }
\ No newline at end of file
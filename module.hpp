@@ -1,35 +1,150 @@
 #ifndef REELIA_MODULE_HPP
 #define REELIA_MODULE_HPP
 
+#include "bit_pattern.hpp"
+#include "counter_rng.hpp"
+#include "object_pool.hpp"
+#include <cstdint>
 #include <map>
-#include <random>
+#include <memory>
 #include <string>
 #include <vector>
 
+class Module;
+
+// Module ownership (move-only; freed back to the object arena)
+using ModulePtr = std::unique_ptr<Module>;
+
 /**
  * Base Module class
  * Provides the interface for all REELIA modules
+ * Instances are allocated from the object arena
  */
-class Module {
+class Module : public PoolAllocated {
 public:
   virtual ~Module() {}
 
   // Get the current value of the module
   virtual int getValue() const = 0;
 
-  // Set a parameter of the module
-  virtual void setParameter(const std::string &name, int value) = 0;
+  // Resolve a parameter name to its id once (-1 if the name is unknown)
+  virtual int findParameter(const std::string &name) const;
+
+  // Set a parameter by id (no string comparison on the hot path)
+  virtual void setParameterById(int id, int value) = 0;
+
+  // Set a parameter by name (resolves the id on every call). This is the
+  // input thread's path, so it also prepares what the new value needs
+  void setParameter(const std::string &name, int value) {
+    int id = findParameter(name);
+    if (id >= 0) {
+      setParameterById(id, value);
+      prepare();
+    }
+  }
+
+  // Build whatever getValue() needs for the current parameters (lookup
+  // tables), so reading on the tick only indexes
+  virtual void prepare() {}
 
   // Create a clone of the module
-  virtual Module *clone() const = 0;
+  virtual ModulePtr clone() const = 0;
 
   // Get the module type name
   virtual std::string getType() const = 0;
 
   // Get a string representation of the module's state
   virtual std::string getVisualRepresentation() const = 0;
+
+protected:
+  // Parameter names indexed by id (nullptr-terminated)
+  virtual const char *const *parameterNames() const = 0;
+};
+
+/**
+ * Lookup table shapes for the table-driven generators
+ */
+enum class TableShape : uint8_t { SINE, TRIANGLE, SAWTOOTH, SQUARE, EUCLIDEAN };
+
+/**
+ * Lookup table key
+ * Generators with identical keys share one table. `extra` is the duty
+ * cycle for SQR and the number of hits for EUC.
+ */
+struct TableKey {
+  TableShape shape;
+  int length;
+  int amp;
+  int extra;
+
+  bool operator==(const TableKey &other) const {
+    return shape == other.shape && length == other.length &&
+           amp == other.amp && extra == other.extra;
+  }
+};
+
+// One output value (0-255) per step of a cycle
+using PatternTable = std::vector<uint8_t>;
+
+/**
+ * Shared lookup table cache
+ * Tables are held weakly, so a table is released as soon as no generator
+ * uses it. All functions are thread-safe.
+ */
+class TableCache {
+public:
+  // Longest cycle that gets a table; longer cycles are computed per call
+  static constexpr int MAX_LENGTH = 65536;
+
+  // Get (building if needed) the table for a key
+  static std::shared_ptr<const PatternTable> get(const TableKey &key);
+
+  // Build the tables for a whole bank of keys in one pass
+  static std::vector<std::shared_ptr<const PatternTable>>
+  build(const std::vector<TableKey> &keys);
+
+  // Compute a single step without a table
+  static int sample(const TableKey &key, int step);
+
+  // Fill out[0..key.length) (branch-free kernels per shape)
+  static void fill(const TableKey &key, uint8_t *out);
+};
+
+/**
+ * Table-driven module
+ * Builds its lookup table when it is created and whenever a parameter that
+ * changes the table is set by name (or for a whole bank with
+ * prepareModuleTables()), so getValue() is a single table index. A table
+ * parameter set by id while ticking is built on the next getValue().
+ */
+class TableModule : public Module {
+protected:
+  mutable std::shared_ptr<const PatternTable> table;
+
+  // Key of the table for the current parameters
+  virtual TableKey tableKey() const = 0;
+
+  // Drop the table (call when length/amplitude/shape parameters change)
+  void invalidateTable() { table.reset(); }
+
+  // Table lookup with wrap-around (negative positions wrap too)
+  int lookup(int step) const;
+
+public:
+  void prepare() override;
+
+  // Key of the table this module is waiting for (false if it has one)
+  bool pendingTable(TableKey &key) const;
+
+  // Install a table built in a batch
+  void setTable(std::shared_ptr<const PatternTable> t) const {
+    table = std::move(t);
+  }
 };
 
+// Build the missing tables for a bank of modules in one batch
+void prepareModuleTables(const std::vector<Module *> &modules);
+
 /**
  * PAT Module (Bit Pattern)
  * Generates patterns based on bit values in the pattern
@@ -40,100 +155,129 @@ private:
   int index;   // Current index
 
 public:
+  enum Parameter { PARAM_P, PARAM_I };
+
   PatternModule() : pattern(0), index(0) {}
 
   int getValue() const override;
-  void setParameter(const std::string &name, int value) override;
-  Module *clone() const override;
+  void setParameterById(int id, int value) override;
+  ModulePtr clone() const override;
   std::string getType() const override { return "PAT"; }
   std::string getVisualRepresentation() const override;
+
+protected:
+  const char *const *parameterNames() const override;
 };
 
 /**
  * EUC Module (Euclidean Rhythm)
  * Generates patterns based on Euclidean rhythm algorithm
  */
-class EuclideanModule : public Module {
+class EuclideanModule : public TableModule {
 private:
   int hits;  // Number of hits
   int steps; // Number of steps
   int index; // Current index
 
 public:
+  enum Parameter { PARAM_K, PARAM_N, PARAM_I };
+
   EuclideanModule() : hits(0), steps(8), index(0) {}
 
   int getValue() const override;
-  void setParameter(const std::string &name, int value) override;
-  Module *clone() const override;
+  void setParameterById(int id, int value) override;
+  ModulePtr clone() const override;
   std::string getType() const override { return "EUC"; }
   std::string getVisualRepresentation() const override;
+
+protected:
+  TableKey tableKey() const override;
+  const char *const *parameterNames() const override;
 };
 
 /**
  * SIN Module (Sine Wave)
  * Generates a sine wave pattern
  */
-class SineModule : public Module {
+class SineModule : public TableModule {
 private:
   int length; // Pattern length
   int pos;    // Current position
   int amp;    // Amplitude (0-127)
 
 public:
+  enum Parameter { PARAM_LEN, PARAM_POS, PARAM_A };
+
   SineModule() : length(16), pos(0), amp(127) {}
 
   int getValue() const override;
-  void setParameter(const std::string &name, int value) override;
-  Module *clone() const override;
+  void setParameterById(int id, int value) override;
+  ModulePtr clone() const override;
   std::string getType() const override { return "SIN"; }
   std::string getVisualRepresentation() const override;
+
+protected:
+  TableKey tableKey() const override;
+  const char *const *parameterNames() const override;
 };
 
 /**
  * TRI Module (Triangle Wave)
  * Generates a triangle wave pattern
  */
-class TriangleModule : public Module {
+class TriangleModule : public TableModule {
 private:
   int length; // Pattern length
   int pos;    // Current position
   int amp;    // Amplitude (0-127)
 
 public:
+  enum Parameter { PARAM_LEN, PARAM_POS, PARAM_A };
+
   TriangleModule() : length(16), pos(0), amp(127) {}
 
   int getValue() const override;
-  void setParameter(const std::string &name, int value) override;
-  Module *clone() const override;
+  void setParameterById(int id, int value) override;
+  ModulePtr clone() const override;
   std::string getType() const override { return "TRI"; }
   std::string getVisualRepresentation() const override;
+
+protected:
+  TableKey tableKey() const override;
+  const char *const *parameterNames() const override;
 };
 
 /**
  * SAW Module (Sawtooth Wave)
  * Generates a sawtooth wave pattern
  */
-class SawtoothModule : public Module {
+class SawtoothModule : public TableModule {
 private:
   int length; // Pattern length
   int pos;    // Current position
   int amp;    // Amplitude (0-127)
 
 public:
+  enum Parameter { PARAM_LEN, PARAM_POS, PARAM_A };
+
   SawtoothModule() : length(16), pos(0), amp(127) {}
 
   int getValue() const override;
-  void setParameter(const std::string &name, int value) override;
-  Module *clone() const override;
+  void setParameterById(int id, int value) override;
+  ModulePtr clone() const override;
   std::string getType() const override { return "SAW"; }
   std::string getVisualRepresentation() const override;
+
+protected:
+  TableKey tableKey() const override;
+  const char *const *parameterNames() const override;
 };
 
 /**
  * SQR Module (Square Wave)
  * Generates a square wave pattern with variable duty cycle
  */
-class SquareModule : public Module {
+class SquareModule : public TableModule {
 private:
   int length; // Pattern length
   int pos;    // Current position
@@ -141,18 +285,26 @@ private:
   int duty;   // Duty cycle (0-100%)
 
 public:
+  enum Parameter { PARAM_LEN, PARAM_POS, PARAM_A, PARAM_D };
+
   SquareModule() : length(16), pos(0), amp(127), duty(50) {}
 
   int getValue() const override;
-  void setParameter(const std::string &name, int value) override;
-  Module *clone() const override;
+  void setParameterById(int id, int value) override;
+  ModulePtr clone() const override;
   std::string getType() const override { return "SQR"; }
   std::string getVisualRepresentation() const override;
+
+protected:
+  TableKey tableKey() const override;
+  const char *const *parameterNames() const override;
 };
 
 /**
  * RND Module (Random Pattern)
- * Generates random patterns based on probability
+ * Generates random patterns based on probability. Each step is computed
+ * directly from (seed, step) with a counter-based generator, so the module
+ * holds no generator state and any step can be read in any order.
  */
 class RandomModule : public Module {
 private:
@@ -161,25 +313,33 @@ private:
   int length;      // Pattern length
   int pos;         // Current position
 
-  std::mt19937 rng;          // Random number generator
-  bool regenerateOnCycle;    // Whether to regenerate on each cycle
-  std::vector<bool> pattern; // Pre-generated pattern
+  bool regenerateOnCycle; // Whether each cycle gets a new pattern
+  uint64_t key;           // Generator key derived from the seed
 
 public:
+  enum Parameter { PARAM_P, PARAM_LEN, PARAM_POS, PARAM_SEED, PARAM_REGEN };
+
   RandomModule()
-      : probability(50), seed(0), length(16), pos(0), regenerateOnCycle(true) {
-    rng.seed(seed);
-    generatePattern();
-  }
+      : probability(50), seed(0), length(16), pos(0), regenerateOnCycle(true),
+        key(counter_rng::key(0, 0)) {}
 
   int getValue() const override;
-  void setParameter(const std::string &name, int value) override;
-  Module *clone() const override;
+  void setParameterById(int id, int value) override;
+  ModulePtr clone() const override;
   std::string getType() const override { return "RND"; }
   std::string getVisualRepresentation() const override;
 
 private:
-  void generatePattern();
+  // First step of the current cycle (0 when the pattern repeats)
+  int64_t cycleStart() const;
+  // Step of the pattern counted from the start of the song
+  bool bit(int64_t step) const {
+    return counter_rng::below(counter_rng::at(key, static_cast<uint64_t>(step)),
+                              100) < static_cast<uint64_t>(probability);
+  }
+
+protected:
+  const char *const *parameterNames() const override;
 };
 
 /**
@@ -194,20 +354,126 @@ private:
   bool looping;           // Whether to loop
 
 public:
+  // S1-S16 map to PARAM_STEP + 0..15
+  enum Parameter { PARAM_POS, PARAM_LEN, PARAM_LOOP, PARAM_STEP };
+
   SequencerModule() : pos(0), length(8), looping(true) {
     // Create default 8-step sequence with 0 values
     steps.resize(16, 0);
   }
 
   int getValue() const override;
-  void setParameter(const std::string &name, int value) override;
-  Module *clone() const override;
+  int findParameter(const std::string &name) const override;
+  void setParameterById(int id, int value) override;
+  ModulePtr clone() const override;
   std::string getType() const override { return "SEQ"; }
   std::string getVisualRepresentation() const override;
 
   // Set step value
   void setStep(int index, int value);
   int getStep(int index) const;
+
+protected:
+  const char *const *parameterNames() const override;
+};
+
+/**
+ * CMB Module (Pattern Combinator Graph)
+ * A combinator chain such as euclid(5,16).rotate(3).and(rnd(70)) fused
+ * into one module. Nodes live in a flat array with children before their
+ * parents and are evaluated on demand one 64-step block at a time: sources
+ * read their cycle from a table built when one of their parameters
+ * changes, and combinators shift and mask their inputs' blocks, so no
+ * intermediate pattern is ever materialized. Each node keeps the last block
+ * it produced until a parameter of the node or of one of its inputs
+ * changes.
+ */
+class CombinatorModule : public Module {
+public:
+  enum class Op : uint8_t {
+    EUCLID,  // k hits over n steps, optionally rotated (sources)
+    PATTERN, // a fixed bit pattern, repeating
+    RANDOM,  // each step on with a probability (%), never repeating
+    ROTATE,  // input shifted later by an amount (combinators)
+    INVERT,
+    AND,
+    OR,
+    XOR
+  };
+
+  // Parameter ids: 0 is POS, node parameters are parameterId(node, slot)
+  enum Parameter { PARAM_POS };
+  static constexpr int NODE_PARAMS = 3;
+
+  // Steps evaluated (and cached) at once
+  static constexpr int BLOCK = 64;
+
+private:
+  struct Node {
+    Op op;
+    int params[NODE_PARAMS]; // EUCLID: k, n, rotation / RANDOM: probability,
+                             // seed / ROTATE: amount
+    int left;                // Inputs (-1 if none)
+    int right;
+    int parent;              // Consumer of this node's output (-1 for the root)
+    BitPattern source;       // PATTERN: the literal
+
+    // Source cycle followed by its first BLOCK steps, so any block of the
+    // cycle is a single extract() (empty until needed)
+    mutable BitPattern table;
+
+    // Last block produced
+    mutable int64_t cachedStart;
+    mutable uint64_t cachedBlock;
+    mutable bool cached;
+  };
+
+  std::vector<Node> nodes;
+  int pos; // Current position
+
+  int addNode(Op op, int left, int right, int a = 0, int b = 0, int c = 0);
+  void invalidate(int node);
+  uint64_t evaluate(int node, int64_t start) const;
+  uint64_t sourceBlock(int node, int64_t start) const;
+  int cycleLength(int node) const;
+
+public:
+  CombinatorModule() : pos(0) {}
+
+  // Graph construction; each call returns the new node, and the node added
+  // last is the output
+  int addEuclid(int hits, int steps, int rotation = 0);
+  int addPattern(const BitPattern &pattern);
+  int addRandom(int probability, int seed = 0);
+  int addRotate(int input, int amount);
+  int addInvert(int input);
+  int addMask(Op op, int left, int right); // AND / OR / XOR
+
+  int nodeCount() const { return static_cast<int>(nodes.size()); }
+
+  // Parameter id of a node parameter (slot as in Node::params)
+  static int parameterId(int node, int slot) {
+    return 1 + node * NODE_PARAMS + slot;
+  }
+
+  // BLOCK steps starting at `start` (bit i is step start + i)
+  uint64_t block(int64_t start) const;
+
+  // Output at one step (negative steps wrap like any other)
+  bool at(int64_t step) const;
+
+  // Length after which the output repeats (lcm of the sources, capped at
+  // BitPattern::MAX_STEPS; RANDOM counts as the cap)
+  int cycleLength() const;
+
+  int getValue() const override { return at(pos) ? 1 : 0; }
+  void setParameterById(int id, int value) override;
+  ModulePtr clone() const override;
+  std::string getType() const override { return "CMB"; }
+  std::string getVisualRepresentation() const override;
+
+protected:
+  const char *const *parameterNames() const override;
 };
 
 /**
@@ -216,7 +482,7 @@ public:
  */
 class ModuleFactory {
 public:
-  static Module *createModule(const std::string &type);
+  static ModulePtr createModule(const std::string &type);
 };
 
 #endif // REELIA_MODULE_HPP
\ No newline at end of file
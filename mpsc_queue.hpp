@@ -0,0 +1,96 @@
+#ifndef REELIA_MPSC_QUEUE_HPP
+#define REELIA_MPSC_QUEUE_HPP
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+/**
+ * MPSCロックフリーリングバッファ
+ * 生産者スレッド複数・消費者スレッド1つの間でメッセージを受け渡す。
+ * 容量は2のべき乗で固定。各セルの通し番号で書き込み済みかを判定するので、
+ * 生産者同士は書き込み位置をCASで取り合うだけで互いを待たない。
+ * push/popとも確保・ロックを一切行わない（要素のムーブを除く）。
+ */
+template <typename T, size_t Capacity>
+class MPSCQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "MPSCQueue capacity must be a power of two");
+
+private:
+    static constexpr size_t MASK = Capacity - 1;
+    static constexpr size_t CACHE_LINE = 64;
+
+    struct Cell {
+        // pos なら空き、pos + 1 なら書き込み済み（pos はこのセルに書く通し番号）
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    std::unique_ptr<Cell[]> cells;
+
+    // 生産者が次に書き込む通し番号（生産者同士で取り合う）
+    alignas(CACHE_LINE) std::atomic<size_t> head;
+
+    // 消費者が次に読み出す通し番号（消費者だけが触る）
+    alignas(CACHE_LINE) size_t tail;
+
+public:
+    MPSCQueue() : cells(new Cell[Capacity]), head(0), tail(0) {
+        for (size_t i = 0; i < Capacity; i++) {
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+    // 生産者側: 要素を追加（満杯ならfalse）
+    bool tryPush(T&& item) {
+        size_t pos = head.load(std::memory_order_relaxed);
+        Cell* cell;
+        while (true) {
+            cell = &cells[pos & MASK];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+            if (diff == 0) {
+                if (head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                // 一周前の要素がまだ読まれていない
+                return false;
+            } else {
+                pos = head.load(std::memory_order_relaxed);
+            }
+        }
+        cell->value = std::move(item);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 消費者側: 要素を取り出す（空ならfalse）
+    bool tryPop(T& item) {
+        Cell& cell = cells[tail & MASK];
+        size_t seq = cell.sequence.load(std::memory_order_acquire);
+        if (seq != tail + 1) {
+            return false;
+        }
+        item = std::move(cell.value);
+        cell.value = T();
+        cell.sequence.store(tail + Capacity, std::memory_order_release);
+        tail++;
+        return true;
+    }
+
+    // 消費者側: 取り出せる要素があるか（取り出しはしない）
+    bool hasPending() const {
+        return cells[tail & MASK].sequence.load(std::memory_order_acquire) == tail + 1;
+    }
+
+    static constexpr size_t capacity() { return Capacity; }
+};
+
+#endif // REELIA_MPSC_QUEUE_HPP
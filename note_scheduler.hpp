@@ -0,0 +1,164 @@
+#ifndef REELIA_NOTE_SCHEDULER_HPP
+#define REELIA_NOTE_SCHEDULER_HPP
+
+#include <cstdint>
+#include <vector>
+
+/**
+ * ノートオフ・タイマーホイール
+ * ティック単位のバケットにノートオフを登録し、サブティック（1/256ティック）の
+ * オフセットを保持する。ノードは事前確保したプールから取り出すため、
+ * 登録・取消・発火のいずれもヒープ確保を行わない。
+ */
+class NoteOffWheel {
+public:
+  // 1ティックあたりのサブティック数
+  static constexpr int SUBTICKS = 256;
+
+  // バケット数（これより先のノートオフは周回して同じバケットに入る）
+  static constexpr uint32_t WHEEL_SIZE = 256;
+
+  // 登録ハンドル（下位32ビット: ノード番号、上位32ビット: 世代）
+  using Handle = uint64_t;
+  static constexpr Handle INVALID_HANDLE = ~static_cast<Handle>(0);
+
+private:
+  static constexpr uint32_t NIL = 0xFFFFFFFFu;
+
+  struct Node {
+    uint64_t dueTick;
+    uint32_t generation;
+    uint32_t prev;
+    uint32_t next;
+    uint16_t subTick;
+    uint8_t port;
+    uint8_t channel;
+    uint8_t note;
+    bool active;
+  };
+
+  std::vector<Node> nodes;
+  std::vector<uint32_t> buckets;
+  uint32_t freeList;
+  size_t activeCount;
+
+  void unlink(uint32_t index) {
+    Node &n = nodes[index];
+    if (n.prev != NIL) {
+      nodes[n.prev].next = n.next;
+    } else {
+      buckets[n.dueTick % WHEEL_SIZE] = n.next;
+    }
+    if (n.next != NIL) {
+      nodes[n.next].prev = n.prev;
+    }
+  }
+
+  void release(uint32_t index) {
+    Node &n = nodes[index];
+    n.active = false;
+    n.generation++;
+    n.next = freeList;
+    freeList = index;
+    activeCount--;
+  }
+
+public:
+  explicit NoteOffWheel(size_t capacity = 8192)
+      : buckets(WHEEL_SIZE, NIL), freeList(NIL), activeCount(0) {
+    nodes.resize(capacity);
+    for (size_t i = capacity; i-- > 0;) {
+      nodes[i].generation = 0;
+      nodes[i].active = false;
+      nodes[i].next = freeList;
+      freeList = static_cast<uint32_t>(i);
+    }
+  }
+
+  // ノートオフの登録（空きがなければINVALID_HANDLE）
+  Handle schedule(uint64_t dueTick, int subTick, int channel, int note,
+                  int port = 0) {
+    if (freeList == NIL) {
+      return INVALID_HANDLE;
+    }
+
+    uint32_t index = freeList;
+    Node &n = nodes[index];
+    freeList = n.next;
+
+    n.dueTick = dueTick;
+    n.subTick = static_cast<uint16_t>(subTick);
+    n.port = static_cast<uint8_t>(port);
+    n.channel = static_cast<uint8_t>(channel);
+    n.note = static_cast<uint8_t>(note);
+    n.active = true;
+
+    uint32_t &head = buckets[dueTick % WHEEL_SIZE];
+    n.prev = NIL;
+    n.next = head;
+    if (head != NIL) {
+      nodes[head].prev = index;
+    }
+    head = index;
+    activeCount++;
+
+    return (static_cast<Handle>(n.generation) << 32) | index;
+  }
+
+  // 登録済みのノートオフがまだ発火していないか
+  bool isPending(Handle handle) const {
+    if (handle == INVALID_HANDLE) {
+      return false;
+    }
+    uint32_t index = static_cast<uint32_t>(handle);
+    uint32_t generation = static_cast<uint32_t>(handle >> 32);
+    return index < nodes.size() && nodes[index].active &&
+           nodes[index].generation == generation;
+  }
+
+  // ノートオフの取消
+  bool cancel(Handle handle) {
+    if (!isPending(handle)) {
+      return false;
+    }
+    uint32_t index = static_cast<uint32_t>(handle);
+    unlink(index);
+    release(index);
+    return true;
+  }
+
+  // 指定ティックに達したノートオフを発火する
+  // fire(port, channel, note, subTick) が呼ばれる
+  template <typename Fn> void advance(uint64_t tick, Fn &&fire) {
+    uint32_t index = buckets[tick % WHEEL_SIZE];
+    while (index != NIL) {
+      uint32_t next = nodes[index].next;
+      Node &n = nodes[index];
+      if (n.dueTick <= tick) {
+        fire(n.port, n.channel, n.note, n.subTick);
+        unlink(index);
+        release(index);
+      }
+      index = next;
+    }
+  }
+
+  // すべてのノートオフを即時に発火して空にする
+  template <typename Fn> void flush(Fn &&fire) {
+    for (uint32_t b = 0; b < WHEEL_SIZE; b++) {
+      uint32_t index = buckets[b];
+      while (index != NIL) {
+        uint32_t next = nodes[index].next;
+        fire(nodes[index].port, nodes[index].channel, nodes[index].note, 0);
+        release(index);
+        index = next;
+      }
+      buckets[b] = NIL;
+    }
+  }
+
+  size_t pendingCount() const { return activeCount; }
+  size_t capacity() const { return nodes.size(); }
+};
+
+#endif // REELIA_NOTE_SCHEDULER_HPP
@@ -1,27 +1,391 @@
 #include "base_object.hpp"
 #include "midi_object.hpp"
+#include "pattern_graph.hpp"
+#include "snapshot.hpp"
+#include <algorithm>
+#include <unordered_map>
+
+//------------------------------------------------------------------------------
+// 型の登録表
+//------------------------------------------------------------------------------
+
+namespace {
+struct RegistryTables {
+    std::unordered_map<std::string, const ObjectType*> types;
+    std::unordered_map<std::string, MethodId> methodIds;
+    std::vector<std::string> methodNames;
+};
+
+RegistryTables& tables() {
+    static RegistryTables instance;
+    return instance;
+}
+
+void registerBuiltinTypes();
+
+// 組み込み型の登録は最初の検索時に一度だけ行う
+RegistryTables& registeredTables() {
+    static bool registered = (registerBuiltinTypes(), true);
+    (void)registered;
+    return tables();
+}
+} // namespace
+
+void ObjectRegistry::registerType(const ObjectType& type) {
+    tables().types[type.getName()] = &type;
+}
+
+const ObjectType* ObjectRegistry::findType(const std::string& name) {
+    auto& t = registeredTables();
+    auto it = t.types.find(name);
+    return it != t.types.end() ? it->second : nullptr;
+}
+
+MethodId ObjectRegistry::internMethod(const std::string& name) {
+    auto& t = tables();
+    auto it = t.methodIds.find(name);
+    if (it != t.methodIds.end()) {
+        return it->second;
+    }
+    MethodId id = static_cast<MethodId>(t.methodNames.size());
+    t.methodNames.push_back(name);
+    t.methodIds.emplace(name, id);
+    return id;
+}
+
+MethodId ObjectRegistry::findMethod(const std::string& name) {
+    auto& t = registeredTables();
+    auto it = t.methodIds.find(name);
+    return it != t.methodIds.end() ? it->second : INVALID_METHOD;
+}
+
+const std::string& ObjectRegistry::methodName(MethodId id) {
+    static const std::string unknown = "unknown";
+    auto& t = tables();
+    return id < t.methodNames.size() ? t.methodNames[id] : unknown;
+}
+
+ObjectType& ObjectType::method(const std::string& methodName, MethodFn fn, const char* message) {
+    MethodId id = ObjectRegistry::internMethod(methodName);
+    if (methods.size() <= id) {
+        methods.resize(id + 1, Method{nullptr, nullptr, nullptr, 0, 0});
+    }
+    methods[id] = Method{fn, nullptr, message, 0, 0};
+    return *this;
+}
+
+ObjectType& ObjectType::method(const std::string& methodName, MethodArgsFn fn, uint8_t minArgs, uint8_t maxArgs,
+                               const char* message) {
+    MethodId id = ObjectRegistry::internMethod(methodName);
+    if (methods.size() <= id) {
+        methods.resize(id + 1, Method{nullptr, nullptr, nullptr, 0, 0});
+    }
+    methods[id] = Method{nullptr, fn, message, minArgs, maxArgs};
+    return *this;
+}
+
+//------------------------------------------------------------------------------
+// 組み込み型
+//------------------------------------------------------------------------------
+
+const ObjectType& IntObject::objectType() {
+    static const ObjectType type("int", []() -> BaseObject* { return new IntObject(0); });
+    return type;
+}
+
+const ObjectType& BinaryPatternObject::objectType() {
+    static const ObjectType type("binary", []() -> BaseObject* { return new BinaryPatternObject(0); });
+    return type;
+}
+
+const ObjectType& SeqObject::objectType() {
+    static const ObjectType type =
+        ObjectType("seq", []() -> BaseObject* { return new SeqObject(); })
+            .method("start", [](BaseObject& o, Environment&) { static_cast<SeqObject&>(o).start(); },
+                    "Started sequence")
+            .method("stop", [](BaseObject& o, Environment&) { static_cast<SeqObject&>(o).stop(); },
+                    "Stopped sequence")
+            // パターンの変形（先頭 length ステップに対して）
+            .method("rotate",
+                    [](BaseObject& o, Environment&, const MethodArgs& args) {
+                        static_cast<SeqObject&>(o).rotate(args.empty() ? 1 : args[0].value.asInt());
+                    },
+                    0, 1)
+            .method("invert", [](BaseObject& o, Environment&) { static_cast<SeqObject&>(o).invert(); })
+            .method("mirror", [](BaseObject& o, Environment&) { static_cast<SeqObject&>(o).mirror(); })
+            .method("reverse", [](BaseObject& o, Environment&) { static_cast<SeqObject&>(o).mirror(); })
+            .method("and",
+                    [](BaseObject& o, Environment&, const MethodArgs& args) {
+                        static_cast<SeqObject&>(o).applyMask(SeqObject::MASK_AND, args[0].asPattern());
+                    },
+                    1, 1)
+            .method("or",
+                    [](BaseObject& o, Environment&, const MethodArgs& args) {
+                        static_cast<SeqObject&>(o).applyMask(SeqObject::MASK_OR, args[0].asPattern());
+                    },
+                    1, 1)
+            .method("xor",
+                    [](BaseObject& o, Environment&, const MethodArgs& args) {
+                        static_cast<SeqObject&>(o).applyMask(SeqObject::MASK_XOR, args[0].asPattern());
+                    },
+                    1, 1)
+            .method("euclid",
+                    [](BaseObject& o, Environment&, const MethodArgs& args) {
+                        SeqObject& seq = static_cast<SeqObject&>(o);
+                        int steps = args.size() > 1 ? args[1].value.asInt() : seq.getAttr(Attr::LENGTH).asInt();
+                        seq.euclid(args[0].value.asInt(), steps);
+                    },
+                    1, 2);
+    return type;
+}
+
+const ObjectType& CountObject::objectType() {
+    static const ObjectType type =
+        ObjectType("count", []() -> BaseObject* { return new CountObject(); })
+            .method("start", [](BaseObject& o, Environment&) { static_cast<CountObject&>(o).start(); },
+                    "Started counter")
+            .method("stop", [](BaseObject& o, Environment&) { static_cast<CountObject&>(o).stop(); },
+                    "Stopped counter")
+            .method("reset", [](BaseObject& o, Environment&) { static_cast<CountObject&>(o).reset(); },
+                    "Reset counter");
+    return type;
+}
+
+const ObjectType& MIDINoteObject::objectType() {
+    static const ObjectType type =
+        ObjectType("midi_note", []() -> BaseObject* { return new MIDINoteObject(); })
+            .method("trigger", [](BaseObject& o, Environment& env) { static_cast<MIDINoteObject&>(o).trigger(env); })
+            .method("stop", [](BaseObject& o, Environment& env) { static_cast<MIDINoteObject&>(o).stop(env); });
+    return type;
+}
+
+const ObjectType& MIDICCObject::objectType() {
+    static const ObjectType type("midi_cc", []() -> BaseObject* { return new MIDICCObject(); });
+    return type;
+}
+
+const ObjectType& MIDISeqObject::objectType() {
+    static const ObjectType type("midi_seq", []() -> BaseObject* { return new MIDISeqObject(); },
+                                 &SeqObject::objectType());
+    return type;
+}
+
+const ObjectType& PatternGraphObject::objectType() {
+    static const ObjectType type =
+        ObjectType("pattern", []() -> BaseObject* { return new PatternGraphObject(); })
+            .method("start", [](BaseObject& o, Environment&) { static_cast<SeqObject&>(o).start(); },
+                    "Started pattern")
+            .method("stop", [](BaseObject& o, Environment&) { static_cast<SeqObject&>(o).stop(); },
+                    "Stopped pattern");
+    return type;
+}
+
+//------------------------------------------------------------------------------
+// プールへの登録
+//------------------------------------------------------------------------------
+
+// 速さが1/1でなければプールには入らず、環境の予定表から onTick で進む
+void SeqObject::attach(Environment& env, uint32_t /* slot */) {
+    if (!home) {
+        home = &env.getSequencePool();
+        syncPool();
+    }
+}
+
+void CountObject::attach(Environment& env, uint32_t /* slot */) {
+    if (!home) {
+        home = &env.getCounterPool();
+        syncPool();
+    }
+}
+
+//------------------------------------------------------------------------------
+// スナップショット（Scene が型名と一緒に書く。読み込みは環境に登録する前）
+//------------------------------------------------------------------------------
+
+void BaseObject::save(SnapshotWriter& out) const {
+    out.u16(rate.mul);
+    out.u16(rate.div);
+}
+
+bool BaseObject::load(SnapshotReader& in) {
+    int mul = in.u16();
+    int div = in.u16();
+    if (!in.good()) {
+        return false;
+    }
+    // 派生クラスの setAttr を通す（範囲の制限とプールの出入り）
+    setAttr(Attr::RATE_MUL, Value::integer(mul));
+    setAttr(Attr::RATE_DIV, Value::integer(div));
+    return true;
+}
+
+void IntObject::save(SnapshotWriter& out) const {
+    out.i32(value);
+}
+
+bool IntObject::load(SnapshotReader& in) {
+    // 属性を持たないので速さも書かない
+    value = in.i32();
+    return in.good();
+}
+
+void BinaryPatternObject::save(SnapshotWriter& out) const {
+    out.pattern(pattern);
+}
+
+bool BinaryPatternObject::load(SnapshotReader& in) {
+    return in.pattern(pattern);
+}
+
+void SeqObject::save(SnapshotWriter& out) const {
+    BaseObject::save(out);
+    out.pattern(data);
+    SequenceState s = state();
+    out.i32(s.position);
+    out.i32(s.length);
+    out.u8(s.playing);
+}
+
+bool SeqObject::load(SnapshotReader& in) {
+    if (!BaseObject::load(in) || !in.pattern(data)) {
+        return false;
+    }
+    int32_t pos = in.i32();
+    int32_t len = in.i32();
+    uint8_t play = in.u8();
+    if (!in.good() || len < 1 || len > static_cast<int32_t>(BitPattern::MAX_STEPS) || pos < -1 || pos >= len) {
+        return false;
+    }
+    if (data.size() < static_cast<size_t>(len)) {
+        data.resize(static_cast<size_t>(len));
+    }
+    position() = pos;
+    length() = len;
+    playing() = play != 0;
+    return true;
+}
+
+void CountObject::save(SnapshotWriter& out) const {
+    BaseObject::save(out);
+    CounterState s = state();
+    out.i32(s.value);
+    out.i32(s.min);
+    out.i32(s.max);
+    out.i32(s.step);
+    out.u8(s.running);
+}
+
+bool CountObject::load(SnapshotReader& in) {
+    if (!BaseObject::load(in)) {
+        return false;
+    }
+    value() = in.i32();
+    min() = in.i32();
+    max() = in.i32();
+    step() = in.i32();
+    running() = in.u8() != 0;
+    return in.good();
+}
+
+void MIDINoteObject::save(SnapshotWriter& out) const {
+    BaseObject::save(out);
+    out.u8(static_cast<uint8_t>(channel));
+    out.u8(static_cast<uint8_t>(note));
+    out.u8(static_cast<uint8_t>(velocity));
+    out.i32(duration);
+    out.u8(static_cast<uint8_t>(gate));
+    out.u8(static_cast<uint8_t>(port));
+}
+
+bool MIDINoteObject::load(SnapshotReader& in) {
+    if (!BaseObject::load(in)) {
+        return false;
+    }
+    channel = in.u8() & 0x0F;
+    note = in.u8() & 0x7F;
+    velocity = in.u8() & 0x7F;
+    duration = std::max(1, static_cast<int>(in.i32()));
+    gate = std::min(100, std::max(1, static_cast<int>(in.u8())));
+    port = clampPort(in.u8());
+    return in.good();
+}
+
+void MIDICCObject::save(SnapshotWriter& out) const {
+    BaseObject::save(out);
+    out.u8(static_cast<uint8_t>(channel));
+    out.u8(static_cast<uint8_t>(controller));
+    out.u8(static_cast<uint8_t>(value));
+    out.u8(static_cast<uint8_t>(port));
+}
+
+bool MIDICCObject::load(SnapshotReader& in) {
+    if (!BaseObject::load(in)) {
+        return false;
+    }
+    channel = in.u8() & 0x0F;
+    controller = in.u8() & 0x7F;
+    value = in.u8() & 0x7F;
+    port = clampPort(in.u8());
+    return in.good();
+}
+
+void MIDISeqObject::save(SnapshotWriter& out) const {
+    SeqObject::save(out);
+    out.u8(static_cast<uint8_t>(midiChannel));
+    out.u8(static_cast<uint8_t>(velocity));
+    out.i32(duration);
+    out.u8(static_cast<uint8_t>(gate));
+    out.u8(static_cast<uint8_t>(port));
+    out.u8(midiEnabled ? 1 : 0);
+    out.u32(static_cast<uint32_t>(notes.size()));
+    for (int n : notes) {
+        out.i32(n);
+    }
+}
+
+bool MIDISeqObject::load(SnapshotReader& in) {
+    if (!SeqObject::load(in)) {
+        return false;
+    }
+    midiChannel = in.u8() & 0x0F;
+    velocity = in.u8() & 0x7F;
+    duration = std::max(1, static_cast<int>(in.i32()));
+    gate = std::min(100, std::max(1, static_cast<int>(in.u8())));
+    port = clampPort(in.u8());
+    midiEnabled = in.u8() != 0;
+    uint32_t count = in.u32();
+    if (!in.good() || count == 0 || count > BitPattern::MAX_STEPS || !in.fits(count, 4)) {
+        return false;
+    }
+    notes.resize(count);
+    for (int& n : notes) {
+        // -1 は鳴らさないステップ
+        n = std::min(127, std::max(-1, static_cast<int>(in.i32())));
+    }
+    return in.good();
+}
+
+namespace {
+// 組み込み型の登録（新しい型はここに追加する）
+void registerBuiltinTypes() {
+    ObjectRegistry::registerType(IntObject::objectType());
+    ObjectRegistry::registerType(SeqObject::objectType());
+    ObjectRegistry::registerType(CountObject::objectType());
+    ObjectRegistry::registerType(BinaryPatternObject::objectType());
+    ObjectRegistry::registerType(MIDINoteObject::objectType());
+    ObjectRegistry::registerType(MIDICCObject::objectType());
+    ObjectRegistry::registerType(MIDISeqObject::objectType());
+    ObjectRegistry::registerType(PatternGraphObject::objectType());
+}
+} // namespace
 
 // ObjectFactoryの実装
-BaseObject* ObjectFactory::createObject(const std::string &type) {
-    if (type == "int") {
-        return new IntObject(0);
-    } else if (type == "seq") {
-        return new SeqObject();
-    } else if (type == "count") {
-        return new CountObject();
-    } else if (type == "binary") {
-        return new BinaryPatternObject(0);
-    }
-    else if (type == "midi_note") {
-        return new MIDINoteObject();
-    } 
-    else if (type == "midi_cc") {
-        return new MIDICCObject();
-    } 
-    else if (type == "midi_seq") {
-        return new MIDISeqObject();
-    }
-    // 将来的に他のタイプを追加
+ObjectPtr ObjectFactory::createObject(const std::string &type) {
+    const ObjectType* objectType = ObjectRegistry::findType(type);
+    if (objectType) {
+        return objectType->create();
+    }
 
     throw std::runtime_error("Unknown object type: " + type);
-}
\ No newline at end of file
+}
@@ -0,0 +1,94 @@
+#include "object_pool.hpp"
+#include <atomic>
+#include <mutex>
+#include <new>
+
+namespace {
+// 空きブロック（解放済みブロックの先頭に次の空きブロックへのリンクを置く）
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+constexpr size_t SIZE_CLASSES = ObjectArena::MAX_BLOCK / ObjectArena::GRANULARITY;
+
+// 大きさクラスごとの空きリスト（ロックもクラスごとなので、別の大きさの
+// オブジェクトを扱うスレッドどうしは待ち合わせない）
+struct SizeClass {
+    std::mutex mutex;
+    FreeBlock* head = nullptr;
+};
+
+struct ArenaState {
+    SizeClass classes[SIZE_CLASSES];
+    std::atomic<size_t> chunks{0};
+    std::atomic<size_t> live{0};
+};
+
+// 静的オブジェクトの破棄順に左右されないよう、アリーナ自体は破棄しない
+ArenaState& state() {
+    static ArenaState* instance = new ArenaState();
+    return *instance;
+}
+
+// 大きさから大きさクラスの番号を求める
+size_t sizeClass(size_t size) {
+    return (size + ObjectArena::GRANULARITY - 1) / ObjectArena::GRANULARITY - 1;
+}
+} // namespace
+
+void* ObjectArena::allocate(size_t size) {
+    if (size == 0 || size > MAX_BLOCK) {
+        return ::operator new(size);
+    }
+
+    ArenaState& s = state();
+    size_t cls = sizeClass(size);
+    SizeClass& c = s.classes[cls];
+    FreeBlock* block;
+    {
+        std::lock_guard<std::mutex> lock(c.mutex);
+        if (!c.head) {
+            // 空きがなければ塊を1つ確保して空きリストに繋ぐ
+            size_t blockSize = (cls + 1) * GRANULARITY;
+            char* chunk = static_cast<char*>(::operator new(blockSize * BLOCKS_PER_CHUNK));
+            s.chunks.fetch_add(1, std::memory_order_relaxed);
+            for (size_t i = BLOCKS_PER_CHUNK; i > 0; i--) {
+                FreeBlock* fresh = reinterpret_cast<FreeBlock*>(chunk + (i - 1) * blockSize);
+                fresh->next = c.head;
+                c.head = fresh;
+            }
+        }
+        block = c.head;
+        c.head = block->next;
+    }
+    s.live.fetch_add(1, std::memory_order_relaxed);
+    return block;
+}
+
+void ObjectArena::release(void* p, size_t size) {
+    if (!p) {
+        return;
+    }
+    if (size == 0 || size > MAX_BLOCK) {
+        ::operator delete(p);
+        return;
+    }
+
+    ArenaState& s = state();
+    SizeClass& c = s.classes[sizeClass(size)];
+    FreeBlock* block = static_cast<FreeBlock*>(p);
+    {
+        std::lock_guard<std::mutex> lock(c.mutex);
+        block->next = c.head;
+        c.head = block;
+    }
+    s.live.fetch_sub(1, std::memory_order_relaxed);
+}
+
+size_t ObjectArena::chunkCount() {
+    return state().chunks.load(std::memory_order_relaxed);
+}
+
+size_t ObjectArena::liveBlocks() {
+    return state().live.load(std::memory_order_relaxed);
+}
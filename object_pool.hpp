@@ -0,0 +1,66 @@
+#ifndef REELIA_OBJECT_POOL_HPP
+#define REELIA_OBJECT_POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+/**
+ * オブジェクト用アリーナ
+ * オブジェクトの大きさ（16バイト単位）ごとに固定長ブロックの空きリストを持つ。
+ * ブロックはまとまった塊で確保し、解放されたブロックは同じ大きさの
+ * オブジェクトにそのまま再利用する。確保した塊はプロセス終了まで返さないので、
+ * 演奏中の再代入・複製・破棄では汎用アロケータを呼ばない。
+ * 大きさが MAX_BLOCK を超えるものだけ通常のnew/deleteに回す。
+ * 全関数スレッドセーフ（ロックは大きさクラスごと）。
+ */
+class ObjectArena {
+public:
+  static constexpr size_t GRANULARITY = 16;
+  static constexpr size_t MAX_BLOCK = 512;
+  static constexpr size_t BLOCKS_PER_CHUNK = 64;
+
+  static void *allocate(size_t size);
+  static void release(void *p, size_t size);
+
+  // 統計（ベンチマーク・デバッグ用）
+  static size_t chunkCount();  // 汎用アロケータから確保した塊の数
+  static size_t liveBlocks();  // 使用中のブロック数
+};
+
+/**
+ * アリーナから確保するクラスの基底
+ * 仮想デストラクタを持つクラスが継承すると、派生クラスも実際の大きさで
+ * アリーナから確保・解放される。
+ */
+class PoolAllocated {
+public:
+  static void *operator new(size_t size) { return ObjectArena::allocate(size); }
+  static void operator delete(void *p, size_t size) {
+    ObjectArena::release(p, size);
+  }
+};
+
+/**
+ * アリーナから確保するアロケータ
+ * オブジェクトが持つ小さな配列（パターンの語、ステップごとのノートなど）に
+ * 使うと、オブジェクトの生成・複製で汎用アロケータを呼ばない。
+ */
+template <typename T>
+struct ArenaAllocator {
+  using value_type = T;
+
+  ArenaAllocator() = default;
+  template <typename U>
+  ArenaAllocator(const ArenaAllocator<U> &) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(ObjectArena::allocate(n * sizeof(T)));
+  }
+  void deallocate(T *p, size_t n) { ObjectArena::release(p, n * sizeof(T)); }
+
+  bool operator==(const ArenaAllocator &) const { return true; }
+  bool operator!=(const ArenaAllocator &) const { return false; }
+};
+
+#endif // REELIA_OBJECT_POOL_HPP
@@ -0,0 +1,252 @@
+#ifndef REELIA_OSC_HPP
+#define REELIA_OSC_HPP
+
+#include "base_object.hpp"
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+/**
+ * OSCメッセージ
+ * 受信バッファの中を指すだけで、アドレスも引数も複写しない
+ * （バッファを使い回す前に読み終えること）。
+ */
+struct OSCMessage {
+    const char* address;
+    size_t addressLength;
+    const char* types; // 型タグ（先頭の ',' は除く。型タグのない古い形式なら空）
+    size_t typeCount;
+    const uint8_t* args; // 引数の先頭
+    const uint8_t* end;
+};
+
+namespace osc_detail {
+// ビッグエンディアンの整数
+inline uint32_t readU32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+inline uint64_t readU64(const uint8_t* p) {
+    return (static_cast<uint64_t>(readU32(p)) << 32) | readU32(p + 4);
+}
+
+// 0終端の文字列（4バイト境界まで詰め物がある）を読み飛ばし、次の位置を返す
+// 壊れていればnullptr
+inline const uint8_t* skipString(const uint8_t* p, const uint8_t* end, size_t& length) {
+    const void* nul = std::memchr(p, 0, static_cast<size_t>(end - p));
+    if (!nul) {
+        return nullptr;
+    }
+    length = static_cast<size_t>(static_cast<const uint8_t*>(nul) - p);
+    size_t padded = (length + 4) & ~static_cast<size_t>(3);
+    return padded <= static_cast<size_t>(end - p) ? p + padded : nullptr;
+}
+
+// int の範囲に丸める
+inline int clampInt(double v) {
+    if (!(v == v)) {
+        return 0; // NaN
+    }
+    if (v >= 2147483647.0) {
+        return 2147483647;
+    }
+    if (v <= -2147483648.0) {
+        return -2147483647 - 1;
+    }
+    return static_cast<int>(std::lround(v));
+}
+
+// "1011" や "b1011" をバイナリパターンの値として読む（32桁まで）
+inline bool parseBits(const char* s, size_t n, Value& value) {
+    if (n > 0 && (s[0] == 'b' || s[0] == '#')) {
+        s++;
+        n--;
+    }
+    if (n == 0 || n > 32) {
+        return false;
+    }
+    uint32_t bits = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] != '0' && s[i] != '1') {
+            return false;
+        }
+        bits = (bits << 1) | static_cast<uint32_t>(s[i] - '0');
+    }
+    value = Value::binary(static_cast<int>(bits));
+    return true;
+}
+} // namespace osc_detail
+
+/**
+ * OSCメッセージの引数を順に読む
+ * 数値（i h f d）、真偽値（T F）、0と1だけの文字列を値にする。
+ * それ以外の型（N I b t など）は値にせず読み飛ばす。
+ */
+class OSCArguments {
+private:
+    const char* type;
+    const char* typeEnd;
+    const uint8_t* p;
+    const uint8_t* end;
+
+public:
+    explicit OSCArguments(const OSCMessage& msg)
+        : type(msg.types), typeEnd(msg.types + msg.typeCount), p(msg.args), end(msg.end) {}
+
+    // 次の値（残りがない・形式が壊れていればfalse）
+    bool next(Value& value) {
+        using namespace osc_detail;
+        while (type < typeEnd) {
+            char t = *type++;
+            size_t left = static_cast<size_t>(end - p);
+            switch (t) {
+                case 'i':
+                    if (left < 4) {
+                        return false;
+                    }
+                    value = Value::integer(static_cast<int32_t>(readU32(p)));
+                    p += 4;
+                    return true;
+                case 'f': {
+                    if (left < 4) {
+                        return false;
+                    }
+                    uint32_t bits = readU32(p);
+                    float f;
+                    std::memcpy(&f, &bits, sizeof(f));
+                    value = Value::integer(clampInt(f));
+                    p += 4;
+                    return true;
+                }
+                case 'h':
+                case 'd': {
+                    if (left < 8) {
+                        return false;
+                    }
+                    uint64_t bits = readU64(p);
+                    p += 8;
+                    if (t == 'h') {
+                        value = Value::integer(clampInt(static_cast<double>(static_cast<int64_t>(bits))));
+                    } else {
+                        double d;
+                        std::memcpy(&d, &bits, sizeof(d));
+                        value = Value::integer(clampInt(d));
+                    }
+                    return true;
+                }
+                case 'T':
+                case 'F':
+                    value = Value::integer(t == 'T' ? 1 : 0);
+                    return true;
+                case 's':
+                case 'S': {
+                    size_t length;
+                    const uint8_t* s = p;
+                    if (!(p = skipString(p, end, length))) {
+                        return false;
+                    }
+                    if (parseBits(reinterpret_cast<const char*>(s), length, value)) {
+                        return true;
+                    }
+                    break;
+                }
+                case 'b': {
+                    if (left < 4) {
+                        return false;
+                    }
+                    size_t size = readU32(p);
+                    size_t padded = (size + 3) & ~static_cast<size_t>(3);
+                    if (padded > left - 4) {
+                        return false;
+                    }
+                    p += 4 + padded;
+                    break;
+                }
+                case 'c':
+                case 'r':
+                case 'm':
+                    if (left < 4) {
+                        return false;
+                    }
+                    p += 4;
+                    break;
+                case 't':
+                    if (left < 8) {
+                        return false;
+                    }
+                    p += 8;
+                    break;
+                case 'N':
+                case 'I':
+                case '[':
+                case ']':
+                    break;
+                default:
+                    return false; // 大きさの分からない型
+            }
+        }
+        return false;
+    }
+};
+
+/**
+ * OSCパケットの解析
+ * メッセージならそのまま、バンドルなら中のメッセージを順に fn に渡す
+ * （バンドルの時刻は見ずにすぐ渡す）。形式が壊れていればそこで止めて false。
+ */
+template <typename Fn>
+bool parseOSCPacket(const uint8_t* data, size_t size, Fn&& fn, int depth = 0) {
+    using namespace osc_detail;
+    const uint8_t* end = data + size;
+    if (size < 4 || (size & 3) != 0) {
+        return false;
+    }
+
+    if (data[0] == '#') {
+        // #bundle, 時刻（8バイト）, (要素の長さ, 要素)...
+        if (size < 16 || std::memcmp(data, "#bundle", 8) != 0 || depth >= 8) {
+            return false;
+        }
+        const uint8_t* p = data + 16;
+        while (p < end) {
+            if (end - p < 4) {
+                return false;
+            }
+            size_t length = readU32(p);
+            p += 4;
+            if (length > static_cast<size_t>(end - p) || !parseOSCPacket(p, length, fn, depth + 1)) {
+                return false;
+            }
+            p += length;
+        }
+        return true;
+    }
+
+    if (data[0] != '/') {
+        return false;
+    }
+    OSCMessage msg;
+    const uint8_t* p = skipString(data, end, msg.addressLength);
+    if (!p) {
+        return false;
+    }
+    msg.address = reinterpret_cast<const char*>(data);
+    msg.types = "";
+    msg.typeCount = 0;
+    if (p < end && *p == ',') {
+        const uint8_t* types = p;
+        size_t length;
+        if (!(p = skipString(p, end, length))) {
+            return false;
+        }
+        msg.types = reinterpret_cast<const char*>(types) + 1;
+        msg.typeCount = length - 1;
+    }
+    msg.args = p;
+    msg.end = end;
+    fn(msg);
+    return true;
+}
+
+#endif // REELIA_OSC_HPP
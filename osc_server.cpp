@@ -0,0 +1,263 @@
+#include "osc_server.hpp"
+#include <arpa/inet.h>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+namespace {
+bool setNonBlocking(int fd) {
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+// アドレスのハッシュ（FNV-1a）
+uint32_t hashAddress(const char* s, size_t n) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ static_cast<uint8_t>(s[i])) * 16777619u;
+    }
+    return h;
+}
+} // namespace
+
+OSCServer::OSCServer(Environment& environment)
+    : env(environment), socketFd(-1), pollFd(-1), wakeFds{-1, -1}, port(0), running(false),
+      buffers(BATCH * PACKET_SIZE), routes(ROUTE_SLOTS), received(0), dropped(0) {}
+
+OSCServer::~OSCServer() {
+    stop();
+}
+
+bool OSCServer::start(int udpPort) {
+    stop();
+
+    socketFd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (socketFd < 0 || !setNonBlocking(socketFd)) {
+        std::cerr << "OSC: cannot create socket: " << std::strerror(errno) << std::endl;
+        closeAll();
+        return false;
+    }
+    int yes = 1;
+    setsockopt(socketFd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+    // フェーダーをまとめて動かしたときに溢れないよう受信バッファを広げる
+    int bufferSize = 1 << 20;
+    setsockopt(socketFd, SOL_SOCKET, SO_RCVBUF, &bufferSize, sizeof(bufferSize));
+
+    sockaddr_in addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons(static_cast<uint16_t>(udpPort));
+    socklen_t addrLength = sizeof(addr);
+    if (udpPort < 0 || udpPort > 65535 || bind(socketFd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 ||
+        getsockname(socketFd, reinterpret_cast<sockaddr*>(&addr), &addrLength) != 0) {
+        std::cerr << "OSC: cannot listen on port " << udpPort << ": " << std::strerror(errno) << std::endl;
+        closeAll();
+        return false;
+    }
+    port = ntohs(addr.sin_port);
+
+    if (pipe(wakeFds) != 0 || !setNonBlocking(wakeFds[0]) || !setNonBlocking(wakeFds[1])) {
+        std::cerr << "OSC: cannot create pipe: " << std::strerror(errno) << std::endl;
+        closeAll();
+        return false;
+    }
+
+#ifdef __linux__
+    pollFd = epoll_create1(EPOLL_CLOEXEC);
+    epoll_event socketEvent{};
+    socketEvent.events = EPOLLIN;
+    socketEvent.data.fd = socketFd;
+    epoll_event wakeEvent{};
+    wakeEvent.events = EPOLLIN;
+    wakeEvent.data.fd = wakeFds[0];
+    if (pollFd < 0 || epoll_ctl(pollFd, EPOLL_CTL_ADD, socketFd, &socketEvent) != 0 ||
+        epoll_ctl(pollFd, EPOLL_CTL_ADD, wakeFds[0], &wakeEvent) != 0) {
+        std::cerr << "OSC: cannot create epoll: " << std::strerror(errno) << std::endl;
+        closeAll();
+        return false;
+    }
+#endif
+
+    running = true;
+    thread = std::thread(&OSCServer::loop, this);
+    return true;
+}
+
+void OSCServer::stop() {
+    if (running.exchange(false)) {
+        char c = 0;
+        ssize_t ignored = write(wakeFds[1], &c, 1);
+        (void)ignored;
+    }
+    if (thread.joinable()) {
+        thread.join();
+    }
+    closeAll();
+}
+
+void OSCServer::closeAll() {
+    for (int* fd : {&socketFd, &pollFd, &wakeFds[0], &wakeFds[1]}) {
+        if (*fd >= 0) {
+            close(*fd);
+            *fd = -1;
+        }
+    }
+}
+
+void OSCServer::loop() {
+    while (running.load()) {
+        // ソケットかパイプ（stop()）が読めるようになるまで待つ
+#ifdef __linux__
+        epoll_event events[2];
+        int n = epoll_wait(pollFd, events, 2, -1);
+#else
+        pollfd fds[2] = {{socketFd, POLLIN, 0}, {wakeFds[0], POLLIN, 0}};
+        int n = poll(fds, 2, -1);
+#endif
+        if (n < 0 && errno != EINTR) {
+            std::cerr << "OSC: wait failed: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        if (!running.load()) {
+            break;
+        }
+
+        // ソケットが空になるまでまとめて受け取る
+        bool posted = false;
+        while (running.load() && receiveBatch(posted) == BATCH) {
+        }
+        if (posted && onBatch) {
+            onBatch();
+        }
+    }
+}
+
+size_t OSCServer::receiveBatch(bool& posted) {
+#ifdef __linux__
+    mmsghdr headers[BATCH];
+    iovec vectors[BATCH];
+    std::memset(headers, 0, sizeof(headers));
+    for (size_t i = 0; i < BATCH; i++) {
+        vectors[i].iov_base = &buffers[i * PACKET_SIZE];
+        vectors[i].iov_len = PACKET_SIZE;
+        headers[i].msg_hdr.msg_iov = &vectors[i];
+        headers[i].msg_hdr.msg_iovlen = 1;
+    }
+    int n = recvmmsg(socketFd, headers, BATCH, MSG_DONTWAIT, nullptr);
+    if (n <= 0) {
+        return 0;
+    }
+    for (int i = 0; i < n; i++) {
+        if (headers[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        } else if (handlePacket(&buffers[i * PACKET_SIZE], headers[i].msg_len)) {
+            posted = true;
+        }
+    }
+    return static_cast<size_t>(n);
+#else
+    // recvmmsg のない環境では1パケットずつ受け取る
+    size_t n = 0;
+    while (n < BATCH) {
+        iovec vector{&buffers[0], PACKET_SIZE};
+        msghdr header;
+        std::memset(&header, 0, sizeof(header));
+        header.msg_iov = &vector;
+        header.msg_iovlen = 1;
+        ssize_t size = recvmsg(socketFd, &header, MSG_DONTWAIT);
+        if (size < 0) {
+            break;
+        }
+        n++;
+        if (header.msg_flags & MSG_TRUNC) {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+        } else if (handlePacket(&buffers[0], static_cast<size_t>(size))) {
+            posted = true;
+        }
+    }
+    return n;
+#endif
+}
+
+bool OSCServer::handlePacket(const uint8_t* data, size_t size) {
+    bool posted = false;
+    if (!parseOSCPacket(data, size, [this, &posted](const OSCMessage& msg) { posted |= dispatch(msg); })) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+    }
+    return posted;
+}
+
+bool OSCServer::dispatch(const OSCMessage& msg) {
+    received.fetch_add(1, std::memory_order_relaxed);
+    const Route* route = resolve(msg.address, msg.addressLength);
+    if (!route) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+
+    ControlCommand command;
+    command.kind = route->kind;
+    command.slot = route->slot;
+    command.attr = route->attr;
+    command.method = route->method;
+    OSCArguments args(msg);
+    Value value;
+    while (command.argc < ControlCommand::MAX_ARGS && args.next(value)) {
+        command.args[command.argc++] = value;
+    }
+
+    // 値のない属性の設定は何もしない
+    if ((command.kind == ControlCommand::SET_ATTR && command.argc == 0) || !env.post(command)) {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    return true;
+}
+
+const OSCServer::Route* OSCServer::resolve(const char* address, size_t length) {
+    Route& cached = routes[hashAddress(address, length) & (ROUTE_SLOTS - 1)];
+    if (cached.used && cached.address.size() == length && std::memcmp(cached.address.data(), address, length) == 0) {
+        return &cached;
+    }
+
+    // /変数名/属性 か /変数名/メソッド
+    const char* slash = length > 1 ? static_cast<const char*>(std::memchr(address + 1, '/', length - 1)) : nullptr;
+    if (!slash || slash == address + 1 || slash == address + length - 1 ||
+        std::memchr(slash + 1, '/', static_cast<size_t>(address + length - slash - 1))) {
+        return nullptr;
+    }
+    std::string name(address + 1, slash);
+    std::string member(slash + 1, address + length);
+
+    // 変数名のスロットは一度作られると変わらないので、変数が空でも覚えてよい
+    // （まだ名前のない変数は覚えない）
+    SlotId slot = env.findSlot(name);
+    if (slot == INVALID_SLOT) {
+        return nullptr;
+    }
+    Route route;
+    route.slot = slot;
+    route.attr = resolveAttribute(member);
+    if (route.attr.isKnown()) {
+        route.kind = ControlCommand::SET_ATTR;
+    } else {
+        route.kind = ControlCommand::CALL;
+        route.method = ObjectRegistry::findMethod(member);
+        if (route.method == INVALID_METHOD) {
+            return nullptr;
+        }
+    }
+    route.address.assign(address, length);
+    route.used = true;
+    cached = std::move(route);
+    return &cached;
+}
@@ -0,0 +1,90 @@
+#ifndef REELIA_OSC_SERVER_HPP
+#define REELIA_OSC_SERVER_HPP
+
+#include "environment.hpp"
+#include "osc.hpp"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * OSCの受信（UDP）
+ * 専用スレッドが非ブロッキングのソケットを epoll（Linux以外は poll）で待ち、
+ * 届いたパケットを recvmmsg でまとめて受け取る。パケットは受信バッファの
+ * まま解析し、/変数名/属性 は属性の設定、/変数名/メソッド はメソッドの
+ * 呼び出しとして制御コマンドにし、環境のコマンドキューに送る。
+ * アドレスの解決結果は表に覚えるので、同じアドレスが続く間（フェーダーなど）は
+ * 受信から送信まで確保もロックもしない。
+ */
+class OSCServer {
+public:
+    static constexpr int DEFAULT_PORT = 9000;
+    static constexpr size_t BATCH = 32;          // 1回の受信で受け取るパケットの最大数
+    static constexpr size_t PACKET_SIZE = 2048;  // これより大きいパケットは捨てる
+    static constexpr size_t ROUTE_SLOTS = 256;   // アドレスの解決結果の表の大きさ（2のべき乗）
+
+private:
+    // アドレスの解決結果
+    struct Route {
+        std::string address;
+        SlotId slot;
+        ControlCommand::Kind kind;
+        AttrKey attr;
+        MethodId method;
+        bool used;
+
+        Route() : slot(INVALID_SLOT), kind(ControlCommand::SET_ATTR), method(INVALID_METHOD), used(false) {}
+    };
+
+    Environment& env;
+    int socketFd;
+    int pollFd;      // epoll（Linux以外は使わない）
+    int wakeFds[2];  // stop() で受信スレッドを起こすパイプ
+    int port;
+
+    std::thread thread;
+    std::atomic<bool> running;
+    std::function<void()> onBatch;
+
+    // 受信バッファ（受信スレッドだけが使う）
+    std::vector<uint8_t> buffers;
+    std::vector<Route> routes;
+
+    std::atomic<uint64_t> received; // 受け取ったメッセージ
+    std::atomic<uint64_t> dropped;  // 解決できない・形式が壊れている・キューが満杯で捨てたもの
+
+    void loop();
+    size_t receiveBatch(bool& posted);
+    bool dispatch(const OSCMessage& msg);
+    const Route* resolve(const char* address, size_t length);
+    void closeAll();
+
+public:
+    explicit OSCServer(Environment& environment);
+    ~OSCServer();
+
+    OSCServer(const OSCServer&) = delete;
+    OSCServer& operator=(const OSCServer&) = delete;
+
+    // ポートを開いて受信スレッドを始める（失敗したらエラーを表示してfalse）
+    bool start(int udpPort);
+    void stop();
+
+    // 受け取ったパケットをコマンドキューに送った後に受信スレッドから呼ぶ
+    // （クロックが止まっているときにコマンドを処理させるため。start() の前に設定する）
+    void setBatchHandler(std::function<void()> handler) { onBatch = std::move(handler); }
+
+    // 1パケットの処理（受信スレッドから呼ぶ。ベンチマークからも直接呼べる）
+    // コマンドを1つ以上送ったらtrue
+    bool handlePacket(const uint8_t* data, size_t size);
+
+    bool isRunning() const { return running.load(); }
+    int getPort() const { return port; }
+    uint64_t getReceived() const { return received.load(std::memory_order_relaxed); }
+    uint64_t getDropped() const { return dropped.load(std::memory_order_relaxed); }
+};
+
+#endif // REELIA_OSC_SERVER_HPP
@@ -1,450 +1,775 @@
 #include "parser.hpp"
+#include "metrics.hpp"
+#include "midi_object.hpp"
 #include <iostream>
 
-// ライン全体をトークンに分割
-std::vector<std::string> Parser::tokenizeLine(const std::string& line) {
-    std::vector<std::string> tokens;
-    std::string token;
-    bool inQuotes = false;
-    
-    for (char c : line) {
-        if (c == '"') {
-            inQuotes = !inQuotes;
-            token += c;
-        } else if (c == ' ' && !inQuotes) {
-            if (!token.empty()) {
-                tokens.push_back(token);
-                token.clear();
-            }
-        } else {
-            token += c;
-        }
-    }
-    
-    if (!token.empty()) {
-        tokens.push_back(token);
+//------------------------------------------------------------------------------
+// コンパイル
+//------------------------------------------------------------------------------
+
+// 式のコンパイル（定数部分はコンパイル時に畳み込まれ、変数はスロットに解決される）
+bool Parser::compileExpression(size_t& pos, Expression& expr, std::string& error) {
+    if (!ExpressionEvaluator::compile(tokens, pos, expr, error)) {
+        return false;
     }
-    
-    return tokens;
+    expr.bind(env);
+    return true;
 }
 
-// パイプで区切られたコマンドに分割
-std::vector<std::string> Parser::splitByPipe(const std::string& line) {
-    std::vector<std::string> commands;
-    std::string cmd;
-    bool inQuotes = false;
-    
-    for (char c : line) {
-        if (c == '"') {
-            inQuotes = !inQuotes;
-            cmd += c;
-        } else if (c == '|' && !inQuotes) {
-            if (!cmd.empty()) {
-                commands.push_back(trim(cmd));
-                cmd.clear();
-            }
-        } else {
-            cmd += c;
-        }
-    }
-    
-    if (!cmd.empty()) {
-        commands.push_back(trim(cmd));
-    }
-    
-    return commands;
+namespace {
+// 文の終わり（行末またはパイプ）か
+bool isStatementEnd(const Token& tok) {
+    return tok.is(Token::END) || tok.is(Token::PIPE);
 }
 
-// 空白文字かどうかを判定
-bool Parser::isWhitespace(char c) {
-    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+// 式がバイナリパターンのリテラルだけなら、桁数を保ったパターンを読む
+void compilePatternLiteral(const std::vector<Token>& tokens, size_t start, size_t end, BitPattern& pattern) {
+    if (end == start + 1 && tokens[start].is(Token::BINARY)) {
+        BitPattern::parse(tokens[start].text, pattern);
+    }
 }
 
-// 文字列の前後の空白を削除
-std::string Parser::trim(const std::string& str) {
-    size_t first = str.find_first_not_of(" \t\n\r");
-    if (first == std::string::npos) {
-        return "";
+// 評価済みの値のパターン（リテラルのパターンか、パターンを持つ変数）
+const BitPattern* patternOf(const BitPattern& literal, const Expression& expr, Environment& env) {
+    if (!literal.empty()) {
+        return &literal;
     }
-    size_t last = str.find_last_not_of(" \t\n\r");
-    return str.substr(first, (last - first + 1));
+    if (expr.getShape() == Expression::VARIABLE) {
+        BaseObject* obj = env.getVariable(expr.getSlots()[0]);
+        return obj ? obj->getPattern() : nullptr;
+    }
+    return nullptr;
 }
 
-// バイナリパターン判定（例: b10101010）
-bool Parser::isBinaryPattern(const std::string& str) {
-    if (str.size() <= 1 || str[0] != 'b') {
+// パターングラフの式か（euclid(...) / pat(...) / rnd(...) で始まる）
+// 引数2つの rnd(lo, hi) だけなら式の乱数 RND() として扱う
+bool isGraphExpression(const std::vector<Token>& tokens, size_t pos) {
+    const Token& name = tokens[pos];
+    if (!name.is(Token::IDENTIFIER) || !tokens[pos + 1].is(Token::LPAREN)) {
         return false;
     }
-    
-    for (size_t i = 1; i < str.size(); i++) {
-        if (str[i] != '0' && str[i] != '1') {
-            return false;
+    if (name.text == "euclid" || name.text == "pat") {
+        return true;
+    }
+    if (name.text != "rnd") {
+        return false;
+    }
+    int depth = 0;
+    size_t args = 1;
+    size_t i = pos + 1;
+    for (; !tokens[i].is(Token::END); i++) {
+        if (tokens[i].is(Token::LPAREN)) {
+            depth++;
+        } else if (tokens[i].is(Token::RPAREN)) {
+            if (--depth == 0) {
+                break;
+            }
+        } else if (tokens[i].is(Token::COMMA) && depth == 1) {
+            args++;
         }
     }
-    
-    return true;
+    return !tokens[i].is(Token::END) && (tokens[i + 1].is(Token::DOT) || args != 2);
 }
 
-// バイナリパターンの解析
-int Parser::parseBinaryPattern(const std::string& str) {
-    if (!isBinaryPattern(str)) {
-        return 0;
+// トークン列を元の表記に戻す（パターングラフの定義の表示・比較用）
+std::string tokenSource(const std::vector<Token>& tokens, size_t start, size_t end) {
+    std::string text;
+    for (size_t i = start; i < end; i++) {
+        const Token& tok = tokens[i];
+        if (tok.is(Token::VARIABLE)) {
+            text += "$" + tok.text;
+        } else if (tok.is(Token::COMMA)) {
+            text += ", ";
+        } else if (tok.is(Token::OPERATOR)) {
+            text += " " + tok.text + " ";
+        } else {
+            text += tok.text;
+        }
     }
-    
-    int result = 0;
-    for (size_t i = 1; i < str.size(); i++) {
-        result = (result << 1) | (str[i] == '1' ? 1 : 0);
+    return text;
+}
+
+// 引数が定数ならその値、そうでなければ束縛が最初に評価されるまでの値
+int constantOr(const Expression& expr, int otherwise) {
+    return expr.isConstant() ? expr.constantValue() : otherwise;
+}
+
+// 定数でない引数をパラメータに束縛する
+void bindGraphParameter(std::vector<GraphBinding>& bindings, int node, int slot, Expression& expr) {
+    if (!expr.isConstant()) {
+        bindings.push_back(GraphBinding{CombinatorModule::parameterId(node, slot), std::move(expr)});
     }
-    
-    return result;
 }
+} // namespace
 
-// クラス生成構文の処理: $seq = @seq
-bool Parser::processClassCreation(const std::string& line) {
-    std::regex pattern(R"(\$(\w+)\s*=\s*@(\w+))");
-    std::smatch matches;
-    
-    if (std::regex_match(line, matches, pattern)) {
-        std::string varName = matches[1].str();
-        std::string className = matches[2].str();
-        
-        try {
-            BaseObject* obj = ObjectFactory::createObject(className);
-            env.setVariable(varName, obj);
-            std::cout << "Created new object $" << varName << " of type " << className << std::endl;
-            return true;
-        } catch (const std::exception& e) {
-            std::cerr << "Error creating object: " << e.what() << std::endl;
+// パターングラフの1段の引数: (arg, ...)
+bool Parser::compileGraphArguments(size_t& pos, std::vector<Expression>& args, std::string& error) {
+    pos++; // '('
+    while (!tokens[pos].is(Token::RPAREN)) {
+        if (!args.empty()) {
+            if (!tokens[pos].is(Token::COMMA)) {
+                error = "Expected ',' or ')'";
+                return false;
+            }
+            pos++;
+        }
+        Expression expr;
+        if (!compileExpression(pos, expr, error)) {
+            return false;
         }
+        args.push_back(std::move(expr));
     }
-    
-    return false;
+    pos++;
+    return true;
 }
 
-// 属性アクセス構文の処理: $obj.attr = value または var = $obj.attr
-bool Parser::processAttributeAccess(const std::string& line) {
-    // 属性設定: $obj.attr = value
-    std::regex setPattern(R"(\$(\w+)\.(\w+)\s*=\s*(.*))");
-    std::smatch setMatches;
-    
-    if (std::regex_match(line, setMatches, setPattern)) {
-        std::string objName = setMatches[1].str();
-        std::string attrName = setMatches[2].str();
-        std::string valueExpr = setMatches[3].str();
-        
-        BaseObject* obj = env.getVariable(objName);
-        if (!obj) {
-            std::cerr << "Error: Object $" << objName << " not found" << std::endl;
+// パターングラフ: source(.op(...))*
+// source は euclid(k, n[, rot]) / pat(b...) / rnd(p[, seed])、op は
+// rotate(n) / invert() / and(...) / or(...) / xor(...)（マスクはグラフかバイナリパターン）
+// ノードは入力の後に追加するので、最後に追加したノードが出力になる
+bool Parser::compileGraph(size_t& pos, CombinatorModule& graph, std::vector<GraphBinding>& bindings, int& node,
+                          std::string& error) {
+    const Token& name = tokens[pos];
+    if (!name.is(Token::IDENTIFIER) || !tokens[pos + 1].is(Token::LPAREN)) {
+        error = "Expected euclid(), pat() or rnd()";
+        return false;
+    }
+
+    if (name.text == "pat") {
+        BitPattern pattern;
+        if (!tokens[pos + 2].is(Token::BINARY) || !tokens[pos + 3].is(Token::RPAREN) ||
+            !BitPattern::parse(tokens[pos + 2].text, pattern)) {
+            error = "pat() takes a binary pattern";
             return false;
         }
-        
-        // 式を評価して値を取得
-        BaseObject* value = evaluateExpression(valueExpr);
-        if (!value) {
-            std::cerr << "Error evaluating expression: " << valueExpr << std::endl;
+        node = graph.addPattern(pattern);
+        pos += 4;
+    } else if (name.text == "euclid" || name.text == "rnd") {
+        bool euclid = name.text == "euclid";
+        pos++;
+        std::vector<Expression> args;
+        if (!compileGraphArguments(pos, args, error)) {
             return false;
         }
-        
-        try {
-            obj->setAttribute(attrName, value);
-            std::cout << "Set $" << objName << "." << attrName << " = " << value->toString() << std::endl;
-            
-            // 一時オブジェクトを解放
-            delete value;
-            return true;
-        } catch (const std::exception& e) {
-            std::cerr << "Error setting attribute: " << e.what() << std::endl;
-            delete value;
+        if (euclid && (args.size() < 2 || args.size() > 3)) {
+            error = "euclid() takes 2-3 arguments";
+            return false;
+        }
+        if (!euclid && (args.empty() || args.size() > 2)) {
+            error = "rnd() takes 1-2 arguments";
             return false;
         }
+        if (euclid) {
+            node = graph.addEuclid(constantOr(args[0], 0), constantOr(args[1], 16),
+                                   args.size() > 2 ? constantOr(args[2], 0) : 0);
+            // 打数はステップ数に制限されるので、ステップ数を先に評価する
+            bindGraphParameter(bindings, node, 1, args[1]);
+            bindGraphParameter(bindings, node, 0, args[0]);
+            if (args.size() > 2) {
+                bindGraphParameter(bindings, node, 2, args[2]);
+            }
+        } else {
+            node = graph.addRandom(constantOr(args[0], 50), args.size() > 1 ? constantOr(args[1], 0) : 0);
+            bindGraphParameter(bindings, node, 0, args[0]);
+            if (args.size() > 1) {
+                bindGraphParameter(bindings, node, 1, args[1]);
+            }
+        }
+    } else {
+        error = "Unknown pattern source: " + name.text;
+        return false;
+    }
+
+    while (tokens[pos].is(Token::DOT) && tokens[pos + 1].is(Token::IDENTIFIER) &&
+           tokens[pos + 2].is(Token::LPAREN)) {
+        std::string op = tokens[pos + 1].text;
+        pos += 2;
+        if (op == "rotate") {
+            std::vector<Expression> args;
+            if (!compileGraphArguments(pos, args, error)) {
+                return false;
+            }
+            if (args.size() > 1) {
+                error = "rotate() takes 0-1 arguments";
+                return false;
+            }
+            node = graph.addRotate(node, args.empty() ? 1 : constantOr(args[0], 0));
+            if (!args.empty()) {
+                bindGraphParameter(bindings, node, 0, args[0]);
+            }
+        } else if (op == "invert") {
+            if (!tokens[pos + 1].is(Token::RPAREN)) {
+                error = "invert() takes no arguments";
+                return false;
+            }
+            pos += 2;
+            node = graph.addInvert(node);
+        } else if (op == "and" || op == "or" || op == "xor") {
+            pos++;
+            int operand = -1;
+            BitPattern pattern;
+            if (tokens[pos].is(Token::BINARY) && BitPattern::parse(tokens[pos].text, pattern)) {
+                operand = graph.addPattern(pattern);
+                pos++;
+            } else if (!compileGraph(pos, graph, bindings, operand, error)) {
+                return false;
+            }
+            if (!tokens[pos].is(Token::RPAREN)) {
+                error = "Expected ')'";
+                return false;
+            }
+            pos++;
+            CombinatorModule::Op mask = op == "and" ? CombinatorModule::Op::AND
+                                        : op == "or" ? CombinatorModule::Op::OR
+                                                     : CombinatorModule::Op::XOR;
+            node = graph.addMask(mask, node, operand);
+        } else {
+            error = "Unknown pattern operation: " + op;
+            return false;
+        }
+    }
+    return true;
+}
+
+// 1文の構文解析と命令の生成
+bool Parser::compileStatement(size_t& pos, Program& program) {
+    const Token& first = tokens[pos];
+    
+    // 属性取得の代入先は$なしの名前も許可: x = $obj.attr
+    if (first.is(Token::IDENTIFIER) && tokens[pos + 1].is(Token::ASSIGN) &&
+        tokens[pos + 2].is(Token::VARIABLE) && tokens[pos + 3].is(Token::DOT) &&
+        tokens[pos + 4].is(Token::IDENTIFIER) && isStatementEnd(tokens[pos + 5])) {
+        Instruction ins(Instruction::GET_ATTR);
+        ins.target = env.intern(first.text);
+        ins.source = env.intern(tokens[pos + 2].text);
+        ins.member = tokens[pos + 4].text;
+        ins.attr = resolveAttribute(ins.member);
+        program.code.push_back(std::move(ins));
+        pos += 5;
+        return true;
     }
     
-    // 属性取得: var = $obj.attr
-    std::regex getPattern(R"((\$?\w+)\s*=\s*\$(\w+)\.(\w+))");
-    std::smatch getMatches;
+    if (!first.is(Token::VARIABLE)) {
+        program.error = "Expected variable";
+        return false;
+    }
+    pos++;
     
-    if (std::regex_match(line, getMatches, getPattern)) {
-        std::string destName = getMatches[1].str();
-        std::string objName = getMatches[2].str();
-        std::string attrName = getMatches[3].str();
+    // $obj.member ...
+    if (tokens[pos].is(Token::DOT)) {
+        if (!tokens[pos + 1].is(Token::IDENTIFIER)) {
+            program.error = "Expected attribute or method name after '.'";
+            return false;
+        }
+        std::string member = tokens[pos + 1].text;
+        pos += 2;
         
-        // 先頭の$を削除（もしあれば）
-        if (!destName.empty() && destName[0] == '$') {
-            destName = destName.substr(1);
+        // メソッド呼び出し: $obj.method(arg, ...)
+        if (tokens[pos].is(Token::LPAREN)) {
+            pos++;
+            Instruction ins(Instruction::CALL);
+            while (!tokens[pos].is(Token::RPAREN)) {
+                if (!ins.args.empty()) {
+                    if (!tokens[pos].is(Token::COMMA)) {
+                        program.error = "Expected ',' or ')'";
+                        return false;
+                    }
+                    pos++;
+                }
+                Instruction::Argument arg;
+                size_t start = pos;
+                if (!compileExpression(pos, arg.expr, program.error)) {
+                    return false;
+                }
+                compilePatternLiteral(tokens, start, pos, arg.pattern);
+                ins.args.push_back(std::move(arg));
+            }
+            pos++;
+            ins.target = env.intern(first.text);
+            ins.method = ObjectRegistry::findMethod(member);
+            ins.member = std::move(member);
+            program.code.push_back(std::move(ins));
+            return true;
         }
         
-        BaseObject* obj = env.getVariable(objName);
-        if (!obj) {
-            std::cerr << "Error: Object $" << objName << " not found" << std::endl;
-            return false;
+        // 属性設定: $obj.attr = value
+        if (tokens[pos].is(Token::ASSIGN)) {
+            pos++;
+            Instruction ins(Instruction::SET_ATTR);
+            ins.target = env.intern(first.text);
+            ins.attr = resolveAttribute(member);
+            ins.member = std::move(member);
+            size_t start = pos;
+            if (!compileExpression(pos, ins.expr, program.error)) {
+                return false;
+            }
+            compilePatternLiteral(tokens, start, pos, ins.pattern);
+            program.code.push_back(std::move(ins));
+            return true;
         }
         
-        try {
-            BaseObject* attrValue = obj->getAttribute(attrName);
-            if (attrValue) {
-                env.setVariable(destName, attrValue->clone());
-                std::cout << "Got $" << objName << "." << attrName << " -> $" << destName << std::endl;
-                return true;
-            } else {
-                std::cerr << "Error: Attribute " << attrName << " returned null" << std::endl;
+        // 属性の束縛: $obj.attr <- expr（"<" と "-" の間に空白がないときだけ）
+        if (tokens[pos].isOperator("<") && tokens[pos + 1].isOperator("-") &&
+            tokens[pos + 1].column == tokens[pos].column + 1) {
+            pos += 2;
+            Instruction ins(Instruction::BIND);
+            ins.target = env.intern(first.text);
+            ins.attr = resolveAttribute(member);
+            ins.member = std::move(member);
+            size_t start = pos;
+            if (!compileExpression(pos, ins.expr, program.error)) {
                 return false;
             }
-        } catch (const std::exception& e) {
-            std::cerr << "Error getting attribute: " << e.what() << std::endl;
+            ins.definition = tokenSource(tokens, start, pos);
+            program.code.push_back(std::move(ins));
+            return true;
+        }
+        
+        program.error = "Expected '=', '<-' or '()'";
+        return false;
+    }
+    
+    if (!tokens[pos].is(Token::ASSIGN)) {
+        program.error = "Expected '='";
+        return false;
+    }
+    pos++;
+    
+    // クラス生成: $var = @class
+    if (tokens[pos].is(Token::CLASS)) {
+        Instruction ins(Instruction::CREATE);
+        ins.target = env.intern(first.text);
+        ins.member = tokens[pos].text;
+        program.code.push_back(std::move(ins));
+        pos++;
+        return true;
+    }
+    
+    // 属性取得: $var = $obj.attr（属性の型を保ったまま複製する）
+    if (tokens[pos].is(Token::VARIABLE) && tokens[pos + 1].is(Token::DOT) &&
+        tokens[pos + 2].is(Token::IDENTIFIER) && isStatementEnd(tokens[pos + 3])) {
+        Instruction ins(Instruction::GET_ATTR);
+        ins.target = env.intern(first.text);
+        ins.source = env.intern(tokens[pos].text);
+        ins.member = tokens[pos + 2].text;
+        ins.attr = resolveAttribute(ins.member);
+        program.code.push_back(std::move(ins));
+        pos += 3;
+        return true;
+    }
+    
+    // パターングラフ: $var = euclid(5,16).rotate($cnt).and(rnd(70))
+    if (isGraphExpression(tokens, pos)) {
+        Instruction ins(Instruction::GRAPH);
+        ins.target = env.intern(first.text);
+        size_t start = pos;
+        CombinatorModule graph;
+        std::vector<GraphBinding> bindings;
+        int node = -1;
+        if (!compileGraph(pos, graph, bindings, node, program.error)) {
             return false;
         }
+        ins.graph = std::make_shared<PatternGraphObject>(graph, std::move(bindings), tokenSource(tokens, start, pos));
+        program.code.push_back(std::move(ins));
+        return true;
     }
     
-    return false;
+    // 変数代入: $var = expr
+    Instruction ins(Instruction::ASSIGN);
+    ins.target = env.intern(first.text);
+    size_t start = pos;
+    if (!compileExpression(pos, ins.expr, program.error)) {
+        return false;
+    }
+    compilePatternLiteral(tokens, start, pos, ins.pattern);
+    program.code.push_back(std::move(ins));
+    return true;
 }
 
-// メソッド呼び出し構文の処理: $obj.method()
-bool Parser::processMethodCall(const std::string& line) {
-    std::regex pattern(R"(\$(\w+)\.(\w+)\(\))");
-    std::smatch matches;
+// 1行のコンパイル: stmt | stmt | ...
+bool Parser::compileLine(const std::string& line, Program& program) {
+    if (!Tokenizer::tokenize(line, tokens, program.error)) {
+        return false;
+    }
     
-    if (std::regex_match(line, matches, pattern)) {
-        std::string objName = matches[1].str();
-        std::string methodName = matches[2].str();
-        
-        BaseObject* obj = env.getVariable(objName);
-        if (!obj) {
-            std::cerr << "Error: Object $" << objName << " not found" << std::endl;
+    size_t pos = 0;
+    if (tokens[pos].is(Token::END)) {
+        // コメントのみの行
+        program.valid = true;
+        return true;
+    }
+    
+    while (true) {
+        if (!compileStatement(pos, program)) {
             return false;
         }
         
-        // メソッド呼び出しを環境のイベントキューに登録
-        if (methodName == "start") {
-            // Seqオブジェクトのstart()メソッド
-            if (obj->getType() == "seq") {
-                auto event = [objName](Environment& env) {
-                    BaseObject* obj = env.getVariable(objName);
-                    if (obj && obj->getType() == "seq") {
-                        static_cast<SeqObject*>(obj)->start();
-                        std::cout << "Started sequence $" << objName << std::endl;
-                    }
-                };
-                
-                env.queueEvent(event);
-                return true;
-            } 
-            // Countオブジェクトのstart()メソッド
-            else if (obj->getType() == "count") {
-                auto event = [objName](Environment& env) {
-                    BaseObject* obj = env.getVariable(objName);
-                    if (obj && obj->getType() == "count") {
-                        static_cast<CountObject*>(obj)->start();
-                        std::cout << "Started counter $" << objName << std::endl;
-                    }
-                };
-                
-                env.queueEvent(event);
-                return true;
-            }
-        } 
-        else if (methodName == "stop") {
-            // Seqオブジェクトのstop()メソッド
-            if (obj->getType() == "seq") {
-                auto event = [objName](Environment& env) {
-                    BaseObject* obj = env.getVariable(objName);
-                    if (obj && obj->getType() == "seq") {
-                        static_cast<SeqObject*>(obj)->stop();
-                        std::cout << "Stopped sequence $" << objName << std::endl;
-                    }
-                };
-                
-                env.queueEvent(event);
-                return true;
-            } 
-            // Countオブジェクトのstop()メソッド
-            else if (obj->getType() == "count") {
-                auto event = [objName](Environment& env) {
-                    BaseObject* obj = env.getVariable(objName);
-                    if (obj && obj->getType() == "count") {
-                        static_cast<CountObject*>(obj)->stop();
-                        std::cout << "Stopped counter $" << objName << std::endl;
-                    }
-                };
-                
-                env.queueEvent(event);
-                return true;
+        if (tokens[pos].is(Token::END)) {
+            break;
+        }
+        if (!tokens[pos].is(Token::PIPE)) {
+            program.error = "Unexpected '" + tokens[pos].text + "'";
+            return false;
+        }
+        pos++;
+    }
+    
+    // パイプラインはメソッド呼び出しのみ
+    if (program.code.size() > 1) {
+        for (const auto& ins : program.code) {
+            if (ins.op != Instruction::CALL) {
+                program.error = "Only method calls can be combined with '|'";
+                return false;
             }
-        } 
-        else if (methodName == "reset" && obj->getType() == "count") {
-            // Countオブジェクトのreset()メソッド
-            auto event = [objName](Environment& env) {
-                BaseObject* obj = env.getVariable(objName);
-                if (obj && obj->getType() == "count") {
-                    static_cast<CountObject*>(obj)->reset();
-                    std::cout << "Reset counter $" << objName << std::endl;
-                }
-            };
-            
-            env.queueEvent(event);
-            return true;
         }
-        
-        std::cerr << "Error: Unknown method or object type: $" << objName << "." << methodName << "()" << std::endl;
     }
     
-    return false;
+    program.valid = true;
+    return true;
 }
 
-// 変数代入構文の処理: $var = value
-bool Parser::processVariableAssignment(const std::string& line) {
-    // クラス生成と属性アクセスは他のメソッドで処理されるため、
-    // ここでは単純な値の代入のみ処理する
-    std::regex pattern(R"(\$(\w+)\s*=\s*([^@].*))");
-    std::smatch matches;
+// 行のコンパイル（キャッシュ付き）
+std::shared_ptr<const Program> Parser::compile(const std::string& line) {
+    auto it = programCache.find(line);
+    if (it != programCache.end()) {
+        return it->second;
+    }
     
-    if (std::regex_match(line, matches, pattern)) {
-        std::string varName = matches[1].str();
-        std::string valueExpr = matches[2].str();
-        
-        // 式が他の変数への参照かチェック
-        std::regex varRefPattern(R"(\$(\w+))");
-        std::smatch varRefMatches;
-        
-        if (std::regex_match(valueExpr, varRefMatches, varRefPattern)) {
-            // 他の変数からのコピー
-            std::string srcVarName = varRefMatches[1].str();
-            BaseObject* srcObj = env.getVariable(srcVarName);
-            
-            if (!srcObj) {
-                std::cerr << "Error: Variable $" << srcVarName << " not found" << std::endl;
+    // ライブコーディングで行が増え続けてもメモリを使い切らないようにする
+    if (programCache.size() >= MAX_CACHED_PROGRAMS) {
+        programCache.clear();
+    }
+    
+    int64_t started = Metrics::now();
+    auto program = std::make_shared<Program>();
+    compileLine(line, *program);
+    getMetrics().record(Metrics::PARSE, Metrics::now() - started);
+    return programCache.emplace(line, std::move(program)).first->second;
+}
+
+//------------------------------------------------------------------------------
+// 実行
+//------------------------------------------------------------------------------
+
+// 式の評価
+ObjectPtr Parser::evaluateExpression(const Expression& expr) {
+    switch (expr.getShape()) {
+        case Expression::VARIABLE: {
+            // 単独の変数参照は型を保つため複製する
+            BaseObject* obj = env.getVariable(expr.getSlots()[0]);
+            if (!obj) {
+                std::cerr << "Error: Variable $" << expr.getSymbols()[0] << " not found" << std::endl;
+                return nullptr;
+            }
+            return obj->clone();
+        }
+        case Expression::BINARY_LITERAL:
+            return ObjectPtr(new BinaryPatternObject(expr.constantValue()));
+        case Expression::CONSTANT:
+            return ObjectPtr(new IntObject(expr.constantValue()));
+        case Expression::GENERAL:
+            break;
+    }
+    return ObjectPtr(new IntObject(expr.evaluate(env, env.nextStatementStream())));
+}
+
+// 式の評価（値渡し）
+bool Parser::evaluateValue(const Expression& expr, Value& value) {
+    switch (expr.getShape()) {
+        case Expression::VARIABLE: {
+            // 単独の変数参照はバイナリパターンの型を保つ
+            BaseObject* obj = env.getVariable(expr.getSlots()[0]);
+            if (!obj) {
+                std::cerr << "Error: Variable $" << expr.getSymbols()[0] << " not found" << std::endl;
                 return false;
             }
-            
-            // クローンを作成して代入
-            env.setVariable(varName, srcObj->clone());
-            std::cout << "Copied $" << srcVarName << " to $" << varName << std::endl;
-            return true;
-        } 
-        // バイナリパターンの処理
-        else if (isBinaryPattern(valueExpr)) {
-            int patternValue = parseBinaryPattern(valueExpr);
-            env.setVariable(varName, new BinaryPatternObject(patternValue));
-            std::cout << "Set $" << varName << " = " << valueExpr << std::endl;
+            value = Value::of(*obj);
             return true;
         }
-        // 数値リテラルの処理
-        else if (std::regex_match(valueExpr, std::regex(R"(\d+)"))) {
-            int intValue = std::stoi(valueExpr);
-            env.setVariable(varName, new IntObject(intValue));
-            std::cout << "Set $" << varName << " = " << intValue << std::endl;
+        case Expression::BINARY_LITERAL:
+            value = Value::binary(expr.constantValue());
             return true;
+        case Expression::CONSTANT:
+            value = Value::integer(expr.constantValue());
+            return true;
+        case Expression::GENERAL:
+            break;
+    }
+    value = Value::integer(expr.evaluate(env, env.nextStatementStream()));
+    return true;
+}
+
+// クラス生成: $seq = @seq
+bool Parser::executeCreate(const Instruction& ins) {
+    try {
+        env.setVariable(ins.target, ObjectFactory::createObject(ins.member));
+        if (echo) {
+            std::cout << "Created new object $" << env.getName(ins.target) << " of type " << ins.member << std::endl;
         }
-        // その他の式の評価
-        else {
-            BaseObject* evalResult = evaluateExpression(valueExpr);
-            if (evalResult) {
-                env.setVariable(varName, evalResult);
-                std::cout << "Set $" << varName << " = " << evalResult->toString() << std::endl;
-                return true;
-            } else {
-                std::cerr << "Error evaluating expression: " << valueExpr << std::endl;
-                return false;
-            }
-        }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error creating object: " << e.what() << std::endl;
+        return false;
     }
-    
-    return false;
 }
 
-// パイプライン構文の処理: cmd1 | cmd2 | cmd3
-bool Parser::processPipeline(const std::string& line) {
-    auto commands = splitByPipe(line);
+// 属性設定: $obj.attr = value
+bool Parser::executeSetAttribute(const Instruction& ins) {
+    BaseObject* obj = env.getVariable(ins.target);
+    if (!obj) {
+        std::cerr << "Error: Object $" << env.getName(ins.target) << " not found" << std::endl;
+        return false;
+    }
     
-    if (commands.size() <= 1) {
-        // パイプがない場合は他の処理メソッドに委譲
+    if (!ins.attr.isKnown()) {
+        std::cerr << "Error setting attribute: Unknown attribute: " << ins.member << std::endl;
         return false;
     }
     
-    bool success = true;
+    Value value;
+    if (!evaluateValue(ins.expr, value)) {
+        return false;
+    }
     
-    for (const auto& cmd : commands) {
-        // 各コマンドをメソッド呼び出しとして処理
-        if (!processMethodCall(cmd)) {
-            std::cerr << "Error in pipeline command: " << cmd << std::endl;
-            success = false;
+    try {
+        // バイナリパターンは桁数を保ったまま設定する
+        const BitPattern* pattern = patternOf(ins.pattern, ins.expr, env);
+        if (pattern) {
+            obj->setAttrPattern(ins.attr, *pattern);
+        } else {
+            obj->setAttr(ins.attr, value);
         }
+        env.updateSchedule(ins.target);
+        // 値を直接設定したら束縛は外す
+        bool unbound = env.unbind(ins.target, ins.attr);
+        if (echo) {
+            std::cout << "Set $" << env.getName(ins.target) << "." << ins.member << " = "
+                      << (pattern ? BinaryPatternObject(*pattern).toString() : value.toString())
+                      << (unbound ? " (binding removed)" : "") << std::endl;
+        }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error setting attribute: " << e.what() << std::endl;
+        return false;
     }
-    
-    return success;
 }
 
-// 式の評価
-BaseObject* Parser::evaluateExpression(const std::string& expr) {
-    // まずは単純なケースを処理
-    std::string trimmedExpr = trim(expr);
+// 属性取得: var = $obj.attr
+bool Parser::executeGetAttribute(const Instruction& ins) {
+    BaseObject* obj = env.getVariable(ins.source);
+    if (!obj) {
+        std::cerr << "Error: Object $" << env.getName(ins.source) << " not found" << std::endl;
+        return false;
+    }
     
-    // 変数参照
-    std::regex varRefPattern(R"(\$(\w+))");
-    std::smatch varRefMatches;
+    if (!ins.attr.isKnown()) {
+        std::cerr << "Error getting attribute: Unknown attribute: " << ins.member << std::endl;
+        return false;
+    }
     
-    if (std::regex_match(trimmedExpr, varRefMatches, varRefPattern)) {
-        std::string varName = varRefMatches[1].str();
-        BaseObject* obj = env.getVariable(varName);
-        
-        if (!obj) {
-            std::cerr << "Error: Variable $" << varName << " not found" << std::endl;
-            return nullptr;
+    try {
+        // 値を読んでから変数用のオブジェクトを作る（パターンは桁数を保つ）
+        BitPattern pattern;
+        if (obj->getAttrPattern(ins.attr, pattern)) {
+            env.setVariable(ins.target, ObjectPtr(new BinaryPatternObject(pattern)));
+        } else {
+            env.setVariable(ins.target, obj->getAttr(ins.attr).toObject());
         }
-        
-        // 変数の値を複製して返す
-        return obj->clone();
+        if (echo) {
+            std::cout << "Got $" << env.getName(ins.source) << "." << ins.member << " -> $" << env.getName(ins.target) << std::endl;
+        }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error getting attribute: " << e.what() << std::endl;
+        return false;
     }
-    
-    // バイナリパターン
-    if (isBinaryPattern(trimmedExpr)) {
-        int patternValue = parseBinaryPattern(trimmedExpr);
-        return new BinaryPatternObject(patternValue);
+}
+
+// メソッド呼び出し: $obj.method(arg, ...)
+bool Parser::executeCall(const Instruction& ins) {
+    BaseObject* obj = env.getVariable(ins.target);
+    if (!obj) {
+        std::cerr << "Error: Object $" << env.getName(ins.target) << " not found" << std::endl;
+        return false;
     }
     
-    // 数値リテラル
-    if (std::regex_match(trimmedExpr, std::regex(R"(\d+)"))) {
-        int intValue = std::stoi(trimmedExpr);
-        return new IntObject(intValue);
+    // メソッドは型のメソッド表から引く（IDはコンパイル時に解決済み）
+    const ObjectType::Method* method = obj->getObjectType().findMethod(ins.method);
+    if (!method) {
+        std::cerr << "Error: Unknown method or object type: $" << env.getName(ins.target) << "." << ins.member << "()" << std::endl;
+        return false;
     }
     
-    // 今後、より複雑な式の評価を追加
-    
-    std::cerr << "Error: Could not evaluate expression: " << expr << std::endl;
-    return nullptr;
-}
+    ObjectHandle handle = env.getHandle(ins.target);
+    const char* message = method->message;
 
-// 行の解析と実行
-bool Parser::parseLine(const std::string& line) {
-    // コメント行や空行をスキップ
-    std::string trimmedLine = trim(line);
-    if (trimmedLine.empty() || trimmedLine[0] == '#' || trimmedLine.substr(0, 2) == "//") {
+    // 引数はここで評価し、値をイベントに持たせる
+    if (method->argFn) {
+        if (ins.args.size() < method->minArgs || ins.args.size() > method->maxArgs) {
+            std::cerr << "Error: $" << env.getName(ins.target) << "." << ins.member << "() takes "
+                      << static_cast<int>(method->minArgs);
+            if (method->maxArgs != method->minArgs) {
+                std::cerr << "-" << static_cast<int>(method->maxArgs);
+            }
+            std::cerr << " argument(s), got " << ins.args.size() << std::endl;
+            return false;
+        }
+        MethodArgs args(ins.args.size());
+        for (size_t i = 0; i < ins.args.size(); i++) {
+            if (!evaluateValue(ins.args[i].expr, args[i].value)) {
+                return false;
+            }
+            const BitPattern* pattern = patternOf(ins.args[i].pattern, ins.args[i].expr, env);
+            if (pattern) {
+                args[i].pattern = *pattern;
+            }
+        }
+        MethodArgsFn fn = method->argFn;
+        env.queueEvent([handle, fn, message, args](Environment& env) {
+            BaseObject* obj = env.getVariable(handle);
+            if (obj) {
+                fn(*obj, env, args);
+                env.updateSchedule(handle.slot);
+                if (message) {
+                    std::cout << message << " $" << env.getName(handle.slot) << std::endl;
+                }
+            }
+        });
         return true;
     }
+    if (!ins.args.empty()) {
+        std::cerr << "Error: $" << env.getName(ins.target) << "." << ins.member << "() takes no arguments" << std::endl;
+        return false;
+    }
+
+    // メソッド呼び出しを環境のイベントキューに登録
+    // イベントは呼び出し時点のオブジェクトを世代付きハンドルで参照する
+    // （実行までに再代入された場合は何もしない）
+    MethodFn fn = method->fn;
+    env.queueEvent([handle, fn, message](Environment& env) {
+        BaseObject* obj = env.getVariable(handle);
+        if (obj) {
+            fn(*obj, env);
+            env.updateSchedule(handle.slot);
+            if (message) {
+                std::cout << message << " $" << env.getName(handle.slot) << std::endl;
+            }
+        }
+    });
+    return true;
+}
+
+// 変数代入: $var = value
+bool Parser::executeAssign(const Instruction& ins) {
+    // バイナリパターンのリテラルは桁数を保つ
+    ObjectPtr value = ins.pattern.empty() ? evaluateExpression(ins.expr)
+                                          : ObjectPtr(new BinaryPatternObject(ins.pattern));
+    if (!value) {
+        return false;
+    }
     
-    // 各種構文パターンを試す
-    if (processClassCreation(trimmedLine)) {
+    env.setVariable(ins.target, std::move(value));
+    if (!echo) {
         return true;
     }
+    if (ins.expr.getShape() == Expression::VARIABLE) {
+        std::cout << "Copied $" << ins.expr.getSymbols()[0] << " to $" << env.getName(ins.target) << std::endl;
+    } else {
+        std::cout << "Set $" << env.getName(ins.target) << " = " << env.getVariable(ins.target)->toString() << std::endl;
+    }
+    return true;
+}
+
+// パターングラフの代入: $var = euclid(...)...
+bool Parser::executeGraph(const Instruction& ins) {
+    env.setVariable(ins.target, ins.graph->clone());
+    // 定数でない引数は最初のティックを待たずに評価しておく
+    PatternGraphObject* graph = static_cast<PatternGraphObject*>(env.getVariable(ins.target));
+    graph->update(env);
+    if (echo) {
+        std::cout << "Created pattern $" << env.getName(ins.target) << " = " << graph->getDefinition() << std::endl;
+    }
+    return true;
+}
+
+// 属性の束縛: $obj.attr <- expr
+bool Parser::executeBind(const Instruction& ins) {
+    if (!ins.attr.isKnown()) {
+        std::cerr << "Error binding attribute: Unknown attribute: " << ins.member << std::endl;
+        return false;
+    }
+    if (!env.bind(ins.target, ins.attr, ins.member, ins.expr, ins.definition)) {
+        return false;
+    }
+    if (echo) {
+        std::cout << "Bound $" << env.getName(ins.target) << "." << ins.member << " <- " << ins.definition << std::endl;
+    }
+    return true;
+}
+
+// 1命令の実行
+bool Parser::executeInstruction(const Instruction& ins) {
+    switch (ins.op) {
+        case Instruction::CREATE:   return executeCreate(ins);
+        case Instruction::SET_ATTR: return executeSetAttribute(ins);
+        case Instruction::GET_ATTR: return executeGetAttribute(ins);
+        case Instruction::CALL:     return executeCall(ins);
+        case Instruction::ASSIGN:   return executeAssign(ins);
+        case Instruction::GRAPH:    return executeGraph(ins);
+        case Instruction::BIND:     return executeBind(ins);
+    }
+    return false;
+}
+
+// コンパイル済みプログラムの実行
+bool Parser::execute(const Program& program) {
+    bool success = true;
     
-    if (processAttributeAccess(trimmedLine)) {
-        return true;
+    for (const auto& ins : program.code) {
+        if (!executeInstruction(ins)) {
+            success = false;
+        }
     }
     
-    if (processPipeline(trimmedLine)) {
+    return success;
+}
+
+// 行の解析と実行
+bool Parser::parseLine(const std::string& line) {
+    // コメント行や空行をスキップ（前後の空白は字句解析で読み飛ばすので切り出さない）
+    size_t first = line.find_first_not_of(" \t\n\r");
+    if (first == std::string::npos || line[first] == '#' || line.compare(first, 2, "//") == 0) {
         return true;
     }
     
-    if (processMethodCall(trimmedLine)) {
-        return true;
+    std::shared_ptr<const Program> program = compile(line);
+    if (!program->valid) {
+        std::cerr << "Syntax error: " << line << " (" << program->error << ")" << std::endl;
+        return false;
     }
     
-    if (processVariableAssignment(trimmedLine)) {
+    return execute(*program);
+}
+
+// 行のコンパイルと実行の予約
+bool Parser::submit(const std::string& line, Quantize quantize) {
+    size_t first = line.find_first_not_of(" \t\n\r");
+    if (first == std::string::npos || line[first] == '#' || line.compare(first, 2, "//") == 0) {
         return true;
     }
     
-    // どのパターンにも一致しない
-    std::cerr << "Syntax error: " << line << std::endl;
-    return false;
+    std::shared_ptr<const Program> program = compile(line);
+    if (!program->valid) {
+        std::cerr << "Syntax error: " << line << " (" << program->error << ")" << std::endl;
+        return false;
+    }
+    
+    // 実行はティックのスレッドで行う（プログラムはキャッシュから消えても残る）
+    if (!env.post([this, program](Environment&) { execute(*program); }, quantize)) {
+        std::cerr << "Command queue full, dropped: " << line << std::endl;
+        return false;
+    }
+    return true;
 }
 
 // 複数行の解析と実行
@@ -460,4 +785,4 @@ bool Parser::parseMultipleLines(const std::string& code) {
     }
     
     return success;
-}
\ No newline at end of file
+}
@@ -2,46 +2,83 @@
 #define REELIA_PARSER_HPP
 
 #include "base_object.hpp"
+#include "bytecode.hpp"
 #include "environment.hpp"
-#include <algorithm>
-#include <regex>
+#include "pattern_graph.hpp"
+#include "tokenizer.hpp"
+#include <memory>
 #include <sstream>
 #include <string>
+#include <unordered_map>
 #include <vector>
 
 /**
  * 新しい構文パーサー
- * 提案された新構文を解析して実行する
+ * 1行を字句解析して命令列にコンパイルし、環境上で実行する。
+ * コンパイル結果は行ごとにキャッシュされ、同じ行の再実行は命令列の
+ * 実行だけで済む。
  */
 class Parser {
 private:
   // 環境
   Environment &env;
 
-  // 内部ヘルパー関数
-  std::vector<std::string> tokenizeLine(const std::string &line);
-  std::vector<std::string> splitByPipe(const std::string &line);
-  bool isWhitespace(char c);
-  std::string trim(const std::string &str);
-  bool isBinaryPattern(const std::string &str);
-  int parseBinaryPattern(const std::string &str);
+  // 行テキストからコンパイル済みプログラムへのキャッシュ
+  // （送信済みのコマンドが参照している間はキャッシュを消しても残る）
+  std::unordered_map<std::string, std::shared_ptr<const Program>> programCache;
+  static constexpr size_t MAX_CACHED_PROGRAMS = 4096;
 
-  // 構文パターン処理
-  bool processClassCreation(const std::string &line);
-  bool processAttributeAccess(const std::string &line);
-  bool processMethodCall(const std::string &line);
-  bool processVariableAssignment(const std::string &line);
-  bool processPipeline(const std::string &line);
+  // コンパイル時の作業用トークン列
+  std::vector<Token> tokens;
 
-  // 式の評価
-  BaseObject *evaluateExpression(const std::string &expr);
+  // 実行結果を標準出力に表示するか（エラーは常に表示する）
+  bool echo;
+
+  // コンパイル
+  bool compileLine(const std::string &line, Program &program);
+  bool compileStatement(size_t &pos, Program &program);
+  bool compileExpression(size_t &pos, Expression &expr, std::string &error);
+  bool compileGraph(size_t &pos, CombinatorModule &graph,
+                    std::vector<GraphBinding> &bindings, int &node,
+                    std::string &error);
+  bool compileGraphArguments(size_t &pos, std::vector<Expression> &args,
+                             std::string &error);
+
+  // 実行
+  bool executeInstruction(const Instruction &ins);
+  bool executeCreate(const Instruction &ins);
+  bool executeSetAttribute(const Instruction &ins);
+  bool executeGetAttribute(const Instruction &ins);
+  bool executeCall(const Instruction &ins);
+  bool executeAssign(const Instruction &ins);
+  bool executeGraph(const Instruction &ins);
+  bool executeBind(const Instruction &ins);
+
+  // 式の評価（呼び出し側が所有権を持つ）
+  ObjectPtr evaluateExpression(const Expression &expr);
+
+  // 式の評価（値渡し。属性設定でオブジェクトを確保しないために使う）
+  bool evaluateValue(const Expression &expr, Value &value);
 
 public:
-  Parser(Environment &environment) : env(environment) {}
+  Parser(Environment &environment) : env(environment), echo(true) {}
+
+  // 実行結果の表示の切り替え（裏で実行するスクリプト用）
+  void setEcho(bool enabled) { echo = enabled; }
+
+  // 行のコンパイル（キャッシュ済みならそれを返す）
+  std::shared_ptr<const Program> compile(const std::string &line);
+
+  // コンパイル済みプログラムの実行
+  bool execute(const Program &program);
 
   // 行の解析と実行
   bool parseLine(const std::string &line);
 
+  // 行をこのスレッドでコンパイルし、実行は環境のコマンドキューに送る
+  // ティック中の環境とは並行に呼べる（実行はティックのスレッドで行われる）
+  bool submit(const std::string &line, Quantize quantize = Quantize::NOW);
+
   // 複数行の解析と実行
   bool parseMultipleLines(const std::string &code);
 
@@ -49,4 +86,4 @@ public:
   void tick() { env.tick(); }
 };
 
-#endif // REELIA_PARSER_HPP
\ No newline at end of file
+#endif // REELIA_PARSER_HPP
@@ -0,0 +1,165 @@
+#ifndef REELIA_PATTERN_GRAPH_HPP
+#define REELIA_PATTERN_GRAPH_HPP
+
+#include "expression.hpp"
+#include "midi_object.hpp"
+#include "module.hpp"
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+/**
+ * パターングラフの引数の束縛
+ * 定数でない引数（$cnt など）は毎ティック評価してパラメータに渡す。
+ */
+struct GraphBinding {
+    int parameter;   // CombinatorModule のパラメータID
+    Expression expr; // 引数の式
+};
+
+/**
+ * パターングラフのシーケンス
+ * euclid(5,16).rotate($cnt).and(rnd(70)) のような組み合わせを1つの
+ * CombinatorModule にまとめて持ち、現在のステップだけをその場で計算する。
+ * 途中のパターンは作らず、引数が変わらない間は各段の結果を使い回す。
+ * 再生位置とMIDI出力は MIDISeqObject と同じ（長さはグラフの周期）。
+ */
+class PatternGraphObject : public MIDISeqObject {
+private:
+    CombinatorModule graph;
+    std::vector<GraphBinding> bindings;
+    std::string definition; // 組み合わせの式（表示とリロードの比較用）
+    int cycle;              // 長さを合わせたときのグラフの周期
+    uint32_t home;          // 登録先のスロット（引数の RND() の系列に使う）
+
+    // 先頭 steps ステップ（64ステップずつ計算する）
+    BitPattern steps(size_t count) const {
+        BitPattern out(count);
+        for (size_t w = 0; w * BitPattern::WORD_BITS < out.size(); w++) {
+            out.setWord(w, graph.block(static_cast<int64_t>(w * BitPattern::WORD_BITS)));
+        }
+        return out;
+    }
+
+public:
+    PatternGraphObject() : cycle(0), home(0) {}
+
+    PatternGraphObject(const CombinatorModule& g, std::vector<GraphBinding> b, std::string def)
+        : graph(g), bindings(std::move(b)), definition(std::move(def)), cycle(graph.cycleLength()), home(0) {
+        SeqObject::setAttr(Attr::LENGTH, Value::integer(cycle));
+    }
+
+    std::string getType() const override { return "pattern"; }
+
+    // 型情報（start/stopのみ。seqのパターン変形はグラフの式で書く）
+    static const ObjectType &objectType();
+    const ObjectType &getObjectType() const override { return objectType(); }
+
+    const std::string& getDefinition() const { return definition; }
+
+    int getValue() const override {
+        int pos = getPosition();
+        return pos >= 0 && graph.at(pos) ? 1 : 0;
+    }
+
+    // 引数の評価（値の変わった引数だけがその段から先のキャッシュを捨てる）
+    // 周期が変わったら長さも合わせる（ライブで変えた長さは周期が変わるまで残す）
+    // 引数の RND() は変数と引数ごとに別の系列
+    void update(Environment& env) {
+        for (const GraphBinding& binding : bindings) {
+            uint64_t stream = static_cast<uint64_t>(home) << 32 | static_cast<uint32_t>(binding.parameter);
+            graph.setParameterById(binding.parameter, binding.expr.evaluate(env, stream));
+        }
+        int length = graph.cycleLength();
+        if (length != cycle) {
+            cycle = length;
+            SeqObject::setAttr(Attr::LENGTH, Value::integer(length));
+        }
+    }
+
+    void onTick(Environment& env) override {
+        update(env);
+        MIDISeqObject::onTick(env);
+    }
+
+    // 引数の式を登録先の環境のスロットに結び直し、参照する変数への依存を登録する
+    void attach(Environment& env, uint32_t slot) override {
+        SeqObject::attach(env, slot);
+        home = slot;
+        for (GraphBinding& binding : bindings) {
+            binding.expr.bind(env);
+            for (uint32_t source : binding.expr.getSlots()) {
+                if (source != slot) {
+                    env.addDependency(slot, source);
+                }
+            }
+        }
+    }
+
+    void setAttr(const AttrKey &key, Value value) override {
+        if (key.id == Attr::DATA || key.id == Attr::STEP || key.id == Attr::STEP_AT) {
+            throw std::runtime_error("Pattern graph steps are computed; reassign the pattern instead");
+        }
+        MIDISeqObject::setAttr(key, value);
+    }
+
+    Value getAttr(const AttrKey &key) const override {
+        switch (key.id) {
+            case Attr::DATA:
+                return Value::binary(static_cast<int>(static_cast<uint32_t>(graph.block(0))));
+            case Attr::STEP_AT:
+                return Value::integer(key.index >= 0 && graph.at(key.index) ? 1 : 0);
+            case Attr::DENSITY:
+                return Value::integer(static_cast<int>(steps(static_cast<size_t>(
+                    SeqObject::getAttr(Attr::LENGTH).asInt())).count()));
+            default:
+                return MIDISeqObject::getAttr(key);
+        }
+    }
+
+    void setAttrPattern(const AttrKey &key, const BitPattern &pattern) override {
+        if (key.id == Attr::DATA) {
+            throw std::runtime_error("Pattern graph steps are computed; reassign the pattern instead");
+        }
+        MIDISeqObject::setAttrPattern(key, pattern);
+    }
+
+    bool getAttrPattern(const AttrKey &key, BitPattern &pattern) const override {
+        if (key.id != Attr::DATA) {
+            return false;
+        }
+        pattern = steps(static_cast<size_t>(SeqObject::getAttr(Attr::LENGTH).asInt()));
+        return true;
+    }
+
+    ObjectPtr clone() const override {
+        // グラフのキャッシュも引き継ぐ（引数の式は attach で結び直す）
+        return ObjectPtr(new PatternGraphObject(*this));
+    }
+
+    // グラフの引数は毎ティック update で設定し直すので周期だけ写す
+    void copyState(const BaseObject& other) override {
+        MIDISeqObject::copyState(other);
+        cycle = static_cast<const PatternGraphObject&>(other).cycle;
+    }
+
+    std::string toString() const override {
+        // 64ステップを超える分は省く
+        int pos = getPosition();
+        int len = SeqObject::getAttr(Attr::LENGTH).asInt();
+        int shown = std::min(len, 64);
+        BitPattern current = steps(static_cast<size_t>(shown));
+        std::string result = "pattern " + definition + " [";
+        for (int i = 0; i < shown; i++) {
+            if (i > 0)
+                result += ",";
+            result += current.test(static_cast<size_t>(i)) ? "1" : "0";
+            if (i == pos)
+                result += "*";
+        }
+        result += shown < len ? ",...]" : "]";
+        return result;
+    }
+};
+
+#endif // REELIA_PATTERN_GRAPH_HPP
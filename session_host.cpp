@@ -0,0 +1,370 @@
+#include "session_host.hpp"
+#include "metrics.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+//------------------------------------------------------------------------------
+// セッション
+//------------------------------------------------------------------------------
+
+Session::Session(const std::string& sessionName, const std::vector<int>& outputPorts, int64_t budget)
+    : name(sessionName), parser(env), ports(outputPorts), budgetNs(budget), shard(0),
+      ticks(0), overruns(0), lastNs(0), maxNs(0), totalNs(0) {
+    env.setPortMap(ports);
+}
+
+bool Session::runScript(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Cannot open " << path << std::endl;
+        return false;
+    }
+    std::ostringstream code;
+    code << in.rdbuf();
+
+    std::lock_guard<std::mutex> lock(mutex);
+    parser.setEcho(false);
+    bool ok = parser.parseMultipleLines(code.str());
+    parser.setEcho(true);
+    if (!ok) {
+        std::cerr << name << ": errors in " << path << std::endl;
+    }
+    return ok;
+}
+
+bool Session::submit(const std::string& line, bool running) {
+    if (!parser.submit(line)) {
+        return false;
+    }
+    if (!running) {
+        std::lock_guard<std::mutex> lock(mutex);
+        env.processCommands();
+    }
+    // ティックのワーカーがためた知らせはコマンドを受けた入力スレッドが表示する
+    if (env.hasNotices()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        env.reportNotices(std::cerr);
+    }
+    return true;
+}
+
+bool Session::listen(int port, const SessionHost& host) {
+    osc.reset(new OSCServer(env));
+    osc->setBatchHandler([this, &host]() {
+        if (!host.isRunning()) {
+            std::lock_guard<std::mutex> lock(mutex);
+            env.processCommands();
+        }
+    });
+    return osc->start(port);
+}
+
+void Session::tick(double time, double period) {
+    int64_t ns;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        int64_t started = Metrics::now();
+        env.setTickTiming(time, period);
+        env.tick();
+        ns = Metrics::now() - started;
+    }
+
+    // 統計を書くのはこのセッションを受け持つワーカーだけ
+    ticks.store(ticks.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    lastNs.store(ns, std::memory_order_relaxed);
+    totalNs.store(totalNs.load(std::memory_order_relaxed) + ns, std::memory_order_relaxed);
+    if (ns > maxNs.load(std::memory_order_relaxed)) {
+        maxNs.store(ns, std::memory_order_relaxed);
+    }
+    if (budgetNs > 0 && ns > budgetNs) {
+        overruns.store(overruns.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+}
+
+//------------------------------------------------------------------------------
+// ホスト
+//------------------------------------------------------------------------------
+
+SessionHost::SessionHost(size_t workers)
+    : workerCount(workers), epoch(0), pending(0), stopping(false), tickTime(0.0), tickPeriod(0.0) {
+    if (workerCount == 0) {
+        unsigned int cores = std::thread::hardware_concurrency();
+        workerCount = cores > 0 ? cores : 1;
+    }
+    std::fill(portOwner, portOwner + MIDIManager::MAX_PORTS, -1);
+}
+
+SessionHost::~SessionHost() {
+    // OSCの受信スレッドはホストのクロックを見るので、クロックより先に止める
+    stop();
+    for (const auto& session : sessions) {
+        if (session->osc) {
+            session->osc->stop();
+        }
+    }
+}
+
+Session* SessionHost::addSession(const std::string& name, const std::vector<int>& ports, int64_t budgetNs) {
+    if (name.empty() || findSession(name)) {
+        std::cerr << "Session name '" << name << "' is empty or already used" << std::endl;
+        return nullptr;
+    }
+    if (isRunning()) {
+        std::cerr << "Sessions can only be added while the clock is stopped" << std::endl;
+        return nullptr;
+    }
+
+    // 出力ポートは1つのセッションだけが使う（ポートのキューは生産者が1つの前提）
+    std::vector<int> assigned = ports;
+    if (assigned.empty()) {
+        for (int port = 0; port < MIDIManager::MAX_PORTS && assigned.empty(); port++) {
+            if (portOwner[port] < 0) {
+                assigned.push_back(port);
+            }
+        }
+        if (assigned.empty()) {
+            std::cerr << "Session " << name << ": no free MIDI output port" << std::endl;
+            return nullptr;
+        }
+    }
+    for (int port : assigned) {
+        if (port < 0 || port >= MIDIManager::MAX_PORTS) {
+            std::cerr << "Session " << name << ": invalid port " << port << " (0-" << MIDIManager::MAX_PORTS - 1
+                      << ")" << std::endl;
+            return nullptr;
+        }
+        if (portOwner[port] >= 0) {
+            std::cerr << "Session " << name << ": port " << port << " is used by "
+                      << sessions[static_cast<size_t>(portOwner[port])]->getName() << std::endl;
+            return nullptr;
+        }
+    }
+    for (int port : assigned) {
+        portOwner[port] = static_cast<int>(sessions.size());
+    }
+    sessions.emplace_back(new Session(name, assigned, budgetNs));
+    return sessions.back().get();
+}
+
+Session* SessionHost::findSession(const std::string& name) const {
+    for (const auto& session : sessions) {
+        if (session->getName() == name) {
+            return session.get();
+        }
+    }
+    return nullptr;
+}
+
+bool SessionHost::loadConfig(const std::string& path) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Cannot open " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    int number = 0;
+    bool ok = true;
+    while (std::getline(in, line)) {
+        number++;
+        line = line.substr(0, line.find('#'));
+        std::istringstream words(line);
+        std::string command;
+        if (!(words >> command)) {
+            continue;
+        }
+        std::string where = path + ":" + std::to_string(number) + ": ";
+
+        try {
+            if (command == "device") {
+                // 出力ポートにデバイスを開く
+                std::string mapping;
+                words >> mapping;
+                size_t colon = mapping.find(':');
+                if (colon == std::string::npos) {
+                    throw std::invalid_argument("expected PORT:DEVICE");
+                }
+                int port = std::stoi(mapping.substr(0, colon));
+                int device = std::stoi(mapping.substr(colon + 1));
+                if (!getMIDIManager().openOutputDevice(device, port)) {
+                    throw std::invalid_argument("cannot open device " + std::to_string(device));
+                }
+            } else if (command == "session") {
+                std::string name;
+                words >> name;
+                std::vector<int> ports;
+                int64_t budget = 0;
+                int oscPort = -1;
+                std::string script;
+                std::string option;
+                while (words >> option) {
+                    size_t eq = option.find('=');
+                    std::string key = option.substr(0, eq);
+                    std::string value = eq == std::string::npos ? "" : option.substr(eq + 1);
+                    if (key == "ports") {
+                        std::stringstream list(value);
+                        std::string item;
+                        while (std::getline(list, item, ',')) {
+                            ports.push_back(std::stoi(item));
+                        }
+                    } else if (key == "budget") {
+                        budget = static_cast<int64_t>(std::stod(value) * 1000.0);
+                    } else if (key == "osc") {
+                        oscPort = std::stoi(value);
+                    } else if (key == "script") {
+                        script = value;
+                    } else {
+                        throw std::invalid_argument("unknown option " + option);
+                    }
+                }
+                Session* session = addSession(name, ports, budget);
+                if (!session) {
+                    throw std::invalid_argument("session not added");
+                }
+                if (!script.empty() && !session->runScript(script)) {
+                    ok = false;
+                }
+                if (oscPort >= 0 && !session->listen(oscPort, *this)) {
+                    ok = false;
+                }
+            } else {
+                throw std::invalid_argument("unknown command " + command);
+            }
+        } catch (const std::exception& e) {
+            std::cerr << where << e.what() << std::endl;
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+void SessionHost::start() {
+    if (isRunning()) {
+        return;
+    }
+    for (const auto& session : sessions) {
+        std::lock_guard<std::mutex> lock(session->mutex);
+        session->env.setBeatTicks(clock.getPPQN());
+        session->env.setBarTicks(clock.getPPQN() * 4);
+    }
+    startWorkers();
+    clock.start([this](uint64_t, ClockEngine::Clock::time_point scheduled) { tickAll(scheduled); });
+}
+
+void SessionHost::stop() {
+    clock.stop();
+    stopWorkers();
+}
+
+void SessionHost::startWorkers() {
+    // セッションを順にワーカーへ振り分ける（ワーカーはセッション数より多くしない）
+    size_t count = std::min(workerCount, sessions.size());
+    shards.assign(count, std::vector<Session*>());
+    for (size_t i = 0; i < sessions.size(); i++) {
+        sessions[i]->shard = i % count;
+        shards[i % count].push_back(sessions[i].get());
+    }
+    // ワーカーが動き出す前にクロックが進んでも取りこぼさないよう、今の世代を渡す
+    stopping = false;
+    for (size_t id = 0; id < count; id++) {
+        workers.emplace_back(&SessionHost::workerLoop, this, id, epoch);
+    }
+}
+
+void SessionHost::stopWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    workers.clear();
+}
+
+void SessionHost::tickAll(ClockEngine::Clock::time_point scheduled) {
+    if (shards.empty()) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tickTime = std::chrono::duration<double>(scheduled.time_since_epoch()).count();
+        tickPeriod = clock.getPeriodMs() / 1000.0;
+        epoch++;
+        pending = shards.size();
+    }
+    wake.notify_all();
+
+    // 全ワーカーがこのティックを終えるまで次のティックに進まない
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [this]() { return pending == 0; });
+}
+
+void SessionHost::workerLoop(size_t shard, uint64_t seen) {
+#ifdef __linux__
+    // コア0はクロックと入力のスレッドに残し、ワーカーは1番から順に固定する
+    unsigned int cores = std::thread::hardware_concurrency();
+    if (cores > 1) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET((shard + 1) % cores, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+#endif
+
+    while (true) {
+        double time;
+        double period;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]() { return stopping || epoch != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = epoch;
+            time = tickTime;
+            period = tickPeriod;
+        }
+
+        for (Session* session : shards[shard]) {
+            session->tick(time, period);
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (--pending == 0) {
+            done.notify_one();
+        }
+    }
+}
+
+void SessionHost::printStats(std::ostream& out) const {
+    char line[160];
+    std::snprintf(line, sizeof(line), "%-12s %-8s %5s %6s %10s %9s %9s %9s %9s %9s", "session", "ports", "shard", "osc",
+                  "ticks", "mean us", "last us", "max us", "budget", "overruns");
+    out << line << std::endl;
+    for (const auto& session : sessions) {
+        std::string ports;
+        for (int port : session->ports) {
+            ports += (ports.empty() ? "" : ",") + std::to_string(port);
+        }
+        uint64_t ticks = session->ticks.load(std::memory_order_relaxed);
+        double mean = ticks ? session->totalNs.load(std::memory_order_relaxed) / 1000.0 / ticks : 0.0;
+        std::string budget = session->budgetNs > 0 ? std::to_string(session->budgetNs / 1000) : "-";
+        std::string osc = session->getOSCPort() ? std::to_string(session->getOSCPort()) : "-";
+        std::snprintf(line, sizeof(line), "%-12s %-8s %5zu %6s %10llu %9.1f %9.1f %9.1f %9s %9llu",
+                      session->name.c_str(), ports.c_str(), session->shard, osc.c_str(),
+                      static_cast<unsigned long long>(ticks), mean,
+                      session->lastNs.load(std::memory_order_relaxed) / 1000.0,
+                      session->maxNs.load(std::memory_order_relaxed) / 1000.0, budget.c_str(),
+                      static_cast<unsigned long long>(session->overruns.load(std::memory_order_relaxed)));
+        out << line << std::endl;
+    }
+}
@@ -0,0 +1,135 @@
+#ifndef REELIA_SESSION_HOST_HPP
+#define REELIA_SESSION_HOST_HPP
+
+#include "clock_engine.hpp"
+#include "environment.hpp"
+#include "osc_server.hpp"
+#include "parser.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+class SessionHost;
+
+/**
+ * セッション
+ * 独立した環境とパーサーの組（演奏者・インスタレーションごとに1つ）。
+ * オブジェクトの port は論理ポートで、セッションに割り当てた出力ポートに
+ * 対応付ける（MIDIManager の出力ポートはセッションどうしで重ならない）。
+ * 環境はセッションのロックで守る（ティックするワーカーと入力・OSCのスレッド）。
+ */
+class Session {
+private:
+    std::string name;
+    Environment env;
+    Parser parser;
+    std::vector<int> ports;
+    int64_t budgetNs; // 1ティックに使ってよい時間（0なら制限なし）
+    size_t shard;     // ティックするワーカー
+    std::mutex mutex;
+    std::unique_ptr<OSCServer> osc;
+
+    // ワーカーだけが書き、入力スレッドが読む
+    std::atomic<uint64_t> ticks;
+    std::atomic<uint64_t> overruns; // 予算を超えたティックの数
+    std::atomic<int64_t> lastNs;
+    std::atomic<int64_t> maxNs;
+    std::atomic<int64_t> totalNs;
+
+    friend class SessionHost;
+
+    // 1ティック（ワーカーから呼ぶ）
+    void tick(double time, double period);
+
+public:
+    Session(const std::string& sessionName, const std::vector<int>& outputPorts, int64_t budget);
+
+    Session(const Session&) = delete;
+    Session& operator=(const Session&) = delete;
+
+    const std::string& getName() const { return name; }
+    const std::vector<int>& getPorts() const { return ports; }
+
+    // スクリプトの実行（クロックを始める前に呼ぶ）
+    bool runScript(const std::string& path);
+
+    // 行の実行（コンパイルはこのスレッド、実行は次のティックの頭）
+    // running でなければすぐ実行する
+    bool submit(const std::string& line, bool running);
+
+    // OSCの受信（host はクロックが止まっているかの判定に使う）
+    bool listen(int port, const SessionHost& host);
+    int getOSCPort() const { return osc && osc->isRunning() ? osc->getPort() : 0; }
+};
+
+/**
+ * 複数セッションのホスト
+ * 1つのクロックで全セッションを同じティックで進める。セッションはワーカーに
+ * 振り分け（シャード）、各ワーカーは決まったコアに固定したスレッドで自分の
+ * セッションを順にティックする。クロックのスレッドは全ワーカーが終わるまで待つ。
+ * セッションごとに1ティックの時間を測り、予算を超えた回数を数える。
+ */
+class SessionHost {
+private:
+    std::vector<std::unique_ptr<Session>> sessions;
+    int portOwner[MIDIManager::MAX_PORTS]; // 出力ポートを使うセッション（-1なら空き）
+    size_t workerCount;
+
+    ClockEngine clock;
+
+    // ワーカー（shards[i] を i 番目のワーカーがティックする）
+    std::vector<std::vector<Session*>> shards;
+    std::vector<std::thread> workers;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    uint64_t epoch;
+    size_t pending; // このティックを終えていないワーカーの数
+    bool stopping;
+    double tickTime;
+    double tickPeriod;
+
+    void workerLoop(size_t shard, uint64_t seen);
+    void tickAll(ClockEngine::Clock::time_point scheduled);
+    void startWorkers();
+    void stopWorkers();
+
+public:
+    // workers: ティックするスレッドの最大数（0ならコア数）
+    explicit SessionHost(size_t workers = 0);
+    ~SessionHost();
+
+    SessionHost(const SessionHost&) = delete;
+    SessionHost& operator=(const SessionHost&) = delete;
+
+    // セッションの追加（クロックを始める前に。失敗したらエラーを表示してnullptr）
+    // ports が空なら空いている出力ポートを1つ割り当てる
+    Session* addSession(const std::string& name, const std::vector<int>& ports, int64_t budgetNs);
+    Session* findSession(const std::string& name) const;
+    size_t sessionCount() const { return sessions.size(); }
+    Session& getSession(size_t index) const { return *sessions[index]; }
+
+    /**
+     * 設定ファイルの読み込み
+     * 1行に1つ、空白区切りで書く（# 以降はコメント）:
+     *   session NAME [ports=P,...] [budget=MICROSECONDS] [osc=PORT] [script=FILE]
+     *   device PORT:DEVICE
+     */
+    bool loadConfig(const std::string& path);
+
+    void start();
+    void stop();
+    bool isRunning() const { return clock.isRunning(); }
+    ClockEngine& getClock() { return clock; }
+
+    // セッションごとのティック時間・予算超過の表
+    void printStats(std::ostream& out) const;
+};
+
+#endif // REELIA_SESSION_HOST_HPP
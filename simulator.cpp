@@ -3,10 +3,25 @@
 #include "base_object.hpp"
 #include "midi_manager.hpp"
 #include "midi_object.hpp"
+#include "clock_engine.hpp"
+#include "midi_clock.hpp"
+#include "hot_reload.hpp"
+#include "lookahead.hpp"
+#include "metrics.hpp"
+#include "osc_server.hpp"
+#include "session_host.hpp"
+#include "snapshot.hpp"
+#include "terminal_view.hpp"
+#include <atomic>
 #include <chrono>
 #include <cstdlib>
+#include <fstream>
 #include <iomanip>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <poll.h>
+#include <sstream>
 #include <string>
 #include <termios.h>
 #include <thread>
@@ -47,8 +62,13 @@ void disableRawMode() {
     std::cout << SHOW_CURSOR;
 }
 
-// ノンブロッキングでキー入力を取得
-int readKey() {
+// タイムアウト付きでキー入力を取得（入力がなければ-1）
+int readKey(int timeoutMs) {
+    pollfd pfd{STDIN_FILENO, POLLIN, 0};
+    if (poll(&pfd, 1, timeoutMs) <= 0) {
+        return -1;
+    }
+    
     char c;
     int result = read(STDIN_FILENO, &c, 1);
     if (result < 0) {
@@ -74,23 +94,58 @@ private:
     std::vector<std::string> history;
     int historyIndex;
     
-    // 自動的にティックを進めるかどうか
+    // 自動ティック用のクロックエンジン（専用スレッドでEnvironment::tick()を駆動）
+    ClockEngine clock;
     bool autoTick;
-    int tickInterval; // ミリ秒
     
-    // 最後にプロンプトを表示した時刻
-    std::chrono::steady_clock::time_point lastPromptTime;
+    // MIDIクロック同期（マスターはクロックを送り、スレーブは受けたクロックでティックを進める）
+    enum class ClockSync { INTERNAL, MASTER, SLAVE };
+    std::atomic<ClockSync> clockSync;
+    MIDIClockMaster clockMaster;
+    MIDIClockSlave clockSlave;
     
-    // クロック表示
-    void displayClock() {
-        int tick = env.getTickCount();
-        int beat = tick / 4;
-        int subBeat = tick % 4;
-        
-        std::cout << terminal::BOLD << terminal::CYAN;
-        std::cout << "Tick: " << tick << " (";
-        std::cout << beat + 1 << "." << subBeat + 1;
-        std::cout << ")" << terminal::RESET_COLOR << std::endl;
+    // Environmentへのアクセスを入力スレッドとクロックスレッドで受け渡すためのロック
+    // （スクリプトの行はロックを取らずにコマンドキューで送る）
+    std::mutex envMutex;
+    
+    // 自動ティック中に入力した行を実行するタイミング
+    Quantize quantize;
+    
+    // 画面の描画（描画スレッドが出力と状態のスナップショットをまとめて書く）
+    TerminalView view;
+    ClockEngine::Clock::time_point lastPublished; // 最後にスナップショットを渡した時刻（envMutexで保護）
+    
+    // スクリプトの再読み込み（裏でコンパイルし、小節の頭で差分を適用）
+    HotReloader reloader;
+    
+    // メモリに置いたシーン（番号で呼び出す）
+    std::map<int, Scene> scenes;
+    
+    // OSCの受信（受信スレッドから直接コマンドキューに送る）
+    OSCServer osc;
+    
+    // 先読み（クロックスレッドがティックを送信時刻より先に計算する。envMutexで保護）
+    Lookahead lookahead;
+    
+    // 終了要求
+    bool quit;
+    
+    // 画面の状態を描画スレッドに渡す（envMutexを持って呼ぶ）
+    void publishView(ClockEngine::Clock::time_point now) {
+        ViewState& state = view.writeState();
+        state.capture(env);
+        state.ppqn = clock.getPPQN();
+        state.bpm = clock.getBPM();
+        state.autoTick = clock.isRunning();
+        view.publish();
+        lastPublished = now;
+    }
+    
+    // 前に渡してから1フレーム以上たっていれば渡す（envMutexを持って呼ぶ）
+    void publishViewThrottled(ClockEngine::Clock::time_point now) {
+        if (now - lastPublished >= view.getFrameInterval()) {
+            publishView(now);
+        }
     }
     
     // ヘルプ表示
@@ -99,25 +154,58 @@ private:
         std::cout << "Commands:" << std::endl;
         std::cout << "  $var = @class       - Create instance" << std::endl;
         std::cout << "  $obj.attr = value   - Set attribute" << std::endl;
+        std::cout << "  $obj.attr <- expr   - Bind attribute (follows expr)" << std::endl;
         std::cout << "  $var = $obj.attr    - Get attribute" << std::endl;
         std::cout << "  $obj.method()       - Call method" << std::endl;
+        std::cout << "  $obj.mul = M        - Advance M steps every div ticks ($obj.div = D, default 1/1)" << std::endl;
+        std::cout << "  $seq.rotate(N)      - Pattern ops: rotate(N) invert() mirror() and/or/xor(MASK) euclid(K, N)" << std::endl;
+        std::cout << "  $p = euclid(K, N)   - Pattern graph: euclid(K, N[, R]) pat(b...) rnd(P[, SEED]) chained with" << std::endl;
+        std::cout << "                        .rotate(X) .invert() .and/.or/.xor(GRAPH), e.g. euclid(5,16).rotate($c).and(rnd(70))" << std::endl;
         std::cout << "  cmd1 | cmd2         - Parallel execution" << std::endl;
         std::cout << std::endl;
+        std::cout << "Clock Commands:" << std::endl;
+        std::cout << "  @clock.bpm = X      - Set tempo in BPM" << std::endl;
+        std::cout << "  @clock.ppqn = X     - Set ticks per quarter note" << std::endl;
+        std::cout << "  @clock.interval = X - Set tick interval in ms (fractional allowed)" << std::endl;
+        std::cout << "  @clock.threads = X  - Worker threads for ticking (1 = single-threaded)" << std::endl;
+        std::cout << "  @clock.lookahead = MS - Render ticks MS ahead of the wire, redo them on edits (0 = off)" << std::endl;
+        std::cout << "  @quantize = X       - Run typed lines at the next tick/beat/bar (off, beat, bar)" << std::endl;
+        std::cout << "  @reload FILE        - Reload a script at the next bar (keeps running state)" << std::endl;
+        std::cout << "  @reload             - Reload the last script again" << std::endl;
+        std::cout << "  @scene.save FILE    - Save every variable to a binary scene file" << std::endl;
+        std::cout << "  @scene.load FILE    - Load a scene file (applied at the next bar)" << std::endl;
+        std::cout << "  @scene.store N      - Keep the current variables in memory as scene N" << std::endl;
+        std::cout << "  @scene.preload N F  - Load scene file F into memory as scene N" << std::endl;
+        std::cout << "  @scene N            - Recall scene N at the next bar (@scene.list to list)" << std::endl;
+        std::cout << "  @osc = PORT         - Receive OSC on a UDP port (/var/attr value, /var/method; off to stop)" << std::endl;
+        std::cout << "  @metrics            - Show tick/parse/MIDI timing histograms" << std::endl;
+        std::cout << "  @metrics.csv FILE   - Export the timing summary as CSV" << std::endl;
+        std::cout << "  @metrics.reset      - Clear the timing histograms" << std::endl;
+        std::cout << "  @display.fps = X    - Screen refresh rate (1-120, default 30)" << std::endl;
+        std::cout << "  @display.objects = X - Live object state above the prompt (on, off)" << std::endl;
+        std::cout << std::endl;
         std::cout << "MIDI Commands:" << std::endl;
         std::cout << "  @midi.list          - List available MIDI devices" << std::endl;
-        std::cout << "  @midi.device = X    - Select MIDI output device" << std::endl;
+        std::cout << "  @midi.device = X    - Select MIDI output device (port 0)" << std::endl;
+        std::cout << "  @midi.device = P:X  - Map output port P to device X (list: 0:2, 1:3)" << std::endl;
+        std::cout << "  @midi.cc_dedup = X  - Drop CCs that repeat the last value sent (on, off)" << std::endl;
+        std::cout << "  @midi.cc_rate = X   - Send each CC at most X times per second (0 = off)" << std::endl;
+        std::cout << "  @midi.clock = X     - MIDI clock sync (master [port], slave INPUT, off)" << std::endl;
+        std::cout << "  @midi.clock.rewind  - Send Start instead of Continue on the next master start" << std::endl;
         std::cout << "  $n = @midi_note     - Create MIDI note object" << std::endl;
         std::cout << "  $cc = @midi_cc      - Create MIDI CC object" << std::endl;
         std::cout << "  $seq = @midi_seq    - Create MIDI sequence" << std::endl;
+        std::cout << "  $n.port = P         - Send a MIDI object's output to port P (0-7)" << std::endl;
         std::cout << std::endl;
         std::cout << "Keyboard shortcuts:" << std::endl;
         std::cout << "  Ctrl+T         - Manual tick" << std::endl;
         std::cout << "  Ctrl+A         - Toggle auto-tick" << std::endl;
         std::cout << "  Ctrl+S         - Change tick interval" << std::endl;
-        std::cout << "  Ctrl+M         - MIDI device configuration" << std::endl;
+        std::cout << "  Ctrl+N         - MIDI device configuration" << std::endl;
         std::cout << "  Ctrl+L         - Clear screen" << std::endl;
         std::cout << "  ?              - Show this help" << std::endl;
         std::cout << "  Ctrl+D         - Dump variables" << std::endl;
+        std::cout << "  Ctrl+P         - Show timing" << std::endl;
         std::cout << "  Ctrl+X         - Exit" << std::endl;
         std::cout << std::endl;
     }
@@ -129,42 +217,229 @@ private:
         // Auto-tick状態
         std::cout << "Auto-tick: " << (autoTick ? "ON" : "OFF");
         if (autoTick) {
-            std::cout << " (" << tickInterval << "ms)";
+            std::cout << " (" << clock.getPeriodMs() << "ms, "
+                      << clock.getBPM() << " BPM @ " << clock.getPPQN() << " PPQN)";
         }
         std::cout << " | ";
         
-        // MIDI状態
+        // MIDI状態（ポート0以外は開いているものだけ表示）
         if (midiManager.isInitialized()) {
+            auto outputs = midiManager.getAvailableOutputs();
+            auto deviceName = [&outputs](int deviceId) -> std::string {
+                return static_cast<size_t>(deviceId) < outputs.size() ? outputs[deviceId] : "unknown device";
+            };
             int deviceId = midiManager.getCurrentOutputDevice();
             if (deviceId >= 0) {
-                auto outputs = midiManager.getAvailableOutputs();
-                if (static_cast<size_t>(deviceId) < outputs.size()) {
-                    std::cout << "MIDI: " << outputs[deviceId];
-                } else {
-                    std::cout << "MIDI: unknown device";
-                }
+                std::cout << "MIDI: " << deviceName(deviceId);
             } else {
                 std::cout << "MIDI: not connected";
             }
+            for (int port = 1; port < MIDIManager::MAX_PORTS; port++) {
+                int portDevice = midiManager.getCurrentOutputDevice(port);
+                if (portDevice >= 0) {
+                    std::cout << ", port " << port << ": " << deviceName(portDevice);
+                }
+            }
         } else {
             std::cout << "MIDI: not initialized";
         }
         
+        // クロック同期（内部クロックのときは表示しない）
+        if (clockSync == ClockSync::MASTER) {
+            std::cout << " | Clock: master (port " << clockMaster.getPort() << ")";
+        } else if (clockSync == ClockSync::SLAVE) {
+            std::cout << " | Clock: slave (";
+            if (!clockSlave.isLocked()) {
+                std::cout << "waiting for clock";
+            } else {
+                std::cout << std::fixed << std::setprecision(1) << clockSlave.getBPM() << " BPM"
+                          << std::defaultfloat << (clockSlave.isPlaying() ? ", playing" : ", stopped");
+            }
+            std::cout << ")";
+        }
+        
         std::cout << terminal::RESET_COLOR << std::endl;
     }
     
+    // 計測値の表示（時間はマイクロ秒）
+    void displayMetrics() {
+        std::cout << terminal::BOLD << terminal::YELLOW;
+        std::cout << "Timing:" << terminal::RESET_COLOR << std::endl;
+        getMetrics().print(std::cout);
+        std::cout << "Dropped ticks: " << clock.getDroppedTicks()
+                  << " | Dropped MIDI messages: " << midiManager.getDroppedMessages()
+                  << " | Filtered CCs: " << midiManager.getFilteredMessages() << std::endl;
+    }
+    
+    // 計測コマンド処理: @metrics | @metrics.reset | @metrics.csv FILE
+    bool handleMetricsCommand(const std::string& line) {
+        if (line.compare(0, 8, "@metrics") != 0) {
+            return false;
+        }
+        
+        std::string rest = line.substr(8);
+        if (rest.empty()) {
+            displayMetrics();
+        } else if (rest == ".reset") {
+            getMetrics().reset();
+            std::cout << "Timing histograms cleared" << std::endl;
+        } else if (rest.compare(0, 5, ".csv ") == 0) {
+            std::string file = rest.substr(5);
+            file.erase(0, file.find_first_not_of(' '));
+            file.erase(file.find_last_not_of(' ') + 1);
+            if (!file.empty() && getMetrics().writeCSV(file)) {
+                std::cout << "Timing written to " << file << std::endl;
+            }
+        } else {
+            std::cout << "Usage: @metrics | @metrics.reset | @metrics.csv FILE" << std::endl;
+        }
+        return true;
+    }
+    
     // 変数ダンプ
     void dumpVariables() {
         std::cout << terminal::BOLD << terminal::YELLOW;
         std::cout << "Variables:" << terminal::RESET_COLOR << std::endl;
+        std::lock_guard<std::mutex> lock(envMutex);
         env.dumpVariables();
     }
     
-    // 画面クリア
+    // 画面クリア（クロックの表示は描画スレッドが固定行に書き直す）
     void clearScreen() {
-        std::cout << terminal::CLEAR_SCREEN;
+        view.clear();
         displayStatus();
-        displayClock();
+    }
+    
+    // クロックスレッドから呼ばれるティック処理
+    void onClockTick(ClockEngine::Clock::time_point scheduled) {
+        double tickTime = std::chrono::duration<double>(scheduled.time_since_epoch()).count();
+        double period = clock.getPeriodMs() / 1000.0;
+        std::lock_guard<std::mutex> lock(envMutex);
+        if (clockSync == ClockSync::MASTER) {
+            // ティックのノートより先にクロック（と最初のスタート）を積む
+            // 先読みしたティックと同じ時刻に送る（やり直しても送り直さない）
+            clockMaster.tick(tickTime + lookahead.getWindow(), period, clock.getPPQN());
+        }
+        lookahead.tick(tickTime, period);
+        // 端末には書かない。スナップショットもフレームの間隔より細かくは渡さない
+        publishViewThrottled(scheduled);
+    }
+    
+    // 自動ティックのオン/オフ
+    void setAutoTick(bool enabled) {
+        if (enabled && !clock.isRunning()) {
+            if (clockSync == ClockSync::MASTER) {
+                clockMaster.start();
+            }
+            clock.start([this](uint64_t, ClockEngine::Clock::time_point scheduled) {
+                onClockTick(scheduled);
+            });
+        } else if (!enabled && clock.isRunning()) {
+            clock.stop();
+            std::lock_guard<std::mutex> lock(envMutex);
+            if (clockMaster.isPlaying()) {
+                // 先読みして送信待ちになったクロックの後に止める
+                clockMaster.stop(MIDIManager::now() + lookahead.getWindow());
+            }
+            lookahead.reset();
+        }
+        autoTick = enabled;
+    }
+    
+    // 手動ティック
+    void manualTick() {
+        std::lock_guard<std::mutex> lock(envMutex);
+        lookahead.reset();
+        env.setTickTiming(MIDIManager::now(), clock.getPeriodMs() / 1000.0);
+        parser.tick();
+        publishView(ClockEngine::Clock::now());
+    }
+    
+    // ティック間隔の変更（"120bpm" のようにテンポでも指定可能）
+    bool setTickInterval(const std::string& input) {
+        try {
+            size_t pos = input.find("bpm");
+            if (pos != std::string::npos) {
+                clock.setBPM(std::stod(input.substr(0, pos)));
+            } else {
+                double ms = std::stod(input);
+                if (ms <= 0.0) {
+                    return false;
+                }
+                clock.setPeriodMs(ms);
+            }
+            return true;
+        } catch (...) {
+            return false;
+        }
+    }
+    
+    // クロックコマンド処理
+    bool handleClockCommand(const std::string& line) {
+        if (line.find("@clock.") != 0) {
+            return false;
+        }
+        
+        size_t pos = line.find('=');
+        if (pos == std::string::npos && line.find_last_not_of(' ') == 15 && line.compare(0, 16, "@clock.lookahead") == 0) {
+            showLookahead();
+            return true;
+        }
+        if (pos == std::string::npos) {
+            std::cout << "Usage: @clock.bpm = X | @clock.ppqn = X | @clock.interval = X | @clock.threads = X"
+                      << " | @clock.lookahead [= MS]" << std::endl;
+            return true;
+        }
+        
+        std::string key = line.substr(7, line.find_first_of(" =", 7) - 7);
+        std::string valueStr = line.substr(pos + 1);
+        try {
+            if (key == "bpm") {
+                clock.setBPM(std::stod(valueStr));
+            } else if (key == "ppqn") {
+                clock.setPPQN(std::stoi(valueStr));
+                std::lock_guard<std::mutex> lock(envMutex);
+                env.setBeatTicks(clock.getPPQN());
+                env.setBarTicks(clock.getPPQN() * 4);
+            } else if (key == "interval") {
+                if (!setTickInterval(valueStr)) {
+                    throw std::invalid_argument(valueStr);
+                }
+            } else if (key == "threads") {
+                int threads = std::stoi(valueStr);
+                if (threads < 1) {
+                    throw std::invalid_argument(valueStr);
+                }
+                std::lock_guard<std::mutex> lock(envMutex);
+                env.setTickThreads(static_cast<size_t>(threads));
+                std::cout << "Tick threads: " << env.getTickThreads() << std::endl;
+            } else if (key == "lookahead") {
+                if (!setLookahead(std::stod(valueStr))) {
+                    throw std::invalid_argument(valueStr);
+                }
+                showLookahead();
+            } else {
+                std::cout << "Unknown clock setting: " << key << std::endl;
+                return true;
+            }
+            displayStatus();
+        } catch (...) {
+            std::cout << "Invalid clock value!" << std::endl;
+        }
+        return true;
+    }
+    
+    // 先読みの状態
+    void showLookahead() {
+        std::lock_guard<std::mutex> lock(envMutex);
+        if (lookahead.getWindow() <= 0.0) {
+            std::cout << "Lookahead: off" << std::endl;
+            return;
+        }
+        std::cout << "Lookahead: " << lookahead.getWindow() * 1000.0 << " ms, " << lookahead.pendingTicks()
+                  << " ticks ahead, " << lookahead.getRewinds() << " rewinds, " << lookahead.getRerenderedTicks()
+                  << " ticks re-rendered, " << midiManager.getRetractedMessages() << " messages retracted"
+                  << std::endl;
     }
     
     // MIDI設定
@@ -174,20 +449,22 @@ private:
         
         // 利用可能なMIDIデバイスの一覧表示
         std::cout << "Available MIDI Output Devices:" << std::endl;
-        auto outputs = midiManager.getAvailableOutputs();
+        std::vector<std::string> outputs;
+        {
+            // 初めてなら出力先を作るので、ティックと排他にする
+            std::lock_guard<std::mutex> lock(envMutex);
+            outputs = midiManager.getAvailableOutputs();
+        }
         
         if (outputs.empty()) {
             std::cout << "  No MIDI output devices found!" << std::endl;
         } else {
             for (size_t i = 0; i < outputs.size(); i++) {
-                std::cout << "  " << i << ": " << outputs[i];
-                if (static_cast<int>(i) == midiManager.getCurrentOutputDevice()) {
-                    std::cout << " (selected)";
-                }
-                std::cout << std::endl;
+                std::cout << "  " << i << ": " << outputs[i] << portsUsing(static_cast<int>(i)) << std::endl;
             }
             
-            // デバイス選択
+            // デバイス選択（ポート0）。入力の間は描画を止めて端末を明け渡す
+            view.pause();
             std::cout << "Enter device number to select (or just press Enter to cancel): ";
             
             // rawモードを一時的に解除
@@ -200,6 +477,8 @@ private:
                 try {
                     int deviceId = std::stoi(input);
                     if (deviceId >= 0 && static_cast<size_t>(deviceId) < outputs.size()) {
+                        // デバイスの切り替えはティックと排他にする（ティックが送る出力先を替えるため）
+                        std::lock_guard<std::mutex> lock(envMutex);
                         midiManager.openOutputDevice(deviceId);
                         midiManager.startProcessing();
                         std::cout << "MIDI output device set to: " << outputs[deviceId] << std::endl;
@@ -213,6 +492,360 @@ private:
             
             // rawモードを再設定
             terminal::enableRawMode();
+            view.resume();
+        }
+    }
+    
+    // クオンタイズ設定: @quantize = off|beat|bar
+    bool handleQuantizeCommand(const std::string& line) {
+        if (line.compare(0, 9, "@quantize") != 0) {
+            return false;
+        }
+        
+        size_t pos = line.find('=');
+        std::string value = pos == std::string::npos ? "" : line.substr(pos + 1);
+        value.erase(0, value.find_first_not_of(' '));
+        value.erase(value.find_last_not_of(' ') + 1);
+        
+        if (value == "off" || value == "tick") {
+            quantize = Quantize::NOW;
+        } else if (value == "beat") {
+            quantize = Quantize::BEAT;
+        } else if (value == "bar") {
+            quantize = Quantize::BAR;
+        } else {
+            std::cout << "Usage: @quantize = off | beat | bar" << std::endl;
+            return true;
+        }
+        std::cout << "Quantize: " << value << std::endl;
+        return true;
+    }
+    
+    // 表示設定: @display.fps = X | @display.objects = on|off
+    bool handleDisplayCommand(const std::string& line) {
+        if (line.compare(0, 9, "@display.") != 0) {
+            return false;
+        }
+        
+        size_t pos = line.find('=');
+        if (pos == std::string::npos) {
+            std::cout << "Usage: @display.fps = X | @display.objects = on | off" << std::endl;
+            return true;
+        }
+        
+        std::string key = line.substr(9, line.find_first_of(" =", 9) - 9);
+        std::string value = line.substr(pos + 1);
+        value.erase(0, value.find_first_not_of(' '));
+        value.erase(value.find_last_not_of(' ') + 1);
+        
+        if (key == "fps") {
+            try {
+                int fps = std::stoi(value);
+                if (fps < 1 || fps > TerminalView::MAX_FPS) {
+                    throw std::invalid_argument(value);
+                }
+                view.setFrameRate(fps);
+                std::cout << "Display: " << view.getFrameRate() << " fps" << std::endl;
+            } catch (...) {
+                std::cout << "Invalid frame rate! (1-" << TerminalView::MAX_FPS << ")" << std::endl;
+            }
+        } else if (key == "objects" && (value == "on" || value == "off")) {
+            view.setShowObjects(value == "on");
+            std::cout << "Display objects: " << value << std::endl;
+        } else {
+            std::cout << "Usage: @display.fps = X | @display.objects = on | off" << std::endl;
+        }
+        return true;
+    }
+    
+    // スクリプトの行の実行
+    // コンパイルはこのスレッドで行い、実行はコマンドキュー経由でティックの頭に回す
+    // （クロックを止めるロックは取らない）。止まっているときはすぐ実行する
+    void submitLine(const std::string& line) {
+        bool running = clock.isRunning();
+        if (!parser.submit(line, running ? quantize : Quantize::NOW)) {
+            return;
+        }
+        if (!running) {
+            std::lock_guard<std::mutex> lock(envMutex);
+            env.processCommands();
+            publishView(ClockEngine::Clock::now());
+        }
+    }
+    
+    // 再読み込みコマンド処理: @reload [FILE]
+    bool handleReloadCommand(const std::string& line) {
+        if (line.compare(0, 7, "@reload") != 0 || (line.size() > 7 && line[7] != ' ')) {
+            return false;
+        }
+        
+        std::string file = line.substr(7);
+        size_t first = file.find_first_not_of(' ');
+        file = first == std::string::npos ? "" : file.substr(first, file.find_last_not_of(' ') - first + 1);
+        
+        std::lock_guard<std::mutex> lock(envMutex);
+        if (reloader.start(file, env)) {
+            std::cout << "Compiling " << reloader.getPath() << " in the background..." << std::endl;
+        }
+        return true;
+    }
+    
+    // 裏でのコンパイルが終わっていれば差分を小節の頭に予約
+    // ティックのスレッドがためた知らせを表示する
+    void pollNotices() {
+        if (!env.hasNotices()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(envMutex);
+        env.reportNotices(std::cerr);
+    }
+    
+    void pollReload() {
+        if (!reloader.hasResult()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(envMutex);
+        ScriptPatch patch;
+        if (!reloader.poll(patch, env)) {
+            return;
+        }
+        if (patch.empty()) {
+            std::cout << "Reload: no changes" << std::endl;
+            return;
+        }
+        
+        // 止まっているときは待つ小節がないのですぐ適用
+        if (!clock.isRunning()) {
+            patch.apply(env);
+            return;
+        }
+        std::cout << "Reload: " << patch.ops.size() << " changes at the next bar (in "
+                  << env.ticksUntilBar() << " ticks)" << std::endl;
+        auto shared = std::make_shared<ScriptPatch>(std::move(patch));
+        env.queueAtBar([shared](Environment& env) { shared->apply(env); });
+    }
+    
+    // OSCコマンド処理: @osc = PORT | off、@osc（状態の表示）
+    bool handleOSCCommand(const std::string& line) {
+        if (line.compare(0, 4, "@osc") != 0 || (line.size() > 4 && line[4] != ' ' && line[4] != '=')) {
+            return false;
+        }
+        
+        size_t pos = line.find('=');
+        std::string value = pos == std::string::npos ? "" : line.substr(pos + 1);
+        value.erase(0, value.find_first_not_of(' '));
+        value.erase(value.find_last_not_of(' ') + 1);
+        
+        if (pos == std::string::npos) {
+            if (osc.isRunning()) {
+                std::cout << "OSC: listening on UDP port " << osc.getPort() << " (" << osc.getReceived()
+                          << " messages, " << osc.getDropped() << " dropped)" << std::endl;
+            } else {
+                std::cout << "OSC: off" << std::endl;
+            }
+        } else if (value == "off") {
+            osc.stop();
+            std::cout << "OSC: off" << std::endl;
+        } else {
+            startOSC(value.empty() ? std::to_string(OSCServer::DEFAULT_PORT) : value);
+        }
+        return true;
+    }
+    
+    // シーンを環境に適用（止まっているときはすぐ、動いているときは次の小節の頭）
+    // オブジェクトの複製はこのスレッドで作り、ティックのスレッドでは差し替えるだけ
+    void recallScene(const Scene& scene, const std::string& label) {
+        auto shared = std::make_shared<ScriptPatch>(scene.patch());
+        std::lock_guard<std::mutex> lock(envMutex);
+        if (!clock.isRunning()) {
+            shared->apply(env, label.c_str());
+            publishView(ClockEngine::Clock::now());
+            return;
+        }
+        std::cout << label << ": " << scene.size() << " objects at the next bar (in "
+                  << env.ticksUntilBar() << " ticks)" << std::endl;
+        std::string title = label;
+        env.queueAtBar([shared, title](Environment& env) { shared->apply(env, title.c_str()); });
+    }
+    
+    // シーンコマンド処理:
+    //   @scene.save FILE / @scene.load FILE（ファイル）
+    //   @scene.store N / @scene.preload N FILE / @scene N / @scene.list（メモリのシーン）
+    bool handleSceneCommand(const std::string& line) {
+        if (line.compare(0, 6, "@scene") != 0 || (line.size() > 6 && line[6] != ' ' && line[6] != '.')) {
+            return false;
+        }
+        
+        std::istringstream words(line);
+        std::string command, first, file;
+        words >> command >> first;
+        std::getline(words, file);
+        file.erase(0, file.find_first_not_of(' '));
+        file.erase(file.find_last_not_of(' ') + 1);
+        
+        // 番号を取るコマンドの番号（なければ-1）
+        int number = -1;
+        try {
+            size_t used = 0;
+            number = std::stoi(first, &used);
+            if (used != first.size() || number < 0) {
+                number = -1;
+            }
+        } catch (...) {
+        }
+        
+        if (command == "@scene.save" && !first.empty()) {
+            std::string path = first + (file.empty() ? "" : " " + file);
+            Scene scene;
+            {
+                std::lock_guard<std::mutex> lock(envMutex);
+                scene.capture(env);
+            }
+            if (scene.save(path)) {
+                std::cout << "Scene saved to " << path << " (" << scene.size() << " objects)" << std::endl;
+            }
+        } else if (command == "@scene.load" && !first.empty()) {
+            std::string path = first + (file.empty() ? "" : " " + file);
+            Scene scene;
+            if (scene.load(path, parser)) {
+                recallScene(scene, "Scene " + path);
+            }
+        } else if (command == "@scene.store" && number >= 0 && file.empty()) {
+            Scene& scene = scenes[number];
+            {
+                std::lock_guard<std::mutex> lock(envMutex);
+                scene.capture(env);
+            }
+            std::cout << "Scene " << number << " stored (" << scene.size() << " objects)" << std::endl;
+        } else if (command == "@scene.preload" && number >= 0 && !file.empty()) {
+            Scene scene;
+            if (scene.load(file, parser)) {
+                std::cout << "Scene " << number << " preloaded from " << file << " (" << scene.size()
+                          << " objects)" << std::endl;
+                scenes[number] = std::move(scene);
+            }
+        } else if ((command == "@scene" || command == "@scene.recall") && number >= 0 && file.empty()) {
+            auto it = scenes.find(number);
+            if (it == scenes.end()) {
+                std::cout << "Scene " << number << " is empty" << std::endl;
+            } else {
+                recallScene(it->second, "Scene " + std::to_string(number));
+            }
+        } else if (command == "@scene.list" && first.empty()) {
+            if (scenes.empty()) {
+                std::cout << "No scenes stored" << std::endl;
+            }
+            for (const auto& entry : scenes) {
+                std::cout << "Scene " << entry.first << ": " << entry.second.size() << " objects" << std::endl;
+            }
+        } else {
+            std::cout << "Usage: @scene.save FILE | @scene.load FILE | @scene.store N | @scene.preload N FILE | @scene N | @scene.list" << std::endl;
+        }
+        return true;
+    }
+    
+    // デバイスを使っているポートの表示（例: " (ports 0, 2)"、なければ空）
+    std::string portsUsing(int deviceId) const {
+        std::string ports;
+        int count = 0;
+        for (int port = 0; port < MIDIManager::MAX_PORTS; port++) {
+            if (midiManager.getCurrentOutputDevice(port) == deviceId) {
+                ports += (count++ > 0 ? ", " : "") + std::to_string(port);
+            }
+        }
+        if (count == 0) {
+            return "";
+        }
+        return (count == 1 ? " (port " : " (ports ") + ports + ")";
+    }
+    
+    // "X" または "ポート:デバイス, ..." の解析（"X" はポート0）
+    static bool parsePortMappings(const std::string& text, std::vector<std::pair<int, int>>& mappings) {
+        std::stringstream list(text);
+        std::string item;
+        while (std::getline(list, item, ',')) {
+            try {
+                size_t colon = item.find(':');
+                size_t used = 0;
+                if (colon == std::string::npos) {
+                    mappings.emplace_back(0, std::stoi(item, &used));
+                } else {
+                    mappings.emplace_back(std::stoi(item.substr(0, colon)), std::stoi(item.substr(colon + 1), &used));
+                    colon++;
+                }
+                // 数字の後ろに空白以外が続いていたら不正
+                std::string rest = item.substr(colon == std::string::npos ? used : colon + used);
+                if (rest.find_first_not_of(" \t") != std::string::npos) {
+                    return false;
+                }
+            } catch (...) {
+                return false;
+            }
+        }
+        return !mappings.empty();
+    }
+    
+    // クロック同期: @midi.clock = master [ポート] | slave 入力デバイス | off、@midi.clock.rewind
+    void handleClockSyncCommand(const std::string& line) {
+        if (line == "@midi.clock.rewind") {
+            std::lock_guard<std::mutex> lock(envMutex);
+            clockMaster.rewind();
+            std::cout << "MIDI clock: next start sends Start from the top" << std::endl;
+            return;
+        }
+        
+        size_t pos = line.find('=');
+        std::stringstream args(pos == std::string::npos ? "" : line.substr(pos + 1));
+        std::string mode;
+        args >> mode;
+        int number = 0;
+        bool hasNumber = static_cast<bool>(args >> number);
+        
+        if (mode == "master") {
+            if (number < 0 || number >= MIDIManager::MAX_PORTS) {
+                std::cout << "Invalid MIDI port: " << number << " (0-" << MIDIManager::MAX_PORTS - 1 << ")" << std::endl;
+                return;
+            }
+            stopClockSync();
+            std::lock_guard<std::mutex> lock(envMutex);
+            clockMaster.setPort(number);
+            clockSync = ClockSync::MASTER;
+            if (clock.isRunning()) {
+                clockMaster.start();
+            }
+            std::cout << "MIDI clock: master (port " << number << ")" << std::endl;
+        } else if (mode == "slave" && hasNumber) {
+            stopClockSync();
+            if (!clockSlave.openInputDevice(number)) {
+                return;
+            }
+            clock.setSyncSource(&clockSlave);
+            clockSync = ClockSync::SLAVE;
+            // ティックは受けたクロックのスタートからストップまでの間だけ進む
+            setAutoTick(true);
+            std::cout << "MIDI clock: slave (waiting for Start)" << std::endl;
+        } else if (mode == "off") {
+            stopClockSync();
+            std::cout << "MIDI clock: internal" << std::endl;
+        } else {
+            std::cout << "Usage: @midi.clock = master [PORT] | slave INPUT | off" << std::endl;
+        }
+    }
+    
+    // クロック同期をやめて内部クロックに戻す（マスターならストップを送る）
+    void stopClockSync() {
+        if (clockSync == ClockSync::SLAVE) {
+            clock.setSyncSource(nullptr);
+        }
+        {
+            std::lock_guard<std::mutex> lock(envMutex);
+            if (clockMaster.isPlaying()) {
+                clockMaster.stop(MIDIManager::now());
+            }
+            clockSync = ClockSync::INTERNAL;
+        }
+        if (clockSlave.getCurrentInputDevice() >= 0) {
+            clockSlave.close();
         }
     }
     
@@ -220,39 +853,96 @@ private:
     bool handleMIDICommand(const std::string& line) {
         if (line == "@midi.list") {
             // MIDIデバイス一覧表示
-            auto outputs = midiManager.getAvailableOutputs();
+            std::vector<std::string> outputs;
+            {
+                std::lock_guard<std::mutex> lock(envMutex);
+                outputs = midiManager.getAvailableOutputs();
+            }
             std::cout << "Available MIDI Output Devices:" << std::endl;
             
             if (outputs.empty()) {
                 std::cout << "  No MIDI output devices found!" << std::endl;
             } else {
                 for (size_t i = 0; i < outputs.size(); i++) {
-                    std::cout << "  " << i << ": " << outputs[i];
-                    if (static_cast<int>(i) == midiManager.getCurrentOutputDevice()) {
-                        std::cout << " (selected)";
-                    }
-                    std::cout << std::endl;
+                    std::cout << "  " << i << ": " << outputs[i] << portsUsing(static_cast<int>(i)) << std::endl;
                 }
             }
+            
+            // クロックを受ける入力デバイス
+            auto inputs = MIDIClockSlave::getAvailableInputs();
+            std::cout << "Available MIDI Input Devices (clock):" << std::endl;
+            if (inputs.empty()) {
+                std::cout << "  No MIDI input devices found!" << std::endl;
+            }
+            for (size_t i = 0; i < inputs.size(); i++) {
+                std::cout << "  " << i << ": " << inputs[i];
+                if (static_cast<int>(i) == clockSlave.getCurrentInputDevice()) {
+                    std::cout << " (clock input)";
+                }
+                std::cout << std::endl;
+            }
             return true;
-        } else if (line.find("@midi.device") == 0) {
-            // MIDIデバイス選択
+        } else if (line.find("@midi.clock") == 0) {
+            handleClockSyncCommand(line);
+            return true;
+        } else if (line.find("@midi.cc_dedup") == 0 || line.find("@midi.cc_rate") == 0) {
+            // CCの間引き設定
             size_t pos = line.find('=');
-            if (pos != std::string::npos) {
-                std::string valueStr = line.substr(pos + 1);
+            std::string value = pos == std::string::npos ? "" : line.substr(pos + 1);
+            value.erase(0, value.find_first_not_of(' '));
+            value.erase(value.find_last_not_of(' ') + 1);
+            if (line.find("@midi.cc_dedup") == 0) {
+                if (value == "on" || value == "off") {
+                    midiManager.setDropRedundantCC(value == "on");
+                    std::cout << "Redundant CC drop: " << value << std::endl;
+                } else {
+                    std::cout << "Usage: @midi.cc_dedup = on | off" << std::endl;
+                }
+            } else {
                 try {
-                    int deviceId = std::stoi(valueStr);
-                    auto outputs = midiManager.getAvailableOutputs();
-                    if (deviceId >= 0 && static_cast<size_t>(deviceId) < outputs.size()) {
-                        midiManager.openOutputDevice(deviceId);
-                        midiManager.startProcessing();
-                        std::cout << "MIDI output device set to: " << outputs[deviceId] << std::endl;
+                    double hz = std::stod(value);
+                    if (hz < 0.0) {
+                        throw std::invalid_argument(value);
+                    }
+                    midiManager.setCCRateLimit(hz);
+                    if (hz > 0.0) {
+                        std::cout << "CC rate limit: " << hz << " Hz per controller" << std::endl;
                     } else {
-                        std::cout << "Invalid device ID!" << std::endl;
+                        std::cout << "CC rate limit: off" << std::endl;
                     }
                 } catch (...) {
+                    std::cout << "Usage: @midi.cc_rate = X (Hz per controller, 0 = off)" << std::endl;
+                }
+            }
+            return true;
+        } else if (line.find("@midi.device") == 0) {
+            // MIDIデバイス選択: @midi.device = X（ポート0）または @midi.device = 0:2, 1:3
+            size_t pos = line.find('=');
+            if (pos != std::string::npos) {
+                std::vector<std::pair<int, int>> mappings;
+                if (!parsePortMappings(line.substr(pos + 1), mappings)) {
                     std::cout << "Invalid device ID format!" << std::endl;
+                    return true;
+                }
+                // デバイスの切り替えはティックと排他にする（ティックが送る出力先を替えるため）
+                std::lock_guard<std::mutex> lock(envMutex);
+                auto outputs = midiManager.getAvailableOutputs();
+                for (const auto& mapping : mappings) {
+                    int port = mapping.first;
+                    int deviceId = mapping.second;
+                    if (port < 0 || port >= MIDIManager::MAX_PORTS) {
+                        std::cout << "Invalid MIDI port: " << port << " (0-" << MIDIManager::MAX_PORTS - 1 << ")" << std::endl;
+                    } else if (deviceId < 0 || static_cast<size_t>(deviceId) >= outputs.size()) {
+                        std::cout << "Invalid device ID!" << std::endl;
+                    } else if (midiManager.openOutputDevice(deviceId, port)) {
+                        std::cout << "MIDI output device set to: " << outputs[deviceId];
+                        if (port != 0) {
+                            std::cout << " (port " << port << ")";
+                        }
+                        std::cout << std::endl;
+                    }
                 }
+                midiManager.startProcessing();
             }
             return true;
         }
@@ -261,7 +951,7 @@ private:
     
     // 入力処理
     void handleInput() {
-        int c = terminal::readKey();
+        int c = terminal::readKey(20);
         if (c == -1) return;
         
         // Ctrl+キー
@@ -283,11 +973,14 @@ private:
                         history.push_back(currentLine);
                         historyIndex = history.size();
                         
-                        // MIDI特殊コマンドかチェック
-                        if (!handleMIDICommand(currentLine)) {
+                        // MIDI/クロック特殊コマンドかチェック
+                        if (!handleMIDICommand(currentLine) && !handleClockCommand(currentLine) &&
+                            !handleReloadCommand(currentLine) && !handleQuantizeCommand(currentLine) &&
+                            !handleMetricsCommand(currentLine) && !handleDisplayCommand(currentLine) &&
+                            !handleSceneCommand(currentLine) && !handleOSCCommand(currentLine)) {
                             // 通常のコマンド実行
                             std::cout << terminal::GREEN << "> " << currentLine << terminal::RESET_COLOR << std::endl;
-                            parser.parseLine(currentLine);
+                            submitLine(currentLine);
                         }
                         currentLine.clear();
                     }
@@ -296,37 +989,39 @@ private:
                     clearScreen();
                     break;
                 case 1:  // Ctrl+A
-                    autoTick = !autoTick;
+                    setAutoTick(!autoTick);
                     displayStatus();
                     break;
                 case 19: // Ctrl+S
                     {
-                        autoTick = false;
-                        displayStatus();
-                        std::cout << "Enter tick interval (ms): ";
+                        // クロックは別スレッドなので入力待ちの間も止まらない
+                        view.pause();
+                        std::cout << "Enter tick interval (ms, or e.g. 120bpm): ";
                         std::string input;
                         // rawモードを一時的に解除
                         terminal::disableRawMode();
                         std::getline(std::cin, input);
                         terminal::enableRawMode();
-                        try {
-                            tickInterval = std::stoi(input);
-                            autoTick = true;
+                        view.resume();
+                        if (setTickInterval(input)) {
+                            setAutoTick(true);
                             displayStatus();
-                        } catch (...) {
+                        } else {
                             std::cout << "Invalid input" << std::endl;
                         }
                     }
                     break;
-                case 13: // Ctrl+M
+                case 14: // Ctrl+N（Ctrl+MはEnterと同じコードのため使用不可）
                     configureMIDI();
                     break;
+                case 16: // Ctrl+P
+                    displayMetrics();
+                    break;
                 case 20: // Ctrl+T
-                    parser.tick();
-                    displayClock();
+                    manualTick();
                     break;
                 case 24: // Ctrl+X
-                    exit(0);
+                    quit = true;
                     break;
             }
         } 
@@ -340,14 +1035,8 @@ private:
             }
         }
         
-        // 現在の入力行を表示
-        auto now = std::chrono::steady_clock::now();
-        auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - lastPromptTime).count();
-        
-        if (elapsed >= 100) { // 100msごとにプロンプト更新（負荷軽減）
-            std::cout << "\r" << std::string(80, ' ') << "\r> " << currentLine << std::flush;
-            lastPromptTime = now;
-        }
+        // 入力行は描画スレッドが次のフレームで書く
+        view.setPrompt(currentLine);
     }
     
 public:
@@ -356,64 +1045,364 @@ public:
           midiManager(getMIDIManager()),
           historyIndex(0), 
           autoTick(false), 
-          tickInterval(250),
-          lastPromptTime(std::chrono::steady_clock::now()) {
+          clockSync(ClockSync::INTERNAL),
+          quantize(Quantize::NOW),
+          osc(env),
+          lookahead(env),
+          quit(false) {
         // MIDI初期化
         midiManager.initialize();
+        
+        // 独立したオブジェクトのティックは空いているコアで並列に処理する
+        unsigned int cores = std::thread::hardware_concurrency();
+        env.setTickThreads(cores > 1 ? cores : 1);
+        
+        // 再読み込みやクオンタイズは4/4拍子の拍・小節の頭で行う
+        env.setBeatTicks(clock.getPPQN());
+        env.setBarTicks(clock.getPPQN() * 4);
+        
+        // 止まっているときはOSCで届いたコマンドを受信スレッドが処理する
+        osc.setBatchHandler([this]() {
+            if (!clock.isRunning()) {
+                std::lock_guard<std::mutex> lock(envMutex);
+                env.processCommands();
+                publishViewThrottled(ClockEngine::Clock::now());
+            }
+        });
     }
     
     ~ReeliaSimulator() {
+        // 受信スレッドとクロックスレッドを先に止める
+        osc.stop();
+        clock.stop();
+        
         // MIDI片付け
         midiManager.cleanup();
     }
     
+    // OSCの受信を始める（port は文字列のポート番号）
+    bool startOSC(const std::string& port) {
+        int number;
+        try {
+            size_t used = 0;
+            number = std::stoi(port, &used);
+            if (used != port.size()) {
+                throw std::invalid_argument(port);
+            }
+        } catch (...) {
+            std::cout << "Usage: @osc = PORT | off" << std::endl;
+            return false;
+        }
+        if (!osc.start(number)) {
+            return false;
+        }
+        std::cout << "OSC: listening on UDP port " << osc.getPort() << std::endl;
+        return true;
+    }
+    
+    // 先読みの長さ（ミリ秒。0で止める）
+    bool setLookahead(double ms) {
+        if (!(ms >= 0.0 && ms <= 1000.0)) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(envMutex);
+        lookahead.setWindow(ms / 1000.0);
+        return true;
+    }
+    
+    // 起動時のシーン（曲の位置も保存したところに戻す）
+    bool loadStartupScene(const std::string& path) {
+        Scene scene;
+        if (!scene.load(path, parser)) {
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(envMutex);
+        scene.patch().apply(env, "Scene");
+        env.locate(scene.getSongPosition());
+        return true;
+    }
+    
     void run() {
-        // ターミナル設定
+        // ターミナル設定（ここから先の出力は描画スレッドが書く）
         terminal::enableRawMode();
+        view.start();
+        {
+            std::lock_guard<std::mutex> lock(envMutex);
+            publishView(ClockEngine::Clock::now());
+        }
         
         // 初期表示
         clearScreen();
         displayHelp();
         
-        // 最初のプロンプト
-        std::cout << "> " << std::flush;
-        
-        // 前回のティック時間
-        auto lastTickTime = std::chrono::steady_clock::now();
-        
-        // メインループ
-        while (true) {
-            // 入力処理
+        // メインループ（入力スレッド）。ティックはクロックスレッドが進める
+        while (!quit) {
+            // 入力処理（最大20ms待機）
             handleInput();
             
-            // 自動ティック
-            if (autoTick) {
-                auto now = std::chrono::steady_clock::now();
-                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - lastTickTime).count();
-                
-                if (elapsed >= tickInterval) {
-                    parser.tick();
-                    displayClock();
-                    lastTickTime = now;
-                    
-                    // 入力行を再表示
-                    std::cout << "\r" << std::string(80, ' ') << "\r> " << currentLine << std::flush;
-                    lastPromptTime = now;
-                }
-            }
+            // 再読み込みの結果を確認
+            pollReload();
+
+            // ティック中の知らせ（外した束縛など）を表示
+            pollNotices();
             
-            // CPUの負荷を減らすために少し待機
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            // 自動ティックが止まっている間は状態を渡すのは入力スレッド
+            // （変数の作成や属性の変更を表示に反映する）
+            if (!clock.isRunning()) {
+                std::lock_guard<std::mutex> lock(envMutex);
+                publishViewThrottled(ClockEngine::Clock::now());
+            }
         }
+        
+        setAutoTick(false);
+        view.stop();
+        terminal::disableRawMode();
     }
 };
 
+// コマンドラインの設定
+struct Options {
+    std::string script; // --render のスクリプト
+    std::string scene;  // 先に読み込むシーン（空ならなし）
+    std::string osc;    // 対話モードでOSCを受けるポート（空なら受けない）
+    std::string host;   // 複数セッションのホストの設定ファイル（空なら対話モード）
+    double lookahead = 0.0; // 対話モードの先読み（ミリ秒）
+    std::string output = "out.mid";
+    uint64_t ticks = 384;
+    double bpm = 120.0;
+    int ppqn = 24;
+};
+
+/**
+ * オフラインレンダリング
+ * スクリプトを読み込み、実時間を待たずにティックを進めて、出力された
+ * MIDIメッセージをStandard MIDI Fileに書き出す。
+ */
+int renderOffline(const Options& options) {
+    std::ifstream in(options.script);
+    if (!in) {
+        std::cerr << "Cannot open " << options.script << std::endl;
+        return 1;
+    }
+    std::ostringstream code;
+    code << in.rdbuf();
+    
+    // 時刻0は「即時送信」の意味になるので、1秒からティックを並べる
+    const double origin = 1.0;
+    const double period = 60.0 / (options.bpm * options.ppqn);
+    
+    std::unique_ptr<SMFWriterSink> writer(new SMFWriterSink(options.output, options.bpm));
+    if (!writer->isOpen()) {
+        return 1;
+    }
+    writer->setOrigin(origin);
+    SMFWriterSink* file = writer.get();
+    
+    // 出力スレッドは使わず、ティックのスレッドから直接書き出す
+    MIDIManager& midiManager = getMIDIManager();
+    midiManager.setOutputSink(std::move(writer));
+    
+    auto started = std::chrono::steady_clock::now();
+    {
+        Environment env;
+        env.setBeatTicks(options.ppqn);
+        env.setBarTicks(options.ppqn * 4);
+        Parser parser(env);
+        parser.setEcho(false);
+        
+        // シーンを読み込み、保存した曲の位置から進める（スクリプトはその後に実行）
+        if (!options.scene.empty()) {
+            Scene scene;
+            if (!scene.load(options.scene, parser)) {
+                midiManager.setOutputSink(nullptr);
+                return 1;
+            }
+            scene.patch().apply(env, "Scene");
+            env.locate(scene.getSongPosition());
+        }
+        bool parsed = parser.parseMultipleLines(code.str());
+        env.reportNotices(std::cerr);
+        if (!parsed) {
+            std::cerr << "Errors in " << options.script << " (rendering anyway)" << std::endl;
+        }
+        
+        for (uint64_t i = 0; i < options.ticks; i++) {
+            double time = origin + i * period;
+            // 前のティックのメッセージはこれより前の時刻なので確定できる
+            file->advance(time);
+            env.setTickTiming(time, period);
+            env.tick();
+            env.reportNotices(std::cerr);
+        }
+        // 環境の破棄で未発火のノートオフが送られる
+        env.setTickTiming(origin + options.ticks * period, period);
+    }
+    
+    uint64_t events = file->getEventCount();
+    bool ok = file->close();
+    midiManager.setOutputSink(nullptr);
+    
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - started).count();
+    std::cout << "Rendered " << options.ticks << " ticks (" << events << " events) to " << options.output
+              << " in " << std::fixed << std::setprecision(1) << ms << " ms" << std::endl;
+    return ok ? 0 : 1;
+}
+
+/**
+ * 複数セッションのホスト
+ * 設定ファイルのセッションを1つのクロックで進める。端末は行単位の入力で、
+ * "NAME: 行" をセッション NAME に送る（各セッションはOSCでも操作できる）。
+ */
+int runHost(const Options& options) {
+    MIDIManager& midiManager = getMIDIManager();
+    midiManager.initialize();
+    
+    int status = 0;
+    {
+        SessionHost host;
+        host.getClock().setTempo(options.bpm, options.ppqn);
+        if (!host.loadConfig(options.host)) {
+            std::cerr << "Errors in " << options.host << " (hosting the sessions that loaded)" << std::endl;
+        }
+        if (host.sessionCount() == 0) {
+            std::cerr << "No sessions in " << options.host << std::endl;
+            midiManager.cleanup();
+            return 1;
+        }
+        midiManager.startProcessing();
+        host.start();
+        std::cout << "Hosting " << host.sessionCount() << " sessions at " << host.getClock().getBPM() << " BPM" << std::endl;
+        std::cout << "Commands: NAME: LINE | @sessions | @start | @stop | @clock.bpm = X | @quit" << std::endl;
+        
+        std::string line;
+        while (std::getline(std::cin, line)) {
+            line.erase(0, line.find_first_not_of(" \t"));
+            line.erase(line.find_last_not_of(" \t\r") + 1);
+            if (line.empty()) {
+                continue;
+            }
+            if (line == "@quit") {
+                break;
+            } else if (line == "@sessions") {
+                host.printStats(std::cout);
+            } else if (line == "@start") {
+                host.start();
+            } else if (line == "@stop") {
+                host.stop();
+            } else if (line.compare(0, 10, "@clock.bpm") == 0 && line.find('=') != std::string::npos) {
+                try {
+                    host.getClock().setBPM(std::stod(line.substr(line.find('=') + 1)));
+                    std::cout << "BPM: " << host.getClock().getBPM() << std::endl;
+                } catch (...) {
+                    std::cout << "Invalid BPM" << std::endl;
+                }
+            } else {
+                size_t colon = line.find(':');
+                Session* session = colon == std::string::npos ? nullptr : host.findSession(line.substr(0, colon));
+                if (!session) {
+                    std::cout << "Usage: NAME: LINE (sessions:";
+                    for (size_t i = 0; i < host.sessionCount(); i++) {
+                        std::cout << " " << host.getSession(i).getName();
+                    }
+                    std::cout << ")" << std::endl;
+                    continue;
+                }
+                if (!session->submit(line.substr(colon + 1), host.isRunning())) {
+                    status = 1;
+                }
+            }
+        }
+        host.stop();
+    }
+    midiManager.cleanup();
+    return status;
+}
+
+void printUsage(const char* program) {
+    std::cout << "Usage: " << program << " [--scene FILE] [--osc PORT] [--lookahead MS]" << std::endl;
+    std::cout << "       " << program << " --render SCRIPT [--scene FILE] [--out FILE.mid] [--ticks N] [--bpm X] [--ppqn N]" << std::endl;
+    std::cout << "       " << program << " --host CONFIG [--bpm X] [--ppqn N]" << std::endl;
+}
+
 // メイン関数
-int main() {
+int main(int argc, char** argv) {
+    // --render があればオフラインレンダリング
+    Options options;
+    bool render = false;
+    bool renderOnly = false; // --render なしでは使えない引数があったか
+    bool tempo = false;      // --render か --host がないと使えない引数があったか
+    bool interactiveOnly = false; // 対話モードでしか使えない引数があったか
+    try {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--render" && hasValue) {
+                options.script = argv[++i];
+                render = true;
+            } else if (arg == "--scene" && hasValue) {
+                options.scene = argv[++i];
+            } else if (arg == "--osc" && hasValue) {
+                options.osc = argv[++i];
+            } else if (arg == "--host" && hasValue) {
+                options.host = argv[++i];
+            } else if (arg == "--lookahead" && hasValue) {
+                options.lookahead = std::stod(argv[++i]);
+                interactiveOnly = true;
+            } else if (arg == "--out" && hasValue) {
+                options.output = argv[++i];
+                renderOnly = true;
+            } else if (arg == "--ticks" && hasValue) {
+                options.ticks = std::stoull(argv[++i]);
+                renderOnly = true;
+            } else if (arg == "--bpm" && hasValue) {
+                options.bpm = std::stod(argv[++i]);
+                tempo = true;
+            } else if (arg == "--ppqn" && hasValue) {
+                options.ppqn = std::stoi(argv[++i]);
+                tempo = true;
+            } else {
+                printUsage(argv[0]);
+                return arg == "--help" ? 0 : 1;
+            }
+        }
+    } catch (const std::exception&) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (render) {
+        if (interactiveOnly || !options.osc.empty() || !options.host.empty() || options.bpm <= 0.0 || options.ppqn <= 0) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        return renderOffline(options);
+    }
+    if (!options.host.empty()) {
+        // --bpm と --ppqn はホストのクロックにも使う
+        if (renderOnly || interactiveOnly || !options.osc.empty() || !options.scene.empty() || options.bpm <= 0.0 || options.ppqn <= 0) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        return runHost(options);
+    }
+    if (renderOnly || tempo) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    
     std::cout << "Reelia Live Coding Environment starting..." << std::endl;
     
     // シミュレータの作成と実行
     ReeliaSimulator simulator;
+    if (!options.scene.empty() && !simulator.loadStartupScene(options.scene)) {
+        return 1;
+    }
+    if (!options.osc.empty() && !simulator.startOSC(options.osc)) {
+        return 1;
+    }
+    if (!simulator.setLookahead(options.lookahead)) {
+        std::cerr << "Invalid lookahead: " << options.lookahead << " ms (0-1000)" << std::endl;
+        return 1;
+    }
     
     try {
         simulator.run();
@@ -425,4 +1414,4 @@ int main() {
     }
     
     return 0;
-}
\ No newline at end of file
+}
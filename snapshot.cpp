@@ -0,0 +1,183 @@
+#include "snapshot.hpp"
+#include "parser.hpp"
+#include "pattern_graph.hpp"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// ファイルの形式（整数はすべてリトルエンディアン）
+//   u32 MAGIC, u32 VERSION, u64 曲の位置, u32 オブジェクト数
+//   オブジェクトごとに: 変数名, 型名, パターングラフの式（ほかの型は空）,
+//                       u32 状態のバイト数, 状態（save() の結果）
+// 文字列は u32 の長さと中身
+
+void Scene::capture(const Environment& env) {
+    entries.clear();
+    songPosition = env.getSongPosition();
+    for (SlotId slot = 0; slot < env.slotCount(); slot++) {
+        if (const BaseObject* obj = env.getVariable(slot)) {
+            entries.push_back(Entry{env.getName(slot), obj->clone()});
+        }
+    }
+}
+
+bool Scene::save(const std::string& path) const {
+    SnapshotWriter out;
+    out.u32(MAGIC);
+    out.u32(VERSION);
+    out.u64(songPosition);
+    out.u32(static_cast<uint32_t>(entries.size()));
+    for (const Entry& entry : entries) {
+        const BaseObject& obj = *entry.object;
+        const PatternGraphObject* graph = dynamic_cast<const PatternGraphObject*>(&obj);
+        SnapshotWriter state;
+        obj.save(state);
+        out.string(entry.name);
+        out.string(obj.getObjectType().getName());
+        out.string(graph ? graph->getDefinition() : std::string());
+        out.string(state.data());
+    }
+
+    // 書き終えてから置き換える（途中で失敗しても元のファイルは残る）
+    std::string temp = path + ".tmp";
+    int fd = ::open(temp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) {
+        std::cerr << "Cannot write " << temp << ": " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    const char* p = out.data().data();
+    size_t left = out.size();
+    while (left > 0) {
+        ssize_t written = ::write(fd, p, left);
+        if (written < 0 && errno == EINTR) {
+            continue;
+        }
+        if (written <= 0) {
+            std::cerr << "Cannot write " << temp << ": " << std::strerror(errno) << std::endl;
+            ::close(fd);
+            ::unlink(temp.c_str());
+            return false;
+        }
+        p += written;
+        left -= static_cast<size_t>(written);
+    }
+    if (::close(fd) != 0 || ::rename(temp.c_str(), path.c_str()) != 0) {
+        std::cerr << "Cannot write " << path << ": " << std::strerror(errno) << std::endl;
+        ::unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+namespace {
+// mmap したファイル（読み終えたら閉じる）
+struct MappedFile {
+    void* data;
+    size_t size;
+
+    MappedFile() : data(MAP_FAILED), size(0) {}
+    ~MappedFile() {
+        if (data != MAP_FAILED) {
+            munmap(data, size);
+        }
+    }
+
+    bool open(const std::string& path) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+            ::close(fd);
+            return false;
+        }
+        size = static_cast<size_t>(st.st_size);
+        data = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        return data != MAP_FAILED;
+    }
+};
+} // namespace
+
+bool Scene::load(const std::string& path, Parser& parser) {
+    MappedFile file;
+    if (!file.open(path)) {
+        std::cerr << "Cannot open " << path << std::endl;
+        return false;
+    }
+
+    SnapshotReader in(file.data, file.size);
+    uint32_t magic = in.u32();
+    uint32_t version = in.u32();
+    uint64_t position = in.u64();
+    uint32_t count = in.u32();
+    if (!in.good() || magic != MAGIC) {
+        std::cerr << path << " is not a scene file" << std::endl;
+        return false;
+    }
+    if (version != VERSION) {
+        std::cerr << path << ": unsupported scene version " << version << std::endl;
+        return false;
+    }
+
+    // 1つの変数は少なくとも長さ4つ分（16バイト）ある
+    if (!in.fits(count, 16)) {
+        std::cerr << path << ": truncated (" << count << " objects)" << std::endl;
+        return false;
+    }
+    std::vector<Entry> loaded;
+    loaded.reserve(count);
+    for (uint32_t i = 0; i < count; i++) {
+        std::string name = in.string();
+        std::string type = in.string();
+        std::string definition = in.string();
+        uint32_t bytes = in.u32();
+        SnapshotReader state = in.sub(bytes);
+        if (!in.good() || name.empty()) {
+            std::cerr << path << ": truncated at object " << i << std::endl;
+            return false;
+        }
+
+        // パターングラフは式から組み立て直し、状態だけを読む
+        ObjectPtr object;
+        if (!definition.empty()) {
+            std::shared_ptr<const Program> program = parser.compile("$" + name + " = " + definition);
+            if (program->valid && program->code.size() == 1 && program->code[0].graph) {
+                object = program->code[0].graph->clone();
+            }
+        } else if (const ObjectType* objectType = ObjectRegistry::findType(type)) {
+            object = objectType->create();
+        }
+        if (!object || object->getObjectType().getName() != type) {
+            std::cerr << path << ": $" << name << ": cannot create " << type << std::endl;
+            return false;
+        }
+        if (!object->load(state) || !state.atEnd()) {
+            std::cerr << path << ": $" << name << ": bad " << type << " state" << std::endl;
+            return false;
+        }
+        loaded.push_back(Entry{std::move(name), std::move(object)});
+    }
+
+    entries = std::move(loaded);
+    songPosition = position;
+    return true;
+}
+
+ScriptPatch Scene::patch() const {
+    ScriptPatch patch;
+    patch.ops.reserve(entries.size());
+    for (const Entry& entry : entries) {
+        ScriptPatch::Op op;
+        op.kind = ScriptPatch::Op::REPLACE;
+        op.name = entry.name;
+        op.object = entry.object->clone();
+        patch.ops.push_back(std::move(op));
+    }
+    return patch;
+}
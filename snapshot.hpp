@@ -0,0 +1,184 @@
+#ifndef REELIA_SNAPSHOT_HPP
+#define REELIA_SNAPSHOT_HPP
+
+#include "base_object.hpp"
+#include "hot_reload.hpp"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+class Parser;
+
+/**
+ * スナップショットの書き出し
+ * 整数はリトルエンディアン固定で詰めて書く（境界合わせはしない）。
+ */
+class SnapshotWriter {
+private:
+  std::string bytes;
+
+public:
+  void u8(uint8_t v) { bytes.push_back(static_cast<char>(v)); }
+  void u16(uint16_t v) {
+    u8(static_cast<uint8_t>(v));
+    u8(static_cast<uint8_t>(v >> 8));
+  }
+  void u32(uint32_t v) {
+    u16(static_cast<uint16_t>(v));
+    u16(static_cast<uint16_t>(v >> 16));
+  }
+  void u64(uint64_t v) {
+    u32(static_cast<uint32_t>(v));
+    u32(static_cast<uint32_t>(v >> 32));
+  }
+  void i32(int32_t v) { u32(static_cast<uint32_t>(v)); }
+
+  // 長さ（u32）と中身
+  void string(const std::string &s) {
+    u32(static_cast<uint32_t>(s.size()));
+    bytes += s;
+  }
+
+  // ステップ数（u16）と64ステップずつの語
+  void pattern(const BitPattern &p) {
+    u16(static_cast<uint16_t>(p.size()));
+    for (size_t w = 0; w * BitPattern::WORD_BITS < p.size(); w++) {
+      u64(p.word(w));
+    }
+  }
+
+  const std::string &data() const { return bytes; }
+  size_t size() const { return bytes.size(); }
+};
+
+/**
+ * スナップショットの読み込み
+ * mmap した領域などをそのまま読む。範囲を超えて読もうとしたら以降は0を返し、
+ * good() が false になる（途中で打ち切られたファイルを読んでも落ちない）。
+ */
+class SnapshotReader {
+private:
+  const uint8_t *p;
+  const uint8_t *end;
+  bool ok;
+
+  bool take(size_t n) {
+    if (!ok || static_cast<size_t>(end - p) < n) {
+      ok = false;
+      return false;
+    }
+    return true;
+  }
+
+public:
+  SnapshotReader(const void *data, size_t size)
+      : p(static_cast<const uint8_t *>(data)), end(p + size), ok(true) {}
+
+  uint8_t u8() { return take(1) ? *p++ : 0; }
+  uint16_t u16() {
+    uint16_t lo = u8();
+    return static_cast<uint16_t>(lo | (static_cast<uint16_t>(u8()) << 8));
+  }
+  uint32_t u32() {
+    uint32_t lo = u16();
+    return lo | (static_cast<uint32_t>(u16()) << 16);
+  }
+  uint64_t u64() {
+    uint64_t lo = u32();
+    return lo | (static_cast<uint64_t>(u32()) << 32);
+  }
+  int32_t i32() { return static_cast<int32_t>(u32()); }
+
+  std::string string() {
+    uint32_t n = u32();
+    if (!take(n)) {
+      return std::string();
+    }
+    std::string s(reinterpret_cast<const char *>(p), n);
+    p += n;
+    return s;
+  }
+
+  bool pattern(BitPattern &out) {
+    size_t steps = u16();
+    size_t words = (steps + BitPattern::WORD_BITS - 1) / BitPattern::WORD_BITS;
+    if (steps > BitPattern::MAX_STEPS || !fits(words, 8)) {
+      ok = false;
+      return false;
+    }
+    BitPattern bits(steps);
+    for (size_t w = 0; w * BitPattern::WORD_BITS < steps; w++) {
+      bits.setWord(w, u64());
+    }
+    if (ok) {
+      out = std::move(bits);
+    }
+    return ok;
+  }
+
+  // 続く n バイトを別の読み込みとして切り出す
+  SnapshotReader sub(size_t n) {
+    if (!take(n)) {
+      return SnapshotReader(p, 0);
+    }
+    SnapshotReader r(p, n);
+    p += n;
+    return r;
+  }
+
+  // 1つ each バイト以上の要素が count 個残っているか（足りなければ good() が false）
+  // ファイルから読んだ個数で確保する前に確かめる
+  bool fits(uint64_t count, size_t each) {
+    if (!ok || count > static_cast<uint64_t>(end - p) / each) {
+      ok = false;
+    }
+    return ok;
+  }
+
+  bool good() const { return ok; }
+  bool atEnd() const { return p == end; }
+};
+
+/**
+ * シーン
+ * 環境の変数をまとめて写したもの（変数名・オブジェクトの複製・曲の位置）。
+ * ファイルには型名と各オブジェクトの save() の結果をバイナリで書き、
+ * 読み込みは mmap した内容から型を作って load() するだけで、スクリプトの
+ * 解析は行わない（パターングラフだけは組み合わせの式をコンパイルし直す）。
+ * メモリに置いたシーンは何度でも呼び出せる（呼び出すたびに複製する）。
+ */
+class Scene {
+public:
+  static constexpr uint32_t MAGIC = 0x4E43534C; // "LSCN"
+  static constexpr uint32_t VERSION = 1;
+
+private:
+  struct Entry {
+    std::string name;
+    ObjectPtr object; // 環境に属さない複製
+  };
+
+  std::vector<Entry> entries; // 変数の登録順
+  uint64_t songPosition;
+
+public:
+  Scene() : songPosition(0) {}
+
+  // 環境の変数をすべて写す（環境はロックした状態で呼ぶこと）
+  void capture(const Environment &env);
+
+  // ファイルへの書き出しと読み込み（失敗したらエラーを表示してfalse）
+  // パターングラフの式は parser でコンパイルする（環境には何もしない）
+  bool save(const std::string &path) const;
+  bool load(const std::string &path, Parser &parser);
+
+  // 環境の変数をシーンのオブジェクトの複製で置き換える差分
+  // （シーンにない変数はそのまま残る）
+  ScriptPatch patch() const;
+
+  size_t size() const { return entries.size(); }
+  bool empty() const { return entries.empty(); }
+  uint64_t getSongPosition() const { return songPosition; }
+};
+
+#endif // REELIA_SNAPSHOT_HPP
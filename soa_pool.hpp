@@ -0,0 +1,181 @@
+#ifndef REELIA_SOA_POOL_HPP
+#define REELIA_SOA_POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+/**
+ * 構造体配列（SoA）形式のオブジェクトプール
+ * 同じ種類のオブジェクトの状態をフィールドごとの連続した配列に持ち、
+ * ティックでは種類ごとに1本のループで全要素を進める。
+ * 配列は常に詰めて保持し、要素を削除すると末尾の要素を空いた位置へ移す。
+ * その際に持ち主（ビュー）が持つ添字も書き換える。
+ */
+
+// カウンターの状態
+struct CounterState {
+  int32_t value;
+  int32_t min;
+  int32_t max;
+  int32_t step;
+  uint8_t running;
+};
+
+/**
+ * カウンタープール
+ */
+class CounterPool {
+public:
+  std::vector<int32_t> value;
+  std::vector<int32_t> min;
+  std::vector<int32_t> max;
+  std::vector<int32_t> step;
+  std::vector<uint8_t> running;
+
+private:
+  // 各要素の持ち主が保持する添字への参照（詰め直しで更新する）
+  std::vector<uint32_t *> owners;
+
+public:
+  size_t size() const { return value.size(); }
+
+  // 1カウンター分のティック後の値
+  // 上限を超えたら増加方向なら最小値へ、減少方向なら最大値へ戻る
+  // 足し算は64ビットで行うので、int32_t の範囲の端でも溢れない
+  static int32_t next(int32_t v, int32_t lo, int32_t hi, int32_t st) {
+    int64_t n = static_cast<int64_t>(v) + st;
+    int32_t overflow = st > 0 ? lo : hi;
+    int32_t underflow = st < 0 ? hi : lo;
+    return n > hi ? overflow : (n < lo ? underflow : static_cast<int32_t>(n));
+  }
+
+  // 要素の追加（添字を返す）
+  uint32_t add(const CounterState &state, uint32_t *owner) {
+    uint32_t index = static_cast<uint32_t>(value.size());
+    value.push_back(state.value);
+    min.push_back(state.min);
+    max.push_back(state.max);
+    step.push_back(state.step);
+    running.push_back(state.running);
+    owners.push_back(owner);
+    return index;
+  }
+
+  // 要素の状態を取り出す
+  CounterState get(uint32_t i) const {
+    return {value[i], min[i], max[i], step[i], running[i]};
+  }
+
+  // 要素の削除（末尾の要素を空いた位置へ移す）
+  void remove(uint32_t i) {
+    size_t last = value.size() - 1;
+    if (i != last) {
+      value[i] = value[last];
+      min[i] = min[last];
+      max[i] = max[last];
+      step[i] = step[last];
+      running[i] = running[last];
+      owners[i] = owners[last];
+      *owners[i] = i;
+    }
+    value.pop_back();
+    min.pop_back();
+    max.pop_back();
+    step.pop_back();
+    running.pop_back();
+    owners.pop_back();
+  }
+
+  // 全カウンターを1ティック進める
+  // 分岐を選択に置き換えてあるので、コンパイラがSIMD化できる
+  void tick() {
+    const size_t n = value.size();
+    int32_t *__restrict v = value.data();
+    const int32_t *__restrict lo = min.data();
+    const int32_t *__restrict hi = max.data();
+    const int32_t *__restrict st = step.data();
+    const uint8_t *__restrict run = running.data();
+
+    for (size_t i = 0; i < n; i++) {
+      int32_t advanced = next(v[i], lo[i], hi[i], st[i]);
+      v[i] = run[i] ? advanced : v[i];
+    }
+  }
+};
+
+// シーケンスの再生状態
+struct SequenceState {
+  int32_t position;
+  int32_t length;
+  uint8_t playing;
+};
+
+/**
+ * シーケンスプール
+ * ステップデータは各オブジェクトが持ち、再生位置・長さ・再生状態だけを
+ * 配列で持つ。
+ */
+class SequencePool {
+public:
+  std::vector<int32_t> position;
+  std::vector<int32_t> length;
+  std::vector<uint8_t> playing;
+
+private:
+  std::vector<uint32_t *> owners;
+
+public:
+  size_t size() const { return position.size(); }
+
+  // 1シーケンス分のティック後の位置（(pos + 1) % len と同じ）
+  // 通常は長さに達したら0へ戻るだけ。長さより先に置かれた位置だけ剰余を取る
+  static int32_t next(int32_t pos, int32_t len) {
+    int32_t n = pos + 1;
+    n = n == len ? 0 : n;
+    return n > len ? n % len : n;
+  }
+
+  uint32_t add(const SequenceState &state, uint32_t *owner) {
+    uint32_t index = static_cast<uint32_t>(position.size());
+    position.push_back(state.position);
+    length.push_back(state.length);
+    playing.push_back(state.playing);
+    owners.push_back(owner);
+    return index;
+  }
+
+  SequenceState get(uint32_t i) const {
+    return {position[i], length[i], playing[i]};
+  }
+
+  void remove(uint32_t i) {
+    size_t last = position.size() - 1;
+    if (i != last) {
+      position[i] = position[last];
+      length[i] = length[last];
+      playing[i] = playing[last];
+      owners[i] = owners[last];
+      *owners[i] = i;
+    }
+    position.pop_back();
+    length.pop_back();
+    playing.pop_back();
+    owners.pop_back();
+  }
+
+  // 全シーケンスを1ティック進める
+  void tick() {
+    const size_t n = position.size();
+    int32_t *__restrict pos = position.data();
+    const int32_t *__restrict len = length.data();
+    const uint8_t *__restrict play = playing.data();
+
+    for (size_t i = 0; i < n; i++) {
+      int32_t advanced = next(pos[i], len[i]);
+      pos[i] = play[i] ? advanced : pos[i];
+    }
+  }
+};
+
+#endif // REELIA_SOA_POOL_HPP
@@ -0,0 +1,79 @@
+#ifndef REELIA_SPSC_QUEUE_HPP
+#define REELIA_SPSC_QUEUE_HPP
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+
+/**
+ * SPSCロックフリーリングバッファ
+ * 生産者スレッド1つ・消費者スレッド1つの間でメッセージを受け渡す。
+ * 容量は2のべき乗で固定。push/popとも確保・ロックを一切行わない。
+ */
+template <typename T, size_t Capacity>
+class SPSCQueue {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "SPSCQueue capacity must be a power of two");
+
+private:
+    static constexpr size_t MASK = Capacity - 1;
+    static constexpr size_t CACHE_LINE = 64;
+
+    std::array<T, Capacity> buffer;
+
+    // 生産者が書き込む位置（消費者は読むだけ）
+    alignas(CACHE_LINE) std::atomic<size_t> head;
+    size_t cachedTail; // 生産者側で保持する消費位置のキャッシュ
+
+    // 消費者が読み出す位置（生産者は読むだけ）
+    alignas(CACHE_LINE) std::atomic<size_t> tail;
+    size_t cachedHead; // 消費者側で保持する書き込み位置のキャッシュ
+
+public:
+    SPSCQueue() : head(0), cachedTail(0), tail(0), cachedHead(0) {}
+
+    SPSCQueue(const SPSCQueue&) = delete;
+    SPSCQueue& operator=(const SPSCQueue&) = delete;
+
+    // 生産者側: 要素を追加（満杯ならfalse）
+    bool tryPush(const T& item) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h - cachedTail >= Capacity) {
+            cachedTail = tail.load(std::memory_order_acquire);
+            if (h - cachedTail >= Capacity) {
+                return false;
+            }
+        }
+        buffer[h & MASK] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 消費者側: 要素を取り出す（空ならfalse）
+    bool tryPop(T& item) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t == cachedHead) {
+            cachedHead = head.load(std::memory_order_acquire);
+            if (t == cachedHead) {
+                return false;
+            }
+        }
+        item = buffer[t & MASK];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    // 空かどうか（どちらのスレッドからでも呼べるが近似値）
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+    // 現在の要素数（近似値）
+    size_t size() const {
+        return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+    }
+
+    static constexpr size_t capacity() { return Capacity; }
+};
+
+#endif // REELIA_SPSC_QUEUE_HPP
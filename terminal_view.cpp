@@ -0,0 +1,453 @@
+#include "terminal_view.hpp"
+#include "environment.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <iostream>
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+namespace {
+const char* const RESET = "\033[0m";
+const char* const STATUS = "\033[1m\033[36m"; // 太字・シアン（クロックの表示）
+const char* const RUNNING = "\033[32m";       // 動いているオブジェクト
+
+// オブジェクトの状態1つ分の幅（名前が長ければ切る）
+constexpr size_t CELL_WIDTH = 20;
+
+// 端末の大きさが分からないとき
+constexpr int DEFAULT_ROWS = 24;
+constexpr int DEFAULT_COLS = 80;
+
+// 改行の来ない出力をこれ以上ためたら1行として書く
+constexpr size_t MAX_TAIL = 4096;
+
+// 途中で書けなかった分も書き切る
+void writeAll(int fd, const std::string& text) {
+    const char* p = text.data();
+    size_t left = text.size();
+    while (left > 0) {
+        ssize_t written = ::write(fd, p, left);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        p += written;
+        left -= static_cast<size_t>(written);
+    }
+}
+
+// カーソルを row 行目の先頭へ（1始まり）
+void moveTo(std::string& out, int row) {
+    out += "\033[";
+    out += std::to_string(row);
+    out += ";1H";
+}
+
+std::string tickLabel(uint64_t tick, int ppqn) {
+    uint64_t beats = static_cast<uint64_t>(ppqn > 0 ? ppqn : 1);
+    return "Tick: " + std::to_string(tick) + " (" + std::to_string(tick / beats + 1) + "." +
+           std::to_string(tick % beats + 1) + ")";
+}
+} // namespace
+
+// 環境の変数から状態を写す（変数の登録順。名前の文字列は前回の領域を使い回す）
+void ViewState::capture(const Environment& env) {
+    tick = env.getSongPosition();
+    running = 0;
+    objects = 0;
+    count = 0;
+    for (SlotId slot = 0; slot < env.slotCount(); slot++) {
+        const BaseObject* obj = env.getVariable(slot);
+        if (!obj) {
+            continue;
+        }
+        objects++;
+        if (obj->isRunning()) {
+            running++;
+        }
+        if (count >= MAX_ENTRIES) {
+            continue;
+        }
+        if (count == entries.size()) {
+            entries.emplace_back();
+        }
+        Entry& entry = entries[count++];
+        entry.name = env.getName(slot);
+        entry.type = obj->getType();
+        entry.value = obj->getValue();
+        entry.running = obj->isRunning();
+        if (const SeqObject* seq = dynamic_cast<const SeqObject*>(obj)) {
+            entry.position = seq->getPosition();
+            entry.length = seq->getAttr(Attr::LENGTH).asInt();
+        } else {
+            entry.position = -1;
+            entry.length = 0;
+        }
+    }
+}
+
+void ConsoleBuffer::append(const char* s, size_t n) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (passthrough >= 0) {
+        writeAll(passthrough, std::string(s, n));
+        return;
+    }
+    if (pending.size() + n > LIMIT) {
+        dropped += n;
+        return;
+    }
+    pending.append(s, n);
+}
+
+ConsoleBuffer::int_type ConsoleBuffer::overflow(int_type c) {
+    if (traits_type::eq_int_type(c, traits_type::eof())) {
+        return traits_type::not_eof(c);
+    }
+    char ch = traits_type::to_char_type(c);
+    append(&ch, 1);
+    return c;
+}
+
+std::streamsize ConsoleBuffer::xsputn(const char* s, std::streamsize n) {
+    append(s, static_cast<size_t>(n));
+    return n;
+}
+
+void ConsoleBuffer::take(std::string& out) {
+    std::lock_guard<std::mutex> lock(mutex);
+    out.swap(pending);
+    pending.clear();
+    if (dropped > 0) {
+        out += "[output dropped: " + std::to_string(dropped) + " bytes]\n";
+        dropped = 0;
+    }
+}
+
+void ConsoleBuffer::setPassthrough(int target) {
+    std::lock_guard<std::mutex> lock(mutex);
+    passthrough = target;
+}
+
+TerminalView::TerminalView()
+    : fd(STDOUT_FILENO), terminal(isatty(STDOUT_FILENO) != 0), savedOut(nullptr), savedErr(nullptr),
+      fps(DEFAULT_FPS), showObjects(true), running(false), paused(false), layoutDirty(true),
+      rows(DEFAULT_ROWS), cols(DEFAULT_COLS), shownTick(0), tickShown(false) {
+}
+
+TerminalView::~TerminalView() {
+    stop();
+}
+
+void TerminalView::start() {
+    std::lock_guard<std::mutex> lock(frameMutex);
+    if (running) {
+        return;
+    }
+    std::cout.flush();
+    std::cerr.flush();
+    savedOut = std::cout.rdbuf(&console);
+    savedErr = std::cerr.rdbuf(&console);
+    running = true;
+    paused = false;
+    layoutDirty = true;
+    thread = std::thread(&TerminalView::loop, this);
+}
+
+void TerminalView::stop() {
+    {
+        std::lock_guard<std::mutex> lock(frameMutex);
+        if (!running) {
+            return;
+        }
+        running = false;
+    }
+    wake.notify_all();
+    thread.join();
+
+    std::lock_guard<std::mutex> lock(frameMutex);
+    if (!paused) {
+        flush();
+        if (terminal) {
+            releaseScreen();
+        }
+    }
+    std::cout.rdbuf(savedOut);
+    std::cerr.rdbuf(savedErr);
+    // 元に戻す間に書かれた分
+    console.setPassthrough(-1);
+    console.take(log);
+    writeAll(fd, log);
+    log.clear();
+}
+
+void TerminalView::pause() {
+    std::lock_guard<std::mutex> lock(frameMutex);
+    if (!running || paused) {
+        return;
+    }
+    flush();
+    if (terminal) {
+        releaseScreen();
+    }
+    paused = true;
+    console.setPassthrough(fd);
+}
+
+void TerminalView::resume() {
+    std::lock_guard<std::mutex> lock(frameMutex);
+    if (!paused) {
+        return;
+    }
+    console.setPassthrough(-1);
+    paused = false;
+    layoutDirty = true;
+}
+
+void TerminalView::clear() {
+    std::lock_guard<std::mutex> lock(frameMutex);
+    if (terminal && running && !paused) {
+        writeAll(fd, "\033[2J\033[H");
+        layoutDirty = true;
+    }
+}
+
+void TerminalView::setPrompt(const std::string& line) {
+    std::lock_guard<std::mutex> lock(promptMutex);
+    prompt = line;
+}
+
+void TerminalView::setFrameRate(int framesPerSecond) {
+    fps = std::min(MAX_FPS, std::max(1, framesPerSecond));
+}
+
+void TerminalView::setShowObjects(bool show) {
+    showObjects = show;
+}
+
+// 描画スレッド（フレームの間隔で描く。描くのが遅れても追いつこうとはしない）
+void TerminalView::loop() {
+    std::unique_lock<std::mutex> lock(frameMutex);
+    auto next = std::chrono::steady_clock::now();
+    while (running) {
+        if (!paused) {
+            drawFrame();
+        }
+        next += getFrameInterval();
+        auto now = std::chrono::steady_clock::now();
+        if (next < now) {
+            next = now;
+        }
+        wake.wait_until(lock, next, [this] { return !running; });
+    }
+}
+
+void TerminalView::drawFrame() {
+    state.update();
+    const ViewState& view = state.readBuffer();
+    console.take(log);
+    frame.clear();
+    if (terminal) {
+        drawTerminal(view);
+    } else {
+        drawPlain(view);
+    }
+    log.clear();
+    if (!frame.empty()) {
+        writeAll(fd, frame);
+    }
+}
+
+// 残りの出力を書き切る（改行で終わっていない分も1行として）
+void TerminalView::flush() {
+    drawFrame();
+    if (!logTail.empty()) {
+        log.swap(logTail);
+        log += '\n';
+        logTail.clear();
+        frame.clear();
+        if (terminal) {
+            drawTerminal(state.readBuffer());
+        } else {
+            drawPlain(state.readBuffer());
+        }
+        log.clear();
+        writeAll(fd, frame);
+    }
+}
+
+// 端末でないとき: 出力はそのまま、ティックが進んでいれば1行
+// （出力の行の途中にティックの行が入らないよう、改行で終わっていない分は次に回す）
+void TerminalView::drawPlain(const ViewState& view) {
+    std::string text;
+    text.swap(logTail);
+    text += log;
+    size_t end = text.rfind('\n');
+    if (end == std::string::npos && text.size() > MAX_TAIL) {
+        text += '\n';
+        end = text.size() - 1;
+    }
+    if (end != std::string::npos) {
+        frame.append(text, 0, end + 1);
+        logTail.assign(text, end + 1, std::string::npos);
+    } else {
+        logTail.swap(text);
+    }
+    if (!tickShown || view.tick != shownTick) {
+        frame += tickLabel(view.tick, view.ppqn);
+        frame += '\n';
+        shownTick = view.tick;
+        tickShown = true;
+    }
+}
+
+// 固定行（上から順に: オブジェクトの状態、クロック、入力行）
+void TerminalView::footer(const ViewState& view, const std::string& line,
+                          std::vector<std::string>& lines) const {
+    size_t width = static_cast<size_t>(cols);
+    lines.clear();
+
+    if (showObjects && view.count > 0) {
+        size_t perRow = std::max<size_t>(1, width / CELL_WIDTH);
+        size_t needed = (view.count + perRow - 1) / perRow;
+        size_t maxRows = static_cast<size_t>(std::max(1, rows / 3));
+        size_t shownRows = std::min(needed, maxRows);
+        size_t capacity = shownRows * perRow;
+        size_t hidden = view.objects - std::min(view.objects, capacity);
+        for (size_t r = 0; r < shownRows; r++) {
+            std::string row;
+            for (size_t c = 0; c < perRow; c++) {
+                size_t i = r * perRow + c;
+                if (i >= view.count) {
+                    break;
+                }
+                const ViewState::Entry& e = view.entries[i];
+                bool more = hidden > 0 && i + 1 == capacity;
+                std::string cell;
+                if (more) {
+                    cell = "+" + std::to_string(hidden + 1) + " more";
+                } else if (e.position >= 0) {
+                    cell = "$" + e.name + " " + std::to_string(e.position) + "/" + std::to_string(e.length);
+                } else {
+                    cell = "$" + e.name + " " + std::to_string(e.value);
+                }
+                // 区切りの空白を最低1つ残して幅をそろえる（色の指定は幅の外）
+                cell.resize(CELL_WIDTH - 1, ' ');
+                if (c + 1 < perRow) {
+                    cell += ' ';
+                }
+                if (!more && e.running) {
+                    row += RUNNING + cell + RESET;
+                } else {
+                    row += cell;
+                }
+            }
+            lines.push_back(row);
+        }
+    }
+
+    std::string status = tickLabel(view.tick, view.ppqn);
+    char detail[96];
+    if (view.autoTick) {
+        std::snprintf(detail, sizeof(detail), "  AUTO %.1f BPM  %zu/%zu running", view.bpm, view.running, view.objects);
+    } else {
+        std::snprintf(detail, sizeof(detail), "  STOP  %zu/%zu running", view.running, view.objects);
+    }
+    std::string rest = detail;
+    if (status.size() + rest.size() > width) {
+        rest.resize(width > status.size() ? width - status.size() : 0);
+    }
+    lines.push_back(STATUS + status + RESET + rest);
+
+    // 入力行は幅に収まらなければ末尾を見せる
+    std::string input = "> ";
+    size_t room = width > 3 ? width - 3 : 1;
+    input += line.size() > room ? line.substr(line.size() - room) : line;
+    lines.push_back(input);
+}
+
+// 端末のとき: 出力はスクロール領域に流し、固定行は変わった行だけ書く
+void TerminalView::drawTerminal(const ViewState& view) {
+    winsize ws;
+    int newRows = rows;
+    int newCols = cols;
+    if (ioctl(fd, TIOCGWINSZ, &ws) == 0 && ws.ws_row > 0 && ws.ws_col > 0) {
+        newRows = ws.ws_row;
+        newCols = ws.ws_col;
+    }
+    bool resized = newRows != rows || newCols != cols;
+    int oldBottom = rows - static_cast<int>(shown.size());
+    rows = newRows;
+    cols = newCols;
+
+    std::string line;
+    {
+        std::lock_guard<std::mutex> lock(promptMutex);
+        line = prompt;
+    }
+    std::vector<std::string> lines;
+    footer(view, line, lines);
+    // 出力の領域を少なくとも1行残す（足りなければ状態の行から削る）
+    while (lines.size() > 2 && static_cast<int>(lines.size()) >= rows) {
+        lines.erase(lines.begin());
+    }
+    int bottom = std::max(1, rows - static_cast<int>(lines.size()));
+
+    if (layoutDirty || resized || lines.size() != shown.size()) {
+        frame += "\033[1;" + std::to_string(bottom) + "r";
+        // 固定行だった行と、これから固定行になる行を消して、固定行はすべて書き直す
+        int from = (layoutDirty || resized) ? bottom + 1 : std::min(bottom, oldBottom) + 1;
+        for (int r = from; r <= rows; r++) {
+            moveTo(frame, r);
+            frame += "\033[2K";
+        }
+        shown.assign(lines.size(), "\001");
+        layoutDirty = false;
+    }
+
+    std::string text;
+    text.swap(logTail);
+    text += log;
+    size_t end = text.rfind('\n');
+    if (end == std::string::npos && text.size() > MAX_TAIL) {
+        text += '\n';
+        end = text.size() - 1;
+    }
+    if (end != std::string::npos) {
+        // 領域の最下行で改行すると領域だけが1行上に送られる
+        moveTo(frame, bottom);
+        size_t begin = 0;
+        while (begin <= end) {
+            size_t next = text.find('\n', begin);
+            frame += '\n';
+            frame.append(text, begin, next - begin);
+            begin = next + 1;
+        }
+        frame += RESET;
+        logTail.assign(text, end + 1, std::string::npos);
+    } else {
+        logTail.swap(text);
+    }
+
+    for (size_t i = 0; i < lines.size(); i++) {
+        if (lines[i] != shown[i]) {
+            moveTo(frame, bottom + 1 + static_cast<int>(i));
+            frame += lines[i];
+            frame += RESET;
+            frame += "\033[K";
+            shown[i].swap(lines[i]);
+        }
+    }
+}
+
+// スクロール領域を戻し、入力行を消してカーソルをそこへ
+void TerminalView::releaseScreen() {
+    std::string out = "\033[r";
+    moveTo(out, rows);
+    out += "\033[2K";
+    writeAll(fd, out);
+    shown.clear();
+    layoutDirty = true;
+}
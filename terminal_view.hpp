@@ -0,0 +1,175 @@
+#ifndef REELIA_TERMINAL_VIEW_HPP
+#define REELIA_TERMINAL_VIEW_HPP
+
+#include "triple_buffer.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+class Environment;
+
+/**
+ * 画面に出す状態のスナップショット
+ * 環境のロックを持つスレッド（ティックを進めたスレッド）が書き、描画スレッドが読む。
+ */
+struct ViewState {
+    struct Entry {
+        std::string name;
+        std::string type;
+        int value;
+        int position; // シーケンスの再生位置（シーケンスでなければ-1）
+        int length;
+        bool running;
+    };
+
+    // 写すオブジェクトの上限（画面に収まる数より十分多く）
+    static constexpr size_t MAX_ENTRIES = 512;
+
+    uint64_t tick;
+    int ppqn;
+    double bpm;
+    bool autoTick;
+    size_t running; // 再生中・カウント中のオブジェクトの数
+    size_t objects; // 変数に入っているオブジェクトの数
+    size_t count;   // entries のうち有効な数（文字列の領域を使い回すので entries は縮めない）
+    std::vector<Entry> entries;
+
+    ViewState() : tick(0), ppqn(24), bpm(120.0), autoTick(false), running(0), objects(0), count(0) {}
+
+    // 環境の変数から状態を写す（環境のロックを持って呼ぶ）
+    void capture(const Environment& env);
+};
+
+/**
+ * 出力のため込み先
+ * std::cout / std::cerr の行き先をこれに替えると、どのスレッドの出力も
+ * 端末には書かずにためるだけになる（ティックのスレッドが遅い端末で止まらない）。
+ * ロックはためた文字列に追記する間だけ持つ。ためた出力は描画スレッドが取り出して書く。
+ */
+class ConsoleBuffer : public std::streambuf {
+private:
+    static constexpr size_t LIMIT = 1 << 20; // これ以上たまったら捨てる（バイト）
+
+    std::mutex mutex;
+    std::string pending;
+    size_t dropped;
+    int passthrough; // 直接書く先のファイル記述子（-1ならためる）
+
+    void append(const char* s, size_t n);
+
+protected:
+    int_type overflow(int_type c) override;
+    std::streamsize xsputn(const char* s, std::streamsize n) override;
+
+public:
+    ConsoleBuffer() : dropped(0), passthrough(-1) {}
+
+    // ためた出力を out に移す（捨てた分があれば注記を付ける）
+    void take(std::string& out);
+
+    // ためずに fd へ直接書く（-1で元に戻す）
+    void setPassthrough(int fd);
+};
+
+/**
+ * 端末の描画スレッド
+ * 入力スレッド・クロックスレッドは端末に書かず、出力は ConsoleBuffer に、
+ * 状態は三重バッファのスナップショットに置くだけにする。描画スレッドは
+ * 決まったフレームレートで両方を取り出し、1フレームを1回の write で書く。
+ * 端末なら出力は上のスクロール領域に流し、下の固定行（オブジェクトの状態・
+ * クロック・入力行）は前のフレームから変わった行だけ書き直す。
+ * 端末でなければ（パイプなど）出力とティックの行をそのまま書く。
+ */
+class TerminalView {
+public:
+    static constexpr int DEFAULT_FPS = 30;
+    static constexpr int MAX_FPS = 120;
+
+private:
+    int fd;
+    bool terminal;
+
+    ConsoleBuffer console;
+    std::streambuf* savedOut;
+    std::streambuf* savedErr;
+
+    TripleBuffer<ViewState> state;
+    std::atomic<int> fps;
+    std::atomic<bool> showObjects;
+
+    // 入力中の行（入力スレッドが書く）
+    std::mutex promptMutex;
+    std::string prompt;
+
+    // 描画スレッド（frameMutex は描画中と一時停止の切り替えで持つ）
+    std::thread thread;
+    std::mutex frameMutex;
+    std::condition_variable wake;
+    bool running;
+    bool paused;
+    bool layoutDirty; // 次のフレームで領域を設定し直し、固定行をすべて書く
+
+    // 以下は描画スレッド（か frameMutex を持つスレッド）だけが使う
+    std::string frame;              // 書き出す1フレーム分
+    std::string log;                // 取り出した出力
+    std::string logTail;            // 改行で終わっていない出力（次のフレームに回す）
+    std::vector<std::string> shown; // 前のフレームで書いた固定行
+    int rows;
+    int cols;
+    uint64_t shownTick; // 端末でないときに最後に書いたティック
+    bool tickShown;
+
+    void loop();
+    void drawFrame();
+    void drawPlain(const ViewState& view);
+    void drawTerminal(const ViewState& view);
+    void footer(const ViewState& view, const std::string& line, std::vector<std::string>& lines) const;
+    void releaseScreen();
+    void flush();
+
+public:
+    TerminalView();
+    ~TerminalView();
+
+    TerminalView(const TerminalView&) = delete;
+    TerminalView& operator=(const TerminalView&) = delete;
+
+    // std::cout / std::cerr を取り込み、描画スレッドを始める
+    void start();
+
+    // 残りの出力を書いて描画スレッドを止め、std::cout / std::cerr を元に戻す
+    void stop();
+
+    // 端末を行単位の入力（std::getline）に明け渡す。その間の出力は直接書く
+    void pause();
+    void resume();
+
+    // 画面を消して描き直す
+    void clear();
+
+    // 状態のスナップショット（環境のロックを持つスレッドだけが書く）
+    ViewState& writeState() { return state.writeBuffer(); }
+    void publish() { state.publish(); }
+
+    // 入力中の行
+    void setPrompt(const std::string& line);
+
+    void setFrameRate(int framesPerSecond);
+    int getFrameRate() const { return fps.load(); }
+    std::chrono::nanoseconds getFrameInterval() const {
+        return std::chrono::nanoseconds(1000000000LL / fps.load());
+    }
+
+    void setShowObjects(bool show);
+    bool getShowObjects() const { return showObjects.load(); }
+
+    bool isTerminal() const { return terminal; }
+};
+
+#endif // REELIA_TERMINAL_VIEW_HPP
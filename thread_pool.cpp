@@ -0,0 +1,129 @@
+#include "thread_pool.hpp"
+
+// コンストラクタ（呼び出し側の分を除いたワーカースレッドを起動）
+WorkStealingPool::WorkStealingPool(size_t threads)
+    : epoch(0), stopping(false), task(nullptr), remaining(0) {
+    if (threads < 1) {
+        threads = 1;
+    }
+    for (size_t i = 0; i < threads; i++) {
+        queues.push_back(std::unique_ptr<Queue>(new Queue()));
+    }
+    for (size_t i = 1; i < threads; i++) {
+        workers.emplace_back(&WorkStealingPool::workerLoop, this, i);
+    }
+}
+
+// デストラクタ（ワーカーを停止して合流）
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_all();
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// 自分のキューの末尾から取り出す
+bool WorkStealingPool::pop(size_t id, size_t& item) {
+    Queue& q = *queues[id];
+    std::lock_guard<std::mutex> lock(q.mutex);
+    if (q.items.empty()) {
+        return false;
+    }
+    item = q.items.back();
+    q.items.pop_back();
+    return true;
+}
+
+// 他のワーカーのキューの先頭から盗む
+bool WorkStealingPool::steal(size_t id, size_t& item) {
+    for (size_t offset = 1; offset < queues.size(); offset++) {
+        Queue& q = *queues[(id + offset) % queues.size()];
+        std::lock_guard<std::mutex> lock(q.mutex);
+        if (!q.items.empty()) {
+            item = q.items.front();
+            q.items.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+// 仕事がなくなるまでタスクを実行する
+void WorkStealingPool::drain(size_t id) {
+    size_t item;
+    while (pop(id, item) || steal(id, item)) {
+        (*task)(item);
+        if (remaining.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(mutex);
+            done.notify_all();
+        }
+    }
+}
+
+// ワーカースレッドのメインループ
+void WorkStealingPool::workerLoop(size_t id) {
+    uint64_t seen = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [&]() { return stopping || epoch != seen; });
+            if (stopping) {
+                return;
+            }
+            seen = epoch;
+        }
+        drain(id);
+    }
+}
+
+// タスクの並列実行
+void WorkStealingPool::run(size_t count, const Task& fn) {
+    if (count == 0) {
+        return;
+    }
+
+    // ワーカーが1つだけならその場で順に実行
+    if (queues.size() == 1 || count == 1) {
+        for (size_t i = 0; i < count; i++) {
+            fn(i);
+        }
+        return;
+    }
+
+    // 前回のrun()の終わりにまだキューを覗いているワーカーがいても
+    // 正しいタスクを実行するよう、振り分けより先にタスクを設定する
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        task = &fn;
+        remaining.store(count, std::memory_order_release);
+    }
+
+    // タスクを連続した塊で各キューに振り分ける（近いタスクは同じワーカーへ）
+    size_t perQueue = (count + queues.size() - 1) / queues.size();
+    for (size_t q = 0; q < queues.size(); q++) {
+        std::lock_guard<std::mutex> lock(queues[q]->mutex);
+        size_t begin = q * perQueue;
+        size_t end = begin + perQueue < count ? begin + perQueue : count;
+        // 末尾から取り出すので逆順に積む
+        for (size_t i = end; i > begin; i--) {
+            queues[q]->items.push_back(i - 1);
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        epoch++;
+    }
+    wake.notify_all();
+
+    // 呼び出し側も処理に参加
+    drain(0);
+
+    std::unique_lock<std::mutex> lock(mutex);
+    done.wait(lock, [&]() { return remaining.load(std::memory_order_acquire) == 0; });
+    task = nullptr;
+}
@@ -0,0 +1,66 @@
+#ifndef REELIA_THREAD_POOL_HPP
+#define REELIA_THREAD_POOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/**
+ * ワークスティーリング・スレッドプール
+ * run() で渡したタスク番号を各ワーカーのキューに振り分け、呼び出し側の
+ * スレッドもワーカー0として処理に加わる。自分のキューが空になった
+ * ワーカーは他のワーカーのキューの反対側から仕事を盗む。
+ * run() は全タスクが終わるまで戻らない。
+ */
+class WorkStealingPool {
+public:
+    using Task = std::function<void(size_t index)>;
+
+private:
+    struct Queue {
+        std::mutex mutex;
+        std::deque<size_t> items;
+    };
+
+    // ワーカーごとのキュー（0番は呼び出し側スレッド）
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    uint64_t epoch;
+    bool stopping;
+
+    // 実行中のタスクと残り件数
+    const Task* task;
+    std::atomic<size_t> remaining;
+
+    void workerLoop(size_t id);
+    void drain(size_t id);
+    bool pop(size_t id, size_t& item);
+    bool steal(size_t id, size_t& item);
+
+public:
+    // threads: 呼び出し側を含むスレッド数（1なら追加のスレッドを作らない）
+    explicit WorkStealingPool(size_t threads);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // スレッド数（呼び出し側を含む）
+    size_t size() const { return queues.size(); }
+
+    // 0..count-1 のタスクを並列に実行し、全て終わるまで待つ
+    void run(size_t count, const Task& fn);
+};
+
+#endif // REELIA_THREAD_POOL_HPP
@@ -0,0 +1,170 @@
+#include "tokenizer.hpp"
+#include <cctype>
+#include <cstdint>
+
+namespace {
+bool isIdentStart(char c) {
+    return std::isalpha(static_cast<unsigned char>(c)) || c == '_';
+}
+
+bool isIdentChar(char c) {
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_';
+}
+
+// 2文字演算子
+const char* const TWO_CHAR_OPERATORS[] = {"<<", ">>", "<=", ">=", "==", "!=", "&&", "||"};
+
+// 1文字演算子（= と | は構文上の意味を持つので別扱い）
+const std::string SINGLE_CHAR_OPERATORS = "+-*/%<>&^~!?:";
+} // namespace
+
+// バイナリパターン判定（例: b10101010）
+bool Tokenizer::isBinaryPattern(const std::string& str) {
+    if (str.size() <= 1 || (str[0] != 'b' && str[0] != '#')) {
+        return false;
+    }
+
+    for (size_t i = 1; i < str.size(); i++) {
+        if (str[i] != '0' && str[i] != '1') {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// バイナリパターンの解析
+int Tokenizer::parseBinaryPattern(const std::string& str) {
+    if (!isBinaryPattern(str)) {
+        return 0;
+    }
+
+    // 32桁を超える分は上位の桁を捨てる（整数としては先頭32ステップ）
+    uint32_t result = 0;
+    for (size_t i = 1; i < str.size(); i++) {
+        result = (result << 1) | (str[i] == '1' ? 1u : 0u);
+    }
+
+    return static_cast<int>(result);
+}
+
+// 行をトークン列に変換
+bool Tokenizer::tokenize(const std::string& line, std::vector<Token>& tokens, std::string& error) {
+    tokens.clear();
+    size_t i = 0;
+    const size_t n = line.size();
+
+    while (i < n) {
+        char c = line[i];
+
+        // 空白
+        if (c == ' ' || c == '\t' || c == '\r' || c == '\n') {
+            i++;
+            continue;
+        }
+
+        // 行末コメント
+        if (c == '/' && i + 1 < n && line[i + 1] == '/') {
+            break;
+        }
+
+        size_t start = i;
+
+        // 変数 ($name) とクラス (@name)
+        if (c == '$' || c == '@') {
+            i++;
+            while (i < n && isIdentChar(line[i])) {
+                i++;
+            }
+            if (i == start + 1) {
+                error = std::string("Expected name after '") + c + "'";
+                return false;
+            }
+            tokens.emplace_back(c == '$' ? Token::VARIABLE : Token::CLASS,
+                                line.substr(start + 1, i - start - 1), 0, start);
+            continue;
+        }
+
+        // #で始まるバイナリパターン (#1010)
+        if (c == '#') {
+            i++;
+            while (i < n && (line[i] == '0' || line[i] == '1')) {
+                i++;
+            }
+            std::string text = line.substr(start, i - start);
+            if (!isBinaryPattern(text)) {
+                error = "Invalid binary pattern";
+                return false;
+            }
+            tokens.emplace_back(Token::BINARY, text, parseBinaryPattern(text), start);
+            continue;
+        }
+
+        // 識別子とbで始まるバイナリパターン (b1010)
+        if (isIdentStart(c)) {
+            while (i < n && isIdentChar(line[i])) {
+                i++;
+            }
+            std::string text = line.substr(start, i - start);
+            if (isBinaryPattern(text)) {
+                tokens.emplace_back(Token::BINARY, text, parseBinaryPattern(text), start);
+            } else {
+                tokens.emplace_back(Token::IDENTIFIER, text, 0, start);
+            }
+            continue;
+        }
+
+        // 10進数
+        if (std::isdigit(static_cast<unsigned char>(c))) {
+            long long value = 0;
+            while (i < n && std::isdigit(static_cast<unsigned char>(line[i]))) {
+                value = value * 10 + (line[i] - '0');
+                if (value > 0x7FFFFFFF) {
+                    error = "Number out of range";
+                    return false;
+                }
+                i++;
+            }
+            tokens.emplace_back(Token::NUMBER, line.substr(start, i - start), static_cast<int>(value), start);
+            continue;
+        }
+
+        // 2文字演算子
+        bool matched = false;
+        if (i + 1 < n) {
+            for (const char* op : TWO_CHAR_OPERATORS) {
+                if (line[i] == op[0] && line[i + 1] == op[1]) {
+                    tokens.emplace_back(Token::OPERATOR, op, 0, start);
+                    i += 2;
+                    matched = true;
+                    break;
+                }
+            }
+        }
+        if (matched) {
+            continue;
+        }
+
+        // 記号
+        switch (c) {
+            case '.': tokens.emplace_back(Token::DOT, ".", 0, start); break;
+            case '=': tokens.emplace_back(Token::ASSIGN, "=", 0, start); break;
+            case '(': tokens.emplace_back(Token::LPAREN, "(", 0, start); break;
+            case ')': tokens.emplace_back(Token::RPAREN, ")", 0, start); break;
+            case ',': tokens.emplace_back(Token::COMMA, ",", 0, start); break;
+            case '|': tokens.emplace_back(Token::PIPE, "|", 0, start); break;
+            default:
+                if (SINGLE_CHAR_OPERATORS.find(c) != std::string::npos) {
+                    tokens.emplace_back(Token::OPERATOR, std::string(1, c), 0, start);
+                } else {
+                    error = std::string("Unexpected character '") + c + "'";
+                    return false;
+                }
+                break;
+        }
+        i++;
+    }
+
+    tokens.emplace_back(Token::END, "", 0, n);
+    return true;
+}
@@ -0,0 +1,59 @@
+#ifndef REELIA_TOKENIZER_HPP
+#define REELIA_TOKENIZER_HPP
+
+#include <string>
+#include <vector>
+
+/**
+ * トークン
+ * スクリプト1行を字句解析した結果の最小単位
+ */
+struct Token {
+  enum Kind {
+    VARIABLE,   // $name
+    CLASS,      // @name
+    IDENTIFIER, // name
+    NUMBER,     // 123
+    BINARY,     // b1010 / #1010
+    DOT,        // .
+    ASSIGN,     // =
+    LPAREN,     // (
+    RPAREN,     // )
+    COMMA,      // ,
+    PIPE,       // |
+    OPERATOR,   // 式で使う演算子（+ - * / % << >> < > <= >= == != & ^ && || ~ ! ? :）
+    END
+  };
+
+  Kind kind;
+  std::string text; // 名前や演算子の文字列（$や@は含まない）
+  int value;        // 数値・バイナリパターンの値
+  size_t column;    // 行内の位置（エラー表示用）
+
+  Token(Kind k, std::string t = "", int v = 0, size_t col = 0)
+      : kind(k), text(std::move(t)), value(v), column(col) {}
+
+  bool is(Kind k) const { return kind == k; }
+  bool isOperator(const char *op) const {
+    return kind == OPERATOR && text == op;
+  }
+};
+
+/**
+ * 字句解析器
+ * 正規表現を使わずに1パスで行をトークン列に変換する
+ */
+class Tokenizer {
+public:
+  // 行をトークン列に変換（末尾にENDを追加）。失敗時はerrorに理由を設定
+  static bool tokenize(const std::string &line, std::vector<Token> &tokens,
+                       std::string &error);
+
+  // バイナリパターン判定（例: b10101010）
+  static bool isBinaryPattern(const std::string &str);
+
+  // バイナリパターンの解析
+  static int parseBinaryPattern(const std::string &str);
+};
+
+#endif // REELIA_TOKENIZER_HPP
@@ -0,0 +1,53 @@
+#ifndef REELIA_TRIPLE_BUFFER_HPP
+#define REELIA_TRIPLE_BUFFER_HPP
+
+#include <atomic>
+#include <cstdint>
+
+/**
+ * 三重バッファ
+ * 書き込み側1つ・読み出し側1つの間で最新の値だけを受け渡す。
+ * 書き込み側は裏のバッファを埋めてから真ん中のバッファと交換し、
+ * 読み出し側は新しい値があれば手元のバッファと真ん中を交換する。
+ * どちらも相手を待たず（ロックなし）、読み出し中の値が書き換わることもない。
+ * 公開のたびに裏のバッファは古い値になるので、書き込み側は毎回すべて書き直すこと。
+ */
+template <typename T>
+class TripleBuffer {
+private:
+    static constexpr uint8_t INDEX = 0x3;
+    static constexpr uint8_t FRESH = 0x4; // 真ん中のバッファがまだ読まれていない
+
+    T buffers[3];
+    std::atomic<uint8_t> middle;
+    uint8_t back;  // 書き込み側のバッファ
+    uint8_t front; // 読み出し側のバッファ
+
+public:
+    TripleBuffer() : middle(1), back(0), front(2) {}
+
+    TripleBuffer(const TripleBuffer&) = delete;
+    TripleBuffer& operator=(const TripleBuffer&) = delete;
+
+    // 書き込み側: 次に公開する値を書くバッファ
+    T& writeBuffer() { return buffers[back]; }
+
+    // 書き込み側: writeBuffer() の内容を公開する
+    void publish() {
+        back = middle.exchange(static_cast<uint8_t>(back | FRESH), std::memory_order_acq_rel) & INDEX;
+    }
+
+    // 読み出し側: 新しい値が公開されていれば取り込む（取り込んだらtrue）
+    bool update() {
+        if (!(middle.load(std::memory_order_relaxed) & FRESH)) {
+            return false;
+        }
+        front = middle.exchange(front, std::memory_order_acq_rel) & INDEX;
+        return true;
+    }
+
+    // 読み出し側: 最後に取り込んだ値
+    const T& readBuffer() const { return buffers[front]; }
+};
+
+#endif // REELIA_TRIPLE_BUFFER_HPP
@@ -37,19 +37,19 @@ public:
  */
 class ModuleValue : public BaseValue {
 private:
-  Module *module;
+  ModulePtr module;
 
 public:
-  ModuleValue(const std::string &type) {
-    module = ModuleFactory::createModule(type);
-  }
+  ModuleValue(const std::string &type)
+      : module(ModuleFactory::createModule(type)) {}
 
-  ModuleValue(Module *mod) : module(mod) {}
+  ModuleValue(ModulePtr mod) : module(std::move(mod)) {}
 
-  ~ModuleValue() {
-    if (module)
-      delete module;
-  }
+  // Owns its module: move-only
+  ModuleValue(const ModuleValue &) = delete;
+  ModuleValue &operator=(const ModuleValue &) = delete;
+  ModuleValue(ModuleValue &&) = default;
+  ModuleValue &operator=(ModuleValue &&) = default;
 
   std::string getType() const override { return "MODULE"; }
   int toInt() const override { return module ? module->getValue() : 0; }
@@ -58,7 +58,7 @@ public:
   }
 
   // Module access
-  Module *getModule() { return module; }
+  Module *getModule() { return module.get(); }
 
   // Parameter setting
   void setParameter(const std::string &name, int value) {